@@ -0,0 +1,649 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <stdio.h>
+#include <string.h>
+#include "../src/sim.h"
+#include "../src/frontend/error.h"
+
+#define RUN_SLICE 1000000 // Instructions run between checks for Ctrl+C, with the GIL released
+
+static PyObject* SimError;
+static PyTypeObject* CacheStatsType;
+
+static PyStructSequence_Field cache_stats_fields[] = {
+	{"access_count", NULL},
+	{"hit_count", NULL},
+	{"miss_count", NULL},
+	{"writebacks", NULL},
+	{"hit_rate", NULL},
+	{NULL, NULL},
+};
+
+static PyStructSequence_Desc cache_stats_desc = {
+	"riscvsim.CacheStats",
+	"Stats of the L1 cache of one hart",
+	cache_stats_fields,
+	5,
+};
+
+static const char* replacement_names[] = {"FIFO", "LRU", "RANDOM"};
+static const char* write_policy_names[] = {"WT", "WB"};
+static const char* coherence_names[] = {"NONE", "MSI", "MESI"};
+
+// CacheConfig
+
+typedef struct {
+	PyObject_HEAD
+	CacheConfig config;
+} CacheConfigObject;
+
+static PyTypeObject CacheConfigType;
+
+// Parses a config the way --cache and $cache_sim enable do, so both accept the same configs
+static int parse_cache_config(CacheConfig* config, FILE* fp, const char* trace_file) {
+	char error[SIM_ERROR_LEN] = "";
+
+	set_error_buffer(error, sizeof(error));
+	*config = read_cache_config(fp);
+	set_error_buffer(NULL, 0);
+
+	if (!config->has_cache) {
+		PyErr_SetString(PyExc_ValueError, error);
+		return -1;
+	}
+	snprintf(config->trace_file_name, sizeof(config->trace_file_name), "%s", trace_file);
+	return 0;
+}
+
+static int CacheConfig_init(CacheConfigObject* self, PyObject* args, PyObject* kwargs) {
+	static char* keywords[] = {"size", "block_size", "associativity", "replacement", "write_policy", "coherence", "trace_file", NULL};
+	unsigned long size, block_size, associativity;
+	const char* replacement = "LRU";
+	const char* write_policy = "WB";
+	const char* coherence = "MESI";
+	const char* trace_file = "/dev/null";
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "kkk|ssss", keywords, &size, &block_size, &associativity, &replacement, &write_policy, &coherence, &trace_file)) return -1;
+
+	char text[128];
+	int len = snprintf(text, sizeof(text), "%lu\n%lu\n%lu\n%.8s\n%.8s\n%.8s\n", size, block_size, associativity, replacement, write_policy, coherence);
+
+	FILE* fp = fmemopen(text, len, "r");
+	if (!fp) {
+		PyErr_NoMemory();
+		return -1;
+	}
+
+	int result = parse_cache_config(&self->config, fp, trace_file);
+	fclose(fp);
+	return result;
+}
+
+static PyObject* CacheConfig_from_file(PyTypeObject* type, PyObject* args) {
+	PyObject* path;
+	const char* trace_file = "/dev/null";
+
+	if (!PyArg_ParseTuple(args, "O&|s", PyUnicode_FSConverter, &path, &trace_file)) return NULL;
+
+	FILE* fp = fopen(PyBytes_AS_STRING(path), "r");
+	if (!fp) {
+		PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+		Py_DECREF(path);
+		return NULL;
+	}
+	Py_DECREF(path);
+
+	CacheConfigObject* self = (CacheConfigObject*) type->tp_alloc(type, 0);
+	if (self && parse_cache_config(&self->config, fp, trace_file)) Py_CLEAR(self);
+
+	fclose(fp);
+	return (PyObject*) self;
+}
+
+static PyObject* CacheConfig_get(CacheConfigObject* self, void* field) {
+	CacheConfig* config = &self->config;
+
+	switch ((intptr_t) field) {
+		case 0: return PyLong_FromUnsignedLong(config->n_lines*config->block_size*config->associativity);
+		case 1: return PyLong_FromUnsignedLong(config->block_size);
+		case 2: return PyLong_FromUnsignedLong(config->associativity);
+		case 3: return PyLong_FromUnsignedLong(config->n_lines);
+		case 4: return PyUnicode_FromString(replacement_names[config->replacement_policy]);
+		case 5: return PyUnicode_FromString(write_policy_names[config->write_policy]);
+		case 6: return PyBool_FromLong(config->write_allocate);
+		case 7: return PyUnicode_FromString(coherence_names[config->coherence]);
+		default: return PyUnicode_DecodeFSDefault(config->trace_file_name);
+	}
+}
+
+static PyObject* CacheConfig_repr(CacheConfigObject* self) {
+	CacheConfig* config = &self->config;
+
+	return PyUnicode_FromFormat("CacheConfig(size=%lu, block_size=%lu, associativity=%lu, replacement='%s', write_policy='%s', coherence='%s')",
+		config->n_lines*config->block_size*config->associativity, config->block_size, config->associativity,
+		replacement_names[config->replacement_policy], write_policy_names[config->write_policy], coherence_names[config->coherence]);
+}
+
+static PyGetSetDef CacheConfig_getset[] = {
+	{"size", (getter) CacheConfig_get, NULL, "Size of the cache in bytes", (void*) 0},
+	{"block_size", (getter) CacheConfig_get, NULL, NULL, (void*) 1},
+	{"associativity", (getter) CacheConfig_get, NULL, NULL, (void*) 2},
+	{"n_lines", (getter) CacheConfig_get, NULL, "Number of sets", (void*) 3},
+	{"replacement", (getter) CacheConfig_get, NULL, "LRU, FIFO or RANDOM", (void*) 4},
+	{"write_policy", (getter) CacheConfig_get, NULL, "WB or WT", (void*) 5},
+	{"write_allocate", (getter) CacheConfig_get, NULL, NULL, (void*) 6},
+	{"coherence", (getter) CacheConfig_get, NULL, "MESI, MSI or NONE, used with more than one hart", (void*) 7},
+	{"trace_file", (getter) CacheConfig_get, NULL, "Where every access is logged, with .hart<n> appended for the other harts", (void*) 8},
+	{NULL},
+};
+
+static PyMethodDef CacheConfig_methods[] = {
+	{"from_file", (PyCFunction) CacheConfig_from_file, METH_VARARGS | METH_CLASS, "from_file(path, trace_file='/dev/null')\n\nReads a cache config file, like --cache"},
+	{NULL},
+};
+
+static PyTypeObject CacheConfigType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name = "riscvsim.CacheConfig",
+	.tp_doc = "CacheConfig(size, block_size, associativity, replacement='LRU', write_policy='WB', coherence='MESI', trace_file='/dev/null')\n\n"
+		"An L1 cache, with the same fields and checks as a cache config file",
+	.tp_basicsize = sizeof(CacheConfigObject),
+	.tp_flags = Py_TPFLAGS_DEFAULT,
+	.tp_new = PyType_GenericNew,
+	.tp_init = (initproc) CacheConfig_init,
+	.tp_repr = (reprfunc) CacheConfig_repr,
+	.tp_getset = CacheConfig_getset,
+	.tp_methods = CacheConfig_methods,
+};
+
+// Sim
+
+typedef struct {
+	PyObject_HEAD
+	sim_t* sim;
+	Py_ssize_t exports;	// Views of guest memory, which has to stay where it is while there are any
+	bool busy;			// Running with the GIL released, when nothing else may use the simulator
+	uint64_t instructions;
+} SimObject;
+
+static PyTypeObject SimType;
+
+static bool available(SimObject* self) {
+	if (self->busy) PyErr_SetString(PyExc_RuntimeError, "Sim is running on another thread");
+	return !self->busy;
+}
+
+// Loads and cache changes allocate new memory
+static bool can_move_memory(SimObject* self) {
+	if (!available(self)) return false;
+	if (self->exports) PyErr_SetString(PyExc_BufferError, "Sim memory cannot move while it has views");
+	return !self->exports;
+}
+
+static PyObject* sim_exception(SimObject* self) {
+	PyErr_SetString(SimError, sim_error(self->sim));
+	return NULL;
+}
+
+static PyObject* Sim_new(PyTypeObject* type, PyObject* args, PyObject* kwargs) {
+	static char* keywords[] = {"harts", "quantum", "cache", "smc", NULL};
+	int n_harts = 1, quantum = 1, smc = 0;
+	PyObject* cache = Py_None;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|iiOp", keywords, &n_harts, &quantum, &cache, &smc)) return NULL;
+
+	if (n_harts < 1 || n_harts > MAX_HARTS) return PyErr_Format(PyExc_ValueError, "harts must be between 1 and %d", MAX_HARTS);
+	if (quantum < 1) return PyErr_Format(PyExc_ValueError, "quantum must be at least 1");
+	if (cache != Py_None && !PyObject_TypeCheck(cache, &CacheConfigType)) return PyErr_Format(PyExc_TypeError, "cache must be a CacheConfig or None");
+
+	SimObject* self = (SimObject*) type->tp_alloc(type, 0);
+	if (!self) return NULL;
+
+	self->sim = sim_new(n_harts, quantum, false);
+	if (!self->sim) {
+		Py_DECREF(self);
+		return PyErr_NoMemory();
+	}
+
+	sim_set_smc(self->sim, smc);
+	if (cache != Py_None) sim_set_cache(self->sim, ((CacheConfigObject*) cache)->config);
+	return (PyObject*) self;
+}
+
+static void Sim_dealloc(SimObject* self) {
+	if (self->sim) sim_free(self->sim);
+	Py_TYPE(self)->tp_free((PyObject*) self);
+}
+
+static PyObject* Sim_load(SimObject* self, PyObject* args) {
+	PyObject* path;
+	bool loaded;
+
+	if (!PyArg_ParseTuple(args, "O&", PyUnicode_FSConverter, &path)) return NULL;
+	if (!can_move_memory(self)) {
+		Py_DECREF(path);
+		return NULL;
+	}
+
+	self->busy = true;
+	Py_BEGIN_ALLOW_THREADS
+	loaded = sim_load(self->sim, PyBytes_AS_STRING(path));
+	Py_END_ALLOW_THREADS
+	self->busy = false;
+
+	Py_DECREF(path);
+	if (!loaded) return sim_exception(self);
+
+	self->instructions = 0;
+	Py_RETURN_NONE;
+}
+
+static PyObject* Sim_load_source(SimObject* self, PyObject* args) {
+	const char* source;
+	Py_ssize_t len;
+	bool loaded;
+
+	if (!PyArg_ParseTuple(args, "s#", &source, &len)) return NULL;
+	if (!can_move_memory(self)) return NULL;
+
+	self->busy = true;
+	Py_BEGIN_ALLOW_THREADS
+	loaded = sim_load_source(self->sim, source, len);
+	Py_END_ALLOW_THREADS
+	self->busy = false;
+
+	if (!loaded) return sim_exception(self);
+
+	self->instructions = 0;
+	Py_RETURN_NONE;
+}
+
+static PyObject* Sim_reload(SimObject* self, PyObject* Py_UNUSED(args)) {
+	uint64_t patched = 0;
+	bool reloaded;
+
+	if (!sim_get_program(self->sim)->loaded) return PyErr_Format(SimError, "No program loaded");
+	if (sim_get_program(self->sim)->elf?!can_move_memory(self):!available(self)) return NULL;
+
+	self->busy = true;
+	Py_BEGIN_ALLOW_THREADS
+	reloaded = sim_reload(self->sim, NULL, &patched);
+	Py_END_ALLOW_THREADS
+	self->busy = false;
+
+	if (!reloaded) return sim_exception(self);
+
+	self->instructions = 0;
+	return PyLong_FromUnsignedLongLong(patched);
+}
+
+static PyObject* Sim_reset(SimObject* self, PyObject* Py_UNUSED(args)) {
+	if (!available(self)) return NULL;
+
+	sim_reset(self->sim);
+	self->instructions = 0;
+	Py_RETURN_NONE;
+}
+
+static PyObject* Sim_set_cache(SimObject* self, PyObject* config) {
+	if (config != Py_None && !PyObject_TypeCheck(config, &CacheConfigType)) return PyErr_Format(PyExc_TypeError, "set_cache expects a CacheConfig or None");
+	if (!can_move_memory(self)) return NULL;
+
+	CacheConfig new_config = *sim_cache_config(self->sim);
+	if (config == Py_None) new_config.has_cache = false;
+	else new_config = ((CacheConfigObject*) config)->config;
+
+	sim_set_cache(self->sim, new_config);
+	self->instructions = 0;
+	Py_RETURN_NONE;
+}
+
+// Runs in slices, so Ctrl+C can stop long runs and other threads get the GIL in between
+static PyObject* run_sim(SimObject* self, uint64_t until, uint64_t max_steps, bool limit_is_ok) {
+	sim_result result = SIM_LIMIT;
+
+	if (!available(self)) return NULL;
+	self->busy = true;
+
+	while (max_steps && result == SIM_LIMIT) {
+		uint64_t slice = max_steps < RUN_SLICE?max_steps:RUN_SLICE;
+		uint64_t executed = 0;
+
+		Py_BEGIN_ALLOW_THREADS
+		result = sim_run(self->sim, until, slice, &executed);
+		Py_END_ALLOW_THREADS
+
+		self->instructions += executed;
+		if (result == SIM_LIMIT) max_steps -= slice;
+
+		if (PyErr_CheckSignals()) {
+			self->busy = false;
+			return NULL;
+		}
+	}
+
+	self->busy = false;
+	if (result == SIM_ERROR) return sim_exception(self);
+	if (result == SIM_LIMIT && limit_is_ok) result = SIM_OK;
+	return PyLong_FromLong(result);
+}
+
+static PyObject* Sim_step(SimObject* self, PyObject* args) {
+	unsigned long long n = 1;
+
+	if (!PyArg_ParseTuple(args, "|K", &n)) return NULL;
+	return run_sim(self, SIM_NO_ADDRESS, n, true);
+}
+
+static PyObject* Sim_run(SimObject* self, PyObject* args, PyObject* kwargs) {
+	static char* keywords[] = {"until", "max_steps", NULL};
+	PyObject* until = Py_None;
+	unsigned long long max_steps = UINT64_MAX;
+	uint64_t address = SIM_NO_ADDRESS;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|OK", keywords, &until, &max_steps)) return NULL;
+	if (until != Py_None) {
+		address = PyLong_AsUnsignedLongLong(until);
+		if (PyErr_Occurred()) return NULL;
+	}
+
+	return run_sim(self, address, max_steps, false);
+}
+
+// Registers, shared with the simulator through a view like guest memory. They never move
+
+typedef struct {
+	PyObject_HEAD
+	SimObject* owner;
+	uint64_t* registers;
+} RegistersObject;
+
+static Py_ssize_t register_shape[1] = {32};
+static Py_ssize_t register_strides[1] = {sizeof(uint64_t)};
+
+static void Registers_dealloc(RegistersObject* self) {
+	Py_XDECREF(self->owner);
+	Py_TYPE(self)->tp_free((PyObject*) self);
+}
+
+static int Registers_getbuffer(RegistersObject* self, Py_buffer* view, int flags) {
+	if (PyBuffer_FillInfo(view, (PyObject*) self, self->registers, sizeof(uint64_t)*32, 0, flags)) return -1;
+
+	view->itemsize = sizeof(uint64_t);
+	view->format = (flags & PyBUF_FORMAT)?"Q":NULL;
+	view->shape = (flags & PyBUF_ND)?register_shape:NULL;
+	view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES?register_strides:NULL;
+	return 0;
+}
+
+static PyBufferProcs Registers_buffer = {
+	.bf_getbuffer = (getbufferproc) Registers_getbuffer,
+};
+
+static PyTypeObject RegistersType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name = "riscvsim._Registers",
+	.tp_basicsize = sizeof(RegistersObject),
+	.tp_flags = Py_TPFLAGS_DEFAULT,
+	.tp_dealloc = (destructor) Registers_dealloc,
+	.tp_as_buffer = &Registers_buffer,
+};
+
+static PyObject* Sim_registers(SimObject* self, PyObject* args) {
+	int hart = 0;
+
+	if (!PyArg_ParseTuple(args, "|i", &hart)) return NULL;
+	if (!available(self)) return NULL;
+
+	uint64_t* registers = sim_registers(self->sim, hart);
+	if (!registers) return PyErr_Format(PyExc_IndexError, "No hart %d", hart);
+
+	RegistersObject* exporter = PyObject_New(RegistersObject, &RegistersType);
+	if (!exporter) return NULL;
+
+	Py_INCREF(self);
+	exporter->owner = self;
+	exporter->registers = registers;
+
+	PyObject* view = PyMemoryView_FromObject((PyObject*) exporter);
+	Py_DECREF(exporter);
+	return view;
+}
+
+static PyObject* Sim_pc(SimObject* self, PyObject* args) {
+	int hart = 0;
+
+	if (!PyArg_ParseTuple(args, "|i", &hart)) return NULL;
+	if (!available(self)) return NULL;
+	if (!sim_registers(self->sim, hart)) return PyErr_Format(PyExc_IndexError, "No hart %d", hart);
+
+	return PyLong_FromUnsignedLongLong(sim_get_pc(self->sim, hart));
+}
+
+static PyObject* Sim_set_pc(SimObject* self, PyObject* args) {
+	unsigned long long pc;
+	int hart = 0;
+
+	if (!PyArg_ParseTuple(args, "K|i", &pc, &hart)) return NULL;
+	if (!available(self)) return NULL;
+	if (!sim_registers(self->sim, hart)) return PyErr_Format(PyExc_IndexError, "No hart %d", hart);
+
+	sim_set_pc(self->sim, hart, pc);
+	Py_RETURN_NONE;
+}
+
+static PyObject* Sim_read_memory(SimObject* self, PyObject* args) {
+	unsigned long long addr;
+	Py_ssize_t len;
+
+	if (!PyArg_ParseTuple(args, "Kn", &addr, &len)) return NULL;
+	if (!available(self)) return NULL;
+	if (len < 0 || addr > (MEMORY_SIZE) || (uint64_t) len > (MEMORY_SIZE) - addr) return PyErr_Format(PyExc_IndexError, "Range is out of memory");
+
+	PyObject* data = PyBytes_FromStringAndSize(NULL, len);
+	if (data) sim_read_memory(self->sim, addr, PyBytes_AS_STRING(data), len);
+	return data;
+}
+
+static PyObject* Sim_write_memory(SimObject* self, PyObject* args) {
+	unsigned long long addr;
+	Py_buffer data;
+
+	if (!PyArg_ParseTuple(args, "Ky*", &addr, &data)) return NULL;
+
+	bool written = available(self) && sim_write_memory(self->sim, addr, data.buf, data.len);
+	PyBuffer_Release(&data);
+
+	if (!written && !PyErr_Occurred()) PyErr_SetString(PyExc_IndexError, "Range is out of memory");
+	if (!written) return NULL;
+	Py_RETURN_NONE;
+}
+
+static bool parse_range(SimObject* self, PyObject* args, uint64_t* addr, uint64_t* len) {
+	unsigned long long start = 0;
+	PyObject* size = Py_None;
+
+	if (!PyArg_ParseTuple(args, "|KO", &start, &size)) return false;
+	if (!available(self)) return false;
+
+	*addr = start;
+	*len = start < (MEMORY_SIZE)?(MEMORY_SIZE) - start:0;
+	if (size != Py_None) {
+		*len = PyLong_AsUnsignedLongLong(size);
+		if (PyErr_Occurred()) return false;
+	}
+	return true;
+}
+
+static PyObject* Sim_flush(SimObject* self, PyObject* args) {
+	uint64_t addr, len;
+
+	if (!parse_range(self, args, &addr, &len)) return NULL;
+	if (!sim_flush_memory(self->sim, addr, len)) return PyErr_Format(PyExc_IndexError, "Range is out of memory");
+	Py_RETURN_NONE;
+}
+
+static PyObject* Sim_memory_written(SimObject* self, PyObject* args) {
+	uint64_t addr, len;
+
+	if (!parse_range(self, args, &addr, &len)) return NULL;
+	if (!sim_memory_written(self->sim, addr, len)) return PyErr_Format(PyExc_IndexError, "Range is out of memory");
+	Py_RETURN_NONE;
+}
+
+static PyObject* Sim_cache_stats(SimObject* self, PyObject* args) {
+	int hart = 0;
+	CacheStats stats;
+
+	if (!PyArg_ParseTuple(args, "|i", &hart)) return NULL;
+	if (!available(self)) return NULL;
+	if (!sim_registers(self->sim, hart)) return PyErr_Format(PyExc_IndexError, "No hart %d", hart);
+	if (!sim_cache_stats(self->sim, hart, &stats)) Py_RETURN_NONE;
+
+	PyObject* result = PyStructSequence_New(CacheStatsType);
+	if (!result) return NULL;
+
+	PyStructSequence_SetItem(result, 0, PyLong_FromUnsignedLongLong(stats.access_count));
+	PyStructSequence_SetItem(result, 1, PyLong_FromUnsignedLongLong(stats.hit_count));
+	PyStructSequence_SetItem(result, 2, PyLong_FromUnsignedLongLong(stats.miss_count));
+	PyStructSequence_SetItem(result, 3, PyLong_FromUnsignedLongLong(stats.writebacks));
+	PyStructSequence_SetItem(result, 4, PyFloat_FromDouble(stats.hit_rate));
+
+	if (PyErr_Occurred()) Py_CLEAR(result);
+	return result;
+}
+
+static PyObject* Sim_get(SimObject* self, void* field) {
+	int64_t code;
+	size_t len;
+
+	if (!available(self)) return NULL;
+
+	switch ((intptr_t) field) {
+		case 0: return PyMemoryView_FromObject((PyObject*) self);
+		case 1:
+			const char* output = sim_output(self->sim, &len);
+			return PyBytes_FromStringAndSize(output, len);
+		case 2:
+			if (!sim_exited(self->sim, &code)) Py_RETURN_NONE;
+			return PyLong_FromLongLong(code);
+		case 3: return PyUnicode_FromString(sim_error(self->sim));
+		default: return PyLong_FromUnsignedLongLong(self->instructions);
+	}
+}
+
+static int Sim_getbuffer(SimObject* self, Py_buffer* view, int flags) {
+	if (!available(self)) {
+		view->obj = NULL;
+		return -1;
+	}
+	if (PyBuffer_FillInfo(view, (PyObject*) self, sim_memory(self->sim), MEMORY_SIZE, 0, flags)) return -1;
+
+	self->exports++;
+	return 0;
+}
+
+static void Sim_releasebuffer(SimObject* self, Py_buffer* Py_UNUSED(view)) {
+	self->exports--;
+}
+
+static PyBufferProcs Sim_buffer = {
+	.bf_getbuffer = (getbufferproc) Sim_getbuffer,
+	.bf_releasebuffer = (releasebufferproc) Sim_releasebuffer,
+};
+
+static PyGetSetDef Sim_getset[] = {
+	{"memory", (getter) Sim_get, NULL, "Writable view of guest memory, without copying it. The same as memoryview(sim)", (void*) 0},
+	{"output", (getter) Sim_get, NULL, "Everything the program wrote to stdout and stderr", (void*) 1},
+	{"exit_code", (getter) Sim_get, NULL, "Exit code of the program, None if it did not exit", (void*) 2},
+	{"error", (getter) Sim_get, NULL, "Last error of a load, reload or run", (void*) 3},
+	{"instructions", (getter) Sim_get, NULL, "Instructions run since the program was loaded or reset", (void*) 4},
+	{NULL},
+};
+
+static PyMethodDef Sim_methods[] = {
+	{"load", (PyCFunction) Sim_load, METH_VARARGS, "load(path)\n\nLoads an assembly source or ELF executable. Raises SimError if it fails, keeping the old program"},
+	{"load_source", (PyCFunction) Sim_load_source, METH_VARARGS, "load_source(source)\n\nLoads assembly source from a string"},
+	{"reload", (PyCFunction) Sim_reload, METH_NOARGS, "reload()\n\nReassembles the loaded source after it was edited, keeping the caches. Returns the bytes of memory written"},
+	{"reset", (PyCFunction) Sim_reset, METH_NOARGS, "reset()\n\nRestarts the program"},
+	{"set_cache", (PyCFunction) Sim_set_cache, METH_O, "set_cache(config)\n\nReplaces the cache (None for none) and restarts the program"},
+	{"step", (PyCFunction) Sim_step, METH_VARARGS, "step(n=1)\n\nRuns up to n instructions. Returns OK, or END, BREAKPOINT or WATCHPOINT if it stopped early. Raises SimError on errors"},
+	{"run", (PyCFunction) Sim_run, METH_VARARGS | METH_KEYWORDS, "run(until=None, max_steps=None)\n\nRuns until the program ends, stops, the hart that ran last reaches until, or max_steps instructions (LIMIT)"},
+	{"registers", (PyCFunction) Sim_registers, METH_VARARGS, "registers(hart=0)\n\nWritable view of the 32 registers of a hart as unsigned 64 bit integers, without copying them"},
+	{"pc", (PyCFunction) Sim_pc, METH_VARARGS, "pc(hart=0)"},
+	{"set_pc", (PyCFunction) Sim_set_pc, METH_VARARGS, "set_pc(pc, hart=0)"},
+	{"read_memory", (PyCFunction) Sim_read_memory, METH_VARARGS, "read_memory(addr, size)\n\nCopies memory as the harts see it, through the caches without counting as accesses"},
+	{"write_memory", (PyCFunction) Sim_write_memory, METH_VARARGS, "write_memory(addr, data)\n\nWrites memory through the caches"},
+	{"flush", (PyCFunction) Sim_flush, METH_VARARGS, "flush(addr=0, size=None)\n\nWrites what the caches hold back to memory, so views of it are up to date"},
+	{"memory_written", (PyCFunction) Sim_memory_written, METH_VARARGS, "memory_written(addr=0, size=None)\n\nTells the caches and decoder that memory was written through a view"},
+	{"cache_stats", (PyCFunction) Sim_cache_stats, METH_VARARGS, "cache_stats(hart=0)\n\nStats of the L1 of a hart, None without a cache"},
+	{NULL},
+};
+
+static PyTypeObject SimType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name = "riscvsim.Sim",
+	.tp_doc = "Sim(harts=1, quantum=1, cache=None, smc=False)\n\n"
+		"One simulator. Simulators share nothing, so they can run on separate threads at once, with the GIL released while they run",
+	.tp_basicsize = sizeof(SimObject),
+	.tp_flags = Py_TPFLAGS_DEFAULT,
+	.tp_new = Sim_new,
+	.tp_dealloc = (destructor) Sim_dealloc,
+	.tp_getset = Sim_getset,
+	.tp_methods = Sim_methods,
+	.tp_as_buffer = &Sim_buffer,
+};
+
+static PyObject* set_object_cache(PyObject* module, PyObject* args) {
+	PyObject* dir = NULL;
+
+	if (!PyArg_ParseTuple(args, "|O&", PyUnicode_FSConverter, &dir)) return NULL;
+
+	sim_set_object_cache(dir?PyBytes_AS_STRING(dir):NULL);
+	Py_XDECREF(dir);
+	Py_RETURN_NONE;
+}
+
+static PyMethodDef riscvsim_methods[] = {
+	{"set_object_cache", set_object_cache, METH_VARARGS, "set_object_cache(dir=None)\n\nKeeps assembled programs in dir, to load them from there when their source is loaded again. "
+		"Off by default, None turns it off again. The directory is shared by every Sim"},
+	{NULL},
+};
+
+static struct PyModuleDef riscvsim_module = {
+	PyModuleDef_HEAD_INIT,
+	.m_name = "riscvsim",
+	.m_doc = "The RISC-V simulator without the TUI",
+	.m_size = -1,
+	.m_methods = riscvsim_methods,
+};
+
+PyMODINIT_FUNC PyInit_riscvsim() {
+	if (PyType_Ready(&CacheConfigType) || PyType_Ready(&SimType) || PyType_Ready(&RegistersType)) return NULL;
+
+	CacheStatsType = PyStructSequence_NewType(&cache_stats_desc);
+	if (!CacheStatsType) return NULL;
+
+	PyObject* module = PyModule_Create(&riscvsim_module);
+	if (!module) return NULL;
+
+	SimError = PyErr_NewException("riscvsim.SimError", PyExc_RuntimeError, NULL);
+
+	if (PyModule_AddObjectRef(module, "SimError", SimError) ||
+		PyModule_AddObjectRef(module, "Sim", (PyObject*) &SimType) ||
+		PyModule_AddObjectRef(module, "CacheConfig", (PyObject*) &CacheConfigType) ||
+		PyModule_AddObjectRef(module, "CacheStats", (PyObject*) CacheStatsType) ||
+		PyModule_AddIntConstant(module, "OK", SIM_OK) ||
+		PyModule_AddIntConstant(module, "END", SIM_END) ||
+		PyModule_AddIntConstant(module, "BREAKPOINT", SIM_BREAKPOINT) ||
+		PyModule_AddIntConstant(module, "WATCHPOINT", SIM_WATCHPOINT) ||
+		PyModule_AddIntConstant(module, "UNTIL", SIM_UNTIL) ||
+		PyModule_AddIntConstant(module, "LIMIT", SIM_LIMIT) ||
+		PyModule_AddIntConstant(module, "MEMORY_SIZE", MEMORY_SIZE) ||
+		PyModule_AddIntConstant(module, "DATA_BASE", DATA_BASE)) {
+		Py_DECREF(module);
+		return NULL;
+	}
+
+	return module;
+}
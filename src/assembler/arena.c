@@ -0,0 +1,71 @@
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+#define ARENA_ALIGN 16
+
+static arena_block* new_block(size_t size) {
+	arena_block* block = malloc(sizeof(arena_block) + size);
+	if (!block) return NULL;
+
+	block->next = NULL;
+	block->size = size;
+	block->used = 0;
+	return block;
+}
+
+arena* new_arena(size_t block_size) {
+	arena* a = malloc(sizeof(arena));
+	if (!a) return NULL;
+
+	a->blocks = NULL;
+	a->block_size = block_size;
+	return a;
+}
+
+void* arena_alloc(arena* a, size_t size) {
+	size = (size + ARENA_ALIGN-1) & ~(size_t) (ARENA_ALIGN-1);
+	arena_block* block = a->blocks;
+
+	if (!block || block->size - block->used < size) {
+		// Big allocations get a block of their own behind the current one, so the space left in it is not wasted
+		if (block && size > a->block_size) {
+			arena_block* own = new_block(size);
+			if (!own) return NULL;
+
+			own->used = size;
+			own->next = block->next;
+			block->next = own;
+			return own->data;
+		}
+
+		block = new_block(size > a->block_size?size:a->block_size);
+		if (!block) return NULL;
+
+		block->next = a->blocks;
+		a->blocks = block;
+	}
+
+	void* result = block->data + block->used;
+	block->used += size;
+	return result;
+}
+
+char* arena_strdup(arena* a, const char* str) {
+	size_t len = strlen(str);
+	char* copy = arena_alloc(a, len+1);
+	if (copy) memcpy(copy, str, len+1);
+	return copy;
+}
+
+void free_arena(arena* a) {
+	arena_block* block = a->blocks;
+
+	while (block) {
+		arena_block* next = block->next;
+		free(block);
+		block = next;
+	}
+
+	free(a);
+}
@@ -0,0 +1,31 @@
+#ifndef ARENA_H
+#define ARENA_H
+#include <stdlib.h>
+#include <stdint.h>
+
+#define ARENA_BLOCK_SIZE 0x10000 // Default size of the blocks an arena allocates from
+
+typedef struct arena_block {
+	struct arena_block* next;
+	size_t size;
+	size_t used;
+	_Alignas(16) uint8_t data[];
+} arena_block;
+
+// Bump allocator that owns everything belonging to one loaded program, so it can all be freed at once.
+// Allocations are never freed individually
+typedef struct arena {
+	arena_block* blocks;	// Most recent block first, allocations come from the front one
+	size_t block_size;
+} arena;
+
+arena* new_arena(size_t block_size);
+
+// Returns size bytes aligned to 16 bytes, or NULL if out of memory. Allocations larger than a block get a block of their own
+void* arena_alloc(arena* a, size_t size);
+
+char* arena_strdup(arena* a, const char* str);
+
+void free_arena(arena* a);
+
+#endif
@@ -1,18 +1,39 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
+#include <ctype.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "assembler.h"
 #include "vec.h"
 #include "index.h"
 #include "translator.h"
-#include "../frontend/frontend.h"
+#include "objcache.h"
+#include "../frontend/error.h"
 #include "../backend/backend.h"
 
-int read_greedy(FILE** in_fp, char* buffer, size_t n) {
-	FILE* fp = *in_fp;
+#define NAME_LEN 16 // Longest instruction name (plus null terminator) that will be accepted
+
+// The source file, mapped into memory and read a character at a time through a pointer
+typedef struct source {
+	const char* p;
+	const char* end;
+} source;
+
+// Works like fgetc. Reading past the end still moves the pointer, so stepping back after EOF gives EOF again
+static inline char next_char(source* src) {
+	if (src->p >= src->end) {
+		src->p++;
+		return EOF;
+	}
+	return *(src->p++);
+}
+
+int read_greedy(source* src, char* buffer, size_t n) {
 	int i = 0;
 	char c;
 
-	while((c = fgetc(fp)) != '.' && c != '\n' && c != ',' && c != EOF) {
+	while((c = next_char(src)) != '.' && c != '\n' && c != ',' && c != EOF) {
 		if (c == ' ' || c == '\t') continue;
 		if (i==n-1) return 1;
 		buffer[i] = c;
@@ -20,7 +41,7 @@ int read_greedy(FILE** in_fp, char* buffer, size_t n) {
 	}
 
 	buffer[i] = '\0';
-	fseek(fp, -1, SEEK_CUR);
+	src->p--;
 	return 0;
 }
 
@@ -42,8 +63,8 @@ long int parse_imm(char* arg, char** endptr) {
 	return ret;
 }
 
-int pre_pass(FILE **in_fp, uint8_t* memory) {
-	FILE* fp = *in_fp;
+// Writes the data segment into memory, and sets data_end to the end of it
+int pre_pass(source* src, uint8_t* memory, uint64_t* data_end) {
 	char c;
 	char buffer[80];
 	char *endptr;
@@ -56,7 +77,7 @@ int pre_pass(FILE **in_fp, uint8_t* memory) {
 	bool command_flag = false;
 
 	while(1) {
-		c = fgetc(fp);
+		c = next_char(src);
 		switch (c) {
 			case '#':
 			case ';':
@@ -83,7 +104,8 @@ int pre_pass(FILE **in_fp, uint8_t* memory) {
 						data_flag = true;
 
 					} else if (!strcmp(buffer, "text")) {
-						fseek(fp, -1, SEEK_CUR);
+						src->p--;
+						*data_end = mem_pointer;
 						return line_offset-1;
 
 					} else if (!strcmp(buffer, "dword")) {
@@ -92,7 +114,7 @@ int pre_pass(FILE **in_fp, uint8_t* memory) {
 						}
 
 						do {
-							if (read_greedy(&fp, buffer, 80)) {
+							if (read_greedy(src, buffer, 80)) {
 								show_error("Value too large on line %d", line_offset);
 								return -1;
 							}
@@ -105,9 +127,9 @@ int pre_pass(FILE **in_fp, uint8_t* memory) {
 
 							memcpy(&memory[mem_pointer], &imm, 8);
 							mem_pointer += 8;
-						} while((c = fgetc(fp)) == ',');
+						} while((c = next_char(src)) == ',');
 		
-						fseek(fp, -1, SEEK_CUR);
+						src->p--;
 
 					} else if (!strcmp(buffer, "word")) {
 						if (!data_flag) {
@@ -115,7 +137,7 @@ int pre_pass(FILE **in_fp, uint8_t* memory) {
 						}
 
 						do {
-							if (read_greedy(&fp, buffer, 80)) {
+							if (read_greedy(src, buffer, 80)) {
 								show_error("Value too large on line %d", line_offset);
 								return -1;
 							}
@@ -128,9 +150,9 @@ int pre_pass(FILE **in_fp, uint8_t* memory) {
 
 							memcpy(&memory[mem_pointer], &imm, 4);
 							mem_pointer += 4;
-						} while((c = fgetc(fp)) == ',');
+						} while((c = next_char(src)) == ',');
 		
-						fseek(fp, -1, SEEK_CUR);
+						src->p--;
 
 					} else if (!strcmp(buffer, "half")) {
 						if (!data_flag) {
@@ -138,7 +160,7 @@ int pre_pass(FILE **in_fp, uint8_t* memory) {
 						}
 
 						do {
-							if (read_greedy(&fp, buffer, 80)) {
+							if (read_greedy(src, buffer, 80)) {
 								show_error("Value too large on line %d", line_offset);
 								return -1;
 							}
@@ -151,9 +173,9 @@ int pre_pass(FILE **in_fp, uint8_t* memory) {
 
 							memcpy(&memory[mem_pointer], &imm, 2);
 							mem_pointer += 2;
-						} while((c = fgetc(fp)) == ',');
+						} while((c = next_char(src)) == ',');
 		
-						fseek(fp, -1, SEEK_CUR);
+						src->p--;
 					
 					} else if (!strcmp(buffer, "byte")) {
 						if (!data_flag) {
@@ -161,7 +183,7 @@ int pre_pass(FILE **in_fp, uint8_t* memory) {
 						}
 
 						do {
-							if (read_greedy(&fp, buffer, 80)) {
+							if (read_greedy(src, buffer, 80)) {
 								show_error("Value too large on line %d", line_offset);
 								return -1;
 							}
@@ -174,9 +196,9 @@ int pre_pass(FILE **in_fp, uint8_t* memory) {
 
 							memcpy(&memory[mem_pointer], &imm, 1);
 							mem_pointer += 1;
-						} while((c = fgetc(fp)) == ',');
+						} while((c = next_char(src)) == ',');
 		
-						fseek(fp, -1, SEEK_CUR);
+						src->p--;
 
 					} else {
 						show_error("Unknown statement on line %d", line_offset);
@@ -201,7 +223,8 @@ int pre_pass(FILE **in_fp, uint8_t* memory) {
 			default:
 				if (comment_flag) break;
 				if (!command_flag) {
-					fseek(fp, -1, SEEK_CUR);
+					src->p--;
+					*data_end = mem_pointer;
 					return line_offset-1;
 				}
 
@@ -216,9 +239,12 @@ int pre_pass(FILE **in_fp, uint8_t* memory) {
 	}
 }
 
-// Reads in_fp and writes the same to out_fp while ignoring all whitespace, comments and labels (but makes a note of label positions)
-int first_pass(FILE *in_fp, char *out_fp, label_index* index, vec* line_mapping, int line_offset) {
+// Reads src and writes the same to out_fp while ignoring all whitespace, comments and labels (but makes a note of label positions)
+// Also records the address of every instruction, compressed instructions (c.*) take 2 bytes and all others take 4
+int first_pass(source* src, char *out_fp, label_index* index, vec* line_mapping, vec* addresses, int line_offset) {
 	char c;
+	char* line_start = out_fp;
+	uint64_t address = 0;
 	char label_buffer[128];
 	int linecount = line_offset;
 	int instruction_count = 0;
@@ -231,7 +257,7 @@ int first_pass(FILE *in_fp, char *out_fp, label_index* index, vec* line_mapping,
 	bool keep_reading = true;
 
 	while (keep_reading) {
-		c = fgetc(in_fp);
+		c = next_char(src);
 		switch (c) {
 			case '#':
 			case ';':
@@ -244,8 +270,11 @@ int first_pass(FILE *in_fp, char *out_fp, label_index* index, vec* line_mapping,
 				if (instr_flag) {
 					*(out_fp++) = '\n';
 					append(line_mapping, linecount);
+					append(addresses, address);
+					address += (line_start[0] == 'c' && line_start[1] == '.')?2:4;
 					instruction_count += 1;
 				} 
+				line_start = out_fp;
 				linecount += 1;
 				line_len = 0;
 				comment_flag = false;
@@ -274,6 +303,7 @@ int first_pass(FILE *in_fp, char *out_fp, label_index* index, vec* line_mapping,
 				
 				add_label(index, label_buffer, instruction_count);
 				out_fp -= line_len;
+				line_start = out_fp;
 				instr_flag = false;
 				lw_flag = true;
 				break;
@@ -297,105 +327,275 @@ int first_pass(FILE *in_fp, char *out_fp, label_index* index, vec* line_mapping,
 		whitespace_flag = false;
 	}
 	*(out_fp++) = '\0';
+	append(addresses, address); // End of the text segment
 	return 0;
 }
 
 
-// Actually Encode all the instructions and write it to the int array.
-int second_pass(char* clean_fp, int* hexcode, label_index* index, vec* line_mapping, bool debug) {
+// Encodes the line of cleaned code at *clean_fp as instruction instruction_count, and moves *clean_fp to the next line
+static int encode_line(char** clean_fp, int* hexcode, label_index* index, vec* line_mapping, vec* addresses, int instruction_count) {
 
-	char name[8]; // Sufficient for any valid instruction/pseudo instruction in Base class
-	int instruction_count = 0;
+	char name[NAME_LEN]; // Sufficient for any valid instruction/pseudo instruction
 	int i = 0;
 	char c;
 
-	while ((c = *(clean_fp++)) != '\0') {
-		if (i<8) {
-			if (c == ' ' || c == '\t' || c == '\n') {
-				name[i] = '\0';
+	while ((c = *((*clean_fp)++)) != ' ' && c != '\t' && c != '\n') {
+		if (i == NAME_LEN-1) {
+			// No valid instruction would be this long
+			name[NAME_LEN-1] = '\0';
+			show_error("Error on line %d: Invalid Instruction: %s", line_mapping->values[instruction_count], name);
+			return 1;
+		}
+		name[i++] = c;
+	}
+	name[i] = '\0';
 
-				// Attempt instruction translation
-				
-				// Checking name of instruction against known instructions
-				const instruction_info* instruction = parse_instruction(name);
+	// Attempt instruction translation
+	
+	// Checking name of instruction against known instructions
+	int ordering = parse_ordering(name);
+	const instruction_info* instruction = parse_instruction(name);
 
-				if (!instruction) {
-					show_error("Error on line %d: Unknown Instruction: (%s)", line_mapping->values[instruction_count], name);
-					return 1;
-				}
+	if (!instruction) {
+		show_error("Error on line %d: Unknown Instruction: (%s)", line_mapping->values[instruction_count], name);
+		return 1;
+	}
 
-				int addend = 0;
-				bool fail_flag = false;
-
-				// Parsing arguments of instruction
-				switch (instruction->handler_type) {
-					case R_TYPE:
-						addend = R_type_parser(&clean_fp, index, &line_mapping->values[instruction_count], instruction_count, &fail_flag);
-						break;
-
-					case I1_TYPE:
-						addend = I1_type_parser(&clean_fp, index, &line_mapping->values[instruction_count], instruction_count, &fail_flag);
-						break; 
-
-					case I1B_TYPE:
-						addend = I1B_type_parser(&clean_fp, index, &line_mapping->values[instruction_count], instruction_count, &fail_flag);
-						break; 
-
-					case I2_TYPE:
-						addend = I2_type_parser(&clean_fp, index, &line_mapping->values[instruction_count], instruction_count, &fail_flag);
-						break; 
-
-					case S_TYPE:
-						addend = S_type_parser(&clean_fp, index, &line_mapping->values[instruction_count], instruction_count, &fail_flag);
-						break; 
-
-					case B_TYPE:
-						addend = B_type_parser(&clean_fp, index, &line_mapping->values[instruction_count], instruction_count, &fail_flag);
-						break; 
-
-					case U_TYPE:
-						addend = U_type_parser(&clean_fp, index, &line_mapping->values[instruction_count], instruction_count, &fail_flag);
-						break; 
-
-					case J_TYPE:
-						addend = J_type_parser(&clean_fp, index, &line_mapping->values[instruction_count], instruction_count, &fail_flag);
-						break; 
-
-					case I3_TYPE:
-						addend = I3_type_parser(&clean_fp, index, &line_mapping->values[instruction_count], instruction_count, &fail_flag);
-						break; 
-
-					case I4_TYPE:
-						break;
-						
-					default:
-						show_error("Error on line %d: Unclassified type, This should not have happened!", line_mapping->values[instruction_count]);
-						return 1;
-				}
-				
-				if (fail_flag) return 1;
+	int addend = 0;
+	bool fail_flag = false;
+
+	// Parsing arguments of instruction
+	switch (instruction->handler_type) {
+		case R_TYPE:
+			addend = R_type_parser(clean_fp, index, addresses, &line_mapping->values[instruction_count], instruction_count, &fail_flag);
+			break;
+
+		case I1_TYPE:
+			addend = I1_type_parser(clean_fp, index, addresses, &line_mapping->values[instruction_count], instruction_count, &fail_flag);
+			break; 
+
+		case I1B_TYPE:
+			addend = I1B_type_parser(clean_fp, index, addresses, &line_mapping->values[instruction_count], instruction_count, &fail_flag);
+			break; 
+
+		case I1BW_TYPE:
+			addend = I1BW_type_parser(clean_fp, index, addresses, &line_mapping->values[instruction_count], instruction_count, &fail_flag);
+			break; 
+
+		case I2_TYPE:
+			addend = I2_type_parser(clean_fp, index, addresses, &line_mapping->values[instruction_count], instruction_count, &fail_flag);
+			break; 
+
+		case S_TYPE:
+			addend = S_type_parser(clean_fp, index, addresses, &line_mapping->values[instruction_count], instruction_count, &fail_flag);
+			break; 
+
+		case B_TYPE:
+			addend = B_type_parser(clean_fp, index, addresses, &line_mapping->values[instruction_count], instruction_count, &fail_flag);
+			break; 
+
+		case U_TYPE:
+			addend = U_type_parser(clean_fp, index, addresses, &line_mapping->values[instruction_count], instruction_count, &fail_flag);
+			break; 
+
+		case J_TYPE:
+			addend = J_type_parser(clean_fp, index, addresses, &line_mapping->values[instruction_count], instruction_count, &fail_flag);
+			break; 
+
+		case I3_TYPE:
+			addend = I3_type_parser(clean_fp, index, addresses, &line_mapping->values[instruction_count], instruction_count, &fail_flag);
+			break; 
+
+		case I4_TYPE:
+			break;
+
+		case CSR_TYPE:
+		case CSRR_TYPE:
+			addend = CSR_type_parser(instruction->handler_type, clean_fp, index, addresses, &line_mapping->values[instruction_count], instruction_count, &fail_flag);
+			break;
+
+		case AMO_TYPE:
+		case LR_TYPE:
+			addend = AMO_type_parser(instruction->handler_type, clean_fp, index, addresses, &line_mapping->values[instruction_count], instruction_count, &fail_flag);
+			break;
+
+		case CR_TYPE:
+		case CR1_TYPE:
+		case CI_TYPE:
+		case CIS_TYPE:
+		case CLUI_TYPE:
+		case C16SP_TYPE:
+		case CIW_TYPE:
+		case CLW_TYPE:
+		case CLD_TYPE:
+		case CLWSP_TYPE:
+		case CLDSP_TYPE:
+		case CSWSP_TYPE:
+		case CSDSP_TYPE:
+		case CBS_TYPE:
+		case CBI_TYPE:
+		case CB_TYPE:
+		case CJ_TYPE:
+		case CA_TYPE:
+			addend = C_type_parser(instruction->handler_type, clean_fp, index, addresses, &line_mapping->values[instruction_count], instruction_count, &fail_flag);
+			break;
+			
+		default:
+			show_error("Error on line %d: Unclassified type, This should not have happened!", line_mapping->values[instruction_count]);
+			return 1;
+	}
+	
+	if (fail_flag) return 1;
 
-				// Write the instruction to the output buffer
-				hexcode[instruction_count] = instruction->constant + addend;
-				if (debug) show_error("Instruction %d: %08X", instruction_count, hexcode[instruction_count]);
-				
-				instruction_count++;
-				i = 0;
+	*hexcode = instruction->constant + addend + ordering;
+	return 0;
+}
 
-			} else name[i++] = c;
-		} else {
-			// No valid instruction would be this long
-			name[7] = '\0';
-			show_error("Error on line %d: Invalid Instruction: %s", line_mapping->values[instruction_count], name);
-			return 1;
-		}
+// Actually Encode all the instructions and write it to the int array, and into the text segment of memory
+int second_pass(char* clean_fp, int* hexcode, uint8_t* memory, label_index* index, vec* line_mapping, vec* addresses, bool debug) {
+
+	for (int instruction_count = 0; *clean_fp != '\0'; instruction_count++) {
+		if (encode_line(&clean_fp, &hexcode[instruction_count], index, line_mapping, addresses, instruction_count)) return 1;
 
+		// Write the instruction to the output buffer
+		memcpy(memory + addresses->values[instruction_count], &hexcode[instruction_count], addresses->values[instruction_count+1] - addresses->values[instruction_count]);
+		if (debug) show_error("Instruction %d: %08X", instruction_count, hexcode[instruction_count]);
 	}
 		
 	return 0;
 }
 
-int* assembler_main(FILE* in_fp, char* cleaned, label_index* index, uint8_t* memory) {
+// Maps the whole file into memory, falling back to reading it in one go if it cannot be mapped. Returns NULL on failure
+static char* map_source(FILE* in_fp, size_t* size, bool* mapped) {
+	struct stat info;
+	if (fstat(fileno(in_fp), &info) == -1) return NULL;
+
+	*size = info.st_size;
+	*mapped = false;
+	if (*size == 0) return malloc(1); // Nothing to map, the passes see EOF straight away
+
+	char* data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fileno(in_fp), 0);
+	if (data != MAP_FAILED) {
+		*mapped = true;
+		return data;
+	}
+
+	data = malloc(*size);
+	if (!data) return NULL;
+
+	rewind(in_fp);
+	if (fread(data, 1, *size, in_fp) != *size) {
+		free(data);
+		return NULL;
+	}
+	return data;
+}
+
+// Returns a pointer to the start of each of the n lines of cleaned code. Lines end in '\n', or '\0' once the frontend has shown them
+static char** split_lines(char* clean_fp, int n) {
+	char** lines = malloc(sizeof(char*)*(n+1));
+	if (!lines) return NULL;
+
+	for (int i=0; i<n; i++) {
+		lines[i] = clean_fp;
+		while (*clean_fp != '\n' && *clean_fp != '\0') clean_fp++;
+		clean_fp++;
+	}
+	return lines;
+}
+
+static bool same_line(const char* a, const char* b) {
+	while (*a == *b && *a != '\n' && *a != '\0') {
+		a++;
+		b++;
+	}
+	return (*a == '\n' || *a == '\0') && (*b == '\n' || *b == '\0');
+}
+
+static inline bool is_separator(char c) {
+	return c == ' ' || c == '\t' || c == ',' || c == '(' || c == ')';
+}
+
+// Whether a kept instruction has to be encoded again, because a label it branches to moved relative to it (or is gone).
+// Labels are only ever used as pc relative offsets, so an instruction that moved along with its target keeps its hexcode
+static bool needs_patch(char* line, int instruction, int old_instruction, label_index* index, vec* addresses, assembled_program* old) {
+	char token[128];
+
+	while (*line != '\n' && *line != '\0' && !is_separator(*line)) line++; // Skip the name
+
+	while (*line != '\n' && *line != '\0') {
+		int len = 0;
+		while (is_separator(*line)) line++;
+
+		for (; *line != '\n' && *line != '\0' && !is_separator(*line); line++) {
+			if (len < sizeof(token)-1) token[len++] = *line;
+		}
+		token[len] = '\0';
+		if (!len || !isalpha(token[0])) continue;
+
+		int position = label_to_position(index, token);
+		int old_position = label_to_position(old->index, token);
+		if (position == -1 && old_position == -1) continue; // A register or CSR
+		if (position == -1 || old_position == -1) return true;
+
+		int64_t offset = addresses->values[position] - addresses->values[instruction];
+		int64_t old_offset = old->addresses->values[old_position] - old->addresses->values[old_instruction];
+		if (offset != old_offset) return true;
+	}
+
+	return false;
+}
+
+// Replaces the second pass when reassembling. Lines before and after the edited part are the same as in the old program,
+// so only the edited lines and the kept instructions whose branch offsets changed are encoded, the rest reuse their hexcode
+static int incremental_pass(char* clean_fp, int* hexcode, uint8_t* memory, label_index* index, vec* line_mapping, vec* addresses, assembled_program* old, reload_stats* stats) {
+	int n = line_mapping->len, n_old = old->hexcode[0];
+	char** lines = split_lines(clean_fp, n);
+	char** old_lines = split_lines(old->cleaned, n_old);
+	int result = 1;
+
+	if (!lines || !old_lines) {
+		show_error("Out Of Memory!");
+		goto cleanup;
+	}
+
+	int prefix = 0, suffix = 0;
+	while (prefix < n && prefix < n_old && same_line(lines[prefix], old_lines[prefix])) prefix++;
+	while (suffix < n-prefix && suffix < n_old-prefix && same_line(lines[n-1-suffix], old_lines[n_old-1-suffix])) suffix++;
+
+	stats->changed_start = prefix;
+	stats->old_end = n_old-suffix;
+	stats->new_end = n-suffix;
+	stats->reused = stats->patched = stats->encoded = 0;
+
+	for (int i=0; i<n; i++) {
+		bool kept = i < prefix || i >= stats->new_end;
+		int old_instruction = i < prefix?i:i - stats->new_end + stats->old_end;
+
+		if (kept && !needs_patch(lines[i], i, old_instruction, index, addresses, old)) {
+			hexcode[i] = old->hexcode[old_instruction+1];
+			stats->reused++;
+
+		} else {
+			char* line = lines[i];
+			if (encode_line(&line, &hexcode[i], index, line_mapping, addresses, i)) goto cleanup;
+
+			if (kept) stats->patched++;
+			else stats->encoded++;
+		}
+
+		memcpy(memory + addresses->values[i], &hexcode[i], addresses->values[i+1] - addresses->values[i]);
+	}
+	result = 0;
+
+	cleanup:
+	if (lines) free(lines);
+	if (old_lines) free(old_lines);
+	return result;
+}
+
+// Shared by assembler_main and reassembler_main, old is NULL for a full assembly
+static int* assemble(FILE* in_fp, char* cleaned, label_index* index, uint8_t* memory, vec* addresses, program_layout* layout, arena* program, assembled_program* old, reload_stats* stats) {
 
 	// Initializing and Parsing command line switches
 	bool debug = false;
@@ -403,26 +603,79 @@ int* assembler_main(FILE* in_fp, char* cleaned, label_index* index, uint8_t* mem
 
 	vec *line_mapping;
 	int result;
+	uint64_t data_end = DATA_BASE;
+	int* hexcode = NULL;
+
+	size_t size;
+	bool mapped;
+	char* data = map_source(in_fp, &size, &mapped);
+	if (!data) {
+		show_error("Failed to read the source file!");
+		return NULL;
+	}
+
+	// Sources that were assembled before are loaded from their object instead
+	uint64_t key = hash_source(data, size);
+	if (!old && (hexcode = load_object(key, size, cleaned, index, memory, addresses, layout, program))) {
+		if (mapped) munmap(data, size);
+		else free(data);
+		return hexcode;
+	}
+
+	source src = {data, data + size};
 	line_mapping = new_managed_array();
 
 	// Perform the pre-processing
-	if ((result = pre_pass(&in_fp, memory)) == -1) {
-		return NULL;
+	if ((result = pre_pass(&src, memory, &data_end)) == -1) {
+		goto cleanup;
 	}
 
 	// Perform the first pass
-	if ((result = first_pass(in_fp, cleaned, index, line_mapping, result)) != 0) {
-		return NULL;
+	if ((result = first_pass(&src, cleaned, index, line_mapping, addresses, result)) != 0) {
+		goto cleanup;
 	}
 
-	int* hexcode = malloc(sizeof(int)*(line_mapping->len+1));
+	if (addresses->values[addresses->len-1] > DATA_BASE) {
+		show_error("Program does not fit in the text segment!");
+		goto cleanup;
+	}
+
+	hexcode = arena_alloc(program, sizeof(int)*(line_mapping->len+1));
+	if (!hexcode) {
+		show_error("Out Of Memory!");
+		goto cleanup;
+	}
 	hexcode[0] = line_mapping->len;
 
 	// Perform the second pass
-	if ((result = second_pass(cleaned, &hexcode[1], index, line_mapping, debug)) != 0) {
-		return NULL;
+	if (old) result = incremental_pass(cleaned, &hexcode[1], memory, index, line_mapping, addresses, old, stats);
+	else result = second_pass(cleaned, &hexcode[1], memory, index, line_mapping, addresses, debug);
+
+	if (result != 0) {
+		hexcode = NULL;
+		goto cleanup;
 	}
 
+	// Assembled programs always run from the start of the text segment, and set up their own stack
+	layout->text_start = 0;
+	layout->text_end = DATA_BASE;
+	layout->entry = 0;
+	layout->stack_pointer = 0;
+	layout->heap_start = (data_end + 15) & ~15;
+
+	store_object(key, size, hexcode, cleaned, index, memory, addresses, layout);
+
+	cleanup:
 	free_managed_array(line_mapping);
+	if (mapped) munmap(data, size);
+	else free(data);
 	return hexcode;
 }
+
+int* assembler_main(FILE* in_fp, char* cleaned, label_index* index, uint8_t* memory, vec* addresses, program_layout* layout, arena* program) {
+	return assemble(in_fp, cleaned, index, memory, addresses, layout, program, NULL, NULL);
+}
+
+int* reassembler_main(FILE* in_fp, char* cleaned, label_index* index, uint8_t* memory, vec* addresses, program_layout* layout, arena* program, assembled_program* old, reload_stats* stats) {
+	return assemble(in_fp, cleaned, index, memory, addresses, layout, program, old, stats);
+}
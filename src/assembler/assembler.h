@@ -2,7 +2,35 @@
 #define ASSEMBLER_H
 #include <stdio.h>
 #include "index.h"
+#include "vec.h"
+#include "arena.h"
+#include "../backend/backend.h"
 
-int* assembler_main(FILE *in_fp, char *clean_fp, label_index* index, uint8_t* memory);
+// Assembles in_fp, writing the cleaned code to clean_fp (which must be as large as the file) and the data segment and
+// instructions to memory. The returned hexcode (count first) is allocated from program. Returns NULL on failure
+int* assembler_main(FILE *in_fp, char *clean_fp, label_index* index, uint8_t* memory, vec* addresses, program_layout* layout, arena* program);
+
+// A program assembled earlier, whose hexcode reassembly reuses
+typedef struct assembled_program {
+	int* hexcode;		// Count first
+	char* cleaned;		// Lines may end in '\n' or '\0'
+	label_index* index;
+	vec* addresses;
+} assembled_program;
+
+// Which lines reassembly kept. Lines changed_start...old_end-1 of the old program were replaced by changed_start...new_end-1,
+// the lines before stayed where they were and the lines after moved by new_end-old_end
+typedef struct reload_stats {
+	int changed_start;
+	int old_end;
+	int new_end;
+	int reused;		// Instructions whose hexcode was kept
+	int patched;	// Kept instructions encoded again because a label they branch to moved relative to them
+	int encoded;	// Instructions in the changed lines
+} reload_stats;
+
+// Assembles in_fp like assembler_main, but only encodes the lines that differ from old (and the kept instructions
+// whose branch offsets changed). Fills in stats on success
+int* reassembler_main(FILE *in_fp, char *clean_fp, label_index* index, uint8_t* memory, vec* addresses, program_layout* layout, arena* program, assembled_program* old, reload_stats* stats);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/inotify.h>
+#include "filewatch.h"
+
+#define EVENT_BUFFER_SIZE 4096
+
+static int inotify_fd = -1;
+static char file_name[256];     // Name of the file within the watched directory
+static bool pending = false;    // Whether the file changed since the last reported change
+
+// The directory is watched rather than the file, since editors often save by writing a new file and renaming it over the old one
+bool watch_file(const char* path) {
+	char dir[256], name[256];
+	unwatch_file();
+
+	snprintf(dir, sizeof(dir), "%s", path);
+	snprintf(name, sizeof(name), "%s", path);
+	snprintf(file_name, sizeof(file_name), "%s", basename(name));
+
+	inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotify_fd == -1) return false;
+
+	if (inotify_add_watch(inotify_fd, dirname(dir), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) == -1) {
+		unwatch_file();
+		return false;
+	}
+
+	pending = false;
+	return true;
+}
+
+void unwatch_file() {
+	if (inotify_fd != -1) close(inotify_fd);
+	inotify_fd = -1;
+}
+
+bool watching_file() {
+	return inotify_fd != -1;
+}
+
+bool file_changed() {
+	_Alignas(struct inotify_event) char buffer[EVENT_BUFFER_SIZE];
+	bool changed = false;
+	ssize_t len;
+
+	if (inotify_fd == -1) return false;
+
+	while ((len = read(inotify_fd, buffer, sizeof(buffer))) > 0) {
+		for (char* p = buffer; p < buffer + len; ) {
+			struct inotify_event* event = (struct inotify_event*) p;
+			if (event->len && !strcmp(event->name, file_name)) changed = true;
+			p += sizeof(struct inotify_event) + event->len;
+		}
+	}
+
+	if (changed) {
+		pending = true;
+		return false;
+	}
+
+	bool result = pending;
+	pending = false;
+	return result;
+}
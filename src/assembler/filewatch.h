@@ -0,0 +1,16 @@
+#ifndef FILEWATCH_H
+#define FILEWATCH_H
+#include <stdbool.h>
+
+// Starts watching a file for changes with inotify, replacing the file watched before. Returns false on failure
+bool watch_file(const char* path);
+
+void unwatch_file();
+
+bool watching_file();
+
+// Polls for changes without blocking. Returns true once the file was written or replaced and then left alone for a poll,
+// so a save that takes several writes is only reported once it is done
+bool file_changed();
+
+#endif
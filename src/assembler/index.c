@@ -1,47 +1,88 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "index.h"
 
-// A key-value (string to int) store that internally handles memory management
-// Used for keeping track of which location every label points to
-typedef struct label_index {
-	size_t len;
-	size_t capacity;
-	char** labels;
-	int* positions;
-} label_index;
+// FNV-1a
+static uint32_t hash_label(const char* label) {
+	uint32_t hash = 2166136261u;
+	while (*label) hash = (hash ^ (uint8_t) *(label++)) * 16777619u;
+	return hash;
+}
+
+// Adds labels[i] to the hash table. If the name is already there the earlier label is kept, so lookups find the first one
+static void insert_slot(label_index* index, int i) {
+	size_t mask = 2*index->capacity - 1;
+	uint32_t hash = hash_label(index->labels[i]);
+
+	for (size_t slot = hash & mask; ; slot = (slot+1) & mask) {
+		label_slot* s = &index->slots[slot];
+
+		if (s->label == -1) {
+			s->hash = hash;
+			s->label = i;
+			return;
+		}
+		if (s->hash == hash && !strcmp(index->labels[s->label], index->labels[i])) return;
+	}
+}
+
+// Refills the hash table, needed whenever labels move or the table grows
+static void rebuild_slots(label_index* index) {
+	memset(index->slots, 0xFF, 2*index->capacity*sizeof(label_slot));
+	for (int i=0; i<index->len; i++) insert_slot(index, i);
+}
+
+// Doubles capacity once the index is full
+static int grow(label_index* index) {
+	if (index->len != index->capacity) return 0;
+
+	index->capacity *= 2;
+	char** labels_new = realloc(index->labels, index->capacity * sizeof(char*));
+	int* positions_new = realloc(index->positions, index->capacity * sizeof(int));
+	label_slot* slots_new = realloc(index->slots, 2 * index->capacity * sizeof(label_slot));
+
+	if (labels_new) index->labels = labels_new;
+	if (positions_new) index->positions = positions_new;
+	if (slots_new) index->slots = slots_new;
+
+	if (!labels_new || !positions_new || !slots_new) {
+		printf("Failed to allocate memory for label index\n");
+		index->capacity /= 2;
+		return 1;
+	}
+
+	rebuild_slots(index);
+	return 0;
+}
+
+static char* copy_label(label_index* index, char* in_label) {
+	if (index->strings) return arena_strdup(index->strings, in_label);
 
-int add_label(label_index* index, char* in_label, int position) {
-	
 	int label_length = strlen(in_label);
 	char* label = malloc((label_length+1) * sizeof(char));
-	strcpy(label, in_label);
+	if (label) strcpy(label, in_label);
+	return label;
+}
+
+int add_label(label_index* index, char* in_label, int position) {
+	
+	char* label = copy_label(index, in_label);
+	if (!label) return 1;
 
 	index->labels[index->len] = label;
 	index->positions[index->len] = position;
+	insert_slot(index, index->len);
 	index->len++;
 
 	// If out of space, double capacity
-	if (index->len == index->capacity) {
-		index->capacity *= 2;
-		char** labels_new = realloc(index->labels, index->capacity * sizeof(char*));
-		int* positions_new = realloc(index->positions, index->capacity * sizeof(int));
-		if (!labels_new || !positions_new) {
-			printf("Failed to allocate memory for label index\n");
-			return 1;
-		}
-
-		index->labels = labels_new;
-		index->positions = positions_new;
-	}
-	return 0;
+	return grow(index);
 }
 
 int prepend_label(label_index* index, char* in_label, int position) {
 
-	int label_length = strlen(in_label);
-	char* label = malloc((label_length+1) * sizeof(char));
-	strcpy(label, in_label);
+	char* label = copy_label(index, in_label);
+	if (!label) return 1;
 
 	memmove(index->labels+1, index->labels, index->len*sizeof(char*));
 	memmove(index->positions+1, index->positions, index->len*sizeof(int));
@@ -50,27 +91,20 @@ int prepend_label(label_index* index, char* in_label, int position) {
 	index->positions[0] = position;
 	index->len++;
 
-	// If out of space, double capacity
-	if (index->len == index->capacity) {
-		index->capacity *= 2;
-		char** labels_new = realloc(index->labels, index->capacity * sizeof(char*));
-		int* positions_new = realloc(index->positions, index->capacity * sizeof(int));
-		if (!labels_new || !positions_new) {
-			printf("Failed to allocate memory for label index\n");
-			return 1;
-		}
+	// Every label moved up by one
+	rebuild_slots(index);
 
-		index->labels = labels_new;
-		index->positions = positions_new;
-	}
-	return 0;
+	// If out of space, double capacity
+	return grow(index);
 }
 
 int label_to_position(label_index* index, char* label) {
-	for(int i=0; i<index->len; i++) {
-		if (strcmp(index->labels[i], label) == 0) {
-			return index->positions[i];
-		}
+	size_t mask = 2*index->capacity - 1;
+	uint32_t hash = hash_label(label);
+
+	for (size_t slot = hash & mask; index->slots[slot].label != -1; slot = (slot+1) & mask) {
+		label_slot* s = &index->slots[slot];
+		if (s->hash == hash && !strcmp(index->labels[s->label], label)) return index->positions[s->label];
 	}
 	
 	return -1;
@@ -103,29 +137,36 @@ void index_dedup(label_index* index) {
 			pos = index->positions[j];
 			if (i == j) continue;
 			index->positions[i] = index->positions[j];
-			if (index->labels[i]) free(index->labels[i]);
+			if (index->labels[i] && !index->strings) free(index->labels[i]);
 			index->labels[i] = index->labels[j];
 			index->labels[j] = NULL;
 		}
 	}
 
 	index->len = i+1;
+	rebuild_slots(index);
 
 	return;
 }
 
+// Finds the last label at or before line. Labels are in order of position, so this is a binary search
 int get_section_label(label_index* index, int line) {
 
-	int candidate = -1;
+	int low = 0, high = index->len; // The answer is the last label before high
 
-	for(int i=0; i<index->len; i++) {
-		if (index->positions[i] <= line && index->positions[i] > candidate) candidate = i;
+	while (low < high) {
+		int mid = low + (high-low)/2;
+		if (index->positions[mid] <= line) low = mid+1;
+		else high = mid;
 	}
+
+	// Before index_dedup there can be several labels at a position, the first one names the section
+	while (low > 1 && index->positions[low-2] == index->positions[low-1]) low--;
 	
-	return candidate;
+	return low-1;
 }
 
-label_index* new_label_index() {
+label_index* new_label_index(arena* strings) {
 	label_index* index = malloc(sizeof(label_index)); 
 	
 	if (!index) {
@@ -134,6 +175,7 @@ label_index* new_label_index() {
 
 	index->len = 0;
 	index->capacity = 4;
+	index->strings = strings;
 	index->labels = malloc(4*sizeof(char*));
 
 	if (!index->labels) {
@@ -149,18 +191,29 @@ label_index* new_label_index() {
 		return NULL;
 	}
 
+	index->slots = malloc(8*sizeof(label_slot));
+
+	if (!index->slots) {
+		free(index->positions);
+		free(index->labels);
+		free(index);
+		return NULL;
+	}
+
+	rebuild_slots(index);
 	return index;
 }
 
 void free_label_index(label_index* index) {
 
 	size_t len = index->len;
-	for (int i=0; i<len; i++) {
+	for (int i=0; i<len && !index->strings; i++) {
 		free(index->labels[i]);
 	}
 
 	free(index->labels);
 	free(index->positions);
+	free(index->slots);
 	free(index);
 }
 
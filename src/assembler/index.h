@@ -1,12 +1,24 @@
 #ifndef INDEX_H
 #define INDEX_H
 #include <stdlib.h>
+#include <stdint.h>
+#include "arena.h"
 
+// Slot of the hash table from label names to their index in labels
+typedef struct label_slot {
+	uint32_t hash;
+	int label;		// -1 if the slot is empty
+} label_slot;
+
+// A key-value (string to int) store that internally handles memory management
+// Used for keeping track of which location every label points to. Labels are kept in order of position
 typedef struct label_index {
 	size_t len;
 	size_t capacity;
 	char** labels;
 	int* positions;
+	label_slot* slots;	// Twice as many as capacity, so the table is never more than half full
+	arena* strings;		// Where label names are copied to, NULL to malloc each one
 } label_index;
 
 
@@ -22,7 +34,8 @@ void index_dedup(label_index* index);
 
 int get_section_label(label_index* index, int line);
 
-label_index* new_label_index();
+// Label names are copied into strings if it is not NULL, and then belong to it
+label_index* new_label_index(arena* strings);
 
 void free_label_index(label_index* index);
 
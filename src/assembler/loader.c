@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "loader.h"
+#include "translator.h"
+#include "../frontend/error.h"
+#include "../backend/backend.h"
+#include "../backend/rvc.h"
+
+#define LINE_LEN 48 // Longest line of disassembly (plus newline)
+
+typedef struct symbol {
+	uint64_t addr;
+	const char* name;
+} symbol;
+
+static int compare_symbols(const void* a, const void* b) {
+	uint64_t addr_a = ((symbol*) a)->addr, addr_b = ((symbol*) b)->addr;
+	return (addr_a > addr_b) - (addr_a < addr_b);
+}
+
+bool is_elf_file(const char* path) {
+	unsigned char magic[SELFMAG];
+	FILE* fp = fopen(path, "rb");
+	if (!fp) return false;
+
+	bool result = fread(magic, 1, SELFMAG, fp) == SELFMAG && !memcmp(magic, ELFMAG, SELFMAG);
+	fclose(fp);
+	return result;
+}
+
+// Checks that the file is an executable that this simulator can run
+static bool validate_header(Elf64_Ehdr* header, size_t size) {
+	if (size < sizeof(Elf64_Ehdr) || memcmp(header->e_ident, ELFMAG, SELFMAG)) {
+		show_error("Not an ELF file!");
+		return false;
+	}
+
+	if (header->e_ident[EI_CLASS] != ELFCLASS64 || header->e_ident[EI_DATA] != ELFDATA2LSB || header->e_machine != EM_RISCV) {
+		show_error("ELF file is not a little endian RV64 executable!");
+		return false;
+	}
+
+	if (header->e_type != ET_EXEC) {
+		show_error("ELF file is not an executable, only statically linked executables are supported!");
+		return false;
+	}
+
+	if (header->e_phentsize != sizeof(Elf64_Phdr) || header->e_phoff + header->e_phnum*sizeof(Elf64_Phdr) > size) {
+		show_error("ELF file has a malformed program header table!");
+		return false;
+	}
+
+	return true;
+}
+
+// Copies the PT_LOAD segments into memory and finds the bounds of the executable ones
+static bool load_segments(uint8_t* file, size_t size, uint8_t* memory, program_layout* layout) {
+	Elf64_Ehdr* header = (Elf64_Ehdr*) file;
+	Elf64_Phdr* segments = (Elf64_Phdr*) (file + header->e_phoff);
+
+	layout->text_start = UINT64_MAX;
+	layout->text_end = 0;
+	layout->heap_start = 0;
+
+	for (int i=0; i<header->e_phnum; i++) {
+		Elf64_Phdr* segment = &segments[i];
+
+		if (segment->p_type == PT_INTERP || segment->p_type == PT_DYNAMIC) {
+			show_error("ELF file is dynamically linked, only statically linked executables are supported!");
+			return false;
+		}
+
+		if (segment->p_type != PT_LOAD || !segment->p_memsz) continue;
+
+		if (segment->p_vaddr > MEMORY_SIZE || segment->p_memsz > MEMORY_SIZE || segment->p_vaddr + segment->p_memsz > MEMORY_SIZE || segment->p_filesz > segment->p_memsz) {
+			show_error("ELF segment at 0x%08lX-0x%08lX does not fit in memory (0x%08X bytes)!", segment->p_vaddr, segment->p_vaddr + segment->p_memsz, MEMORY_SIZE);
+			return false;
+		}
+
+		if (segment->p_offset + segment->p_filesz > size) {
+			show_error("ELF segment at 0x%08lX extends past the end of the file!", segment->p_vaddr);
+			return false;
+		}
+
+		// Only the part that is in the file needs copying, the rest (.bss) is already zero
+		memcpy(memory + segment->p_vaddr, file + segment->p_offset, segment->p_filesz);
+
+		if (segment->p_vaddr + segment->p_memsz > layout->heap_start) layout->heap_start = segment->p_vaddr + segment->p_memsz;
+
+		if (segment->p_flags & PF_X) {
+			if (segment->p_vaddr < layout->text_start) layout->text_start = segment->p_vaddr;
+			if (segment->p_vaddr + segment->p_memsz > layout->text_end) layout->text_end = segment->p_vaddr + segment->p_memsz;
+		}
+	}
+
+	if (layout->text_end == 0) {
+		show_error("ELF file has no executable segment!");
+		return false;
+	}
+
+	if (header->e_entry < layout->text_start || header->e_entry >= layout->text_end) {
+		show_error("ELF entry point 0x%08lX is not in an executable segment!", header->e_entry);
+		return false;
+	}
+
+	layout->entry = header->e_entry;
+	layout->heap_start = (layout->heap_start + 15) & ~15; // The heap starts after the last segment
+	layout->stack_pointer = (MEMORY_SIZE - 1) & ~0xF; // Static executables expect the environment to set up the stack
+	return true;
+}
+
+// Walks the text segment an instruction at a time, recording the address, hexcode and disassembly of each
+static int* sweep_text(uint8_t* memory, program_layout* layout, vec* addresses, char** cleaned, arena* program) {
+	uint64_t addr = layout->text_start;
+
+	while (addr + 2 <= layout->text_end) {
+		int length = IS_COMPRESSED(*(uint16_t*) (memory + addr))?2:4;
+		if (addr + length > layout->text_end) break;
+
+		append(addresses, addr);
+		addr += length;
+	}
+	append(addresses, addr);
+
+	size_t n = addresses->len-1;
+	int* hexcode = arena_alloc(program, sizeof(int)*(n+1));
+	*cleaned = arena_alloc(program, n*LINE_LEN+1);
+
+	if (!hexcode || !*cleaned) {
+		show_error("Out Of Memory!");
+		*cleaned = NULL;
+		return NULL;
+	}
+
+	hexcode[0] = n;
+	char* line = *cleaned;
+
+	for (int i=0; i<n; i++) {
+		uint16_t parcel = *(uint16_t*) (memory + addresses->values[i]);
+		uint32_t instruction;
+
+		if (IS_COMPRESSED(parcel)) {
+			hexcode[i+1] = parcel;
+			instruction = expand_compressed(parcel);
+
+			if (instruction) disassemble(instruction, line, LINE_LEN-1);
+			else snprintf(line, LINE_LEN-1, ".half 0x%04X", parcel);
+
+		} else {
+			memcpy(&instruction, memory + addresses->values[i], 4);
+			hexcode[i+1] = instruction;
+			disassemble(instruction, line, LINE_LEN-1);
+		}
+
+		line += strlen(line);
+		*(line++) = '\n';
+	}
+	*line = '\0';
+
+	return hexcode;
+}
+
+// Adds every named symbol that points at an instruction to the label index, in order of address
+static void load_symbols(uint8_t* file, size_t size, vec* addresses, label_index* index) {
+	Elf64_Ehdr* header = (Elf64_Ehdr*) file;
+	if (header->e_shentsize != sizeof(Elf64_Shdr) || header->e_shoff + header->e_shnum*sizeof(Elf64_Shdr) > size) return;
+
+	Elf64_Shdr* sections = (Elf64_Shdr*) (file + header->e_shoff);
+
+	for (int i=0; i<header->e_shnum; i++) {
+		if (sections[i].sh_type != SHT_SYMTAB || sections[i].sh_link >= header->e_shnum) continue;
+
+		Elf64_Shdr* strtab = &sections[sections[i].sh_link];
+		if (sections[i].sh_offset + sections[i].sh_size > size || strtab->sh_offset + strtab->sh_size > size) return;
+
+		Elf64_Sym* symbols = (Elf64_Sym*) (file + sections[i].sh_offset);
+		size_t n_symbols = sections[i].sh_size / sizeof(Elf64_Sym);
+		symbol* found = malloc(sizeof(symbol)*n_symbols);
+		size_t n_found = 0;
+		if (!found) return;
+
+		for (int j=0; j<n_symbols; j++) {
+			Elf64_Sym* sym = &symbols[j];
+			int type = ELF64_ST_TYPE(sym->st_info);
+
+			if (sym->st_shndx == SHN_UNDEF || !sym->st_name || sym->st_name >= strtab->sh_size) continue;
+			if (type != STT_FUNC && type != STT_NOTYPE) continue;
+
+			const char* name = (char*) file + strtab->sh_offset + sym->st_name;
+			if (name[0] == '$' || name[0] == '.') continue; // Mapping symbols and local labels of the compiler
+
+			found[n_found].addr = sym->st_value;
+			found[n_found].name = name;
+			n_found++;
+		}
+
+		qsort(found, n_found, sizeof(symbol), compare_symbols);
+
+		// Both lists are sorted, so they can be merged in one pass
+		int line = 0;
+		for (int j=0; j<n_found; j++) {
+			while (line < addresses->len-1 && addresses->values[line] < found[j].addr) line++;
+			if (line == addresses->len-1) break;
+			if (addresses->values[line] == found[j].addr) add_label(index, (char*) found[j].name, line);
+		}
+
+		free(found);
+		return;
+	}
+}
+
+int* elf_main(const char* path, char** cleaned, label_index* index, uint8_t* memory, vec* addresses, program_layout* layout, arena* program) {
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		show_error("Failed to read %s!", path);
+		return NULL;
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) == -1 || info.st_size == 0) {
+		show_error("Failed to read %s!", path);
+		close(fd);
+		return NULL;
+	}
+
+	// The file is mapped rather than read, only the loaded segments and symbol table are ever touched
+	uint8_t* file = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (file == MAP_FAILED) {
+		show_error("Failed to map %s!", path);
+		return NULL;
+	}
+
+	int* hexcode = NULL;
+
+	if (validate_header((Elf64_Ehdr*) file, info.st_size) && load_segments(file, info.st_size, memory, layout)) {
+		hexcode = sweep_text(memory, layout, addresses, cleaned, program);
+		if (hexcode) load_symbols(file, info.st_size, addresses, index);
+	}
+
+	munmap(file, info.st_size);
+	return hexcode;
+}
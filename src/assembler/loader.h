@@ -0,0 +1,18 @@
+#ifndef LOADER_H
+#define LOADER_H
+#include <stdint.h>
+#include <stdbool.h>
+#include "index.h"
+#include "vec.h"
+#include "arena.h"
+#include "../backend/backend.h"
+
+// Returns true if the file starts with the ELF magic number
+bool is_elf_file(const char* path);
+
+// Loads a statically linked RV64 ELF executable into memory (which must be zeroed).
+// Produces the same outputs as assembler_main, with a disassembly of the text segment in place of the cleaned code.
+// The hexcode and disassembly are allocated from program. Returns NULL on failure
+int* elf_main(const char* path, char** cleaned, label_index* index, uint8_t* memory, vec* addresses, program_layout* layout, arena* program);
+
+#endif
@@ -0,0 +1,271 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "objcache.h"
+
+#define FNV_OFFSET 0xcbf29ce484222325
+#define FNV_PRIME 0x100000001b3
+
+static char cache_dir[256] = "";	// Empty while the cache is disabled
+static pthread_mutex_t cache_dir_lock = PTHREAD_MUTEX_INITIALIZER; // Simulators on other threads may be loading programs
+
+void set_object_cache_dir(const char* dir) {
+	pthread_mutex_lock(&cache_dir_lock);
+	snprintf(cache_dir, sizeof(cache_dir), "%s", dir?dir:"");
+	pthread_mutex_unlock(&cache_dir_lock);
+}
+
+uint64_t hash_source(const char* data, size_t size) {
+	uint64_t hash = FNV_OFFSET;
+
+	for (size_t i=0; i<size; i++) {
+		hash ^= (uint8_t) data[i];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+void set_default_object_cache_dir() {
+	char dir[256] = "";
+	const char* xdg = getenv("XDG_CACHE_HOME");
+	const char* home = getenv("HOME");
+
+	if (xdg && xdg[0]) snprintf(dir, sizeof(dir), "%s/riscv_sim", xdg);
+	else if (home && home[0]) snprintf(dir, sizeof(dir), "%s/.cache/riscv_sim", home);
+	set_object_cache_dir(dir);
+}
+
+// Copies the cache directory to dir, which holds 256 bytes. Returns false if the cache is disabled
+static bool find_cache_dir(char* dir) {
+	pthread_mutex_lock(&cache_dir_lock);
+	strcpy(dir, cache_dir);
+	pthread_mutex_unlock(&cache_dir_lock);
+	return dir[0];
+}
+
+static void object_path(char* path, size_t n, const char* dir, uint64_t key) {
+	snprintf(path, n, "%s/%016lx.rvo", dir, key);
+}
+
+// Creates the cache directory and any missing parents
+static bool make_cache_dir(const char* dir) {
+	char path[256];
+	strcpy(path, dir);
+
+	for (char* p = path+1; ; p++) {
+		if (*p != '/' && *p != '\0') continue;
+
+		char c = *p;
+		*p = '\0';
+		if (mkdir(path, 0755) == -1 && errno != EEXIST) return false;
+		if (!c) return true;
+		*p = c;
+	}
+}
+
+static size_t object_size(object_header* header) {
+	return sizeof(object_header) + header->n_addresses*sizeof(uint64_t) + (header->n_hexcode + header->n_labels)*sizeof(int)
+		+ header->labels_size + header->cleaned_size + header->image_size;
+}
+
+// Checks that an object belongs to the source and that its sections fit in the file and in the buffers they are copied to
+static bool valid_object(object_header* header, size_t size, uint64_t key, size_t source_len) {
+	if (size < sizeof(object_header)) return false;
+	if (memcmp(header->magic, OBJECT_MAGIC, 4) || header->version != OBJECT_VERSION || header->memory_size != MEMORY_SIZE) return false;
+	if (header->key != key || header->source_len != source_len) return false;
+
+	// Bound every count before adding them up, so a corrupt header cannot overflow the size
+	if (header->n_addresses > size || header->n_hexcode > size || header->n_labels > size || header->labels_size > size || header->cleaned_size > size) return false;
+	if (header->image_start > MEMORY_SIZE || header->image_size > MEMORY_SIZE - header->image_start) return false;
+	if (header->cleaned_size > source_len+1 || header->n_hexcode == 0 || header->n_addresses != header->n_hexcode) return false;
+
+	// The backend sizes its line mapping and decode cache by the text segment
+	program_layout* layout = &header->layout;
+	if (layout->text_start > layout->text_end || layout->text_end > MEMORY_SIZE || layout->heap_start > MEMORY_SIZE) return false;
+
+	return object_size(header) == size;
+}
+
+// Checks the sections that are used as indices: the addresses into the line mapping of the text segment, and the
+// label positions and hexcode count into the lines of code, which the TUI splits the cleaned code into
+static bool valid_lines(object_header* header, uint64_t* addresses, int* hexcode, int* positions, char* cleaned) {
+	uint64_t n_lines = header->n_hexcode-1;
+	if (hexcode[0] < 0 || hexcode[0] != n_lines) return false;
+
+	// Instructions follow each other in the text segment, the last entry being the end of the code
+	for (uint64_t i=0; i<header->n_addresses; i++) {
+		if (addresses[i] < header->layout.text_start || addresses[i] > header->layout.text_end) return false;
+		if (i && addresses[i] <= addresses[i-1]) return false;
+	}
+
+	for (uint64_t i=0; i<header->n_labels; i++) {
+		if (positions[i] < 0 || positions[i] > n_lines) return false;
+	}
+
+	uint64_t n_newlines = 0;
+	for (uint64_t i=0; i<header->cleaned_size; i++) n_newlines += cleaned[i] == '\n';
+	return n_newlines+1 >= n_lines;
+}
+
+int* load_object(uint64_t key, size_t source_len, char* cleaned, label_index* index, uint8_t* memory, vec* addresses, program_layout* layout, arena* program) {
+	char dir[256], path[300];
+	if (!find_cache_dir(dir)) return NULL;
+	object_path(path, sizeof(path), dir, key);
+
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) return NULL;
+
+	struct stat info;
+	if (fstat(fd, &info) == -1 || info.st_size < sizeof(object_header)) {
+		close(fd);
+		return NULL;
+	}
+
+	uint8_t* object = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (object == MAP_FAILED) return NULL;
+
+	object_header* header = (object_header*) object;
+	int* hexcode = NULL;
+
+	if (!valid_object(header, info.st_size, key, source_len)) goto cleanup;
+
+	uint64_t* object_addresses = (uint64_t*) (object + sizeof(object_header));
+	int* object_hexcode = (int*) (object_addresses + header->n_addresses);
+	int* positions = object_hexcode + header->n_hexcode;
+	char* names = (char*) (positions + header->n_labels);
+	char* object_cleaned = names + header->labels_size;
+	uint8_t* image = (uint8_t*) object_cleaned + header->cleaned_size;
+
+	// The names must hold exactly n_labels strings, or the labels would be read past them
+	uint64_t n_names = 0;
+	for (uint64_t i=0; i<header->labels_size; i++) n_names += !names[i];
+	if (n_names != header->n_labels || (header->labels_size && names[header->labels_size-1])) goto cleanup;
+	if (!header->cleaned_size || object_cleaned[header->cleaned_size-1]) goto cleanup;
+	if (!valid_lines(header, object_addresses, object_hexcode, positions, object_cleaned)) goto cleanup;
+
+	hexcode = arena_alloc(program, header->n_hexcode*sizeof(int));
+	if (!hexcode) goto cleanup;
+	memcpy(hexcode, object_hexcode, header->n_hexcode*sizeof(int));
+
+	for (uint64_t i=0; i<header->n_addresses; i++) append(addresses, object_addresses[i]);
+
+	for (uint64_t i=0; i<header->n_labels; i++) {
+		add_label(index, names, positions[i]);
+		names += strlen(names)+1;
+	}
+
+	memcpy(cleaned, object_cleaned, header->cleaned_size);
+	memcpy(memory + header->image_start, image, header->image_size);
+	*layout = header->layout;
+
+	cleanup:
+	munmap(object, info.st_size);
+	return hexcode;
+}
+
+typedef struct cached_object {
+	char name[32];
+	uint64_t size;
+	struct timespec stored;
+} cached_object;
+
+static int compare_age(const void* a, const void* b) {
+	struct timespec x = ((cached_object*) a)->stored, y = ((cached_object*) b)->stored;
+	if (x.tv_sec != y.tv_sec) return (x.tv_sec > y.tv_sec) - (x.tv_sec < y.tv_sec);
+	return (x.tv_nsec > y.tv_nsec) - (x.tv_nsec < y.tv_nsec);
+}
+
+// Removes the objects stored longest ago, until the ones left take at most OBJECT_CACHE_LIMIT bytes
+static void trim_cache(const char* dir) {
+	DIR* d = opendir(dir);
+	if (!d) return;
+
+	cached_object* objects = NULL;
+	size_t n = 0, capacity = 0;
+	uint64_t total = 0;
+	struct dirent* entry;
+	struct stat info;
+	char path[300];
+
+	while ((entry = readdir(d))) {
+		size_t len = strlen(entry->d_name);
+		if (len != 20 || strcmp(entry->d_name+16, ".rvo")) continue; // Objects only, not ones still being written
+
+		snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+		if (stat(path, &info) == -1) continue;
+
+		if (n == capacity) {
+			capacity = capacity?capacity*2:64;
+			cached_object* new_objects = realloc(objects, sizeof(cached_object)*capacity);
+			if (!new_objects) break;
+			objects = new_objects;
+		}
+
+		strcpy(objects[n].name, entry->d_name);
+		objects[n].size = info.st_size;
+		objects[n].stored = info.st_mtim;
+		total += info.st_size;
+		n++;
+	}
+	closedir(d);
+
+	if (total > OBJECT_CACHE_LIMIT) qsort(objects, n, sizeof(cached_object), compare_age);
+
+	for (size_t i=0; i<n && total > OBJECT_CACHE_LIMIT; i++) {
+		snprintf(path, sizeof(path), "%s/%s", dir, objects[i].name);
+		if (unlink(path) == 0) total -= objects[i].size;
+	}
+	free(objects);
+}
+
+void store_object(uint64_t key, size_t source_len, int* hexcode, char* cleaned, label_index* index, uint8_t* memory, vec* addresses, program_layout* layout) {
+	char dir[256], path[300], temp_path[320];
+	if (!find_cache_dir(dir) || !make_cache_dir(dir)) return;
+
+	object_header header = {0};
+	memcpy(header.magic, OBJECT_MAGIC, 4);
+	header.version = OBJECT_VERSION;
+	header.key = key;
+	header.source_len = source_len;
+	header.memory_size = MEMORY_SIZE;
+	header.layout = *layout;
+	header.n_addresses = addresses->len;
+	header.n_hexcode = hexcode[0]+1;
+	header.n_labels = index->len;
+	header.cleaned_size = strlen(cleaned)+1;
+
+	for (size_t i=0; i<index->len; i++) header.labels_size += strlen(index->labels[i])+1;
+
+	uint64_t first = 0, last = MEMORY_SIZE;
+	while (first < MEMORY_SIZE && !memory[first]) first++;
+	while (last > first && !memory[last-1]) last--;
+	header.image_start = first;
+	header.image_size = last-first;
+
+	// Written under a temporary name of its own thread and renamed into place, so a concurrent load never sees half an object
+	object_path(path, sizeof(path), dir, key);
+	snprintf(temp_path, sizeof(temp_path), "%s.%d.%lx", path, getpid(), (unsigned long) pthread_self());
+
+	FILE* fp = fopen(temp_path, "wb");
+	if (!fp) return;
+
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+	ok = ok && fwrite(addresses->values, sizeof(uint64_t), addresses->len, fp) == addresses->len;
+	ok = ok && fwrite(hexcode, sizeof(int), header.n_hexcode, fp) == header.n_hexcode;
+	ok = ok && fwrite(index->positions, sizeof(int), index->len, fp) == index->len;
+	for (size_t i=0; ok && i<index->len; i++) ok = fwrite(index->labels[i], 1, strlen(index->labels[i])+1, fp) == strlen(index->labels[i])+1;
+	ok = ok && fwrite(cleaned, 1, header.cleaned_size, fp) == header.cleaned_size;
+	ok = ok && fwrite(memory + first, 1, header.image_size, fp) == header.image_size;
+
+	if (fclose(fp) != 0) ok = false;
+	if (!ok || rename(temp_path, path) == -1) unlink(temp_path);
+	else trim_cache(dir);
+}
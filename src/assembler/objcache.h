@@ -0,0 +1,48 @@
+#ifndef OBJCACHE_H
+#define OBJCACHE_H
+#include <stdint.h>
+#include <stdbool.h>
+#include "vec.h"
+#include "index.h"
+#include "arena.h"
+#include "../backend/backend.h"
+
+#define OBJECT_MAGIC "RVSO"
+#define OBJECT_VERSION 1 // Bump whenever the format or the assembler's output changes, so old objects are ignored
+#define OBJECT_CACHE_LIMIT (64 << 20) // Bytes of objects kept, the oldest are removed once a store goes past it
+
+// Header of an assembled program stored on disk. It is followed by the instruction addresses (uint64_t),
+// the hexcode and label positions (int), then the label names (each ending in '\0'), the cleaned code and the memory image
+typedef struct object_header {
+	char magic[4];
+	uint32_t version;
+	uint64_t key;			// Hash of the source
+	uint64_t source_len;	// Checked along with the key, so a collision also needs sources of the same length
+	uint64_t memory_size;
+	program_layout layout;
+	uint64_t n_addresses;
+	uint64_t n_hexcode;		// Including the count in hexcode[0]
+	uint64_t n_labels;
+	uint64_t labels_size;	// Bytes taken by the label names
+	uint64_t cleaned_size;	// Including the '\0'
+	uint64_t image_start;	// Only the part of memory between the first and last non zero byte is stored
+	uint64_t image_size;
+} object_header;
+
+// Directory objects are kept in, NULL disables the cache. The cache starts out disabled, so programs using the simulator
+// as a library only write to disk if they ask for it
+void set_object_cache_dir(const char* dir);
+
+// Keeps objects in $XDG_CACHE_HOME/riscv_sim (or ~/.cache/riscv_sim), as the TUI does unless told otherwise
+void set_default_object_cache_dir();
+
+uint64_t hash_source(const char* data, size_t size);
+
+// Looks for the object of a source, filling in everything assembler_main would have. Returns the hexcode
+// (allocated from program) on a hit, NULL on a miss. cleaned must be at least source_len+1 bytes and memory must be zeroed
+int* load_object(uint64_t key, size_t source_len, char* cleaned, label_index* index, uint8_t* memory, vec* addresses, program_layout* layout, arena* program);
+
+// Stores an assembled program, failures are silent since the cache is only an optimization
+void store_object(uint64_t key, size_t source_len, int* hexcode, char* cleaned, label_index* index, uint8_t* memory, vec* addresses, program_layout* layout);
+
+#endif
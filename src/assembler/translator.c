@@ -2,8 +2,12 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdlib.h>
+#include <pthread.h>
 #include "translator.h"
-#include "../frontend/frontend.h"
+#include "../frontend/error.h"
+
+#define MAX_ARGS 3  // Most arguments any instruction takes
+#define ARG_LEN 128 // Longest argument accepted (plus null terminator)
 
 typedef struct alias {
     const char* name;
@@ -22,6 +26,26 @@ static const instruction_info instructions[] = {
     "slt",      0b0110011+(0x2<<12),            R_TYPE,
     "sltu",     0b0110011+(0x3<<12),            R_TYPE,
 
+    "mul",      0b0110011+(0x0<<12)+(0x01<<25), R_TYPE,
+    "mulh",     0b0110011+(0x1<<12)+(0x01<<25), R_TYPE,
+    "mulhsu",   0b0110011+(0x2<<12)+(0x01<<25), R_TYPE,
+    "mulhu",    0b0110011+(0x3<<12)+(0x01<<25), R_TYPE,
+    "div",      0b0110011+(0x4<<12)+(0x01<<25), R_TYPE,
+    "divu",     0b0110011+(0x5<<12)+(0x01<<25), R_TYPE,
+    "rem",      0b0110011+(0x6<<12)+(0x01<<25), R_TYPE,
+    "remu",     0b0110011+(0x7<<12)+(0x01<<25), R_TYPE,
+    "mulw",     0b0111011+(0x0<<12)+(0x01<<25), R_TYPE,
+    "divw",     0b0111011+(0x4<<12)+(0x01<<25), R_TYPE,
+    "divuw",    0b0111011+(0x5<<12)+(0x01<<25), R_TYPE,
+    "remw",     0b0111011+(0x6<<12)+(0x01<<25), R_TYPE,
+    "remuw",    0b0111011+(0x7<<12)+(0x01<<25), R_TYPE,
+
+    "addw",     0b0111011,                      R_TYPE,
+    "subw",     0b0111011+(0x20<<25),           R_TYPE,
+    "sllw",     0b0111011+(0x1<<12),            R_TYPE,
+    "srlw",     0b0111011+(0x5<<12),            R_TYPE,
+    "sraw",     0b0111011+(0x5<<12)+(0x20<<25), R_TYPE,
+
     "addi",     0b0010011+(0x0<<12),            I1_TYPE,
     "xori",     0b0010011+(0x4<<12),            I1_TYPE,
     "ori",      0b0010011+(0x6<<12),            I1_TYPE,
@@ -32,6 +56,11 @@ static const instruction_info instructions[] = {
     "slti",     0b0010011+(0x2<<12),            I1_TYPE,
     "sltiu",    0b0010011+(0x3<<12),            I1_TYPE,
 
+    "addiw",    0b0011011+(0x0<<12),            I1_TYPE,
+    "slliw",    0b0011011+(0x1<<12),            I1BW_TYPE,
+    "srliw",    0b0011011+(0x5<<12),            I1BW_TYPE,
+    "sraiw",    0b0011011+(0x5<<12)+(0x20<<25), I1BW_TYPE,
+
     "lb",       0b0000011+(0x0<<12),            I2_TYPE,
     "lh",       0b0000011+(0x1<<12),            I2_TYPE,
     "lw",       0b0000011+(0x2<<12),            I2_TYPE,
@@ -58,6 +87,71 @@ static const instruction_info instructions[] = {
     "auipc",    0b0010111,                      U_TYPE,   
     "ecall",    0b1110011,                      I4_TYPE,   
     "ebreak",   0b1110011+(0X1<<20),            I4_TYPE,       
+
+    // Zicsr. csrr comes first so that it is preferred when disassembling
+    "csrr",     0b1110011+(0x2<<12),            CSRR_TYPE,
+    "csrrw",    0b1110011+(0x1<<12),            CSR_TYPE,
+    "csrrs",    0b1110011+(0x2<<12),            CSR_TYPE,
+    "csrrc",    0b1110011+(0x3<<12),            CSR_TYPE,
+
+    // A extension. The aq and rl ordering bits are set by suffixes on the name, see parse_ordering
+    "lr.w",     0b0101111+(0x2<<12)+(0x02<<27), LR_TYPE,
+    "sc.w",     0b0101111+(0x2<<12)+(0x03<<27), AMO_TYPE,
+    "amoswap.w", 0b0101111+(0x2<<12)+(0x01<<27), AMO_TYPE,
+    "amoadd.w", 0b0101111+(0x2<<12)+(0x00<<27), AMO_TYPE,
+    "amoxor.w", 0b0101111+(0x2<<12)+(0x04<<27), AMO_TYPE,
+    "amoand.w", 0b0101111+(0x2<<12)+(0x0C<<27), AMO_TYPE,
+    "amoor.w",  0b0101111+(0x2<<12)+(0x08<<27), AMO_TYPE,
+    "amomin.w", 0b0101111+(0x2<<12)+(0x10<<27), AMO_TYPE,
+    "amomax.w", 0b0101111+(0x2<<12)+(0x14<<27), AMO_TYPE,
+    "amominu.w", 0b0101111+(0x2<<12)+(0x18<<27), AMO_TYPE,
+    "amomaxu.w", 0b0101111+(0x2<<12)+(0x1C<<27), AMO_TYPE,
+    "lr.d",     0b0101111+(0x3<<12)+(0x02<<27), LR_TYPE,
+    "sc.d",     0b0101111+(0x3<<12)+(0x03<<27), AMO_TYPE,
+    "amoswap.d", 0b0101111+(0x3<<12)+(0x01<<27), AMO_TYPE,
+    "amoadd.d", 0b0101111+(0x3<<12)+(0x00<<27), AMO_TYPE,
+    "amoxor.d", 0b0101111+(0x3<<12)+(0x04<<27), AMO_TYPE,
+    "amoand.d", 0b0101111+(0x3<<12)+(0x0C<<27), AMO_TYPE,
+    "amoor.d",  0b0101111+(0x3<<12)+(0x08<<27), AMO_TYPE,
+    "amomin.d", 0b0101111+(0x3<<12)+(0x10<<27), AMO_TYPE,
+    "amomax.d", 0b0101111+(0x3<<12)+(0x14<<27), AMO_TYPE,
+    "amominu.d", 0b0101111+(0x3<<12)+(0x18<<27), AMO_TYPE,
+    "amomaxu.d", 0b0101111+(0x3<<12)+(0x1C<<27), AMO_TYPE,
+
+    // Compressed instructions (RV64C). These are 16 bits long, and are only emitted when used explicitly
+    "c.addi4spn", 0x0000,                       CIW_TYPE,
+    "c.lw",     0x4000,                         CLW_TYPE,
+    "c.ld",     0x6000,                         CLD_TYPE,
+    "c.sw",     0xC000,                         CLW_TYPE,
+    "c.sd",     0xE000,                         CLD_TYPE,
+    "c.nop",    0x0001,                         I4_TYPE,
+    "c.addi",   0x0001,                         CI_TYPE,
+    "c.addiw",  0x2001,                         CI_TYPE,
+    "c.li",     0x4001,                         CI_TYPE,
+    "c.addi16sp", 0x6101,                       C16SP_TYPE,
+    "c.lui",    0x6001,                         CLUI_TYPE,
+    "c.srli",   0x8001,                         CBS_TYPE,
+    "c.srai",   0x8401,                         CBS_TYPE,
+    "c.andi",   0x8801,                         CBI_TYPE,
+    "c.sub",    0x8C01,                         CA_TYPE,
+    "c.xor",    0x8C21,                         CA_TYPE,
+    "c.or",     0x8C41,                         CA_TYPE,
+    "c.and",    0x8C61,                         CA_TYPE,
+    "c.subw",   0x9C01,                         CA_TYPE,
+    "c.addw",   0x9C21,                         CA_TYPE,
+    "c.j",      0xA001,                         CJ_TYPE,
+    "c.beqz",   0xC001,                         CB_TYPE,
+    "c.bnez",   0xE001,                         CB_TYPE,
+    "c.slli",   0x0002,                         CIS_TYPE,
+    "c.lwsp",   0x4002,                         CLWSP_TYPE,
+    "c.ldsp",   0x6002,                         CLDSP_TYPE,
+    "c.jr",     0x8002,                         CR1_TYPE,
+    "c.mv",     0x8002,                         CR_TYPE,
+    "c.ebreak", 0x9002,                         I4_TYPE,
+    "c.jalr",   0x9002,                         CR1_TYPE,
+    "c.add",    0x9002,                         CR_TYPE,
+    "c.swsp",   0xC002,                         CSWSP_TYPE,
+    "c.sdsp",   0xE002,                         CSDSP_TYPE,
 }; 
 
 static const alias registers[] = {
@@ -128,48 +222,221 @@ static const alias registers[] = {
     "t6", 31,
 };
 
+static const alias csrs[] = {
+    "mhartid", 0xF14,
+};
+
 // Names for error reporting purposes
 const char* argument_type_names[] = {
     "Immediate Value",
     "Offset/Flag",
-    "Register"
+    "Register",
+    "CSR"
 }; 
 
+// Mnemonics and register names are looked up through open addressing hash tables of indices into the tables above,
+// built the first time anything is looked up. Sizes are powers of 2 at least twice the number of entries
+#define INSTRUCTION_SLOTS 256
+#define REGISTER_SLOTS 256
+#define EMPTY_SLOT -1
+_Static_assert(sizeof(instructions)/sizeof(instruction_info)*2 <= INSTRUCTION_SLOTS, "Instruction hash table is too full");
+_Static_assert(sizeof(registers)/sizeof(alias)*2 <= REGISTER_SLOTS, "Register hash table is too full");
+
+static int16_t instruction_slots[INSTRUCTION_SLOTS];
+static int16_t register_slots[REGISTER_SLOTS];
+static pthread_once_t tables_built = PTHREAD_ONCE_INIT;
+
+// FNV-1a
+static uint32_t hash_name(const char* name) {
+    uint32_t hash = 2166136261u;
+    while (*name) hash = (hash ^ (uint8_t) *(name++)) * 16777619u;
+    return hash;
+}
+
+// Adds entry i under name, unless the name is already taken (the first entry with a name wins, like the linear search did)
+static void insert_slot(int16_t* slots, int n_slots, const char* name, int i, const char* (*name_of)(int)) {
+    for (uint32_t slot = hash_name(name) & (n_slots-1); ; slot = (slot+1) & (n_slots-1)) {
+        if (slots[slot] == EMPTY_SLOT) {
+            slots[slot] = i;
+            return;
+        }
+        if (!strcmp(name_of(slots[slot]), name)) return;
+    }
+}
+
+static int find_slot(int16_t* slots, int n_slots, const char* name, const char* (*name_of)(int)) {
+    for (uint32_t slot = hash_name(name) & (n_slots-1); slots[slot] != EMPTY_SLOT; slot = (slot+1) & (n_slots-1)) {
+        if (!strcmp(name_of(slots[slot]), name)) return slots[slot];
+    }
+
+    return -1;
+}
+
+static const char* instruction_name(int i) {return instructions[i].name;}
+static const char* register_name(int i) {return registers[i].name;}
+
+static void build_tables() {
+    memset(instruction_slots, 0xFF, sizeof(instruction_slots));
+    memset(register_slots, 0xFF, sizeof(register_slots));
+
+    for (int i = 0; i<sizeof(instructions)/sizeof(instruction_info); i++) insert_slot(instruction_slots, INSTRUCTION_SLOTS, instructions[i].name, i, instruction_name);
+    for (int i = 0; i<sizeof(registers)/sizeof(alias); i++) insert_slot(register_slots, REGISTER_SLOTS, registers[i].name, i, register_name);
+}
+
 // Converts register name into register number 
 int parse_alias(char* name) {
-    for (int i = 0; i<65; i++) {
-        if (strcmp(name, registers[i].name) == 0) {
-            return registers[i].value;
+    pthread_once(&tables_built, build_tables);
+    int i = find_slot(register_slots, REGISTER_SLOTS, name, register_name);
+    return i == -1?-1:registers[i].value;
+}
+
+// Converts a CSR name or number into the CSR number
+static int parse_csr(char* name) {
+    for (int i = 0; i<sizeof(csrs)/sizeof(alias); i++) {
+        if (strcmp(name, csrs[i].name) == 0) {
+            return csrs[i].value;
         }
     }
 
-    return -1;
+    char* endptr;
+    long csr = strtol(name, &endptr, 0);
+    if (endptr == name || *endptr != '\0' || csr < 0 || csr > 0xFFF) return -1;
+    return csr;
+}
+
+// Strips an .aq, .rl or .aqrl suffix from the name of an atomic instruction, returning the ordering bits it stands for
+int parse_ordering(char* name) {
+    size_t len = strlen(name);
+    if (strncmp(name, "lr.", 3) && strncmp(name, "sc.", 3) && strncmp(name, "amo", 3)) return 0;
+
+    if (len > 5 && !strcmp(name+len-5, ".aqrl")) {
+        name[len-5] = '\0';
+        return (1<<26) + (1<<25);
+    } else if (len > 3 && !strcmp(name+len-3, ".aq")) {
+        name[len-3] = '\0';
+        return 1<<26;
+    } else if (len > 3 && !strcmp(name+len-3, ".rl")) {
+        name[len-3] = '\0';
+        return 1<<25;
+    }
+
+    return 0;
 }
 
 // Convert instruction name into instruction_info* by looking it up in the list of instructions
 const instruction_info* parse_instruction(char* name) {
-    for (int i = 0; i<42; i++) {
-        if (strcmp(name, instructions[i].name) == 0) {
-            return &instructions[i];
+    pthread_once(&tables_built, build_tables);
+    int i = find_slot(instruction_slots, INSTRUCTION_SLOTS, name, instruction_name);
+    return i == -1?NULL:&instructions[i];
+}
+
+// Bits of an instruction that identify it, for each of the 32 bit instruction types
+static uint32_t identifying_bits(int type) {
+    switch (type) {
+        case R_TYPE:
+        case I1BW_TYPE:
+            return 0xFE00707F;
+        case I1B_TYPE:
+            return 0xFC00707F;
+        case U_TYPE:
+        case J_TYPE:
+            return 0x0000007F;
+        case I4_TYPE:
+            return 0xFFFFFFFF;
+        case CSRR_TYPE:
+            return 0x000FF07F;
+        case AMO_TYPE:
+            return 0xF800707F;
+        case LR_TYPE:
+            return 0xF9F0707F;
+        default:
+            return 0x0000707F;
+    }
+}
+
+// Converts a 32 bit instruction back into assembly, in the same syntax the assembler accepts.
+// Branch and jump targets are written as offsets since there may not be a label for them
+void disassemble(uint32_t instruction, char* out, size_t size) {
+    int rd = (instruction >> 7) & 0x1F;
+    int rs1 = (instruction >> 15) & 0x1F;
+    int rs2 = (instruction >> 20) & 0x1F;
+    int32_t imm_i = (int32_t) instruction >> 20;
+    int32_t imm_s = ((int32_t) (instruction & 0xFE000000) >> 20) | ((instruction >> 7) & 0x1F);
+    int32_t imm_b = ((int32_t) (instruction & 0x80000000) >> 19) | ((instruction & 0x80) << 4) | ((instruction >> 20) & 0x7E0) | ((instruction >> 7) & 0x1E);
+    int32_t imm_j = ((int32_t) (instruction & 0x80000000) >> 11) | (instruction & 0xFF000) | ((instruction >> 9) & 0x800) | ((instruction >> 20) & 0x7FE);
+
+    for (int i = 0; i<sizeof(instructions)/sizeof(instruction_info); i++) {
+        const instruction_info* info = &instructions[i];
+        if (info->handler_type >= CR_TYPE) break; // Compressed instructions are expanded before they get here
+        if ((instruction & identifying_bits(info->handler_type)) != info->constant) continue;
+
+        switch (info->handler_type) {
+            case R_TYPE:
+                snprintf(out, size, "%s x%d, x%d, x%d", info->name, rd, rs1, rs2);
+                return;
+            case I1_TYPE:
+                snprintf(out, size, "%s x%d, x%d, %d", info->name, rd, rs1, imm_i);
+                return;
+            case I1B_TYPE:
+                snprintf(out, size, "%s x%d, x%d, %d", info->name, rd, rs1, imm_i & 0x3F);
+                return;
+            case I1BW_TYPE:
+                snprintf(out, size, "%s x%d, x%d, %d", info->name, rd, rs1, rs2);
+                return;
+            case I2_TYPE:
+            case I3_TYPE:
+                snprintf(out, size, "%s x%d, %d(x%d)", info->name, rd, imm_i, rs1);
+                return;
+            case S_TYPE:
+                snprintf(out, size, "%s x%d, %d(x%d)", info->name, rs2, imm_s, rs1);
+                return;
+            case B_TYPE:
+                snprintf(out, size, "%s x%d, x%d, %d", info->name, rs1, rs2, imm_b);
+                return;
+            case U_TYPE:
+                snprintf(out, size, "%s x%d, 0x%X", info->name, rd, instruction >> 12);
+                return;
+            case J_TYPE:
+                snprintf(out, size, "%s x%d, %d", info->name, rd, imm_j);
+                return;
+            case I4_TYPE:
+                snprintf(out, size, "%s", info->name);
+                return;
+            case CSRR_TYPE:
+            case CSR_TYPE:
+                const char* csr_name = NULL;
+                for (int j = 0; j<sizeof(csrs)/sizeof(alias); j++) {
+                    if (csrs[j].value == (instruction >> 20)) csr_name = csrs[j].name;
+                }
+
+                if (info->handler_type == CSRR_TYPE && csr_name) snprintf(out, size, "%s x%d, %s", info->name, rd, csr_name);
+                else if (info->handler_type == CSRR_TYPE) snprintf(out, size, "%s x%d, 0x%03X", info->name, rd, instruction >> 20);
+                else if (csr_name) snprintf(out, size, "%s x%d, %s, x%d", info->name, rd, csr_name, rs1);
+                else snprintf(out, size, "%s x%d, 0x%03X, x%d", info->name, rd, instruction >> 20, rs1);
+                return;
+            case AMO_TYPE:
+            case LR_TYPE:
+                const char* ordering[] = {"", ".rl", ".aq", ".aqrl"};
+                if (info->handler_type == LR_TYPE) snprintf(out, size, "%s%s x%d, (x%d)", info->name, ordering[(instruction >> 25) & 0x3], rd, rs1);
+                else snprintf(out, size, "%s%s x%d, x%d, (x%d)", info->name, ordering[(instruction >> 25) & 0x3], rd, rs2, rs1);
+                return;
         }
     }
 
-    return NULL;
+    snprintf(out, size, ".word 0x%08X", instruction);
 }
 
 // Generalized Function that parses instruction arguments from the file pointer directly. 
-// What type of arguments to expect is specified in the function's arguments itself
-int* parse_args(char** fpp, label_index* labels, int n_args, argument_type* types, uint64_t* line_number, int instruction_number) {
+// What type of arguments to expect is specified in the function's arguments itself.
+// The parsed arguments are written to converted_args, which must have room for n_args. Returns false on failure
+bool parse_args(char** fpp, label_index* labels, vec* addresses, int n_args, argument_type* types, uint64_t* line_number, int instruction_number, int* converted_args) {
     int i_args = 0;
     int current_arg = 0;
     char c;
 
-    // Instruction Arguments are parsed into a single string that is divided into 128 char segments for each argument
-    char* args = malloc(n_args*128*sizeof(char)); 
-    if (!args) {
-        printf("Out of memory!");
-        return NULL;
-    }
+    // Instruction Arguments are parsed into a single string that is divided into 128 char segments for each argument.
+    // This runs for every instruction, so it lives on the stack rather than the heap
+    char args[MAX_ARGS*ARG_LEN];
 
     // Seperate the instruction arguments into aforementioned 128 char segments
     while ((c = (**(fpp))) != '\0') {
@@ -179,14 +446,14 @@ int* parse_args(char** fpp, label_index* labels, int n_args, argument_type* type
             case '\t':
                 break;
 
+            case '(':
+                if (i_args == 0 && current_arg > 0) break; // The argument is just a bracketed register, e.g. (a0) for atomics
             case ',':
-            case'(':
                 if (current_arg==(n_args-1)) {
                     show_error("Error on line %lu, Expected 3 operands, Found more than 3\n", *line_number);
-                    free(args);
-                    return NULL;
+                    return false;
                 }
-                args[current_arg*128 + i_args] = '\0';
+                args[current_arg*ARG_LEN + i_args] = '\0';
                 current_arg++;
                 i_args = 0;
                 break;
@@ -197,33 +464,25 @@ int* parse_args(char** fpp, label_index* labels, int n_args, argument_type* type
                 goto exit;
 
             default:
-                if (i_args==127) {
-                    args[current_arg*128 + i_args] = '\0';
-                    show_error("Error on line %lu, Illegal operand: %s\n", *line_number, args + current_arg*128);
-                    free(args);
-                    return NULL;
+                if (i_args==ARG_LEN-1) {
+                    args[current_arg*ARG_LEN + i_args] = '\0';
+                    show_error("Error on line %lu, Illegal operand: %s\n", *line_number, args + current_arg*ARG_LEN);
+                    return false;
                 }
-                args[current_arg*128 + i_args++] = c;
+                args[current_arg*ARG_LEN + i_args++] = c;
         }
     }
 
     exit:
     if (current_arg<(n_args-1)) {
         show_error("Error on line %lu, Expected 3 operands, Less operands than expected\n", *line_number);
-        free(args);
-        return NULL;
-    }
-    args[current_arg*128 + i_args] = '\0';
-    int* converted_args = malloc(sizeof(unsigned long)*n_args);
-    if (!converted_args) {
-        printf("Out of memory!");
-        free(args);
-        return NULL;
+        return false;
     }
+    args[current_arg*ARG_LEN + i_args] = '\0';
 
     // Attempt to parse each argument based on expected type
     for (current_arg=0; current_arg<n_args; current_arg++) {
-        char* arg = args + current_arg*128;
+        char* arg = args + current_arg*ARG_LEN;
 
         switch (types[current_arg]) {
             case IMMEDIATE:
@@ -243,8 +502,7 @@ int* parse_args(char** fpp, label_index* labels, int n_args, argument_type* type
 
                 if (endptr == arg || *endptr != '\0') {
                     show_error("Argument %d on line %lu is invalid for type %s: %s\n", current_arg+1, *line_number, argument_type_names[types[current_arg]], arg);
-                    free(args);
-                    return NULL;
+                    return false;
                 }
 
                 break;
@@ -257,9 +515,7 @@ int* parse_args(char** fpp, label_index* labels, int n_args, argument_type* type
 
                     if (endptr == arg || *endptr != '\0') {
                         show_error("Failed to interpret argument %d on line %lu as numeric offset: %s\n", current_arg+1, *line_number, arg);
-                        free(args);
-                        free(converted_args);
-                        return NULL;
+                        return false;
                     }
 
                 } else {
@@ -267,12 +523,10 @@ int* parse_args(char** fpp, label_index* labels, int n_args, argument_type* type
 
                     if (position==-1) {
                         show_error("Unseen label on line %lu: %s\n", *line_number, arg);
-                        free(args);
-                        free(converted_args);
-                        return NULL;
+                        return false;
                     }
 
-                    converted_args[current_arg] = (position - instruction_number)*4;
+                    converted_args[current_arg] = addresses->values[position] - addresses->values[instruction_number];
                 }
 
                 break;
@@ -282,21 +536,28 @@ int* parse_args(char** fpp, label_index* labels, int n_args, argument_type* type
 
                 if (converted_args[current_arg]==-1) {
                     show_error("Unknown register on line %lu: %s\n", *line_number, arg);
-                    free(args);
-                    free(converted_args);
-                    return NULL;
+                    return false;
                 }
                 
                 break;
 
+            case CSR:
+                converted_args[current_arg] = parse_csr(arg);
+
+                if (converted_args[current_arg]==-1) {
+                    show_error("Unknown CSR on line %lu: %s\n", *line_number, arg);
+                    return false;
+                }
+
+                break;
+
             default:
-                show_error("Error on line %lu\nUnknown argument type %d for %s, did you forget to write a case?\n", *line_number, types[current_arg], args + current_arg*128);
-				return NULL;
+                show_error("Error on line %lu\nUnknown argument type %d for %s, did you forget to write a case?\n", *line_number, types[current_arg], args + current_arg*ARG_LEN);
+				return false;
         }
     }
 
-    free(args);
-    return converted_args;
+    return true;
 }
 
 // Below are a series of helper functions
@@ -305,26 +566,25 @@ int* parse_args(char** fpp, label_index* labels, int n_args, argument_type* type
 // 
 // The purpose of these functions being defined like this, is to declutter the code for the second_pass function in main.c
 
-long R_type_parser(char** args_raw, label_index* labels, uint64_t* line_number, int instruction_number, bool* fail_flag) {
+long R_type_parser(char** args_raw, label_index* labels, vec* addresses, uint64_t* line_number, int instruction_number, bool* fail_flag) {
     argument_type types[] = {REGISTER, REGISTER, REGISTER};
-    int* args = parse_args(args_raw, labels, 3, types, line_number, instruction_number);
+    int args[MAX_ARGS];
 
-    if (!args) {
+    if (!parse_args(args_raw, labels, addresses, 3, types, line_number, instruction_number, args)) {
         *fail_flag = true;
         return -1;
     }
 
     int result = (args[0] << 7) + (args[1] << 15) + (args[2] << 20);
 
-    free(args);
     return result;
 }
 
-long I1_type_parser(char** args_raw, label_index* labels, uint64_t* line_number, int instruction_number, bool* fail_flag) {
+long I1_type_parser(char** args_raw, label_index* labels, vec* addresses, uint64_t* line_number, int instruction_number, bool* fail_flag) {
     argument_type types[] = {REGISTER, REGISTER, IMMEDIATE};
-    int* args = parse_args(args_raw, labels, 3, types, line_number, instruction_number);
+    int args[MAX_ARGS];
 
-    if (!args) {
+    if (!parse_args(args_raw, labels, addresses, 3, types, line_number, instruction_number, args)) {
         *fail_flag = true;
         return -1;
     }
@@ -336,15 +596,14 @@ long I1_type_parser(char** args_raw, label_index* labels, uint64_t* line_number,
     }
 
     int result = (args[0] << 7) + (args[1] << 15) + (args[2] << 20);
-    free(args);
     return result;
 }
 
-long I1B_type_parser(char** args_raw, label_index* labels, uint64_t* line_number, int instruction_number, bool* fail_flag) {
+long I1B_type_parser(char** args_raw, label_index* labels, vec* addresses, uint64_t* line_number, int instruction_number, bool* fail_flag) {
     argument_type types[] = {REGISTER, REGISTER, IMMEDIATE};
-    int* args = parse_args(args_raw, labels, 3, types, line_number, instruction_number);
+    int args[MAX_ARGS];
 
-    if (!args) {
+    if (!parse_args(args_raw, labels, addresses, 3, types, line_number, instruction_number, args)) {
         *fail_flag = true;
         return -1;
     }
@@ -356,15 +615,33 @@ long I1B_type_parser(char** args_raw, label_index* labels, uint64_t* line_number
     }
 
     int result = (args[0] << 7) + (args[1] << 15) + (args[2] << 20);
-    free(args);
     return result;
 }
 
-long I2_type_parser(char** args_raw, label_index* labels, uint64_t* line_number, int instruction_number, bool* fail_flag) {
+long I1BW_type_parser(char** args_raw, label_index* labels, vec* addresses, uint64_t* line_number, int instruction_number, bool* fail_flag) {
+    argument_type types[] = {REGISTER, REGISTER, IMMEDIATE};
+    int args[MAX_ARGS];
+
+    if (!parse_args(args_raw, labels, addresses, 3, types, line_number, instruction_number, args)) {
+        *fail_flag = true;
+        return -1;
+    }
+
+    if (args[2] > 31 || args[2] < 0) {
+        show_error("Error on line %li: Shift amount of a word instruction must be within 0...31. Stopping...\n", *line_number);
+        *fail_flag = true;
+        return -1;
+    }
+
+    int result = (args[0] << 7) + (args[1] << 15) + (args[2] << 20);
+    return result;
+}
+
+long I2_type_parser(char** args_raw, label_index* labels, vec* addresses, uint64_t* line_number, int instruction_number, bool* fail_flag) {
     argument_type types[] = {REGISTER, IMMEDIATE, REGISTER};
-    int* args = parse_args(args_raw, labels, 3, types, line_number, instruction_number);
+    int args[MAX_ARGS];
 
-    if (!args) {
+    if (!parse_args(args_raw, labels, addresses, 3, types, line_number, instruction_number, args)) {
         *fail_flag = true;
         return -1;
     }
@@ -376,15 +653,14 @@ long I2_type_parser(char** args_raw, label_index* labels, uint64_t* line_number,
     }
 
     int result = (args[0] << 7) + (args[2] << 15) + (args[1] << 20);
-    free(args);
     return result;
 }
 
-long S_type_parser(char** args_raw, label_index* labels, uint64_t* line_number, int instruction_number, bool* fail_flag) {
+long S_type_parser(char** args_raw, label_index* labels, vec* addresses, uint64_t* line_number, int instruction_number, bool* fail_flag) {
     argument_type types[] = {REGISTER, IMMEDIATE, REGISTER};
-    int* args = parse_args(args_raw, labels, 3, types, line_number, instruction_number);
+    int args[MAX_ARGS];
 
-    if (!args) {
+    if (!parse_args(args_raw, labels, addresses, 3, types, line_number, instruction_number, args)) {
         *fail_flag = true;
         return -1;
     }
@@ -397,15 +673,14 @@ long S_type_parser(char** args_raw, label_index* labels, uint64_t* line_number,
 
     int rearranged_immediate = ((args[1] & 0x0000001F) << 7) + ((args[1] & 0x00000FE0) << 20);
     int result = (args[2] << 15) + rearranged_immediate + (args[0] << 20);
-    free(args);
     return result;
 }
 
-long B_type_parser(char** args_raw, label_index* labels, uint64_t* line_number, int instruction_number, bool* fail_flag) {
+long B_type_parser(char** args_raw, label_index* labels, vec* addresses, uint64_t* line_number, int instruction_number, bool* fail_flag) {
     argument_type types[] = {REGISTER, REGISTER, OFFSET};
-    int* args = parse_args(args_raw, labels, 3, types, line_number, instruction_number);
+    int args[MAX_ARGS];
 
-    if (!args) {
+    if (!parse_args(args_raw, labels, addresses, 3, types, line_number, instruction_number, args)) {
         *fail_flag = true;
         return -1;
     }
@@ -419,15 +694,14 @@ long B_type_parser(char** args_raw, label_index* labels, uint64_t* line_number,
     int rearranged_offset = ((args[2] & 0x0000001E) << 7) + ((args[2] & 0x00000800) >> 4) + ((args[2] & 0x00001000) << 19) + ((args[2] & 0x000007E0) << 20);
     int result = (args[0] << 15) + (args[1] << 20) + rearranged_offset;
 
-    free(args);
     return result;
 }
 
-long U_type_parser(char** args_raw, label_index* labels, uint64_t* line_number, int instruction_number, bool* fail_flag) {
+long U_type_parser(char** args_raw, label_index* labels, vec* addresses, uint64_t* line_number, int instruction_number, bool* fail_flag) {
     argument_type types[] = {REGISTER, IMMEDIATE};
-    int* args = parse_args(args_raw, labels, 2, types, line_number, instruction_number);
+    int args[MAX_ARGS];
 
-    if (!args) {
+    if (!parse_args(args_raw, labels, addresses, 2, types, line_number, instruction_number, args)) {
         *fail_flag = true;
         return -1;
     }
@@ -440,15 +714,14 @@ long U_type_parser(char** args_raw, label_index* labels, uint64_t* line_number,
 
     int result = (args[0] << 7) + (args[1] << 12);
 
-    free(args);
     return result;
 }
 
-long J_type_parser(char** args_raw, label_index* labels, uint64_t* line_number, int instruction_number, bool* fail_flag) {
+long J_type_parser(char** args_raw, label_index* labels, vec* addresses, uint64_t* line_number, int instruction_number, bool* fail_flag) {
     argument_type types[] = {REGISTER, OFFSET};
-    int* args = parse_args(args_raw, labels, 2, types, line_number, instruction_number);
+    int args[MAX_ARGS];
 
-    if (!args) {
+    if (!parse_args(args_raw, labels, addresses, 2, types, line_number, instruction_number, args)) {
         *fail_flag = true;
         return -1;
     }
@@ -456,15 +729,14 @@ long J_type_parser(char** args_raw, label_index* labels, uint64_t* line_number,
     int rearranged_offset = (args[1] & 0x000FF000) + ((args[1] & 0x000007FE) << 20) + ((args[1] & 0x00000800) << 9) + ((args[1] & 0x00100000) << 11);
     int result = (args[0] << 7) + rearranged_offset;
 
-    free(args);
     return result;
 }
 
-long I3_type_parser(char** args_raw, label_index* labels, uint64_t* line_number, int instruction_number, bool* fail_flag) {
+long I3_type_parser(char** args_raw, label_index* labels, vec* addresses, uint64_t* line_number, int instruction_number, bool* fail_flag) {
     argument_type types[] = {REGISTER, IMMEDIATE, REGISTER};
-    int* args = parse_args(args_raw, labels, 3, types, line_number, instruction_number);
+    int args[MAX_ARGS];
 
-    if (!args) {
+    if (!parse_args(args_raw, labels, addresses, 3, types, line_number, instruction_number, args)) {
         *fail_flag = true;
         return -1;
     }
@@ -472,6 +744,223 @@ long I3_type_parser(char** args_raw, label_index* labels, uint64_t* line_number,
     int rearranged_offset = (args[1] & 0x00000FFF) << 20;
     int result = (args[0] << 7) + (args[2] << 15) + rearranged_offset;
 
-    free(args);
     return result;
-}
\ No newline at end of file
+}
+
+// csrrw, csrrs and csrrc take rd, csr, rs1. csrr only takes rd, csr and reads without writing (rs1 = x0)
+long CSR_type_parser(int type, char** args_raw, label_index* labels, vec* addresses, uint64_t* line_number, int instruction_number, bool* fail_flag) {
+    argument_type types[] = {REGISTER, CSR, REGISTER};
+    int args[MAX_ARGS];
+
+    if (!parse_args(args_raw, labels, addresses, type==CSRR_TYPE?2:3, types, line_number, instruction_number, args)) {
+        *fail_flag = true;
+        return -1;
+    }
+
+    int result = (args[0] << 7) + (args[1] << 20);
+    if (type == CSR_TYPE) result += args[2] << 15;
+
+    return result;
+}
+
+// Atomics take the address register in brackets and last, as in amoadd.w rd, rs2, (rs1). lr has no rs2
+long AMO_type_parser(int type, char** args_raw, label_index* labels, vec* addresses, uint64_t* line_number, int instruction_number, bool* fail_flag) {
+    argument_type types[] = {REGISTER, REGISTER, REGISTER};
+    int n_args = type==LR_TYPE?2:3;
+    int args[MAX_ARGS];
+
+    if (!parse_args(args_raw, labels, addresses, n_args, types, line_number, instruction_number, args)) {
+        *fail_flag = true;
+        return -1;
+    }
+
+    int result = (args[0] << 7) + (args[n_args-1] << 15);
+    if (type == AMO_TYPE) result += args[1] << 20;
+
+    return result;
+}
+
+// Takes bits hi..lo of x and places them starting at bit pos
+#define PLACE(x, hi, lo, pos) ((((x) >> (lo)) & ((1 << ((hi)-(lo)+1)) - 1)) << (pos))
+
+// Compressed register fields can only address x8 to x15
+static bool is_compressed_register(int reg) {
+    return reg >= 8 && reg <= 15;
+}
+
+// Handles all of the compressed instruction formats, since most of their differences are in how the immediate is scrambled
+long C_type_parser(int type, char** args_raw, label_index* labels, vec* addresses, uint64_t* line_number, int instruction_number, bool* fail_flag) {
+    argument_type types[3];
+    int n_args;
+
+    switch (type) {
+        case CR1_TYPE:
+            types[0] = REGISTER;
+            n_args = 1;
+            break;
+
+        case CJ_TYPE:
+            types[0] = OFFSET;
+            n_args = 1;
+            break;
+
+        case CR_TYPE:
+        case CA_TYPE:
+            types[0] = REGISTER; types[1] = REGISTER;
+            n_args = 2;
+            break;
+
+        case CB_TYPE:
+            types[0] = REGISTER; types[1] = OFFSET;
+            n_args = 2;
+            break;
+
+        case CIW_TYPE:
+        case C16SP_TYPE:
+            types[0] = REGISTER; types[1] = REGISTER; types[2] = IMMEDIATE;
+            n_args = type==CIW_TYPE?3:2;
+            if (type == C16SP_TYPE) types[1] = IMMEDIATE;
+            break;
+
+        case CLW_TYPE:
+        case CLD_TYPE:
+        case CLWSP_TYPE:
+        case CLDSP_TYPE:
+        case CSWSP_TYPE:
+        case CSDSP_TYPE:
+            types[0] = REGISTER; types[1] = IMMEDIATE; types[2] = REGISTER;
+            n_args = 3;
+            break;
+
+        default: // CI_TYPE, CIS_TYPE, CLUI_TYPE, CBS_TYPE, CBI_TYPE
+            types[0] = REGISTER; types[1] = IMMEDIATE;
+            n_args = 2;
+    }
+
+    int args[MAX_ARGS];
+
+    if (!parse_args(args_raw, labels, addresses, n_args, types, line_number, instruction_number, args)) {
+        *fail_flag = true;
+        return -1;
+    }
+
+    int imm = args[n_args-1];
+    int result = -1;
+    char* error = NULL;
+
+    switch (type) {
+        case CR_TYPE:
+            if (!args[0] || !args[1]) error = "Registers cannot be x0";
+            else result = (args[0] << 7) + (args[1] << 2);
+            break;
+
+        case CR1_TYPE:
+            if (!args[0]) error = "Register cannot be x0";
+            else result = args[0] << 7;
+            break;
+
+        case CA_TYPE:
+            if (!is_compressed_register(args[0]) || !is_compressed_register(args[1])) error = "Registers must be within x8...x15";
+            else result = ((args[0]-8) << 7) + ((args[1]-8) << 2);
+            break;
+
+        case CI_TYPE:
+            if (imm > 31 || imm < -32) error = "Immediate value must be within -32...31";
+            else result = (args[0] << 7) + PLACE(imm, 5, 5, 12) + PLACE(imm, 4, 0, 2);
+            break;
+
+        case CIS_TYPE:
+        case CBS_TYPE:
+            if (imm > 63 || imm < 1) error = "Shift amount must be within 1...63";
+            else if (type == CBS_TYPE && !is_compressed_register(args[0])) error = "Register must be within x8...x15";
+            else result = ((type==CBS_TYPE?args[0]-8:args[0]) << 7) + PLACE(imm, 5, 5, 12) + PLACE(imm, 4, 0, 2);
+            break;
+
+        case CBI_TYPE:
+            if (imm > 31 || imm < -32) error = "Immediate value must be within -32...31";
+            else if (!is_compressed_register(args[0])) error = "Register must be within x8...x15";
+            else result = ((args[0]-8) << 7) + PLACE(imm, 5, 5, 12) + PLACE(imm, 4, 0, 2);
+            break;
+
+        case CLUI_TYPE: // Takes the same 20 bit immediate as lui, but it must fit in 6 signed bits
+            if (args[0] == 0 || args[0] == 2) error = "Register cannot be x0 or x2";
+            else if (!((imm >= 1 && imm <= 31) || (imm >= 0xFFFE0 && imm <= 0xFFFFF))) error = "Immediate value must be within 0x1...0x1F or 0xFFFE0...0xFFFFF";
+            else result = (args[0] << 7) + PLACE(imm, 5, 5, 12) + PLACE(imm, 4, 0, 2);
+            break;
+
+        case C16SP_TYPE:
+            if (args[0] != 2) error = "Register must be sp";
+            else if (imm == 0 || imm % 16 || imm > 496 || imm < -512) error = "Immediate value must be a non-zero multiple of 16 within -512...496";
+            else result = PLACE(imm, 9, 9, 12) + PLACE(imm, 4, 4, 6) + PLACE(imm, 6, 6, 5) + PLACE(imm, 8, 7, 3) + PLACE(imm, 5, 5, 2);
+            break;
+
+        case CIW_TYPE:
+            if (!is_compressed_register(args[0]) || args[1] != 2) error = "Registers must be within x8...x15 and sp";
+            else if (imm <= 0 || imm % 4 || imm > 1020) error = "Immediate value must be a non-zero multiple of 4 within 4...1020";
+            else result = ((args[0]-8) << 2) + PLACE(imm, 5, 4, 11) + PLACE(imm, 9, 6, 7) + PLACE(imm, 2, 2, 6) + PLACE(imm, 3, 3, 5);
+            break;
+
+        case CLW_TYPE:
+            imm = args[1];
+            if (!is_compressed_register(args[0]) || !is_compressed_register(args[2])) error = "Registers must be within x8...x15";
+            else if (imm < 0 || imm % 4 || imm > 124) error = "Offset must be a multiple of 4 within 0...124";
+            else result = ((args[0]-8) << 2) + ((args[2]-8) << 7) + PLACE(imm, 5, 3, 10) + PLACE(imm, 2, 2, 6) + PLACE(imm, 6, 6, 5);
+            break;
+
+        case CLD_TYPE:
+            imm = args[1];
+            if (!is_compressed_register(args[0]) || !is_compressed_register(args[2])) error = "Registers must be within x8...x15";
+            else if (imm < 0 || imm % 8 || imm > 248) error = "Offset must be a multiple of 8 within 0...248";
+            else result = ((args[0]-8) << 2) + ((args[2]-8) << 7) + PLACE(imm, 5, 3, 10) + PLACE(imm, 7, 6, 5);
+            break;
+
+        case CLWSP_TYPE:
+            imm = args[1];
+            if (!args[0] || args[2] != 2) error = "Registers cannot be x0, and the base must be sp";
+            else if (imm < 0 || imm % 4 || imm > 252) error = "Offset must be a multiple of 4 within 0...252";
+            else result = (args[0] << 7) + PLACE(imm, 5, 5, 12) + PLACE(imm, 4, 2, 4) + PLACE(imm, 7, 6, 2);
+            break;
+
+        case CLDSP_TYPE:
+            imm = args[1];
+            if (!args[0] || args[2] != 2) error = "Registers cannot be x0, and the base must be sp";
+            else if (imm < 0 || imm % 8 || imm > 504) error = "Offset must be a multiple of 8 within 0...504";
+            else result = (args[0] << 7) + PLACE(imm, 5, 5, 12) + PLACE(imm, 4, 3, 5) + PLACE(imm, 8, 6, 2);
+            break;
+
+        case CSWSP_TYPE:
+            imm = args[1];
+            if (args[2] != 2) error = "The base register must be sp";
+            else if (imm < 0 || imm % 4 || imm > 252) error = "Offset must be a multiple of 4 within 0...252";
+            else result = (args[0] << 2) + PLACE(imm, 5, 2, 9) + PLACE(imm, 7, 6, 7);
+            break;
+
+        case CSDSP_TYPE:
+            imm = args[1];
+            if (args[2] != 2) error = "The base register must be sp";
+            else if (imm < 0 || imm % 8 || imm > 504) error = "Offset must be a multiple of 8 within 0...504";
+            else result = (args[0] << 2) + PLACE(imm, 5, 3, 10) + PLACE(imm, 8, 6, 7);
+            break;
+
+        case CB_TYPE:
+            if (!is_compressed_register(args[0])) error = "Register must be within x8...x15";
+            else if (imm > 254 || imm < -256) error = "Branch offset too large";
+            else result = ((args[0]-8) << 7) + PLACE(imm, 8, 8, 12) + PLACE(imm, 4, 3, 10) + PLACE(imm, 7, 6, 5) + PLACE(imm, 2, 1, 3) + PLACE(imm, 5, 5, 2);
+            break;
+
+        case CJ_TYPE:
+            if (imm > 2046 || imm < -2048) error = "Jump offset too large";
+            else result = PLACE(imm, 11, 11, 12) + PLACE(imm, 4, 4, 11) + PLACE(imm, 9, 8, 9) + PLACE(imm, 10, 10, 8)
+                + PLACE(imm, 6, 6, 7) + PLACE(imm, 7, 7, 6) + PLACE(imm, 3, 1, 3) + PLACE(imm, 5, 5, 2);
+            break;
+    }
+
+
+    if (error) {
+        show_error("Error on line %li: %s. Stopping...\n", *line_number, error);
+        *fail_flag = true;
+        return -1;
+    }
+
+    return result;
+}
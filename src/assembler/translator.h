@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include "index.h"
+#include "vec.h"
 
 typedef struct instruction_info {
     const char* name;
@@ -15,31 +16,61 @@ typedef enum instruction_type {
     R_TYPE,
     I1_TYPE,
     I1B_TYPE,
+    I1BW_TYPE,
     I2_TYPE,
     S_TYPE,
     B_TYPE,
     U_TYPE,
     J_TYPE,
     I3_TYPE,
-    I4_TYPE
+    I4_TYPE,
+    CSR_TYPE,
+    CSRR_TYPE,
+    AMO_TYPE,
+    LR_TYPE,
+    CR_TYPE,    // Compressed types from here on
+    CR1_TYPE,
+    CI_TYPE,
+    CIS_TYPE,
+    CLUI_TYPE,
+    C16SP_TYPE,
+    CIW_TYPE,
+    CLW_TYPE,
+    CLD_TYPE,
+    CLWSP_TYPE,
+    CLDSP_TYPE,
+    CSWSP_TYPE,
+    CSDSP_TYPE,
+    CBS_TYPE,
+    CBI_TYPE,
+    CB_TYPE,
+    CJ_TYPE,
+    CA_TYPE
 } instruction_type;
 
 typedef enum argument_type {
     IMMEDIATE,
     OFFSET,
-    REGISTER
+    REGISTER,
+    CSR
 } argument_type;
 
-long R_type_parser(char** args_raw, label_index* labels, uint64_t* line_number, int instruction_number, bool* fail_flag);
-long I1_type_parser(char** args_raw, label_index* labels, uint64_t* line_number, int instruction_number, bool* fail_flag);
-long I1B_type_parser(char** args_raw, label_index* labels, uint64_t* line_number, int instruction_number, bool* fail_flag);
-long I2_type_parser(char** args_raw, label_index* labels, uint64_t* line_number, int instruction_number, bool* fail_flag);
-long S_type_parser(char** args_raw, label_index* labels, uint64_t* line_number, int instruction_number, bool* fail_flag);
-long B_type_parser(char** args_raw, label_index* labels, uint64_t* line_number, int instruction_number, bool* fail_flag);
-long U_type_parser(char** args_raw, label_index* labels, uint64_t* line_number, int instruction_number, bool* fail_flag);
-long J_type_parser(char** args_raw, label_index* labels, uint64_t* line_number, int instruction_number, bool* fail_flag);
-long I3_type_parser(char** args_raw, label_index* labels, uint64_t* line_number, int instruction_number, bool* fail_flag);
+long R_type_parser(char** args_raw, label_index* labels, vec* addresses, uint64_t* line_number, int instruction_number, bool* fail_flag);
+long I1_type_parser(char** args_raw, label_index* labels, vec* addresses, uint64_t* line_number, int instruction_number, bool* fail_flag);
+long I1B_type_parser(char** args_raw, label_index* labels, vec* addresses, uint64_t* line_number, int instruction_number, bool* fail_flag);
+long I1BW_type_parser(char** args_raw, label_index* labels, vec* addresses, uint64_t* line_number, int instruction_number, bool* fail_flag);
+long I2_type_parser(char** args_raw, label_index* labels, vec* addresses, uint64_t* line_number, int instruction_number, bool* fail_flag);
+long S_type_parser(char** args_raw, label_index* labels, vec* addresses, uint64_t* line_number, int instruction_number, bool* fail_flag);
+long B_type_parser(char** args_raw, label_index* labels, vec* addresses, uint64_t* line_number, int instruction_number, bool* fail_flag);
+long U_type_parser(char** args_raw, label_index* labels, vec* addresses, uint64_t* line_number, int instruction_number, bool* fail_flag);
+long J_type_parser(char** args_raw, label_index* labels, vec* addresses, uint64_t* line_number, int instruction_number, bool* fail_flag);
+long I3_type_parser(char** args_raw, label_index* labels, vec* addresses, uint64_t* line_number, int instruction_number, bool* fail_flag);
+long CSR_type_parser(int type, char** args_raw, label_index* labels, vec* addresses, uint64_t* line_number, int instruction_number, bool* fail_flag);
+long AMO_type_parser(int type, char** args_raw, label_index* labels, vec* addresses, uint64_t* line_number, int instruction_number, bool* fail_flag);
+long C_type_parser(int type, char** args_raw, label_index* labels, vec* addresses, uint64_t* line_number, int instruction_number, bool* fail_flag);
 
 int parse_alias(char* name);
+int parse_ordering(char* name);
 const instruction_info* parse_instruction(char* name);
+void disassemble(uint32_t instruction, char* out, size_t size);
 #endif
\ No newline at end of file
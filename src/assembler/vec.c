@@ -50,7 +50,7 @@ int append(vec* array, uint64_t value) {
 
 void vec_remove(vec* array, size_t index) {
 	if (index != array->len-1) {
-		memcpy(array->values+index, array->values+index+1, array->len-index-1);
+		memmove(array->values+index, array->values+index+1, (array->len-index-1)*sizeof(uint64_t));
 	}
 
 	array->len -= 1;
@@ -5,17 +5,25 @@
 #include <sys/timeb.h>
 #include <bits/types/struct_timeb.h>
 #include <string.h>
-#include "../globals.h"
+#include <pthread.h>
+#include <time.h>
 #include "../assembler/vec.h"
 #include "../frontend/frontend.h"
 #include "backend.h"
 #include "memory.h"
+#include "watchpoint.h"
+#include "condition.h"
+#include "rvc.h"
+#include "syscall.h"
 
 # define RUN_DELAY 200
+# define CSR_MHARTID 0xF14
 
 enum Opcode {
     R_Type      = 0b0110011,
+    R32_Type    = 0b0111011, // Word sized R type
     I_Type      = 0b0010011,
+    I32_Type    = 0b0011011, // Word sized I type
     Load_Type   = 0b0000011,
     S_Type      = 0b0100011,
     B_Type      = 0b1100011,
@@ -24,6 +32,7 @@ enum Opcode {
     LUI         = 0b0110111,
     AUIPC       = 0b0010111,
     EBREAK      = 0b1110011,
+    AMO         = 0b0101111,
     NOP         = 0, // Made up marker, Used to identify end of code.
 };
 
@@ -38,6 +47,24 @@ enum Instruction_Constants{
     sra = 0b0110011+(0x5<<12)+(0x20<<25),
     slt = 0b0110011+(0x2<<12),
     sltu = 0b0110011+(0x3<<12),
+    mul = 0b0110011+(0x01<<25),
+    mulh = 0b0110011+(0x1<<12)+(0x01<<25),
+    mulhsu = 0b0110011+(0x2<<12)+(0x01<<25),
+    mulhu = 0b0110011+(0x3<<12)+(0x01<<25),
+    div_ = 0b0110011+(0x4<<12)+(0x01<<25), // div() is already declared by stdlib.h
+    divu = 0b0110011+(0x5<<12)+(0x01<<25),
+    rem = 0b0110011+(0x6<<12)+(0x01<<25),
+    remu = 0b0110011+(0x7<<12)+(0x01<<25),
+    mulw = 0b0111011+(0x01<<25),
+    divw = 0b0111011+(0x4<<12)+(0x01<<25),
+    divuw = 0b0111011+(0x5<<12)+(0x01<<25),
+    remw = 0b0111011+(0x6<<12)+(0x01<<25),
+    remuw = 0b0111011+(0x7<<12)+(0x01<<25),
+    addw = 0b0111011,
+    subw = 0b0111011+(0x20<<25),
+    sllw = 0b0111011+(0x1<<12),
+    srlw = 0b0111011+(0x5<<12),
+    sraw = 0b0111011+(0x5<<12)+(0x20<<25),
     addi = 0b0010011+(0x0<<12),
     xori = 0b0010011+(0x4<<12),
     ori = 0b0010011+(0x6<<12),
@@ -47,6 +74,10 @@ enum Instruction_Constants{
     srai = 0b0010011+(0x5<<12)+(0x10<<26),
     slti = 0b0010011+(0x2<<12),
     sltiu = 0b0010011+(0x3<<12),
+    addiw = 0b0011011+(0x0<<12),
+    slliw = 0b0011011+(0x1<<12),
+    srliw = 0b0011011+(0x5<<12),
+    sraiw = 0b0011011+(0x5<<12)+(0x20<<25),
     lb = 0b0000011+(0x0<<12),
     lh = 0b0000011+(0x1<<12),
     lw = 0b0000011+(0x2<<12),
@@ -70,120 +101,704 @@ enum Instruction_Constants{
     auipc = 0b0010111,
     ecall = 0b1110011,
     ebreak = 0b1110011+(0X1<<20),
+    csrrw = 0b1110011+(0x1<<12),
+    csrrs = 0b1110011+(0x2<<12),
+    csrrc = 0b1110011+(0x3<<12),
+    lr_w = 0b0101111+(0x2<<12)+(0x02<<27),
+    sc_w = 0b0101111+(0x2<<12)+(0x03<<27),
+    amoswap_w = 0b0101111+(0x2<<12)+(0x01<<27),
+    amoadd_w = 0b0101111+(0x2<<12)+(0x00<<27),
+    amoxor_w = 0b0101111+(0x2<<12)+(0x04<<27),
+    amoand_w = 0b0101111+(0x2<<12)+(0x0C<<27),
+    amoor_w = 0b0101111+(0x2<<12)+(0x08<<27),
+    amomin_w = 0b0101111+(0x2<<12)+(0x10<<27),
+    amomax_w = 0b0101111+(0x2<<12)+(0x14<<27),
+    amominu_w = 0b0101111+(0x2<<12)+(0x18<<27),
+    amomaxu_w = 0b0101111+(0x2<<12)+(0x1C<<27),
+    lr_d = 0b0101111+(0x3<<12)+(0x02<<27),
+    sc_d = 0b0101111+(0x3<<12)+(0x03<<27),
+    amoswap_d = 0b0101111+(0x3<<12)+(0x01<<27),
+    amoadd_d = 0b0101111+(0x3<<12)+(0x00<<27),
+    amoxor_d = 0b0101111+(0x3<<12)+(0x04<<27),
+    amoand_d = 0b0101111+(0x3<<12)+(0x0C<<27),
+    amoor_d = 0b0101111+(0x3<<12)+(0x08<<27),
+    amomin_d = 0b0101111+(0x3<<12)+(0x10<<27),
+    amomax_d = 0b0101111+(0x3<<12)+(0x14<<27),
+    amominu_d = 0b0101111+(0x3<<12)+(0x18<<27),
+    amomaxu_d = 0b0101111+(0x3<<12)+(0x1C<<27),
+    c_ebreak = 0x9002,
 }; 
 
-static uint64_t registers[32] = {0};
-static uint64_t pc = 0;
-static vec *breakpoints = NULL;
-static Memory* memory = NULL;
-static stacktrace* stack = NULL;
-static uint8_t* memory_data = NULL;
-extern bool text_write_enabled;
+// A decoded instruction. Decoding is done once per address and cached, since the same instructions are executed repeatedly
+typedef struct decoded_instruction {
+    uint64_t imm;
+    uint32_t funct_op;
+    uint8_t opcode;
+    uint8_t rd;
+    uint8_t rs1;
+    uint8_t rs2;
+    uint8_t length;     // Length of the instruction in bytes, 0 if this entry has not been decoded yet
+    bool writes_rd;
+} decoded_instruction;
+
+// Everything the backend keeps for one simulator. Each thread works on the instance it selected last,
+// so several simulators can run side by side as long as no two threads run the same one
+struct backend_state {
+    hart harts[MAX_HARTS];
+    int n_harts;
+    int quantum;                        // Instructions a hart runs before the next one gets a turn
+    bool fast_mode;                     // Run harts on host threads instead of interleaving them
+    int current;                        // Hart that runs next
+    int slice;                          // Instructions the current hart has run in its turn
+    vec *breakpoints;
+    vec *breakpoint_conditions;         // bp_condition* for every breakpoint that has a condition or hit count
+    watch_list* watchpoints;
+    Memory* memory;                     // L1 of hart 0, which owns the shared memory
+    uint8_t* memory_data;
+    Bus* bus;                           // Keeps the L1s of the harts coherent, NULL with one hart or no cache
+    pthread_mutex_t hart_lock;          // Guards syscalls and the fields below, which host threads share in fast mode
+    pthread_mutex_t store_lock;         // Makes stores and atomics by different host threads happen one at a time
+    volatile bool stop_harts;           // Tells the host threads of fast mode to stop
+    int stop_result;                    // Why the first hart to stop execution in fast mode stopped
+    volatile int running_threads;
+    decoded_instruction* decode_cache;  // One entry for every 2 bytes of the text segment
+    int* pc_lines;                      // Line (index of instruction) at every 2 byte aligned address of the text segment, -1 if none
+    program_layout layout;
+    bool text_write_enabled;            // Allow writing to the text segment
+    syscall_state* syscalls;
+};
+
+#define DEFAULT_BACKEND_STATE {.n_harts = 1, .quantum = 1, .hart_lock = PTHREAD_MUTEX_INITIALIZER, .store_lock = PTHREAD_MUTEX_INITIALIZER, \
+    .layout = {0, DATA_BASE, 0, 0, DATA_BASE}}
+
+// Used by programs that never create an instance of their own, like the TUI used to be
+static backend_state default_state = DEFAULT_BACKEND_STATE;
+static __thread backend_state* state = &default_state;
+
+backend_state* new_backend_state() {
+    backend_state* new_state = malloc(sizeof(backend_state));
+    if (!new_state) return NULL;
+
+    *new_state = (backend_state) DEFAULT_BACKEND_STATE;
+    pthread_mutex_init(&new_state->hart_lock, NULL);
+    pthread_mutex_init(&new_state->store_lock, NULL);
+
+    new_state->syscalls = new_syscall_state();
+    if (!new_state->syscalls) {
+        free(new_state);
+        return NULL;
+    }
+    return new_state;
+}
+
+void select_backend(backend_state* new_state) {
+    state = new_state?new_state:&default_state;
+    select_syscalls(state->syscalls);
+}
+
+backend_state* selected_backend() {return state;}
+
+void free_backend_state(backend_state* old_state) {
+    backend_state* selected = state;
+
+    select_backend(old_state);
+    destroy_backend();
+    free_syscall_state(old_state->syscalls);
+    pthread_mutex_destroy(&old_state->hart_lock);
+    pthread_mutex_destroy(&old_state->store_lock);
+    free(old_state);
+
+    select_backend(selected == old_state?NULL:selected);
+}
+
+void set_text_write(bool enabled) {state->text_write_enabled = enabled;}
 
 // Utility functions used to link frontend to backend
-uint64_t* get_register_pointer() {return &registers[0];}
-uint64_t* get_pc_pointer() {return &pc;}
-vec* get_breakpoints_pointer() {return breakpoints;}
-Memory* get_memory_pointer() {return memory;}
-CacheStats* get_cache_stats_pointer() {return &(memory->cache_stats);}
-void set_stacktrace_pointer(stacktrace* stacktrace) {stack = stacktrace;}
+uint64_t* get_register_pointer() {return &state->harts[0].registers[0];}
+uint64_t* get_pc_pointer() {return &state->harts[0].pc;}
+vec* get_breakpoints_pointer() {return state->breakpoints;}
+vec* get_breakpoint_conditions_pointer() {return state->breakpoint_conditions;}
+watch_list* get_watchpoints_pointer() {return state->watchpoints;}
+int* get_pc_lines_pointer() {return state->pc_lines;}
+Memory* get_memory_pointer() {return state->memory;}
+CacheStats* get_cache_stats_pointer() {return &(state->memory->cache_stats);}
+hart* get_harts_pointer() {return state->harts;}
+int get_hart_count() {return state->n_harts;}
+int get_current_hart() {return state->current;}
+uint64_t* get_reg_write_pointer() {return &state->harts[0].last_reg_write;}
+
+void set_hart_config(int new_n_harts, int new_quantum, bool fast) {
+    state->n_harts = new_n_harts;
+    state->quantum = new_quantum;
+    state->fast_mode = fast;
+}
+
+// Hart 0 uses the stack trace owned by the loaded program, the others get their own over the same labels
+bool set_stacktrace_pointer(stacktrace* stacktrace) {
+    struct stacktrace* stacks[MAX_HARTS] = {stacktrace};
+
+    for (int i=1; i<state->n_harts; i++) {
+        if ((stacks[i] = new_stacktrace(stacktrace->index, stacktrace->n_lines))) continue;
+
+        while (--i > 0) st_free(stacks[i]);
+        return false;
+    }
+
+    for (int i=0; i<state->n_harts; i++) {
+        if (i && state->harts[i].stack) st_free(state->harts[i].stack);
+        state->harts[i].stack = stacks[i];
+    }
+    restart_stacktraces();
+    return true;
+}
+
+void restart_stacktraces() {
+    for (int i=0; i<state->n_harts; i++) {
+        st_clear(state->harts[i].stack);
+        st_push(state->harts[i].stack, 0, ST_NO_RETURN, 0);
+    }
+}
+
+static void free_conditions() {
+    for (int i=0; i<state->breakpoint_conditions->len; i++) free_condition((bp_condition*) state->breakpoint_conditions->values[i]);
+    free_managed_array(state->breakpoint_conditions);
+}
+
+static inline bool in_text(uint64_t addr, uint64_t size) {
+    return addr < state->layout.text_end && addr+size > state->layout.text_start;
+}
+
+// Returns the line (index of instruction) at an address, or -1 if there is no instruction starting there
+static inline int pc_line(uint64_t addr) {
+    return addr >= state->layout.text_start && addr < state->layout.text_end?state->pc_lines[(addr-state->layout.text_start)/2]:-1;
+}
+
+int get_address_line(uint64_t addr) {return state->pc_lines?pc_line(addr):-1;}
+
+// Puts every hart at the entry point with its own stack. Like firmware does, a0 holds the hart's id
+static void reset_harts() {
+    for (int i=0; i<state->n_harts; i++) {
+        memset(state->harts[i].registers, 0, sizeof(state->harts[i].registers));
+        state->harts[i].pc = state->layout.entry;
+        state->harts[i].registers[2] = state->layout.stack_pointer?state->layout.stack_pointer - i*HART_STACK_SIZE:0;
+        state->harts[i].registers[10] = i;
+        state->harts[i].id = i;
+        state->harts[i].halted = false;
+        state->harts[i].last_reg_write = -2;
+    }
+
+    state->current = 0;
+    state->slice = 0;
+}
+
+// Sets where the text segment is, where execution starts and the initial stack pointer and program break.
+// Must be called after a hard reset, and be followed by set_line_mapping
+void set_program_layout(program_layout* new_layout) {
+    if (state->decode_cache) free(state->decode_cache);
+    if (state->pc_lines) free(state->pc_lines);
+
+    state->layout = *new_layout;
+
+    state->decode_cache = calloc((state->layout.text_end-state->layout.text_start)/2+1, sizeof(decoded_instruction));
+    state->pc_lines = malloc(sizeof(int)*((state->layout.text_end-state->layout.text_start)/2+1));
+    for (int i=0; i<=(state->layout.text_end-state->layout.text_start)/2; i++) state->pc_lines[i] = -1;
+
+    reset_harts();
+    reset_syscalls(state->layout.heap_start);
+}
+
+// Builds the address to line mapping from the address of every instruction (the last entry being the end of the text segment)
+void set_line_mapping(vec* addresses) {
+    for (int i=0; i<=(state->layout.text_end-state->layout.text_start)/2; i++) state->pc_lines[i] = -1;
+    for (int i=0; i+1<addresses->len; i++) state->pc_lines[(addresses->values[i]-state->layout.text_start)/2] = i;
+}
+
+// Drops cached decodes of any instruction that overlaps a write to the text segment
+static void invalidate_decoded(uint64_t addr, uint64_t size) {
+    uint64_t first = addr>=state->layout.text_start+2?(addr-state->layout.text_start-2)/2:0;
+
+    for (uint64_t i=first; i<=(addr+size-1-state->layout.text_start)/2 && i<=(state->layout.text_end-state->layout.text_start)/2; i++) {
+        state->decode_cache[i].length = 0;
+    }
+}
+
+static void free_hart_memories() {
+    if (state->bus) free_bus(state->bus);
+    state->bus = NULL;
+
+    for (int i=1; i<MAX_HARTS; i++) {
+        if (state->harts[i].memory) free_vmem(state->harts[i].memory);
+        state->harts[i].memory = NULL;
+    }
+    if (state->memory) free_vmem(state->memory);
+    state->memory = state->harts[0].memory = NULL;
+}
 
 // Resets memeory and registers. The hard parameters is true if this is a new file load and false if it is just a reset
 void reset_backend(bool hard, CacheConfig cache_config) {
     if (hard) {
-        if (breakpoints) free_managed_array(breakpoints);
-        if (memory) free_vmem(memory);
-        breakpoints = new_managed_array();
-        memory = new_vmem(cache_config);
-        memory_data = memory->data;
+        if (state->breakpoints) free_managed_array(state->breakpoints);
+        if (state->breakpoint_conditions) free_conditions();
+        if (state->watchpoints) free_watch_list(state->watchpoints);
+        free_hart_memories();
+        state->breakpoints = new_managed_array();
+        state->breakpoint_conditions = new_managed_array();
+        state->memory = new_vmem(cache_config);
+        state->watchpoints = new_watch_list(state->memory);
+        state->memory_data = state->memory->data;
+        state->harts[0].memory = state->memory;
+
+        // The other harts get their own L1 in front of the same memory, each with its own trace file
+        for (int i=1; i<state->n_harts; i++) {
+            CacheConfig config = cache_config;
+            snprintf(config.trace_file_name, sizeof(config.trace_file_name), "%s.hart%d", cache_config.trace_file_name, i);
+            state->harts[i].memory = new_shared_vmem(config, state->memory);
+        }
+
+        if (cache_config.has_cache && state->n_harts > 1 && cache_config.coherence != NO_COHERENCE) {
+            state->bus = new_bus(cache_config.coherence, cache_config.block_size, MEMORY_SIZE);
+            if (state->bus) for (int i=0; i<state->n_harts; i++) attach_cache(state->bus, state->harts[i].memory);
+        }
     } else {
-        reset_cache(memory);
+        for (int i=0; i<state->n_harts; i++) reset_cache(state->harts[i].memory);
+        if (state->bus) reset_bus(state->bus);
+        for (int i=0; i<state->breakpoint_conditions->len; i++) ((bp_condition*) state->breakpoint_conditions->values[i])->hits = 0;
+    }
+    memset(state->memory_data, 0, MEMORY_SIZE);
+
+    if (!state->decode_cache) {
+        set_program_layout(&state->layout);
+        return;
+    }
+
+    memset(state->decode_cache, 0, sizeof(decoded_instruction)*((state->layout.text_end-state->layout.text_start)/2+1));
+    reset_harts();
+    reset_syscalls(state->layout.heap_start);
+}
+
+// Restarts the program after it was reassembled, without the hard reset a load does. The caches keep their contents and
+// stats, and only the parts of memory that differ from the new template are written (and reloaded into the caches).
+// The text segment must not have moved. Returns the number of bytes written
+uint64_t reload_backend(program_layout* new_layout, uint8_t* template, vec* addresses) {
+    uint64_t patched = 0;
+    int n_memories = state->bus?1:state->n_harts; // Syncing one cache on the bus syncs all of them
+
+    // Memory has to hold what the caches hold before it can be compared
+    for (int i=0; i<n_memories; i++) sync_cache_to_memory(state->harts[i].memory, 0, MEMORY_SIZE);
+
+    for (uint64_t addr=0; addr<MEMORY_SIZE; addr+=RELOAD_CHUNK) {
+        uint64_t len = MEMORY_SIZE-addr < RELOAD_CHUNK?MEMORY_SIZE-addr:RELOAD_CHUNK;
+        if (!memcmp(state->memory_data+addr, template+addr, len)) continue;
+
+        memcpy(state->memory_data+addr, template+addr, len);
+        for (int i=0; i<n_memories; i++) sync_memory_to_cache(state->harts[i].memory, addr, len);
+        if (in_text(addr, len)) invalidate_decoded(addr, len);
+        patched += len;
+    }
+
+    state->layout.entry = new_layout->entry;
+    state->layout.stack_pointer = new_layout->stack_pointer;
+    state->layout.heap_start = new_layout->heap_start;
+    set_line_mapping(addresses);
+
+    for (int i=0; i<state->n_harts; i++) state->harts[i].memory->reservation = NO_RESERVATION;
+    for (int i=0; i<state->breakpoint_conditions->len; i++) ((bp_condition*) state->breakpoint_conditions->values[i])->hits = 0;
+    reset_harts();
+    reset_syscalls(state->layout.heap_start);
+    return patched;
+}
+
+bool flush_guest_memory(uint64_t addr, uint64_t len) {
+    if (addr > MEMORY_SIZE || len > MEMORY_SIZE - addr) return false;
+    int n_memories = state->bus?1:state->n_harts;
+
+    for (int i=0; i<n_memories; i++) sync_cache_to_memory(state->harts[i].memory, addr, len);
+    return true;
+}
+
+bool guest_memory_written(uint64_t addr, uint64_t len) {
+    if (addr > MEMORY_SIZE || len > MEMORY_SIZE - addr) return false;
+    int n_memories = state->bus?1:state->n_harts;
+
+    for (int i=0; i<n_memories; i++) sync_memory_to_cache(state->harts[i].memory, addr, len);
+    for (int i=0; i<state->n_harts; i++) break_reservation(state->harts[i].memory, addr, len);
+    if (in_text(addr, len)) invalidate_decoded(addr, len);
+    return true;
+}
+
+bool read_guest_memory(uint64_t addr, void* buf, uint64_t len) {
+    if (!flush_guest_memory(addr, len)) return false;
+
+    memcpy(buf, state->memory_data+addr, len);
+    return true;
+}
+
+bool write_guest_memory(uint64_t addr, const void* buf, uint64_t len) {
+    if (addr > MEMORY_SIZE || len > MEMORY_SIZE - addr) return false;
+
+    memcpy(state->memory_data+addr, buf, len);
+    return guest_memory_written(addr, len);
+}
+
+static inline int64_t remap_line(uint64_t line, int changed_start, int old_end, int new_end) {
+    if (line < changed_start) return line;
+    if (line >= old_end) return line - old_end + new_end;
+    return -1;
+}
+
+void remap_breakpoints(int changed_start, int old_end, int new_end) {
+    size_t kept = 0;
+
+    for (size_t i=0; i<state->breakpoints->len; i++) {
+        int64_t line = remap_line(state->breakpoints->values[i], changed_start, old_end, new_end);
+        if (line != -1) state->breakpoints->values[kept++] = line;
     }
-    memset(registers, 0, sizeof(registers));
-    memset(memory_data, 0, MEMORY_SIZE);
-    pc = 0;
+    state->breakpoints->len = kept;
+
+    kept = 0;
+    for (size_t i=0; i<state->breakpoint_conditions->len; i++) {
+        bp_condition* cond = (bp_condition*) state->breakpoint_conditions->values[i];
+        int64_t line = remap_line(cond->line, changed_start, old_end, new_end);
+
+        if (line == -1) free_condition(cond);
+        else {
+            cond->line = line;
+            state->breakpoint_conditions->values[kept++] = (uint64_t) cond;
+        }
+    }
+    state->breakpoint_conditions->len = kept;
 }
 
 void destroy_backend() {
-    if (memory) free_vmem(memory);
-    if (breakpoints) free_managed_array(breakpoints);
+    free_syscalls();
+    if (state->decode_cache) free(state->decode_cache);
+    if (state->pc_lines) free(state->pc_lines);
+    if (state->breakpoint_conditions) free_conditions();
+    if (state->watchpoints) free_watch_list(state->watchpoints);
+    free_hart_memories();
+    if (state->breakpoints) free_managed_array(state->breakpoints);
+    for (int i=1; i<MAX_HARTS; i++) if (state->harts[i].stack) st_free(state->harts[i].stack);
 }
 
-// Implementation of the STEP command
-int step() {
-    if (pc+3 >= DATA_BASE) {
-        show_error("Segmentation Fault! PC ran into data segment");
-        return 3;
+// Reports reads and writes of watched registers by an instruction
+static void watch_registers(decoded_instruction* d, watch_list* watchpoints) {
+    switch (d->opcode) {
+        case R_Type:
+        case R32_Type:
+        case S_Type:
+        case B_Type:
+        case AMO:
+            watch_register_access(watchpoints, d->rs2, WATCH_READ);
+            // fall through
+        case I_Type:
+        case I32_Type:
+        case JALR:
+        case Load_Type:
+            watch_register_access(watchpoints, d->rs1, WATCH_READ);
     }
 
-    // Deconstruct instruction
-    uint32_t instruction = (memory_data[pc+3] << 24) | (memory_data[pc+2] << 16) | (memory_data[pc+1] << 8) |  memory_data[pc];
-    uint32_t funct_op = 0;
-    uint64_t imm = 0;
-    uint64_t *rd = registers + ((0x00000F80 & instruction) >> 7);
-    uint64_t *rs1 = registers + ((0x000F8000 & instruction) >> 15);
-    uint64_t *rs2 = registers + ((0x01F00000 & instruction) >> 20);
+    if (d->writes_rd) watch_register_access(watchpoints, d->rd, WATCH_WRITE);
+}
+
+// Shows which watchpoint was hit by the instruction at line and re-arms the watchpoints
+static void report_watchpoint(hart* h, int line) {
+    watchpoint* wp = &state->watchpoints->entries[state->watchpoints->hit];
+    const char* verb = state->watchpoints->hit_kind == WATCH_READ?"read":"wrote";
 
-    uint64_t data;
+    if (wp->is_register) show_error("Watchpoint hit! line %d %s x%02lu = 0x%016lX", line, verb, wp->start, h->registers[wp->start]);
+    else show_error("Watchpoint hit! line %d %s 0x%08lX (watching 0x%08lX-0x%08lX)", line, verb, state->watchpoints->hit_addr, wp->start, wp->end-1);
+
+    state->watchpoints->triggered = false;
+}
+
+// Decodes the instruction at addr, expanding it first if it is compressed. Returns 1 if it is not a valid instruction
+static int decode(uint64_t addr, decoded_instruction* d) {
+    uint16_t parcel = (state->memory_data[addr+1] << 8) | state->memory_data[addr];
+    uint32_t instruction;
+
+    if (IS_COMPRESSED(parcel)) {
+        instruction = expand_compressed(parcel);
+        if (parcel && !instruction) return 1;
+        d->length = 2;
+    } else {
+        if (addr+3 >= state->layout.text_end) return 1;
+        instruction = (state->memory_data[addr+3] << 24) | (state->memory_data[addr+2] << 16) | (parcel);
+        d->length = 4;
+    }
+
+    d->opcode = instruction & 0x7F;
+    d->rd = (0x00000F80 & instruction) >> 7;
+    d->rs1 = (0x000F8000 & instruction) >> 15;
+    d->rs2 = (0x01F00000 & instruction) >> 20;
+    d->imm = 0;
+    d->writes_rd = false;
 
     // Match instruction type, extract immediate and funct bits appropriately
-    switch (instruction & 0x7F) {
+    switch (d->opcode) {
         case R_Type:
-            funct_op = instruction & 0xFE00707F;
-            set_reg_write(rd - registers);
+        case R32_Type:
+            d->funct_op = instruction & 0xFE00707F;
+            d->writes_rd = true;
+            break;
+
+        case AMO: // The aq and rl bits are ignored, every access is already sequentially consistent
+            d->funct_op = instruction & 0xF800707F;
+            d->writes_rd = true;
             break;
 
         case I_Type:
+        case I32_Type:
         case JALR:
         case Load_Type:
-            imm = (instruction & 0xFFF00000) >> 20;
-            imm |= (imm & 0x800)?0xFFFFFFFFFFFFF000:0; // Sign Bit extension
-            funct_op = instruction & 0x0000707F;
-            set_reg_write(rd - registers);
+            d->imm = (instruction & 0xFFF00000) >> 20;
+            d->imm |= (d->imm & 0x800)?0xFFFFFFFFFFFFF000:0; // Sign Bit extension
+            d->funct_op = instruction & 0x0000707F;
+            d->writes_rd = true;
             break;
 
         case S_Type:
-            imm = ((instruction & 0xFE000000) >> 20) + ((instruction & 0x00000F80) >> 7);
-            imm |= (imm & 0x800)?0xFFFFFFFFFFFFF000:0; // Sign Bit extension
-            funct_op = instruction & 0x0000707F;
+            d->imm = ((instruction & 0xFE000000) >> 20) + ((instruction & 0x00000F80) >> 7);
+            d->imm |= (d->imm & 0x800)?0xFFFFFFFFFFFFF000:0; // Sign Bit extension
+            d->funct_op = instruction & 0x0000707F;
             break;
 
         case B_Type:
-            imm = (((instruction & 0x80000000) >> 19) + ((instruction & 0x7E000000) >> 20) + ((instruction & 0x00000F00) >> 7) + ((instruction & 0x00000080) << 4));
-            imm |= (imm & 0x1000)?0xFFFFFFFFFFFFF000:0; // Sign Bit extension
-            funct_op = instruction & 0x0000707F;
+            d->imm = (((instruction & 0x80000000) >> 19) + ((instruction & 0x7E000000) >> 20) + ((instruction & 0x00000F00) >> 7) + ((instruction & 0x00000080) << 4));
+            d->imm |= (d->imm & 0x1000)?0xFFFFFFFFFFFFF000:0; // Sign Bit extension
+            d->funct_op = instruction & 0x0000707F;
             break;
 
         case EBREAK:
-            funct_op = instruction & 0x0010007F;
-            pc += 4;
-            return 0;
+            if (instruction & 0x00007000) { // CSR instructions, the CSR number is kept as the immediate
+                d->imm = instruction >> 20;
+                d->funct_op = instruction & 0x0000707F;
+                d->writes_rd = true;
+            } else d->funct_op = instruction & 0x0010007F;
+            break;
 
         case JAL:
-            imm = (((instruction & 0x000FF000)) + ((instruction & 0x00100000) >> 9) + ((instruction & 0x80000000) >> 11) + ((instruction & 0x7FE00000) >> 20));
-            imm |= (imm & 0x100000)?0xFFFFFFFFFFF00000:0; // Sign Bit extension
-            funct_op = instruction & 0x0000007F;
-            set_reg_write(rd - registers);
+            d->imm = (((instruction & 0x000FF000)) + ((instruction & 0x00100000) >> 9) + ((instruction & 0x80000000) >> 11) + ((instruction & 0x7FE00000) >> 20));
+            d->imm |= (d->imm & 0x100000)?0xFFFFFFFFFFF00000:0; // Sign Bit extension
+            d->funct_op = instruction & 0x0000007F;
+            d->writes_rd = true;
             break;
 
         case LUI:
         case AUIPC:
-            imm = (instruction & 0xFFFFF000) >> 12;
-            funct_op = instruction & 0x0000007F;
-            set_reg_write(rd - registers);
+            d->imm = (instruction & 0xFFFFF000) >> 12;
+            d->imm |= (d->imm & 0x80000)?0xFFFFFFFFFFF00000:0; // Sign Bit extension
+            d->funct_op = instruction & 0x0000007F;
+            d->writes_rd = true;
             break;
 
-        case NOP:
-            return 1;
+        default:
+            d->funct_op = instruction & 0x0000007F;
+    }
+
+    return 0;
+}
+
+static bool all_halted() {
+    for (int i=0; i<state->n_harts; i++) if (!state->harts[i].halted) return false;
+    return true;
+}
+
+// Reads a CSR of a hart. Returns false if it is not implemented
+static bool read_csr(hart* h, uint64_t csr, uint64_t* value) {
+    switch (csr) {
+        case CSR_MHARTID:
+            *value = h->id;
+            return true;
+    }
+
+    return false;
+}
+
+// Writes to memory for a hart, breaking the reservations other harts hold on what it overwrote.
+// With multiple harts, the caller must hold store_lock
+static void write_memory(hart* h, uint64_t addr, uint64_t value, int size) {
+    switch (size) {
+        case 1: write_data_byte(h->memory, addr, value); break;
+        case 2: write_data_halfword(h->memory, addr, value); break;
+        case 4: write_data_word(h->memory, addr, value); break;
+        case 8: write_data_doubleword(h->memory, addr, value); break;
+    }
+
+    for (int i=0; i<state->n_harts; i++) {
+        if (&state->harts[i] != h) break_reservation(state->harts[i].memory, addr, size);
+    }
+
+    if (in_text(addr, size)) invalidate_decoded(addr, size);
+}
+
+static void store(hart* h, uint64_t addr, uint64_t value, int size) {
+    if (state->n_harts > 1) pthread_mutex_lock(&state->store_lock);
+    write_memory(h, addr, value, size);
+    if (state->n_harts > 1) pthread_mutex_unlock(&state->store_lock);
+}
+
+// Executes lr, sc and the AMOs. The read, operation and write are done under store_lock so no other hart's store can land in between.
+// Returns 3 on an error
+static int execute_atomic(hart* h, decoded_instruction* d, int line) {
+    uint64_t addr = h->registers[d->rs1];
+    uint64_t src = h->registers[d->rs2];
+    bool word = (d->funct_op & 0x7000) == 0x2000;
+    int size = word?4:8;
+    uint64_t loaded = 0, result = 0;
+
+    if (addr & (size-1)) {
+        show_error("Misaligned atomic! line %d accessed 0x%08lX, which is not aligned to %d bytes", line, addr, size);
+        return 3;
+    }
+
+    if (addr + size - 1 >= MEMORY_SIZE) {
+        show_error("Invalid Memory Access! line %d attempted an atomic access at 0x%08lX", line, addr);
+        return 3;
+    }
+
+    if (d->funct_op != lr_w && d->funct_op != lr_d && !state->text_write_enabled && in_text(addr, size)) {
+        show_error("Invalid Memory Access! line %d attempted to write 0x%08lX, smc is not enabled.", line, addr);
+        return 3;
+    }
+
+    if (word) src = (int64_t) (int32_t) src;
+
+    pthread_mutex_lock(&state->store_lock);
+
+    // sc does not read memory, everything else loads the old value (sign extended for word sized ones)
+    if (d->funct_op != sc_w && d->funct_op != sc_d) {
+        loaded = word?(int64_t) (int32_t) read_data_word(h->memory, addr):read_data_doubleword(h->memory, addr);
+        result = loaded;
+    }
+
+    switch (d->funct_op) {
+        case lr_w:
+        case lr_d:
+            reserve(h->memory, addr);
+            break;
+
+        case sc_w:
+        case sc_d:
+            result = 1;
+            if (take_reservation(h->memory, addr)) {
+                write_memory(h, addr, src, size);
+                result = 0;
+            }
+            break;
+
+        case amoswap_w:
+        case amoswap_d:
+            write_memory(h, addr, src, size);
+            break;
+
+        case amoadd_w:
+        case amoadd_d:
+            write_memory(h, addr, loaded + src, size);
+            break;
+
+        case amoxor_w:
+        case amoxor_d:
+            write_memory(h, addr, loaded ^ src, size);
+            break;
+
+        case amoand_w:
+        case amoand_d:
+            write_memory(h, addr, loaded & src, size);
+            break;
+
+        case amoor_w:
+        case amoor_d:
+            write_memory(h, addr, loaded | src, size);
+            break;
+
+        case amomin_w:
+        case amomin_d:
+            write_memory(h, addr, (int64_t) loaded < (int64_t) src?loaded:src, size);
+            break;
+
+        case amomax_w:
+        case amomax_d:
+            write_memory(h, addr, (int64_t) loaded > (int64_t) src?loaded:src, size);
+            break;
+
+        // Word sized values are sign extended, so only the lower 32 bits are compared
+        case amominu_w:
+            write_memory(h, addr, (uint32_t) loaded < (uint32_t) src?loaded:src, size);
+            break;
+
+        case amomaxu_w:
+            write_memory(h, addr, (uint32_t) loaded > (uint32_t) src?loaded:src, size);
+            break;
+
+        case amominu_d:
+            write_memory(h, addr, loaded < src?loaded:src, size);
+            break;
+
+        case amomaxu_d:
+            write_memory(h, addr, loaded > src?loaded:src, size);
+            break;
 
         default:
-            funct_op = instruction & 0x0000007F;
+            pthread_mutex_unlock(&state->store_lock);
+            show_error("Illegal instruction! line %d is not a valid atomic instruction", line);
+            return 3;
+    }
+
+    pthread_mutex_unlock(&state->store_lock);
+    h->registers[d->rd] = result;
+    return 0;
+}
+
+// Runs one instruction on a hart.
+// Returns 0 normally, 1 once the hart has nothing more to run, 2 at a breakpoint, 3 on an error and 4 at a watchpoint
+static int step_hart(hart* h) {
+    if (program_exited(NULL)) return 1;
+    if (h->halted) return 1;
+    // Watchpoints are armed on hart 0's L1, but apply to every hart. Harts may share an L1, which host threads must not all write
+    if (h->memory->watches != state->memory->watches) h->memory->watches = state->memory->watches;
+
+    if (h->pc < state->layout.text_start || h->pc+1 >= state->layout.text_end) {
+        show_error("Segmentation Fault! PC 0x%08lX is outside the text segment", h->pc);
+        return 3;
+    }
+
+    int line = pc_line(h->pc)+1; // Line number as shown in the code pane, for error messages
+
+    // Decode the instruction, unless it is already in the decode cache
+    decoded_instruction* d = &state->decode_cache[(h->pc-state->layout.text_start)/2];
+    if (!d->length && decode(h->pc, d)) {
+        d->length = 0;
+        show_error("Illegal instruction at 0x%08lX", h->pc);
+        return 3;
+    }
+
+    uint32_t funct_op = d->funct_op;
+    uint64_t imm = d->imm;
+    uint64_t *rd = h->registers + d->rd;
+    uint64_t *rs1 = h->registers + d->rs1;
+    uint64_t *rs2 = h->registers + d->rs2;
+    uint64_t next_pc = h->pc + d->length;
+    uint64_t data;
+
+    switch (d->opcode) {
+        case EBREAK:
+            if (funct_op != ebreak) break; // ecall and CSR instructions
+            h->pc = next_pc;
+            return 0;
+
+        case NOP:
+            h->halted = true;
+            return 1;
     }
+
+    if (d->writes_rd) h->last_reg_write = d->rd;
     
     // Update the line number on the stack
-    st_update(stack, (pc/4)+1);
+    st_update(h->stack, line);
 
-    // Execute the instruction. All registers are unsigned by default. Only signed comparisons and offsets have to be type casted  
+    if (h->memory->watches) watch_registers(d, h->memory->watches);
+
+    // Execute the instruction. All h->registers are unsigned by default. Only signed comparisons and offsets have to be type casted  
     switch (funct_op) {
         case add:
             *rd = *rs1 + *rs2;
@@ -206,15 +821,15 @@ int step() {
             break;
 
         case sll:
-            *rd = *rs1 << *rs2;
+            *rd = *rs1 << (*rs2 & 0x3F);
             break;
 
         case srl:
-            *rd = *rs1 >> *rs2;
+            *rd = *rs1 >> (*rs2 & 0x3F);
             break;
 
         case sra:
-            *rd = (*rs1 >> *rs2) + ~((~0) >> *rs2);
+            *rd = (int64_t) *rs1 >> (*rs2 & 0x3F);
             break;
 
         case slt:
@@ -225,10 +840,108 @@ int step() {
             *rd = (*rs1 < *rs2)?1:0;
             break;
 
+        // M extension. Division by zero and overflow do not trap, results are as defined by the spec
+        case mul:
+            *rd = *rs1 * *rs2;
+            break;
+
+        case mulh:
+            *rd = ((__int128) (int64_t) *rs1 * (__int128) (int64_t) *rs2) >> 64;
+            break;
+
+        case mulhsu:
+            *rd = ((__int128) (int64_t) *rs1 * (unsigned __int128) *rs2) >> 64;
+            break;
+
+        case mulhu:
+            *rd = ((unsigned __int128) *rs1 * (unsigned __int128) *rs2) >> 64;
+            break;
+
+        case div_:
+            if (*rs2 == 0) *rd = ~(uint64_t) 0;
+            else if ((int64_t) *rs1 == INT64_MIN && (int64_t) *rs2 == -1) *rd = *rs1;
+            else *rd = (int64_t) *rs1 / (int64_t) *rs2;
+            break;
+
+        case divu:
+            *rd = (*rs2 == 0)?~(uint64_t) 0:*rs1 / *rs2;
+            break;
+
+        case rem:
+            if (*rs2 == 0) *rd = *rs1;
+            else if ((int64_t) *rs1 == INT64_MIN && (int64_t) *rs2 == -1) *rd = 0;
+            else *rd = (int64_t) *rs1 % (int64_t) *rs2;
+            break;
+
+        case remu:
+            *rd = (*rs2 == 0)?*rs1:*rs1 % *rs2;
+            break;
+
+        // Word sized variants operate on the lower 32 bits and sign extend the 32 bit result
+        case mulw:
+            *rd = (int64_t) (int32_t) (*rs1 * *rs2);
+            break;
+
+        case divw:
+            if ((uint32_t) *rs2 == 0) *rd = ~(uint64_t) 0;
+            else if ((int32_t) *rs1 == INT32_MIN && (int32_t) *rs2 == -1) *rd = (int64_t) INT32_MIN;
+            else *rd = (int64_t) ((int32_t) *rs1 / (int32_t) *rs2);
+            break;
+
+        case divuw:
+            if ((uint32_t) *rs2 == 0) *rd = ~(uint64_t) 0;
+            else *rd = (int64_t) (int32_t) ((uint32_t) *rs1 / (uint32_t) *rs2);
+            break;
+
+        case remw:
+            if ((uint32_t) *rs2 == 0) *rd = (int64_t) (int32_t) *rs1;
+            else if ((int32_t) *rs1 == INT32_MIN && (int32_t) *rs2 == -1) *rd = 0;
+            else *rd = (int64_t) ((int32_t) *rs1 % (int32_t) *rs2);
+            break;
+
+        case remuw:
+            if ((uint32_t) *rs2 == 0) *rd = (int64_t) (int32_t) *rs1;
+            else *rd = (int64_t) (int32_t) ((uint32_t) *rs1 % (uint32_t) *rs2);
+            break;
+
         case addi:
             *rd = *rs1 + imm;
             break;
 
+        // RV64 word sized instructions (OP-32 and OP-IMM-32)
+        case addw:
+            *rd = (int64_t) (int32_t) (*rs1 + *rs2);
+            break;
+
+        case subw:
+            *rd = (int64_t) (int32_t) (*rs1 - *rs2);
+            break;
+
+        case sllw:
+            *rd = (int64_t) (int32_t) ((uint32_t) *rs1 << (*rs2 & 0x1F));
+            break;
+
+        case srlw:
+            *rd = (int64_t) (int32_t) ((uint32_t) *rs1 >> (*rs2 & 0x1F));
+            break;
+
+        case sraw:
+            *rd = (int64_t) ((int32_t) *rs1 >> (*rs2 & 0x1F));
+            break;
+
+        case addiw:
+            *rd = (int64_t) (int32_t) (*rs1 + imm);
+            break;
+
+        case slliw:
+            *rd = (int64_t) (int32_t) ((uint32_t) *rs1 << (imm & 0x1F));
+            break;
+
+        case srliw:
+            if (imm & 0x400) *rd = (int64_t) ((int32_t) *rs1 >> (imm & 0x1F)); //sraiw
+            else *rd = (int64_t) (int32_t) ((uint32_t) *rs1 >> (imm & 0x1F)); //srliw
+            break;
+
         case xori:
             *rd = *rs1 ^ imm;
             break;
@@ -242,12 +955,12 @@ int step() {
             break;
 
         case slli:
-            *rd = *rs1 << imm;
+            *rd = *rs1 << (imm & 0x3F);
             break;
 
         case srli:
-            if (imm & 0x20) *rd = (*rs1 >> imm) + ~((~0) >> imm); //srai
-            else  *rd = *rs1 >> imm; //srli
+            if (imm & 0x400) *rd = (int64_t) *rs1 >> (imm & 0x3F); //srai
+            else  *rd = *rs1 >> (imm & 0x3F); //srli
             break;
 
         case slti:
@@ -260,165 +973,166 @@ int step() {
 
         case lb:
             if (*rs1 + imm >= MEMORY_SIZE) {
-                show_error("Invalid Memory Access! line %d attempted to read byte at 0x%08lX", pc/4, (*rs1 + imm));
+                show_error("Invalid Memory Access! line %d attempted to read byte at 0x%08lX", line, (*rs1 + imm));
                 return 3;
             }
             // data = *(memory_data + *rs1 + imm);
-            data = read_data_byte(memory, *rs1 + imm);
+            data = read_data_byte(h->memory, *rs1 + imm);
             if (data&0x00000080) data |= 0xFFFFFFFFFFFFFF00;
             *rd = data;
             break;
 
         case lh:
             if (*rs1 + imm + 1 >= MEMORY_SIZE) {
-                show_error("Invalid Memory Access! line %d attempted to read hword at 0x%08lX", pc/4, (*rs1 + imm));
+                show_error("Invalid Memory Access! line %d attempted to read hword at 0x%08lX", line, (*rs1 + imm));
                 return 3;
             }
             // data = *(uint16_t*)(memory_data + *rs1 + imm);
-            data = read_data_halfword(memory, *rs1 + imm);
+            data = read_data_halfword(h->memory, *rs1 + imm);
             if (data&0x00008000) data |= 0xFFFFFFFFFFFF0000;
             *rd = data;
             break;
 
         case lw:
             if (*rs1 + imm + 3 >= MEMORY_SIZE) {
-                show_error("Invalid Memory Access! line %d attempted to read word at 0x%08lX", pc/4, (*rs1 + imm));
+                show_error("Invalid Memory Access! line %d attempted to read word at 0x%08lX", line, (*rs1 + imm));
                 return 3;
             }
             // data = *(uint32_t*)(memory_data + *rs1 + imm);
-            data = read_data_word(memory, *rs1 + imm);
+            data = read_data_word(h->memory, *rs1 + imm);
             if (data&0x80000000) data |= 0xFFFFFFFF00000000;
             *rd = data;
             break;
 
         case ld:
             if (*rs1 + imm + 7 >= MEMORY_SIZE) {
-                show_error("Invalid Memory Access! line %d attempted to read dword at 0x%08lX", pc/4, (*rs1 + imm));
+                show_error("Invalid Memory Access! line %d attempted to read dword at 0x%08lX", line, (*rs1 + imm));
                 return 3;
             }
             // data = *(uint64_t*)(memory_data + *rs1 + imm);
-            data = read_data_doubleword(memory, *rs1 + imm);
+            data = read_data_doubleword(h->memory, *rs1 + imm);
             *rd = data;
             break;
 
         case lbu:
             if (*rs1 + imm >= MEMORY_SIZE) {
-                show_error("Invalid Memory Access! line %d attempted to read byte at 0x%08lX", pc/4, (*rs1 + imm));
+                show_error("Invalid Memory Access! line %d attempted to read byte at 0x%08lX", line, (*rs1 + imm));
                 return 3;
             }
             // *rs1 = *(memory_data + *rs1 + imm);
-            *rd = read_data_byte(memory, *rs1 + imm);
+            *rd = read_data_byte(h->memory, *rs1 + imm);
             break;
 
         case lhu:
             if (*rs1 + imm + 1 >= MEMORY_SIZE) {
-                show_error("Invalid Memory Access! line %d attempted to read hword at 0x%08lX", pc/4, (*rs1 + imm));
+                show_error("Invalid Memory Access! line %d attempted to read hword at 0x%08lX", line, (*rs1 + imm));
                 return 3;
             }
             // *rs1 = *(uint16_t*)(memory_data + *rs1 + imm);
-            *rd = read_data_halfword(memory, *rs1 + imm);
+            *rd = read_data_halfword(h->memory, *rs1 + imm);
             break;
 
         case lwu:
             if (*rs1 + imm + 3 >= MEMORY_SIZE) {
-                show_error("Invalid Memory Access! line %d attempted to read word at 0x%08lX", pc/4, (*rs1 + imm));
+                show_error("Invalid Memory Access! line %d attempted to read word at 0x%08lX", line, (*rs1 + imm));
                 return 3;
             }
             // *rs1 = *(uint32_t*)(memory_data + *rs1 + imm);
-            *rd = read_data_word(memory, *rs1 + imm);
+            *rd = read_data_word(h->memory, *rs1 + imm);
             break;
 
         case sb:
             if (*rs1 + imm >= MEMORY_SIZE) {
-                show_error("Invalid Memory Access! line %d attempted to write byte at 0x%08lX", pc/4, (*rs1 + imm));
+                show_error("Invalid Memory Access! line %d attempted to write byte at 0x%08lX", line, (*rs1 + imm));
                 return 3;
             }
 
-            if (!text_write_enabled && *rs1 + imm < DATA_BASE) {
-                show_error("Invalid Memory Access! line %d attempted to write byte at 0x%08lX, smc is not enabled.", pc/4, (*rs1 + imm));
+            if (!state->text_write_enabled && in_text(*rs1 + imm, 1)) {
+                show_error("Invalid Memory Access! line %d attempted to write byte at 0x%08lX, smc is not enabled.", line, (*rs1 + imm));
                 return 3;
             }
-            write_data_byte(memory, *rs1 + imm, *rs2);
+            store(h, *rs1 + imm, *rs2, 1);
             // memcpy(memory_data + *rs1 + imm, rs2, 1);
             break;
 
         case sh:
             if (*rs1 + imm + 1 >= MEMORY_SIZE) {
-                show_error("Invalid Memory Access! line %d attempted to write hword at 0x%08lX", pc/4, (*rs1 + imm));
+                show_error("Invalid Memory Access! line %d attempted to write hword at 0x%08lX", line, (*rs1 + imm));
                 return 3;
             }
 
-            if (!text_write_enabled && *rs1 + imm< DATA_BASE) {
-                show_error("Invalid Memory Access! line %d attempted to write hword at 0x%08lX, smc is not enabled.", pc/4, (*rs1 + imm));
+            if (!state->text_write_enabled && in_text(*rs1 + imm, 2)) {
+                show_error("Invalid Memory Access! line %d attempted to write hword at 0x%08lX, smc is not enabled.", line, (*rs1 + imm));
                 return 3;
             }
-            write_data_halfword(memory, *rs1 + imm, *rs2);
+            store(h, *rs1 + imm, *rs2, 2);
             // memcpy(memory_data + *rs1 + imm, rs2, 2);
             break;
         
         case sw:
             if (*rs1 + imm + 3 >= MEMORY_SIZE) {
-                show_error("Invalid Memory Access! line %d attempted to write word at 0x%08lX", pc/4, (*rs1 + imm));
+                show_error("Invalid Memory Access! line %d attempted to write word at 0x%08lX", line, (*rs1 + imm));
                 return 3;
             }
 
-            if (!text_write_enabled && *rs1 + imm< DATA_BASE) {
-                show_error("Invalid Memory Access! line %d attempted to write word at 0x%08lX, smc is not enabled.", pc/4, (*rs1 + imm));
+            if (!state->text_write_enabled && in_text(*rs1 + imm, 4)) {
+                show_error("Invalid Memory Access! line %d attempted to write word at 0x%08lX, smc is not enabled.", line, (*rs1 + imm));
                 return 3;
             }
-            write_data_word(memory, *rs1 + imm, *rs2);
+            store(h, *rs1 + imm, *rs2, 4);
             // memcpy(memory_data + *rs1 + imm, rs2, 4);
             break;
         
         case sd:
             if (*rs1 + imm + 7 >= MEMORY_SIZE) {
-                show_error("Invalid Memory Access! line %d attempted to write dword at 0x%08lX", pc/4, (*rs1 + imm));
+                show_error("Invalid Memory Access! line %d attempted to write dword at 0x%08lX", line, (*rs1 + imm));
                 return 3;
             }
 
-            if (!text_write_enabled && *rs1 + imm< DATA_BASE) {
-                show_error("Invalid Memory Access! line %d attempted to write dword at 0x%08lX, smc is not enabled.", pc/4, (*rs1 + imm));
+            if (!state->text_write_enabled && in_text(*rs1 + imm, 8)) {
+                show_error("Invalid Memory Access! line %d attempted to write dword at 0x%08lX, smc is not enabled.", line, (*rs1 + imm));
                 return 3;
             }
-            write_data_doubleword(memory, *rs1 + imm, *rs2);
+            store(h, *rs1 + imm, *rs2, 8);
             // memcpy(memory_data + *rs1 + imm, rs2, 8);
             break;
 
         case beq:
-            if (*rs1 == *rs2) pc += imm-4;
+            if (*rs1 == *rs2) next_pc = h->pc + imm;
             break;
 
         case bne:
-            if (*rs1 != *rs2) pc += imm-4;
+            if (*rs1 != *rs2) next_pc = h->pc + imm;
             break;
             
         case blt:
-            if ((int64_t) *rs1 < (int64_t) *rs2) pc += imm-4;
+            if ((int64_t) *rs1 < (int64_t) *rs2) next_pc = h->pc + imm;
             break;
             
         case bge:
-            if ((int64_t) *rs1 >= (int64_t) *rs2) pc += imm-4;
+            if ((int64_t) *rs1 >= (int64_t) *rs2) next_pc = h->pc + imm;
             break;
             
         case bltu:
-            if (*rs1 < *rs2) pc += imm-4;
+            if (*rs1 < *rs2) next_pc = h->pc + imm;
             break;
             
         case bgeu:
-            if (*rs1 >= *rs2) pc += imm-4;
+            if (*rs1 >= *rs2) next_pc = h->pc + imm;
             break;
 
         case jal:
-            *rd = pc + 4;
-            pc += imm - 4;
-            st_push(stack, 1 + pc/4);
-            st_update(stack, -1);
+            *rd = next_pc;
+            if (d->rd) st_push(h->stack, h->pc, next_pc, pc_line(h->pc + imm)); // Jumps that link are calls
+            next_pc = h->pc + imm;
             break;
 
         case jalr:
-            *rd = pc + 4;
-            pc = *rs1 + imm - 4;
-            st_pop(stack);
+            data = (*rs1 + imm) & ~1; // Target is computed first, since rd may be the same as rs1
+            *rd = next_pc;
+            if (d->rd) st_push(h->stack, h->pc, next_pc, pc_line(data));
+            else st_return(h->stack, data); // Only jumps to where a call returns to are returns
+            next_pc = data;
             break;
 
         case lui:
@@ -426,43 +1140,230 @@ int step() {
             break;
 
         case auipc:
-            *rd = pc + (imm << 12);
+            *rd = h->pc + (imm << 12);
             break;
 
         case ecall:
-        case ebreak:
+            pthread_mutex_lock(&state->hart_lock);
+            switch (handle_syscall(h->registers, h->memory, &state->layout)) {
+                case 2: // Hart called exit, the program ends with the last one
+                    h->halted = true;
+                    if (all_halted()) end_program((int32_t) h->registers[10]);
+                    // fall through
+                case 1: // Program called exit_group
+                    pthread_mutex_unlock(&state->hart_lock);
+                    h->pc = next_pc;
+                    st_clear(h->stack);
+                    return 1;
+                case 3:
+                    pthread_mutex_unlock(&state->hart_lock);
+                    return 3;
+            }
+            pthread_mutex_unlock(&state->hart_lock);
+            h->last_reg_write = 10;
+            break;
+
+        case csrrw:
+        case csrrs:
+        case csrrc:
+            if (!read_csr(h, imm & 0xFFF, &data)) {
+                show_error("Illegal instruction! line %d accesses unsupported CSR 0x%03lX", line, imm & 0xFFF);
+                return 3;
+            }
+
+            // Only read only CSRs are implemented, so anything but a plain read is illegal
+            if (funct_op == csrrw || d->rs1) {
+                show_error("Illegal instruction! line %d writes read only CSR 0x%03lX", line, imm & 0xFFF);
+                return 3;
+            }
+
+            *rd = data;
+            break;
+
+        // A extension
+        case lr_w:
+        case lr_d:
+        case sc_w:
+        case sc_d:
+        case amoswap_w:
+        case amoswap_d:
+        case amoadd_w:
+        case amoadd_d:
+        case amoxor_w:
+        case amoxor_d:
+        case amoand_w:
+        case amoand_d:
+        case amoor_w:
+        case amoor_d:
+        case amomin_w:
+        case amomin_d:
+        case amomax_w:
+        case amomax_d:
+        case amominu_w:
+        case amominu_d:
+        case amomaxu_w:
+        case amomaxu_d:
+            if (execute_atomic(h, d, line)) return 3;
             break;
     }
 
-    pc += 4; // Increment the PC
-    registers[0] = 0; // Make sure x0 doesn't change
+    h->pc = next_pc; // Move on to the next instruction
+    h->registers[0] = 0; // Make sure x0 doesn't change
 
-    if (memory_data[pc] == ebreak) { // stop if next instruction is a breakpoint
+    if (h->memory->watches && state->watchpoints->triggered) { // stop if a watchpoint was hit by this instruction
+        report_watchpoint(h, line);
+        return 4;
+    }
+
+    if (h->pc < state->layout.text_start || h->pc+1 >= state->layout.text_end) return 0;
+
+    uint16_t next_parcel = *(uint16_t*) (state->memory_data + h->pc);
+    if (next_parcel == c_ebreak || (h->pc+3 < state->layout.text_end && *(uint32_t*) (state->memory_data + h->pc) == ebreak)) { // stop if next instruction is a breakpoint
         return 2;
     }
 
-    if (memory_data[pc] == NOP) { // assume end of code if NOP is encountered.
-        st_clear(stack);
+    if (next_parcel == NOP) { // assume end of code if NOP is encountered.
+        st_clear(h->stack);
     }
 
-    for (int i=0; i<breakpoints->len; i++) { // stop if next instruction is a breakpoint
-        if (pc/4==breakpoints->values[i]) {
-            return 2;
+    int next_line = pc_line(h->pc);
+    for (int i=0; i<state->breakpoints->len; i++) { // stop if next instruction is a breakpoint (and its condition holds)
+        if (next_line==state->breakpoints->values[i]) {
+            bp_condition* cond = find_condition(state->breakpoint_conditions, next_line);
+            if (!cond || should_break(cond, h->registers, h->pc)) return 2;
+            break;
         }
     }
 
     return 0;
 }
 
+// Implementation of the STEP command. Runs one instruction of the current hart, moving on to the next
+// hart that has not halted once the current one has used up its quantum
+int step() {
+    if (state->slice >= state->quantum || state->harts[state->current].halted) {
+        state->slice = 0;
+        for (int i=0; i<state->n_harts; i++) {
+            state->current = (state->current+1) % state->n_harts;
+            if (!state->harts[state->current].halted) break;
+        }
+    }
+
+    int result = step_hart(&state->harts[state->current]);
+    state->slice++;
+
+    // A hart that halts hands over to the next one, the program only ends once all of them have
+    if (result == 1 && !program_exited(NULL) && !all_halted()) return step();
+    return result;
+}
+
+// Runs one instruction of hart id whatever hart's turn it is, like a debugger stepping one thread. The hart then has
+// the turn. A hart that has halted does not run, and the program only ends once every hart has
+int step_hart_id(int id) {
+    if (state->current != id) {
+        state->current = id;
+        state->slice = 0;
+    }
+
+    int result = step_hart(&state->harts[id]);
+    state->slice++;
+
+    if (result == 1 && !program_exited(NULL) && !all_halted()) return 0;
+    return result;
+}
+
+// What a host thread of fast mode runs. The thread has to select the simulator the hart belongs to itself, and keeps
+// its errors here, for the calling thread to show once the threads are joined
+typedef struct hart_thread {
+    backend_state* owner;
+    hart* h;
+    char error[HART_ERROR_LEN];
+} hart_thread;
+
+// Body of the host thread that runs a hart in fast mode
+static void* run_hart_thread(void* arg) {
+    hart_thread* thread = arg;
+    hart* h = thread->h;
+    int result;
+
+    select_backend(thread->owner);
+    set_error_buffer(thread->error, HART_ERROR_LEN);
+
+    while (!(result = step_hart(h)) && !state->stop_harts);
+
+    pthread_mutex_lock(&state->hart_lock);
+    if (result > 1 && !state->stop_harts) { // The first hart to stop decides why execution stopped
+        state->stop_harts = true;
+        state->stop_result = result;
+        state->current = h->id;
+    }
+    state->running_threads--;
+    pthread_mutex_unlock(&state->hart_lock);
+
+    return NULL;
+}
+
+// Runs every hart at full speed on its own host thread, until all of them halt, one stops or the user stops execution.
+// The watch list is not thread safe, so fast mode refuses to run while watchpoints are set
+static int run_fast(Command (*callback)(void)) {
+    pthread_t threads[MAX_HARTS];
+    hart_thread args[MAX_HARTS];
+    int started = 0;
+
+    if (state->memory->watches) {
+        show_error("Watchpoints are not checked in fast mode, clear them to run");
+        return 3;
+    }
+
+    // Decode all of the code up front, so threads never fill in the same decode cache entry at once
+    for (uint64_t addr=state->layout.text_start; addr+1<state->layout.text_end; addr+=2) {
+        decoded_instruction* d = &state->decode_cache[(addr-state->layout.text_start)/2];
+        if (pc_line(addr) != -1 && !d->length && decode(addr, d)) d->length = 0;
+    }
+
+    state->stop_harts = false;
+    state->stop_result = 0;
+    state->running_threads = state->n_harts;
+
+    for (; started<state->n_harts; started++) {
+        args[started] = (hart_thread) {state, &state->harts[started], ""};
+        if (pthread_create(&threads[started], NULL, run_hart_thread, &args[started])) {
+            pthread_mutex_lock(&state->hart_lock);
+            state->stop_harts = true;
+            state->stop_result = 3;
+            state->running_threads -= state->n_harts-started;
+            pthread_mutex_unlock(&state->hart_lock);
+            show_error("Failed to start a host thread for hart %d!", started);
+            break;
+        }
+    }
+
+    // Keep the frontend responsive while the harts run
+    while (state->running_threads) {
+        if ((*callback)() == STOP) state->stop_harts = true;
+    }
+
+    for (int i=0; i<started; i++) pthread_join(threads[i], NULL);
+
+    // Only the hart that stopped execution gets its say, like it would have running on this thread
+    if (state->stop_result && state->current < started && args[state->current].error[0]) show_error("%s", args[state->current].error);
+
+    if (state->stop_result) return state->stop_result;
+    return state->stop_harts?0:1;
+}
+
 // Runs till ebreak or end of program
 // Returns 0 if user requested termination
 // Returns 1 if end of program is reached
 // Returns 2 if breakpoint is reached
+// Returns 4 if a watchpoint is hit
 int run(Command (*callback)(void)) {
-    static time_t next_tick = 0;
-    static struct timeb time;
+    time_t next_tick = 0; // Every simulator and thread keeps its own pace, starting right away
+    struct timeb time;
     int result;
 
+    if (state->fast_mode) return run_fast(callback);
+
     while (1) {
         // Keep updating frontend while we wait out the delay between instructions
         do{
@@ -4,19 +4,90 @@
 #include "../assembler/vec.h"
 #include "stacktrace.h"
 #include "memory.h"
+#include "watchpoint.h"
 
 #define DATA_BASE 0x10000
 #define MEMORY_SIZE 0x50000 + 1 // Also used as end from which stack grows downward
 
+// Layout of a loaded program, filled in by the assembler or ELF loader
+typedef struct program_layout {
+    uint64_t text_start;    // Bounds of the text segment, instructions can only be executed from here
+    uint64_t text_end;
+    uint64_t entry;         // Initial PC
+    uint64_t stack_pointer; // Initial value of sp, 0 leaves it to the program
+    uint64_t heap_start;    // Initial program break, for brk
+} program_layout;
+
+#define MAX_HARTS 8
+#define HART_ERROR_LEN 256      // Longest error a host thread of fast mode keeps for the thread that runs it
+#define HART_STACK_SIZE 0x2000  // Each hart gets its own stack below the previous one's
+#define RELOAD_CHUNK 64         // Granularity at which a reload compares memory with the new program
+
+// A hardware thread. Harts share the guest memory, but each has its own registers, pc, stack trace and private L1
+typedef struct hart {
+    uint64_t registers[32];
+    uint64_t pc;
+    stacktrace* stack;
+    Memory* memory;         // Private L1, in front of the shared memory
+    uint64_t id;            // Value of mhartid
+    bool halted;            // Set once the hart exits or runs off the end of the code
+    uint64_t last_reg_write; // Register written by the hart's last instruction, for the TUI to highlight
+} hart;
+
+// Everything the backend keeps for one simulator. Until a thread selects an instance of its own, it uses a default one
+typedef struct backend_state backend_state;
+
+backend_state* new_backend_state();
+void free_backend_state(backend_state* state);
+
+// Makes the calling thread's backend calls work on state, NULL selects the default instance
+void select_backend(backend_state* state);
+backend_state* selected_backend();
+
 int step();
 int run();
+int step_hart_id(int id);  // Steps one hart instead of the one whose turn it is
+
+// Sets the number of harts, how many instructions each runs before the next gets a turn,
+// and whether run uses one host thread per hart. Takes effect on the next hard reset
+void set_hart_config(int n_harts, int quantum, bool fast);
+void set_text_write(bool enabled);  // Allows programs to write to their text segment (self modifying code)
+hart* get_harts_pointer();
+int get_hart_count();
+int get_current_hart();         // Hart that ran last, or stopped execution
+int get_address_line(uint64_t addr); // Line of the instruction starting at addr, -1 if there is none
 
 void reset_backend(bool hard, CacheConfig cache_config);
-void set_stacktrace_pointer(stacktrace* stacktrace);
+uint64_t reload_backend(program_layout* layout, uint8_t* template, vec* addresses);
+
+// Moves breakpoints along with their lines after a reload. Lines changed_start...old_end-1 were replaced by
+// changed_start...new_end-1, and breakpoints on them are dropped since there is no telling where their instructions went
+void remap_breakpoints(int changed_start, int old_end, int new_end);
+
+// Reads and writes guest memory for the host, through the caches but without counting as a simulated access.
+// Writes also drop cached decodes and reservations of what they overwrite. Return false if the range is out of memory
+bool read_guest_memory(uint64_t addr, void* buf, uint64_t len);
+bool write_guest_memory(uint64_t addr, const void* buf, uint64_t len);
+
+// For hosts that access memory_data directly. flush_guest_memory writes what the caches hold back to memory before
+// it is read, and guest_memory_written brings the caches, decodes and reservations up to date after it was written
+bool flush_guest_memory(uint64_t addr, uint64_t len);
+bool guest_memory_written(uint64_t addr, uint64_t len);
+
+// Gives hart 0 stacktrace and the other harts stack traces of their own over the same labels, all starting over.
+// Returns false, keeping the old ones, if they cannot be allocated
+bool set_stacktrace_pointer(stacktrace* stacktrace);
+void restart_stacktraces(); // Empties the stack traces of every hart, leaving the frame of the entry point
 void destroy_backend();
 uint64_t* get_register_pointer();
 uint64_t* get_pc_pointer();
+uint64_t* get_reg_write_pointer();
 vec* get_breakpoints_pointer();
+vec* get_breakpoint_conditions_pointer();
+watch_list* get_watchpoints_pointer();
+int* get_pc_lines_pointer();
+void set_program_layout(program_layout* layout);
+void set_line_mapping(vec* addresses);
 Memory* get_memory_pointer();
 CacheStats* get_cache_stats_pointer();
 
@@ -0,0 +1,188 @@
+#include <stdlib.h>
+#include <string.h>
+#include "coherence.h"
+#include "memory.h"
+
+Bus* new_bus(CoherenceProtocol protocol, uint64_t block_size, uint64_t memory_size) {
+    Bus* bus = calloc(1, sizeof(Bus));
+    if (!bus) return NULL;
+
+    bus->protocol = protocol;
+    bus->block_size = block_size;
+    bus->n_lines = (memory_size + block_size - 1) / block_size;
+    bus->lines = calloc(bus->n_lines, sizeof(LineCoherenceStats));
+    pthread_mutex_init(&bus->lock, NULL);
+
+    if (!bus->lines) {
+        free(bus);
+        return NULL;
+    }
+
+    return bus;
+}
+
+void attach_cache(Bus* bus, Memory* mem) {
+    if (bus->n_caches == BUS_MAX_CACHES) return;
+
+    int id = bus->n_caches;
+    bus->touched[id] = calloc(bus->n_lines, sizeof(uint64_t));
+    bus->lost[id] = calloc(bus->n_lines, sizeof(bool));
+    if (!bus->touched[id] || !bus->lost[id]) return;
+
+    bus->caches[id] = mem;
+    bus->n_caches++;
+    mem->bus = bus;
+    mem->bus_id = id;
+}
+
+// Bits of the touched mask covering bytes first...last-1 of a block. Blocks over 64 bytes use one bit per block_size/64 bytes
+static uint64_t byte_mask(Bus* bus, uint64_t first, uint64_t last) {
+    uint64_t granularity = bus->block_size <= 64?1:bus->block_size/64;
+    uint64_t mask = 0;
+
+    for (uint64_t i=first/granularity; i<=(last-1)/granularity; i++) mask |= (uint64_t) 1 << i;
+    return mask;
+}
+
+// Writes a modified line back to memory because another cache asked for it
+static void flush(Bus* bus, Memory* owner, uint8_t* line_ptr, uint64_t block_addr) {
+    memcpy(owner->data+block_addr, line_ptr + owner->masks.data_offset, bus->block_size);
+    owner->cache_stats.writebacks += 1;
+    bus->stats.flushes += 1;
+}
+
+// BusRd: other caches give up exclusive ownership of the line, flushing it if they modified it
+static void bus_read(Bus* bus, Memory* mem, uint64_t block_addr) {
+    bus->stats.transactions += 1;
+
+    for (int i=0; i<bus->n_caches; i++) {
+        if (i == mem->bus_id) continue;
+
+        uint8_t* line_ptr = lookup_line(bus->caches[i], block_addr);
+        if (!line_ptr) continue;
+
+        if (*line_ptr & DIRTY) flush(bus, bus->caches[i], line_ptr, block_addr);
+        *line_ptr &= ~(DIRTY | EXCLUSIVE);
+    }
+}
+
+// BusRdX/BusUpgr: every other copy of the line is invalidated, flushing it first if it was modified
+static void bus_invalidate(Bus* bus, Memory* mem, uint64_t block_addr, uint64_t write_mask) {
+    uint64_t n = block_addr / bus->block_size;
+    bus->stats.transactions += 1;
+
+    for (int i=0; i<bus->n_caches; i++) {
+        if (i == mem->bus_id) continue;
+
+        uint8_t* line_ptr = lookup_line(bus->caches[i], block_addr);
+        if (!line_ptr) continue;
+
+        if (*line_ptr & DIRTY) flush(bus, bus->caches[i], line_ptr, block_addr);
+        *line_ptr &= ~(VALID | DIRTY | EXCLUSIVE);
+
+        // Losing the line loses any reservation on it, which is what makes a contended sc fail
+        if (bus->caches[i]->reservation == block_addr) {
+            bus->caches[i]->reservation = NO_RESERVATION;
+            bus->stats.reservations_broken += 1;
+        }
+
+        bus->stats.invalidations += 1;
+        bus->lines[n].invalidations += 1;
+
+        // The other cache never used what was written, so it only lost the line because it shares the block
+        if (!(bus->touched[i][n] & write_mask)) {
+            bus->stats.false_sharing += 1;
+            bus->lines[n].false_sharing += 1;
+        }
+
+        bus->touched[i][n] = 0;
+        bus->lost[i][n] = true;
+    }
+}
+
+void snoop(Memory* mem, uint64_t addr, uint64_t size, bool write) {
+    Bus* bus = mem->bus;
+    int id = mem->bus_id;
+
+    for (uint64_t block_addr = addr & ~(bus->block_size-1); block_addr < addr+size; block_addr += bus->block_size) {
+        uint64_t n = block_addr / bus->block_size;
+        uint64_t first = addr > block_addr?addr-block_addr:0;
+        uint64_t last = addr+size < block_addr+bus->block_size?addr+size-block_addr:bus->block_size;
+        uint64_t mask = byte_mask(bus, first, last);
+        uint8_t* line_ptr = lookup_line(mem, block_addr);
+
+        if (!line_ptr && bus->lost[id][n]) {
+            bus->stats.coherence_misses += 1;
+            bus->lines[n].coherence_misses += 1;
+        }
+        if (!line_ptr) bus->lost[id][n] = false;
+
+        if (!write) {
+            if (!line_ptr) bus_read(bus, mem, block_addr);
+        } else if (!line_ptr || !(*line_ptr & (DIRTY | EXCLUSIVE)) || mem->cache_config.write_policy == WriteThrough) {
+            // Writes to lines in E or M stay local, anything else has to take the line from the other caches
+            bus_invalidate(bus, mem, block_addr, mask);
+            if (line_ptr) *line_ptr |= EXCLUSIVE;
+        }
+
+        bus->touched[id][n] |= mask;
+    }
+}
+
+bool fill_exclusive(Memory* mem, uint64_t block_addr) {
+    if (mem->bus->protocol != MESI) return false;
+
+    for (int i=0; i<mem->bus->n_caches; i++) {
+        if (i != mem->bus_id && lookup_line(mem->bus->caches[i], block_addr)) return false;
+    }
+
+    return true;
+}
+
+void forget_line(Memory* mem, uint64_t block_addr) {
+    uint64_t n = block_addr / mem->bus->block_size;
+    if (n < mem->bus->n_lines) mem->bus->touched[mem->bus_id][n] = 0;
+}
+
+char coherence_state(uint8_t flags) {
+    if (!(flags & VALID)) return 'I';
+    if (flags & DIRTY) return 'M';
+    if (flags & EXCLUSIVE) return 'E';
+    return 'S';
+}
+
+void reset_bus(Bus* bus) {
+    memset(&bus->stats, 0, sizeof(BusStats));
+    memset(bus->lines, 0, bus->n_lines*sizeof(LineCoherenceStats));
+
+    for (int i=0; i<bus->n_caches; i++) {
+        memset(bus->touched[i], 0, bus->n_lines*sizeof(uint64_t));
+        memset(bus->lost[i], 0, bus->n_lines*sizeof(bool));
+    }
+}
+
+// Writes the coherence stats of every line that had any coherence traffic
+void dump_coherence(Bus* bus, FILE* f) {
+    fprintf(f, "Bus transactions: %lu, Invalidations: %lu, Flushes: %lu, Coherence misses: %lu, False sharing: %lu, Reservations broken: %lu\n",
+        bus->stats.transactions, bus->stats.invalidations, bus->stats.flushes, bus->stats.coherence_misses, bus->stats.false_sharing, bus->stats.reservations_broken);
+
+    for (uint64_t i=0; i<bus->n_lines; i++) {
+        LineCoherenceStats* line = &bus->lines[i];
+        if (!line->invalidations && !line->coherence_misses) continue;
+
+        fprintf(f, "Line: 0x%08lx, Invalidations: %u, Coherence misses: %u, False sharing: %u\n",
+            i*bus->block_size, line->invalidations, line->coherence_misses, line->false_sharing);
+    }
+}
+
+void free_bus(Bus* bus) {
+    for (int i=0; i<bus->n_caches; i++) {
+        free(bus->touched[i]);
+        free(bus->lost[i]);
+        bus->caches[i]->bus = NULL;
+    }
+
+    pthread_mutex_destroy(&bus->lock);
+    free(bus->lines);
+    free(bus);
+}
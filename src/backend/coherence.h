@@ -0,0 +1,68 @@
+#ifndef COHERENCE_H
+#define COHERENCE_H
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#define BUS_MAX_CACHES 8
+#define EXCLUSIVE (uint8_t) 0b0010 // Line state flag, set while no other cache holds the line (E, or M together with DIRTY)
+
+typedef struct Memory Memory;
+
+typedef enum CoherenceProtocol {
+    NO_COHERENCE,
+    MSI,
+    MESI
+} CoherenceProtocol;
+
+typedef struct BusStats {
+    uint64_t transactions;      // BusRd, BusRdX and BusUpgr, as well as every write of a write through cache
+    uint64_t invalidations;     // Copies invalidated in other caches
+    uint64_t flushes;           // Modified lines written back because another cache asked for them
+    uint64_t coherence_misses;  // Misses on lines that were lost to an invalidation
+    uint64_t false_sharing;     // Invalidations where the writer touched none of the bytes the other cache had used
+    uint64_t reservations_broken; // lr reservations lost because another cache took the line
+} BusStats;
+
+typedef struct LineCoherenceStats {
+    uint32_t invalidations;
+    uint32_t coherence_misses;
+    uint32_t false_sharing;
+} LineCoherenceStats;
+
+// A snooping bus connecting the private caches of every hart
+typedef struct Bus {
+    CoherenceProtocol protocol;
+    Memory* caches[BUS_MAX_CACHES];
+    int n_caches;
+    uint64_t block_size;
+    uint64_t n_lines;                           // Number of blocks of memory
+    BusStats stats;
+    LineCoherenceStats* lines;                  // Stats of every block of memory
+    uint64_t* touched[BUS_MAX_CACHES];          // Bytes of each block a cache used since it got its copy (64 bits per block)
+    bool* lost[BUS_MAX_CACHES];                 // Whether a cache's copy of each block was invalidated by another cache
+    pthread_mutex_t lock;                       // Accesses are atomic on a real bus, this keeps them atomic between host threads
+} Bus;
+
+Bus* new_bus(CoherenceProtocol protocol, uint64_t block_size, uint64_t memory_size);
+void attach_cache(Bus* bus, Memory* mem);
+
+// Called before every access of a cache on the bus. Performs the bus transactions the access needs,
+// changing the state of the other caches (and flushing their modified copies) before the access reads memory
+void snoop(Memory* mem, uint64_t addr, uint64_t size, bool write);
+
+// Whether a line being filled can be taken in state E, which MESI allows when no other cache holds it
+bool fill_exclusive(Memory* mem, uint64_t block_addr);
+
+// Called when a cache evicts a line, so the bytes it used are forgotten
+void forget_line(Memory* mem, uint64_t block_addr);
+
+// Returns the state of a cache line as a letter (M, E, S or I)
+char coherence_state(uint8_t flags);
+
+void reset_bus(Bus* bus);
+void dump_coherence(Bus* bus, FILE* f);
+void free_bus(Bus* bus);
+
+#endif
@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include "condition.h"
+#include "../assembler/translator.h"
+#include "../frontend/error.h"
+
+typedef struct binary_op {
+    const char* token;
+    int precedence;
+    cond_op op;
+} binary_op;
+
+// Binary operators and their precedence (same as C). Longer tokens must come before their prefixes.
+static const binary_op binary_ops[] = {
+    "||", 1, COND_LOR,
+    "&&", 2, COND_LAND,
+    "==", 6, COND_EQ,
+    "!=", 6, COND_NE,
+    "<=", 7, COND_LE,
+    ">=", 7, COND_GE,
+    "<<", 8, COND_SHL,
+    ">>", 8, COND_SHR,
+    "<",  7, COND_LT,
+    ">",  7, COND_GT,
+    "|",  3, COND_OR,
+    "^",  4, COND_XOR,
+    "&",  5, COND_AND,
+    "+",  9, COND_ADD,
+    "-",  9, COND_SUB,
+    "*",  10, COND_MUL,
+};
+
+typedef struct parser {
+    char* pos;
+    cond_instr* code;
+    size_t len;
+    size_t capacity;
+    int depth;          // Current depth of the evaluation stack
+    bool failed;
+} parser;
+
+static void emit(parser* p, cond_op op, uint64_t operand) {
+    if (p->failed) return;
+
+    if (p->len == p->capacity) {
+        p->capacity *= 2;
+        cond_instr* code_new = realloc(p->code, p->capacity*sizeof(cond_instr));
+        if (!code_new) {
+            show_error("Out Of Memory!");
+            p->failed = true;
+            return;
+        }
+        p->code = code_new;
+    }
+
+    p->code[p->len].op = op;
+    p->code[p->len].operand = operand;
+    p->len++;
+
+    // Track how deep the stack gets, so evaluation can use a fixed size stack
+    if (op == COND_IMM || op == COND_REG || op == COND_PC) p->depth++;
+    else if (op > COND_INV) p->depth--;
+
+    if (p->depth > COND_STACK_SIZE) {
+        show_error("Breakpoint condition is too complex!");
+        p->failed = true;
+    }
+}
+
+static void skip_whitespace(parser* p) {
+    while (*p->pos == ' ' || *p->pos == '\t') p->pos++;
+}
+
+static void parse_expression(parser* p, int min_precedence);
+
+static void parse_unary(parser* p) {
+    skip_whitespace(p);
+    char c = *p->pos;
+
+    if (c == '!' || c == '~' || c == '-') {
+        p->pos++;
+        parse_unary(p);
+        emit(p, c=='!'?COND_NOT:c=='~'?COND_INV:COND_NEG, 0);
+        return;
+    }
+
+    if (c == '(') {
+        p->pos++;
+        parse_expression(p, 1);
+        skip_whitespace(p);
+        if (*p->pos != ')') {
+            show_error("Expected ) in breakpoint condition");
+            p->failed = true;
+            return;
+        }
+        p->pos++;
+        return;
+    }
+
+    if (isdigit(c)) {
+        char* end_ptr;
+        uint64_t value;
+
+        if (c == '0' && p->pos[1] == 'b') value = strtoul(p->pos+2, &end_ptr, 2);
+        else value = strtoul(p->pos, &end_ptr, 0);
+
+        p->pos = end_ptr;
+        emit(p, COND_IMM, value);
+        return;
+    }
+
+    if (isalpha(c)) {
+        char name[8];
+        int i = 0;
+
+        while (isalnum(*p->pos)) {
+            if (i == 7) {
+                show_error("Unknown register in breakpoint condition");
+                p->failed = true;
+                return;
+            }
+            name[i++] = *(p->pos++);
+        }
+        name[i] = '\0';
+
+        if (!strcmp(name, "pc")) {
+            emit(p, COND_PC, 0);
+            return;
+        }
+
+        int reg = parse_alias(name);
+        if (reg == -1) {
+            show_error("Unknown register in breakpoint condition: %s", name);
+            p->failed = true;
+            return;
+        }
+
+        emit(p, COND_REG, reg);
+        return;
+    }
+
+    show_error("Unexpected %s in breakpoint condition", c=='\0'?"end":"character");
+    p->failed = true;
+}
+
+// Precedence climbing parser
+static void parse_expression(parser* p, int min_precedence) {
+    parse_unary(p);
+
+    while (!p->failed) {
+        skip_whitespace(p);
+        const binary_op* op = NULL;
+
+        for (int i=0; i<sizeof(binary_ops)/sizeof(binary_op); i++) {
+            if (!strncmp(p->pos, binary_ops[i].token, strlen(binary_ops[i].token))) {
+                op = &binary_ops[i];
+                break;
+            }
+        }
+
+        if (!op || op->precedence < min_precedence) return;
+
+        p->pos += strlen(op->token);
+        parse_expression(p, op->precedence+1);
+        emit(p, op->op, 0);
+    }
+}
+
+bp_condition* compile_condition(char* expr, uint64_t line, uint64_t hit_target) {
+    bp_condition* cond = malloc(sizeof(bp_condition));
+    if (!cond) {
+        show_error("Out Of Memory!");
+        return NULL;
+    }
+
+    cond->line = line;
+    cond->hits = 0;
+    cond->hit_target = hit_target;
+    cond->code = NULL;
+    cond->len = 0;
+
+    if (!expr) return cond;
+
+    parser p;
+    p.pos = expr;
+    p.len = 0;
+    p.capacity = 8;
+    p.depth = 0;
+    p.failed = false;
+    p.code = malloc(p.capacity*sizeof(cond_instr));
+
+    if (!p.code) {
+        show_error("Out Of Memory!");
+        free(cond);
+        return NULL;
+    }
+
+    parse_expression(&p, 1);
+    skip_whitespace(&p);
+
+    if (!p.failed && *p.pos != '\0') {
+        show_error("Unexpected character in breakpoint condition: %c", *p.pos);
+        p.failed = true;
+    }
+
+    if (p.failed) {
+        free(p.code);
+        free(cond);
+        return NULL;
+    }
+
+    cond->code = p.code;
+    cond->len = p.len;
+    return cond;
+}
+
+// Registers are compared as signed values, since that is what students usually mean in a condition
+static uint64_t evaluate(bp_condition* cond, uint64_t* registers, uint64_t pc) {
+    int64_t stack[COND_STACK_SIZE];
+    int sp = -1;
+
+    for (int i=0; i<cond->len; i++) {
+        cond_instr* instr = &cond->code[i];
+
+        switch (instr->op) {
+            case COND_IMM: stack[++sp] = instr->operand; break;
+            case COND_REG: stack[++sp] = registers[instr->operand]; break;
+            case COND_PC:  stack[++sp] = pc; break;
+            case COND_NEG: stack[sp] = -stack[sp]; break;
+            case COND_NOT: stack[sp] = !stack[sp]; break;
+            case COND_INV: stack[sp] = ~stack[sp]; break;
+            case COND_MUL: sp--; stack[sp] = stack[sp] * stack[sp+1]; break;
+            case COND_ADD: sp--; stack[sp] = stack[sp] + stack[sp+1]; break;
+            case COND_SUB: sp--; stack[sp] = stack[sp] - stack[sp+1]; break;
+            case COND_SHL: sp--; stack[sp] = (uint64_t) stack[sp] << (stack[sp+1] & 0x3F); break;
+            case COND_SHR: sp--; stack[sp] = (uint64_t) stack[sp] >> (stack[sp+1] & 0x3F); break;
+            case COND_LT:  sp--; stack[sp] = stack[sp] < stack[sp+1]; break;
+            case COND_LE:  sp--; stack[sp] = stack[sp] <= stack[sp+1]; break;
+            case COND_GT:  sp--; stack[sp] = stack[sp] > stack[sp+1]; break;
+            case COND_GE:  sp--; stack[sp] = stack[sp] >= stack[sp+1]; break;
+            case COND_EQ:  sp--; stack[sp] = stack[sp] == stack[sp+1]; break;
+            case COND_NE:  sp--; stack[sp] = stack[sp] != stack[sp+1]; break;
+            case COND_AND: sp--; stack[sp] = stack[sp] & stack[sp+1]; break;
+            case COND_XOR: sp--; stack[sp] = stack[sp] ^ stack[sp+1]; break;
+            case COND_OR:  sp--; stack[sp] = stack[sp] | stack[sp+1]; break;
+            case COND_LAND: sp--; stack[sp] = stack[sp] && stack[sp+1]; break;
+            case COND_LOR: sp--; stack[sp] = stack[sp] || stack[sp+1]; break;
+        }
+    }
+
+    return stack[0];
+}
+
+bool should_break(bp_condition* cond, uint64_t* registers, uint64_t pc) {
+    if (cond->code && !evaluate(cond, registers, pc)) return false;
+
+    // Harts running on host threads in fast mode can get here at once
+    uint64_t hits = __atomic_add_fetch(&cond->hits, 1, __ATOMIC_RELAXED);
+    if (cond->hit_target && hits % cond->hit_target != 0) return false;
+
+    return true;
+}
+
+bp_condition* find_condition(vec* conditions, uint64_t line) {
+    for (int i=0; i<conditions->len; i++) {
+        bp_condition* cond = (bp_condition*) conditions->values[i];
+        if (cond->line == line) return cond;
+    }
+
+    return NULL;
+}
+
+void remove_condition(vec* conditions, uint64_t line) {
+    for (int i=0; i<conditions->len; i++) {
+        bp_condition* cond = (bp_condition*) conditions->values[i];
+        if (cond->line != line) continue;
+
+        free_condition(cond);
+        conditions->values[i] = conditions->values[conditions->len-1]; // Order does not matter, so swap with the last
+        conditions->len--;
+        return;
+    }
+}
+
+void free_condition(bp_condition* cond) {
+    if (cond->code) free(cond->code);
+    free(cond);
+}
@@ -0,0 +1,65 @@
+#ifndef CONDITION_H
+#define CONDITION_H
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "../assembler/vec.h"
+
+#define COND_STACK_SIZE 32 // Maximum depth of the evaluation stack
+
+// Operations of the small stack machine that breakpoint conditions are compiled to
+typedef enum cond_op {
+    COND_IMM,       // Push operand
+    COND_REG,       // Push registers[operand]
+    COND_PC,        // Push pc
+    COND_NEG,
+    COND_NOT,
+    COND_INV,
+    COND_MUL,
+    COND_ADD,
+    COND_SUB,
+    COND_SHL,
+    COND_SHR,
+    COND_LT,
+    COND_LE,
+    COND_GT,
+    COND_GE,
+    COND_EQ,
+    COND_NE,
+    COND_AND,
+    COND_XOR,
+    COND_OR,
+    COND_LAND,
+    COND_LOR,
+} cond_op;
+
+typedef struct cond_instr {
+    cond_op op;
+    uint64_t operand;
+} cond_instr;
+
+// Condition attached to a breakpoint. Conditions are parsed once when the breakpoint is set,
+// and only evaluated when execution reaches the line
+typedef struct bp_condition {
+    uint64_t line;          // Line (instruction index) of the breakpoint
+    uint64_t hits;          // Number of times the condition held since the last reset
+    uint64_t hit_target;    // Stop on every hit_target'th hit, 0 stops on every hit
+    cond_instr* code;       // NULL if there is no expression
+    size_t len;
+} bp_condition;
+
+// Compiles expr (which may be NULL) into a new condition. Returns NULL and shows an error if it fails to parse
+bp_condition* compile_condition(char* expr, uint64_t line, uint64_t hit_target);
+
+// Evaluates a condition and updates its hit count, returns true if execution should stop
+bool should_break(bp_condition* cond, uint64_t* registers, uint64_t pc);
+
+// Looks up the condition for a line in a vec of conditions, NULL if the breakpoint is unconditional
+bp_condition* find_condition(vec* conditions, uint64_t line);
+
+// Removes (and frees) the condition for a line from a vec of conditions, if present
+void remove_condition(vec* conditions, uint64_t line);
+
+void free_condition(bp_condition* cond);
+
+#endif
@@ -2,8 +2,7 @@
 #include "stdlib.h"
 #include "string.h"
 #include "math.h"
-#include "../frontend/frontend.h"
-#include "../globals.h" 
+#include "../frontend/error.h"
 
 #define SEC_TO_NS(sec) ((sec)*1000000000)
 
@@ -15,18 +14,28 @@ uint64_t nanos()
     return ns;
 }
 
-static bool last_acc_hit = false;
-
-Memory* new_vmem(CacheConfig cache_config) {
+static Memory* alloc_vmem(CacheConfig cache_config, uint8_t* data) {
     Memory* mem = malloc(sizeof(Memory));
     if (!mem) return NULL;
 
+    mem->data = data;
+    mem->owns_data = false;
+    mem->bus = NULL;
+    mem->reservation = NO_RESERVATION;
     mem->cache_config = cache_config;
+    mem->watches = NULL;
+    mem->set_misses = NULL;
+    mem->cache = NULL;
+    mem->heat = calloc(HEAT_REGIONS, sizeof(RegionHeat));
+    mem->written = calloc((MEMORY_SIZE + 7) / 8, sizeof(uint8_t));
+    if (!mem->heat || !mem->written) goto failed;
+
     if (cache_config.has_cache) {
         mem->masks.block_offset = sizeof(uint8_t) + sizeof(uint64_t) + sizeof(uint8_t) * cache_config.block_size + (cache_config.replacement_policy == RANDOM?0:sizeof(time_t));
         mem->cache = calloc(cache_config.n_blocks, mem->masks.block_offset);
         // mem->debug_info.info_table = calloc(cache_config.n_blocks, sizeof(uint8_t));
-        if (!mem->cache) return NULL;
+        mem->set_misses = calloc(cache_config.n_lines, sizeof(uint32_t));
+        if (!mem->cache || !mem->set_misses) goto failed;
 
         mem->masks.offset = (cache_config.block_size - 1);
         mem->masks.index = (cache_config.n_lines - 1) * cache_config.block_size;
@@ -35,8 +44,7 @@ Memory* new_vmem(CacheConfig cache_config) {
         mem->masks.timestamp_offset = mem->masks.block_offset - sizeof(uint64_t);
 
         mem->cache_config.trace_file = fopen(cache_config.trace_file_name, "w");
-    } else {
-        mem->cache = NULL;
+        if (!mem->cache_config.trace_file) mem->cache_config.trace_file = fopen("/dev/null", "w"); // The trace is written on every access
     }
 
     mem->cache_stats.access_count = 0;
@@ -46,6 +54,32 @@ Memory* new_vmem(CacheConfig cache_config) {
     mem->cache_stats.writebacks = 0;
 
     return mem;
+
+failed:
+    free(mem->cache);
+    free(mem->set_misses);
+    free(mem->heat);
+    free(mem->written);
+    free(mem);
+    return NULL;
+}
+
+Memory* new_vmem(CacheConfig cache_config) {
+    uint8_t* data = malloc(MEMORY_SIZE);
+    if (!data) return NULL;
+
+    Memory* mem = alloc_vmem(cache_config, data);
+    if (!mem) {
+        free(data);
+        return NULL;
+    }
+
+    mem->owns_data = true;
+    return mem;
+}
+
+Memory* new_shared_vmem(CacheConfig cache_config, Memory* owner) {
+    return alloc_vmem(cache_config, owner->data);
 }
 
 void reset_cache(Memory* memory) {
@@ -55,6 +89,18 @@ void reset_cache(Memory* memory) {
     memory->cache_stats.miss_count = 0;
     memory->cache_stats.hit_rate = 0;
     memory->cache_stats.writebacks = 0;
+    memory->reservation = NO_RESERVATION;
+    memset(memory->heat, 0, HEAT_REGIONS*sizeof(RegionHeat));
+    clear_written(memory);
+    if (memory->set_misses) memset(memory->set_misses, 0, memory->cache_config.n_lines*sizeof(uint32_t));
+}
+
+void clear_written(Memory* memory) {
+    memset(memory->written, 0, (MEMORY_SIZE + 7) / 8);
+}
+
+static inline void mark_written(Memory* mem, uint64_t addr, int size) {
+    for (uint64_t i=addr; i<addr+size; i++) mem->written[i/8] |= 1 << (i%8);
 }
 
 uint8_t* find_or_replace_data_line(Memory* mem, uint64_t addr, bool allocate, bool read, bool override_dirty) {
@@ -83,6 +129,8 @@ uint8_t* find_or_replace_data_line(Memory* mem, uint64_t addr, bool allocate, bo
     }
 
     mem->cache_stats.miss_count += 1;
+    mem->set_misses[index] += 1;
+    mem->heat[addr/HEAT_REGION].misses += 1;
     if (!allocate) {
         fprintf(mem->cache_config.trace_file, "%c: Address: 0x%lx, Set: 0x%lx, Miss, Tag: 0x%lx, %s\n", read?'R':'W', addr, index, tag/mem->cache_config.block_size/mem->cache_config.n_lines, "Clean");
         return NULL;
@@ -111,6 +159,12 @@ uint8_t* find_or_replace_data_line(Memory* mem, uint64_t addr, bool allocate, bo
 
     line_ptr += victim*mem->masks.block_offset;
 
+    if (*line_ptr & VALID) {
+        uint64_t victim_addr = *(uint64_t*) (line_ptr+1) | (addr & mem->masks.index);
+        if (mem->bus) forget_line(mem, victim_addr);
+        if (mem->reservation == victim_addr) mem->reservation = NO_RESERVATION;
+    }
+
     if ((*line_ptr & VALID) && (*line_ptr & DIRTY) && mem->cache_config.write_policy == WriteBack) {
         uint64_t ret_addr = *(uint64_t*) (line_ptr+1) | (addr & mem->masks.index);
         memcpy(mem->data+ret_addr, line_ptr + mem->masks.data_offset, mem->cache_config.block_size);
@@ -119,6 +173,7 @@ uint8_t* find_or_replace_data_line(Memory* mem, uint64_t addr, bool allocate, bo
     }
 
     *line_ptr = VALID;
+    if (mem->bus && fill_exclusive(mem, addr & ~mem->masks.offset)) *line_ptr |= EXCLUSIVE;
     *(uint64_t*)(line_ptr+1) = tag;
     memcpy(line_ptr+mem->masks.data_offset, mem->data+(addr&~mem->masks.offset), mem->cache_config.block_size);
     if (mem->cache_config.replacement_policy != RANDOM) *(line_ptr + mem->masks.timestamp_offset) = time(NULL);
@@ -128,17 +183,30 @@ uint8_t* find_or_replace_data_line(Memory* mem, uint64_t addr, bool allocate, bo
 }
 
 uint8_t read_data_byte(Memory* mem, uint64_t addr) {
+    mem->heat[addr/HEAT_REGION].reads += 1;
+    if (mem->watches) watch_memory_access(mem->watches, addr, 1, WATCH_READ);
     if (!mem->cache) return mem->data[addr];
+    if (mem->bus) {
+        pthread_mutex_lock(&mem->bus->lock);
+        snoop(mem, addr, 1, false);
+    }
     
 
     uint8_t* block_ptr = find_or_replace_data_line(mem, addr, true, true, false);
     
     mem->cache_stats.hit_rate = (double) mem->cache_stats.hit_count/mem->cache_stats.access_count;
+    if (mem->bus) pthread_mutex_unlock(&mem->bus->lock);
     return *(block_ptr + (addr & mem->masks.offset) );
 }
 
 uint16_t read_data_halfword(Memory* mem, uint64_t addr) {
+    mem->heat[addr/HEAT_REGION].reads += 1;
+    if (mem->watches) watch_memory_access(mem->watches, addr, 2, WATCH_READ);
     if (!mem->cache) return *(uint16_t*) (mem->data + addr);
+    if (mem->bus) {
+        pthread_mutex_lock(&mem->bus->lock);
+        snoop(mem, addr, 2, false);
+    }
     
 
     uint8_t* block_ptr = find_or_replace_data_line(mem, addr, true, true, false);
@@ -158,11 +226,18 @@ uint16_t read_data_halfword(Memory* mem, uint64_t addr) {
     }
 
     mem->cache_stats.hit_rate = (double) mem->cache_stats.hit_count/mem->cache_stats.access_count;
+    if (mem->bus) pthread_mutex_unlock(&mem->bus->lock);
     return result;
 }
 
 uint32_t read_data_word(Memory* mem, uint64_t addr) {
+    mem->heat[addr/HEAT_REGION].reads += 1;
+    if (mem->watches) watch_memory_access(mem->watches, addr, 4, WATCH_READ);
     if (!mem->cache) return *(uint32_t*) (mem->data + addr);
+    if (mem->bus) {
+        pthread_mutex_lock(&mem->bus->lock);
+        snoop(mem, addr, 4, false);
+    }
     
     
     uint8_t* block_ptr = find_or_replace_data_line(mem, addr, true, true, false);
@@ -181,11 +256,18 @@ uint32_t read_data_word(Memory* mem, uint64_t addr) {
     }
 
     mem->cache_stats.hit_rate = (double) mem->cache_stats.hit_count/mem->cache_stats.access_count;
+    if (mem->bus) pthread_mutex_unlock(&mem->bus->lock);
     return result;
 }
 
 uint64_t read_data_doubleword(Memory* mem, uint64_t addr) {
+    mem->heat[addr/HEAT_REGION].reads += 1;
+    if (mem->watches) watch_memory_access(mem->watches, addr, 8, WATCH_READ);
     if (!mem->cache) return *(uint64_t*) (mem->data + addr);
+    if (mem->bus) {
+        pthread_mutex_lock(&mem->bus->lock);
+        snoop(mem, addr, 8, false);
+    }
     
     
     uint8_t* block_ptr = find_or_replace_data_line(mem, addr, true, true, false);
@@ -204,11 +286,19 @@ uint64_t read_data_doubleword(Memory* mem, uint64_t addr) {
     }
 
     mem->cache_stats.hit_rate = (double) mem->cache_stats.hit_count/mem->cache_stats.access_count;
+    if (mem->bus) pthread_mutex_unlock(&mem->bus->lock);
     return result;
 }
 
 void write_data_byte(Memory* mem, uint64_t addr, uint8_t data) {
+    mem->heat[addr/HEAT_REGION].writes += 1;
+    mark_written(mem, addr, 1);
+    if (mem->watches) watch_memory_access(mem->watches, addr, 1, WATCH_WRITE);
     if (!mem->cache) {mem->data[addr] = data; return;}
+    if (mem->bus) {
+        pthread_mutex_lock(&mem->bus->lock);
+        snoop(mem, addr, 1, true);
+    }
     
 
     uint8_t* block_ptr = find_or_replace_data_line(mem, addr, mem->cache_config.write_allocate, false, true);
@@ -240,10 +330,18 @@ void write_data_byte(Memory* mem, uint64_t addr, uint8_t data) {
     if (block_ptr) *(block_ptr + (addr & mem->masks.offset)) = data;
 
     mem->cache_stats.hit_rate = (double) mem->cache_stats.hit_count/mem->cache_stats.access_count;
+    if (mem->bus) pthread_mutex_unlock(&mem->bus->lock);
 }
 
 void write_data_halfword(Memory* mem, uint64_t addr, uint16_t data) {
+    mem->heat[addr/HEAT_REGION].writes += 1;
+    mark_written(mem, addr, 2);
+    if (mem->watches) watch_memory_access(mem->watches, addr, 2, WATCH_WRITE);
     if (!mem->cache) {*(uint16_t*) (mem->data+addr) = data; return;}
+    if (mem->bus) {
+        pthread_mutex_lock(&mem->bus->lock);
+        snoop(mem, addr, 2, true);
+    }
     
 
     uint8_t* block_ptr = NULL;
@@ -267,10 +365,18 @@ void write_data_halfword(Memory* mem, uint64_t addr, uint16_t data) {
     }
 
     mem->cache_stats.hit_rate = (double) mem->cache_stats.hit_count/mem->cache_stats.access_count;
+    if (mem->bus) pthread_mutex_unlock(&mem->bus->lock);
 }
 
 void write_data_word(Memory* mem, uint64_t addr, uint32_t data) {
+    mem->heat[addr/HEAT_REGION].writes += 1;
+    mark_written(mem, addr, 4);
+    if (mem->watches) watch_memory_access(mem->watches, addr, 4, WATCH_WRITE);
     if (!mem->cache) {*(uint32_t*) (mem->data+addr) = data; return;}
+    if (mem->bus) {
+        pthread_mutex_lock(&mem->bus->lock);
+        snoop(mem, addr, 4, true);
+    }
     
 
     uint8_t* block_ptr = NULL;
@@ -294,10 +400,18 @@ void write_data_word(Memory* mem, uint64_t addr, uint32_t data) {
     }
 
     mem->cache_stats.hit_rate = (double) mem->cache_stats.hit_count/mem->cache_stats.access_count;
+    if (mem->bus) pthread_mutex_unlock(&mem->bus->lock);
 }
 
 void write_data_doubleword(Memory* mem, uint64_t addr, uint64_t data) {
+    mem->heat[addr/HEAT_REGION].writes += 1;
+    mark_written(mem, addr, 8);
+    if (mem->watches) watch_memory_access(mem->watches, addr, 8, WATCH_WRITE);
     if (!mem->cache) {*(uint64_t*) (mem->data+addr) = data; return;}
+    if (mem->bus) {
+        pthread_mutex_lock(&mem->bus->lock);
+        snoop(mem, addr, 8, true);
+    }
     
 
     uint8_t* block_ptr = NULL;
@@ -321,6 +435,77 @@ void write_data_doubleword(Memory* mem, uint64_t addr, uint64_t data) {
     }
 
     mem->cache_stats.hit_rate = (double) mem->cache_stats.hit_count/mem->cache_stats.access_count;
+    if (mem->bus) pthread_mutex_unlock(&mem->bus->lock);
+}
+
+uint8_t* lookup_line(Memory* mem, uint64_t addr) {
+    uint64_t index = (addr & mem->masks.index) / mem->cache_config.block_size;
+    uint64_t tag = addr & mem->masks.tag;
+    uint8_t* line_ptr = mem->cache + (mem->masks.block_offset * index * mem->cache_config.associativity);
+
+    for (int i=0; i<mem->cache_config.associativity; i++, line_ptr += mem->masks.block_offset) {
+        if ((*line_ptr & VALID) && *(uint64_t*)(line_ptr+1) == tag) return line_ptr;
+    }
+
+    return NULL;
+}
+
+// Size of a reservation set, a whole cache block when there is a cache
+static uint64_t reservation_size(Memory* mem) {
+    return mem->cache?mem->cache_config.block_size:8;
+}
+
+void reserve(Memory* mem, uint64_t addr) {
+    mem->reservation = addr & ~(reservation_size(mem)-1);
+}
+
+bool take_reservation(Memory* mem, uint64_t addr) {
+    bool held = mem->reservation != NO_RESERVATION && (addr & ~(reservation_size(mem)-1)) == mem->reservation;
+    mem->reservation = NO_RESERVATION;
+    return held;
+}
+
+void break_reservation(Memory* mem, uint64_t addr, uint64_t size) {
+    if (mem->reservation == NO_RESERVATION) return;
+    if (addr < mem->reservation + reservation_size(mem) && addr+size > mem->reservation) mem->reservation = NO_RESERVATION;
+}
+
+static void write_back_range(Memory* mem, uint64_t addr, uint64_t len) {
+    for (uint64_t block = addr & ~mem->masks.offset; block < addr+len; block += mem->cache_config.block_size) {
+        uint8_t* line_ptr = lookup_line(mem, block);
+        if (line_ptr && (*line_ptr & DIRTY)) memcpy(mem->data+block, line_ptr + mem->masks.data_offset, mem->cache_config.block_size);
+    }
+}
+
+static void reload_range(Memory* mem, uint64_t addr, uint64_t len) {
+    for (uint64_t block = addr & ~mem->masks.offset; block < addr+len; block += mem->cache_config.block_size) {
+        uint8_t* line_ptr = lookup_line(mem, block);
+        if (line_ptr) memcpy(line_ptr + mem->masks.data_offset, mem->data+block, mem->cache_config.block_size);
+    }
+}
+
+// Copies dirty cached data in a range back to memory, so the host can read it directly (e.g. for a syscall).
+// This is not a simulated access, so it does not affect the stats or the state of the cache
+void sync_cache_to_memory(Memory* mem, uint64_t addr, uint64_t len) {
+    if (!mem->cache || !len) return;
+    if (!mem->bus) {
+        write_back_range(mem, addr, len);
+        return;
+    }
+
+    // The modified copy may be in the cache of any hart
+    for (int i=0; i<mem->bus->n_caches; i++) write_back_range(mem->bus->caches[i], addr, len);
+}
+
+// Reloads cached copies of a range after the host wrote to memory directly
+void sync_memory_to_cache(Memory* mem, uint64_t addr, uint64_t len) {
+    if (!mem->cache || !len) return;
+    if (!mem->bus) {
+        reload_range(mem, addr, len);
+        return;
+    }
+
+    for (int i=0; i<mem->bus->n_caches; i++) reload_range(mem->bus->caches[i], addr, len);
 }
 
 void invalidate_cache(Memory* memory) {
@@ -329,6 +514,7 @@ void invalidate_cache(Memory* memory) {
     for (int i=0; i<memory->cache_config.n_blocks; i++) {
         memory->cache[i*memory->masks.block_offset] &= ~VALID;
     }
+    memory->reservation = NO_RESERVATION;
 }
 
 void dump_cache(Memory* memory, FILE* f) {
@@ -337,10 +523,14 @@ void dump_cache(Memory* memory, FILE* f) {
 
     for (int i=0; i<memory->cache_config.n_blocks; i++) {
         if ((*cache_ptr & VALID)) 
-            fprintf(f, "Set: 0x%02lx, Tag: 0x%lx, %s\n", i/memory->cache_config.associativity, (*(uint64_t*) (cache_ptr+1))/memory->cache_config.block_size/memory->cache_config.n_lines, *cache_ptr&DIRTY?"Dirty":"Clean");;
+            fprintf(f, "Set: 0x%02lx, Tag: 0x%lx, %s", i/memory->cache_config.associativity, (*(uint64_t*) (cache_ptr+1))/memory->cache_config.block_size/memory->cache_config.n_lines, *cache_ptr&DIRTY?"Dirty":"Clean");
+        if ((*cache_ptr & VALID))
+            fprintf(f, memory->bus?", State: %c\n":"\n", coherence_state(*cache_ptr));
         
         cache_ptr += memory->masks.block_offset;
     };
+
+    if (memory->bus) dump_coherence(memory->bus, f);
 }
 
 void free_vmem(Memory* Memory) {
@@ -348,6 +538,10 @@ void free_vmem(Memory* Memory) {
         free(Memory->cache);
         fclose(Memory->cache_config.trace_file);
     }
+    if (Memory->owns_data) free(Memory->data);
+    free(Memory->set_misses);
+    free(Memory->heat);
+    free(Memory->written);
     free(Memory);
 }
 
@@ -403,10 +597,22 @@ CacheConfig read_cache_config(FILE* fp) {
         return config;
     }
 
+    // The coherence protocol is optional, MESI is used if it is left out
+    char protocol[8] = "MESI";
+    if (fscanf(fp, " %7s", protocol) != 1) strcpy(protocol, "MESI");
+
+    if (!strcmp("MESI", protocol)) config.coherence = MESI;
+    else if (!strcmp("MSI", protocol)) config.coherence = MSI;
+    else if (!strcmp("NONE", protocol)) config.coherence = NO_COHERENCE;
+    else {
+        show_error("Invalid Coherence Protocol!");
+        return config;
+    }
+
     config.n_blocks = config.n_lines*config.associativity;
     config.has_cache = true;
     // config.tag_shift = log2(config.n_lines*config.block_size);
-    snprintf(config.trace_file_name, 300, "%s.output", active_file);
+    strcpy(config.trace_file_name, "cache.output"); // Clients that load programs name it after them
     return config;
 }
 
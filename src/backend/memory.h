@@ -10,11 +10,16 @@
 #include "stdlib.h"
 #include "stdio.h"
 #include "time.h"
+#include "watchpoint.h"
+#include "coherence.h"
 
 #define DATA_BASE 0x10000
 #define MEMORY_SIZE 0x50000 + 1 // Also used as end from which stack grows downward
 #define VALID (uint8_t) 0b1000
 #define DIRTY (uint8_t) 0b0100
+#define NO_RESERVATION UINT64_MAX
+#define HEAT_REGION 64  // Bytes of memory whose accesses are counted together for the heatmap
+#define HEAT_REGIONS ((MEMORY_SIZE + HEAT_REGION - 1) / HEAT_REGION)
 
 typedef enum ReplacementPolicy {
     FIFO,
@@ -54,6 +59,7 @@ typedef struct CacheConfig {
     char trace_file_name[300];
     bool write_allocate;
     bool has_cache;
+    CoherenceProtocol coherence;    // Used when there are multiple harts
 } CacheConfig;
 
 typedef struct CacheStats {
@@ -64,6 +70,13 @@ typedef struct CacheStats {
     double hit_rate;
 } CacheStats;
 
+// Accesses to a region of memory. Counters only ever go up (and wrap), readers look at how much they moved
+typedef struct RegionHeat {
+    uint32_t reads;
+    uint32_t writes;
+    uint32_t misses;
+} RegionHeat;
+
 typedef struct CacheMasks {
     uint64_t offset;
     uint64_t index;
@@ -78,8 +91,16 @@ typedef struct Memory {
     CacheStats cache_stats;
     CacheMasks masks;
     // CacheDebugInfo debug_info;
+    watch_list* watches; // NULL unless at least one watchpoint is set
     uint8_t* cache;
-    uint8_t data[MEMORY_SIZE]; 
+    uint8_t* data;       // MEMORY_SIZE bytes, shared between the L1s of all harts
+    bool owns_data;      // Only the Memory that allocated data frees it
+    Bus* bus;            // Bus connecting this cache to those of the other harts, NULL without coherence
+    int bus_id;
+    uint64_t reservation; // Start of the reservation set held by lr, NO_RESERVATION if there is none
+    RegionHeat* heat;    // HEAT_REGIONS counters of the accesses made through this cache
+    uint32_t* set_misses; // Misses of every set, NULL without a cache
+    uint8_t* written;    // A bit for every byte of memory stored to through this cache since clear_written
 } Memory;
 
 // Cache line be like:
@@ -87,6 +108,9 @@ typedef struct Memory {
 
 Memory* new_vmem(CacheConfig cache_config);
 
+// Creates another cache in front of the memory of owner, as the private L1 of another hart
+Memory* new_shared_vmem(CacheConfig cache_config, Memory* owner);
+
 uint8_t read_data_byte(Memory* mem, uint64_t addr);
 
 uint16_t read_data_halfword(Memory* mem, uint64_t addr);
@@ -109,6 +133,22 @@ void free_vmem(Memory* Memory);
 
 void invalidate_cache(Memory* memory);
 
+// Forgets which bytes were written, so that only later stores are marked in written
+void clear_written(Memory* memory);
+
+// Finds the cache line holding addr without counting it as an access, NULL if it is not cached
+uint8_t* lookup_line(Memory* mem, uint64_t addr);
+
+// Load reserved/store conditional support. The reservation set is the cache block holding addr,
+// or the aligned doubleword without a cache. It is lost when the block is evicted or invalidated by another cache
+void reserve(Memory* mem, uint64_t addr);
+bool take_reservation(Memory* mem, uint64_t addr);  // Whether the reservation covers addr. Always clears it
+void break_reservation(Memory* mem, uint64_t addr, uint64_t size);  // Clears the reservation if it overlaps a write
+
+void sync_cache_to_memory(Memory* mem, uint64_t addr, uint64_t len);
+
+void sync_memory_to_cache(Memory* mem, uint64_t addr, uint64_t len);
+
 void dump_cache(Memory* memory, FILE* f); 
 
 CacheConfig read_cache_config(FILE* fp);
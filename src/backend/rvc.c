@@ -0,0 +1,178 @@
+#include "rvc.h"
+
+#define BITS(x, hi, lo) (((x) >> (lo)) & ((1u << ((hi)-(lo)+1)) - 1))
+#define SEXT(x, width) ((int32_t) ((uint32_t) (x) << (32-(width))) >> (32-(width)))
+
+// Compressed register fields can only address x8 to x15
+#define CREG(x, lo) (BITS(x, lo+2, lo) + 8)
+
+// Encoders for the base formats. op includes the opcode and any funct bits
+static uint32_t enc_r(uint32_t op, uint32_t rd, uint32_t rs1, uint32_t rs2) {
+    return op | (rd << 7) | (rs1 << 15) | (rs2 << 20);
+}
+
+static uint32_t enc_i(uint32_t op, uint32_t rd, uint32_t rs1, int32_t imm) {
+    return op | (rd << 7) | (rs1 << 15) | ((uint32_t) imm << 20);
+}
+
+static uint32_t enc_s(uint32_t op, uint32_t rs1, uint32_t rs2, int32_t imm) {
+    return op | ((imm & 0x1F) << 7) | (rs1 << 15) | (rs2 << 20) | ((imm & 0xFE0) << 20);
+}
+
+static uint32_t enc_b(uint32_t op, uint32_t rs1, uint32_t rs2, int32_t imm) {
+    return op | ((imm & 0x800) >> 4) | ((imm & 0x1E) << 7) | (rs1 << 15) | (rs2 << 20) | ((imm & 0x7E0) << 20) | ((imm & 0x1000) << 19);
+}
+
+static uint32_t enc_j(uint32_t op, uint32_t rd, int32_t imm) {
+    return op | (rd << 7) | (imm & 0xFF000) | ((imm & 0x800) << 9) | ((imm & 0x7FE) << 20) | ((imm & 0x100000) << 11);
+}
+
+static uint32_t enc_u(uint32_t op, uint32_t rd, int32_t imm) {
+    return op | (rd << 7) | ((uint32_t) imm << 12);
+}
+
+#define OP_ADDI     0b0010011
+#define OP_SLLI     (0b0010011+(0x1<<12))
+#define OP_SRLI     (0b0010011+(0x5<<12))
+#define OP_SRAI     (0b0010011+(0x5<<12)+(0x10<<26))
+#define OP_ANDI     (0b0010011+(0x7<<12))
+#define OP_ADDIW    0b0011011
+#define OP_ADD      0b0110011
+#define OP_SUB      (0b0110011+(0x20<<25))
+#define OP_XOR      (0b0110011+(0x4<<12))
+#define OP_OR       (0b0110011+(0x6<<12))
+#define OP_AND      (0b0110011+(0x7<<12))
+#define OP_ADDW     0b0111011
+#define OP_SUBW     (0b0111011+(0x20<<25))
+#define OP_LW       (0b0000011+(0x2<<12))
+#define OP_LD       (0b0000011+(0x3<<12))
+#define OP_SW       (0b0100011+(0x2<<12))
+#define OP_SD       (0b0100011+(0x3<<12))
+#define OP_BEQ      0b1100011
+#define OP_BNE      (0b1100011+(0x1<<12))
+#define OP_JAL      0b1101111
+#define OP_JALR     0b1100111
+#define OP_LUI      0b0110111
+#define OP_EBREAK   (0b1110011+(0x1<<20))
+
+uint32_t expand_compressed(uint16_t c) {
+    uint32_t rd = BITS(c, 11, 7);
+    uint32_t rs2 = BITS(c, 6, 2);
+    int32_t imm;
+
+    switch ((BITS(c, 15, 13) << 2) | BITS(c, 1, 0)) {
+
+        // Quadrant 0
+        case 0b00000: // c.addi4spn
+            imm = (BITS(c, 12, 11) << 4) | (BITS(c, 10, 7) << 6) | (BITS(c, 6, 6) << 2) | (BITS(c, 5, 5) << 3);
+            if (!imm) return 0;
+            return enc_i(OP_ADDI, CREG(c, 2), 2, imm);
+
+        case 0b01000: // c.lw
+            imm = (BITS(c, 12, 10) << 3) | (BITS(c, 6, 6) << 2) | (BITS(c, 5, 5) << 6);
+            return enc_i(OP_LW, CREG(c, 2), CREG(c, 7), imm);
+
+        case 0b01100: // c.ld
+            imm = (BITS(c, 12, 10) << 3) | (BITS(c, 6, 5) << 6);
+            return enc_i(OP_LD, CREG(c, 2), CREG(c, 7), imm);
+
+        case 0b11000: // c.sw
+            imm = (BITS(c, 12, 10) << 3) | (BITS(c, 6, 6) << 2) | (BITS(c, 5, 5) << 6);
+            return enc_s(OP_SW, CREG(c, 7), CREG(c, 2), imm);
+
+        case 0b11100: // c.sd
+            imm = (BITS(c, 12, 10) << 3) | (BITS(c, 6, 5) << 6);
+            return enc_s(OP_SD, CREG(c, 7), CREG(c, 2), imm);
+
+        // Quadrant 1
+        case 0b00001: // c.addi, c.nop
+            imm = SEXT((BITS(c, 12, 12) << 5) | rs2, 6);
+            return enc_i(OP_ADDI, rd, rd, imm);
+
+        case 0b00101: // c.addiw
+            if (!rd) return 0;
+            imm = SEXT((BITS(c, 12, 12) << 5) | rs2, 6);
+            return enc_i(OP_ADDIW, rd, rd, imm);
+
+        case 0b01001: // c.li
+            imm = SEXT((BITS(c, 12, 12) << 5) | rs2, 6);
+            return enc_i(OP_ADDI, rd, 0, imm);
+
+        case 0b01101:
+            if (rd == 2) { // c.addi16sp
+                imm = SEXT((BITS(c, 12, 12) << 9) | (BITS(c, 6, 6) << 4) | (BITS(c, 5, 5) << 6) | (BITS(c, 4, 3) << 7) | (BITS(c, 2, 2) << 5), 10);
+                if (!imm) return 0;
+                return enc_i(OP_ADDI, 2, 2, imm);
+            }
+
+            // c.lui
+            imm = SEXT((BITS(c, 12, 12) << 5) | rs2, 6);
+            if (!imm || !rd) return 0;
+            return enc_u(OP_LUI, rd, imm & 0xFFFFF);
+
+        case 0b10001:
+            rd = CREG(c, 7);
+            rs2 = CREG(c, 2);
+
+            switch (BITS(c, 11, 10)) {
+                case 0b00: // c.srli
+                    return enc_i(OP_SRLI, rd, rd, (BITS(c, 12, 12) << 5) | BITS(c, 6, 2));
+                case 0b01: // c.srai
+                    return enc_i(OP_SRAI, rd, rd, (BITS(c, 12, 12) << 5) | BITS(c, 6, 2));
+                case 0b10: // c.andi
+                    return enc_i(OP_ANDI, rd, rd, SEXT((BITS(c, 12, 12) << 5) | BITS(c, 6, 2), 6));
+            }
+
+            switch ((BITS(c, 12, 12) << 2) | BITS(c, 6, 5)) {
+                case 0b000: return enc_r(OP_SUB, rd, rd, rs2);  // c.sub
+                case 0b001: return enc_r(OP_XOR, rd, rd, rs2);  // c.xor
+                case 0b010: return enc_r(OP_OR, rd, rd, rs2);   // c.or
+                case 0b011: return enc_r(OP_AND, rd, rd, rs2);  // c.and
+                case 0b100: return enc_r(OP_SUBW, rd, rd, rs2); // c.subw
+                case 0b101: return enc_r(OP_ADDW, rd, rd, rs2); // c.addw
+            }
+            return 0;
+
+        case 0b10101: // c.j
+            imm = SEXT((BITS(c, 12, 12) << 11) | (BITS(c, 11, 11) << 4) | (BITS(c, 10, 9) << 8) | (BITS(c, 8, 8) << 10)
+                | (BITS(c, 7, 7) << 6) | (BITS(c, 6, 6) << 7) | (BITS(c, 5, 3) << 1) | (BITS(c, 2, 2) << 5), 12);
+            return enc_j(OP_JAL, 0, imm);
+
+        case 0b11001: // c.beqz
+        case 0b11101: // c.bnez
+            imm = SEXT((BITS(c, 12, 12) << 8) | (BITS(c, 11, 10) << 3) | (BITS(c, 6, 5) << 6) | (BITS(c, 4, 3) << 1) | (BITS(c, 2, 2) << 5), 9);
+            return enc_b(BITS(c, 13, 13)?OP_BNE:OP_BEQ, CREG(c, 7), 0, imm);
+
+        // Quadrant 2
+        case 0b00010: // c.slli
+            return enc_i(OP_SLLI, rd, rd, (BITS(c, 12, 12) << 5) | rs2);
+
+        case 0b01010: // c.lwsp
+            if (!rd) return 0;
+            imm = (BITS(c, 12, 12) << 5) | (BITS(c, 6, 4) << 2) | (BITS(c, 3, 2) << 6);
+            return enc_i(OP_LW, rd, 2, imm);
+
+        case 0b01110: // c.ldsp
+            if (!rd) return 0;
+            imm = (BITS(c, 12, 12) << 5) | (BITS(c, 6, 5) << 3) | (BITS(c, 4, 2) << 6);
+            return enc_i(OP_LD, rd, 2, imm);
+
+        case 0b10010:
+            if (!BITS(c, 12, 12)) {
+                if (!rs2) return rd?enc_i(OP_JALR, 0, rd, 0):0;  // c.jr
+                return enc_r(OP_ADD, rd, 0, rs2);               // c.mv
+            }
+            if (!rs2) return rd?enc_i(OP_JALR, 1, rd, 0):OP_EBREAK; // c.jalr, c.ebreak
+            return enc_r(OP_ADD, rd, rd, rs2);                      // c.add
+
+        case 0b11010: // c.swsp
+            imm = (BITS(c, 12, 9) << 2) | (BITS(c, 8, 7) << 6);
+            return enc_s(OP_SW, 2, rs2, imm);
+
+        case 0b11110: // c.sdsp
+            imm = (BITS(c, 12, 10) << 3) | (BITS(c, 9, 7) << 6);
+            return enc_s(OP_SD, 2, rs2, imm);
+    }
+
+    return 0;
+}
@@ -0,0 +1,12 @@
+#ifndef RVC_H
+#define RVC_H
+#include <stdint.h>
+
+// Returns true if the 16 bit parcel at the start of an instruction belongs to a compressed instruction
+#define IS_COMPRESSED(parcel) (((parcel) & 0x3) != 0x3)
+
+// Expands a compressed (RV64C) instruction into the equivalent 32 bit instruction.
+// Returns 0 if the parcel is not a valid compressed instruction
+uint32_t expand_compressed(uint16_t parcel);
+
+#endif
@@ -1,48 +1,75 @@
 #include "stacktrace.h"
 #include "stdio.h"
 
-void st_push(stacktrace* st, int line) {
+void st_push(stacktrace* st, uint64_t call_pc, uint64_t return_addr, int line) {
 
-    int label = get_section_label(st->index, line);
+    if (st->len == st->capacity) {
+        st_frame* chunk = st->capacity < ST_MAX_FRAMES?malloc(sizeof(st_frame)*ST_CHUNK_FRAMES):NULL;
 
-    append(st->stack, line);
-    append(st->label_indices, label);
-    
-    st->len++;
+        if (!chunk) {
+            st->lost++;
+            return;
+        }
+        st->chunks[st->capacity/ST_CHUNK_FRAMES] = chunk;
+        st->capacity += ST_CHUNK_FRAMES;
+    }
+
+    st_frame* frame = st_frame_at(st, st->len++);
+    frame->call_pc = call_pc;
+    frame->return_addr = return_addr;
+    frame->section = line >= 0 && line < st->n_lines?st->sections[line]:-1;
+    frame->line = line+1;
 }
 
-void st_pop(stacktrace* st) {
+bool st_return(stacktrace* st, uint64_t target) {
+
+    // Frames that were not kept cannot be matched, so their returns are taken on trust
+    if (st->lost) {
+        st->lost--;
+        return true;
+    }
 
-    if (st->len == 0) return;
-    st->len--;
-    vec_remove(st->stack, st->len);
-    vec_remove(st->label_indices, st->len);
+    // Usually the innermost frame returns. Frames above the matching one were left without returning, e.g. by tail calls
+    for (int i=st->len-1; i>=0; i--) {
+        if (st_frame_at(st, i)->return_addr != target) continue;
+        st->len = i;
+        return true;
+    }
 
+    return false;
 }
 
 void st_clear(stacktrace* st) {
     st->len = 0;
-    vec_clear(st->stack);
-    vec_clear(st->label_indices);
-}
-
-void st_update(stacktrace* st, int line) {
-    st->stack->values[st->len-1] = line;
+    st->lost = 0;
 }
 
 void st_free(stacktrace* st) {
-    free_managed_array(st->stack);
-    free_managed_array(st->label_indices);
+    for (int i=0; i<st->capacity/ST_CHUNK_FRAMES; i++) free(st->chunks[i]);
+    free(st->sections);
     free(st);
 }
 
-stacktrace* new_stacktrace(label_index* index) {
+stacktrace* new_stacktrace(label_index* index, int n_lines) {
     stacktrace* st = malloc(sizeof(stacktrace));
+    if (!st) return NULL;
 
     st->index = index;
-    st->label_indices = new_managed_array();
-    st->stack = new_managed_array();
+    st->sections = malloc(sizeof(int)*(n_lines > 0?n_lines:1));
+    st->n_lines = n_lines;
     st->len = 0;
+    st->capacity = ST_CHUNK_FRAMES; // The first chunk is there from the start, so the entry frame always fits
+    st->lost = 0;
+    st->chunks[0] = malloc(sizeof(st_frame)*ST_CHUNK_FRAMES);
+
+    if (!st->sections || !st->chunks[0]) {
+        free(st->sections);
+        free(st->chunks[0]);
+        free(st);
+        return NULL;
+    }
+
+    for (int line=0; line<n_lines; line++) st->sections[line] = get_section_label(index, line);
 
     return st;
-}
\ No newline at end of file
+}
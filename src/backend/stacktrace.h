@@ -1,26 +1,51 @@
 #ifndef STACKTRACE_H
 #define STACKTRACE_H
+#include <stdbool.h>
 #include "../assembler/vec.h"
 #include "../assembler/index.h"
 
+#define ST_MAX_FRAMES 65536         // Calls nested deeper than this are counted but not kept
+#define ST_CHUNK_FRAMES 256         // Frames are allocated this many at a time, as calls nest deeper
+#define ST_NO_RETURN UINT64_MAX     // Return address of the first frame, which is never returned from
+
+typedef struct st_frame {
+    uint64_t call_pc;       // Address of the call that made the frame
+    uint64_t return_addr;   // Address the call returns to
+    int section;            // Index of the label of the called code in label_index, -1 if it is outside the code
+    int line;               // Line the frame is at, as shown in the code pane
+} st_frame;
+
 typedef struct stacktrace
 {
-    vec* stack; // List of line numbers
-    vec* label_indices; // Index of label in label_index
-    label_index* index; // Pointer to the label index in which the label_indices are
+    // Frames, the innermost last. Chunks never move once allocated, so the TUI can read them while a hart thread calls
+    st_frame* chunks[ST_MAX_FRAMES/ST_CHUNK_FRAMES];
     int len; // Length of stack trace
+    int capacity; // Frames in the chunks allocated so far
+    uint64_t lost; // Frames of calls made while frames was full
+    int* sections; // Section of every line of code, so calls need no label lookups
+    int n_lines;
+    label_index* index; // Pointer to the label index in which the sections are
 } stacktrace;
 
-void st_push(stacktrace* st, int line);
+// Adds a frame for a call at call_pc to the code at line (-1 if outside the code), which returns to return_addr
+void st_push(stacktrace* st, uint64_t call_pc, uint64_t return_addr, int line);
+
+// Pops the frames down to the one that returns to target, if any does. Returns whether target was a return
+bool st_return(stacktrace* st, uint64_t target);
 
-void st_pop(stacktrace* st);
+static inline st_frame* st_frame_at(stacktrace* st, int i) {
+    return &st->chunks[i/ST_CHUNK_FRAMES][i%ST_CHUNK_FRAMES];
+}
 
-void st_update(stacktrace* st, int line);
+// Called on every instruction, with the line it is on
+static inline void st_update(stacktrace* st, int line) {
+    if (st->len) st_frame_at(st, st->len-1)->line = line;
+}
 
 void st_clear(stacktrace* st);
 
-stacktrace* new_stacktrace(label_index* index);
+stacktrace* new_stacktrace(label_index* index, int n_lines);
 
 void st_free(stacktrace* st);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,321 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+#include "syscall.h"
+#include "../frontend/error.h"
+
+// open flags as defined by the RISC-V Linux ABI
+#define GUEST_O_ACCMODE 00003
+#define GUEST_O_CREAT   00100
+#define GUEST_O_EXCL    00200
+#define GUEST_O_TRUNC   01000
+#define GUEST_O_APPEND  02000
+#define GUEST_AT_FDCWD  -100
+
+struct syscall_state {
+    guest_output output;
+    bool output_to_host;
+    int host_fds[MAX_FILES];        // Host file descriptor behind each guest file descriptor, -1 if closed
+    bool fds_initialized;
+    uint64_t heap_start;
+    uint64_t program_break;
+    bool exited;
+    int64_t exit_code;
+};
+
+static syscall_state default_syscalls = {0};
+static __thread syscall_state* syscalls = &default_syscalls;
+
+syscall_state* new_syscall_state() {
+    return calloc(1, sizeof(syscall_state));
+}
+
+void select_syscalls(syscall_state* state) {
+    syscalls = state?state:&default_syscalls;
+}
+
+void free_syscall_state(syscall_state* state) {
+    syscall_state* selected = syscalls;
+
+    select_syscalls(state);
+    free_syscalls();
+    free(state);
+    select_syscalls(selected == state?NULL:selected);
+}
+
+guest_output* get_output_pointer() {return &syscalls->output;}
+void set_output_to_host(bool enabled) {syscalls->output_to_host = enabled;}
+
+bool program_exited(int64_t* code) {
+    if (code) *code = syscalls->exit_code;
+    return syscalls->exited;
+}
+
+void end_program(int64_t code) {
+    syscalls->exited = true;
+    syscalls->exit_code = code;
+    flush_output();
+}
+
+void flush_output() {
+    if (!syscalls->output_to_host || !syscalls->output.len) return;
+    fwrite(syscalls->output.data, 1, syscalls->output.len, stdout);
+    fflush(stdout);
+    syscalls->output.len = 0;
+}
+
+static void close_files() {
+    for (int i=3; i<MAX_FILES; i++) {
+        if (syscalls->host_fds[i] != -1) close(syscalls->host_fds[i]);
+        syscalls->host_fds[i] = -1;
+    }
+}
+
+void reset_syscalls(uint64_t new_heap_start) {
+    if (!syscalls->fds_initialized) {
+        for (int i=3; i<MAX_FILES; i++) syscalls->host_fds[i] = -1;
+        syscalls->fds_initialized = true;
+    }
+
+    flush_output();
+    close_files();
+    syscalls->host_fds[0] = STDIN_FILENO;
+    syscalls->host_fds[1] = STDOUT_FILENO;
+    syscalls->host_fds[2] = STDERR_FILENO;
+
+    syscalls->output.len = 0;
+    syscalls->heap_start = new_heap_start;
+    syscalls->program_break = new_heap_start;
+    syscalls->exited = false;
+    syscalls->exit_code = 0;
+}
+
+void free_syscalls() {
+    flush_output();
+    close_files();
+    if (syscalls->output.data) free(syscalls->output.data);
+    syscalls->output.data = NULL;
+    syscalls->output.len = syscalls->output.capacity = 0;
+}
+
+// Appends to the output, which is only written to the host once enough of it has accumulated
+static int64_t write_output(uint8_t* data, uint64_t len) {
+    if (!syscalls->output.data) {
+        syscalls->output.data = malloc(OUTPUT_LIMIT);
+        if (!syscalls->output.data) return -ENOMEM;
+        syscalls->output.capacity = OUTPUT_LIMIT;
+    }
+
+    uint64_t written = 0;
+
+    while (written < len) {
+        if (syscalls->output.len == syscalls->output.capacity) {
+            if (syscalls->output_to_host) flush_output();
+            else { // Drop the older half of the output
+                memmove(syscalls->output.data, syscalls->output.data + syscalls->output.capacity/2, syscalls->output.capacity - syscalls->output.capacity/2);
+                syscalls->output.len -= syscalls->output.capacity/2;
+            }
+        }
+
+        uint64_t chunk = len - written;
+        if (chunk > syscalls->output.capacity - syscalls->output.len) chunk = syscalls->output.capacity - syscalls->output.len;
+
+        memcpy(syscalls->output.data + syscalls->output.len, data + written, chunk);
+        syscalls->output.len += chunk;
+        written += chunk;
+    }
+
+    if (syscalls->output_to_host && syscalls->output.len >= OUTPUT_FLUSH_SIZE) flush_output();
+    return len;
+}
+
+// Checks that a buffer given by the program lies in memory (and outside the text segment if it is written to)
+static bool valid_buffer(uint64_t addr, uint64_t len, bool writing, program_layout* layout) {
+    if (addr > MEMORY_SIZE || len > MEMORY_SIZE || addr+len > MEMORY_SIZE) return false;
+    if (writing && addr < layout->text_end && addr+len > layout->text_start) return false;
+    return true;
+}
+
+static int64_t guest_fd(uint64_t fd) {
+    if (fd >= MAX_FILES || syscalls->host_fds[fd] == -1) return -1;
+    return syscalls->host_fds[fd];
+}
+
+static int64_t sys_write(uint64_t fd, uint64_t buf, uint64_t count, Memory* memory, program_layout* layout) {
+    if (!valid_buffer(buf, count, false, layout)) return -EFAULT;
+    flush_guest_memory(buf, count);
+
+    if (fd == 1 || fd == 2) return write_output(memory->data + buf, count);
+
+    int64_t host_fd = guest_fd(fd);
+    if (host_fd == -1 || fd == 0) return -EBADF;
+
+    int64_t result = write(host_fd, memory->data + buf, count);
+    return result == -1?-errno:result;
+}
+
+static int64_t sys_read(uint64_t fd, uint64_t buf, uint64_t count, Memory* memory, program_layout* layout) {
+    if (!valid_buffer(buf, count, true, layout)) return -EFAULT;
+
+    // stdin belongs to the TUI while it is active, so programs see it as empty
+    if (fd == 0 && !syscalls->output_to_host) return 0;
+    if (fd == 0) flush_output(); // Make sure any prompt is visible before blocking
+
+    int64_t host_fd = guest_fd(fd);
+    if (host_fd == -1 || fd == 1 || fd == 2) return -EBADF;
+
+    // Other harts may hold dirty copies of the blocks around the buffer, which have to reach memory before the
+    // blocks are reloaded from it
+    flush_guest_memory(buf, count);
+    int64_t result = read(host_fd, memory->data + buf, count);
+    if (result == -1) return -errno;
+
+    guest_memory_written(buf, result);
+    return result;
+}
+
+static int64_t sys_openat(int64_t dirfd, uint64_t path_addr, uint64_t guest_flags, uint64_t mode, Memory* memory) {
+    char path[256];
+    if (path_addr >= MEMORY_SIZE) return -EFAULT;
+    flush_guest_memory(path_addr, path_addr < MEMORY_SIZE - sizeof(path)?sizeof(path):MEMORY_SIZE - path_addr);
+
+    for (int i=0; ; i++) {
+        if (i == sizeof(path) || path_addr+i >= MEMORY_SIZE) return -ENAMETOOLONG;
+        path[i] = memory->data[path_addr+i];
+        if (!path[i]) break;
+    }
+
+    if (dirfd != GUEST_AT_FDCWD && path[0] != '/') return -EBADF;
+
+    int fd = 3;
+    while (fd < MAX_FILES && syscalls->host_fds[fd] != -1) fd++;
+    if (fd == MAX_FILES) return -EMFILE;
+
+    int access[] = {O_RDONLY, O_WRONLY, O_RDWR, O_RDWR};
+    int flags = access[guest_flags & GUEST_O_ACCMODE];
+    if (guest_flags & GUEST_O_CREAT) flags |= O_CREAT;
+    if (guest_flags & GUEST_O_EXCL) flags |= O_EXCL;
+    if (guest_flags & GUEST_O_TRUNC) flags |= O_TRUNC;
+    if (guest_flags & GUEST_O_APPEND) flags |= O_APPEND;
+
+    int host_fd = open(path, flags, (mode_t) mode & 0777);
+    if (host_fd == -1) return -errno;
+
+    syscalls->host_fds[fd] = host_fd;
+    return fd;
+}
+
+static int64_t sys_close(uint64_t fd) {
+    if (fd < 3) return 0; // The standard streams are shared with the simulator, so they are never really closed
+    if (guest_fd(fd) == -1) return -EBADF;
+
+    close(syscalls->host_fds[fd]);
+    syscalls->host_fds[fd] = -1;
+    return 0;
+}
+
+static int64_t sys_lseek(uint64_t fd, int64_t offset, uint64_t whence) {
+    if (fd < 3) return -ESPIPE;
+    if (guest_fd(fd) == -1) return -EBADF;
+
+    int64_t result = lseek(syscalls->host_fds[fd], offset, whence);
+    return result == -1?-errno:result;
+}
+
+static int64_t sys_brk(uint64_t addr, Memory* memory) {
+    // Like Linux, an invalid request (including 0) just returns the current break
+    if (addr >= syscalls->heap_start && addr <= (MEMORY_SIZE - 1) - STACK_RESERVE) {
+        // Memory freed by shrinking the break must read as zero when it is handed out again
+        if (addr < syscalls->program_break) {
+            flush_guest_memory(addr, syscalls->program_break - addr);
+            memset(memory->data + addr, 0, syscalls->program_break - addr);
+            guest_memory_written(addr, syscalls->program_break - addr);
+        }
+        syscalls->program_break = addr;
+    }
+
+    return syscalls->program_break;
+}
+
+static int64_t sys_clock_gettime(uint64_t clock, uint64_t tp, Memory* memory, program_layout* layout) {
+    struct timespec now;
+    if (clock != CLOCK_REALTIME && clock != CLOCK_MONOTONIC) return -EINVAL;
+    if (!valid_buffer(tp, 16, true, layout)) return -EFAULT;
+
+    clock_gettime(clock, &now);
+    int64_t guest_time[2] = {now.tv_sec, now.tv_nsec};
+    flush_guest_memory(tp, 16);
+    memcpy(memory->data + tp, guest_time, 16);
+    guest_memory_written(tp, 16);
+    return 0;
+}
+
+static int64_t sys_gettimeofday(uint64_t tv, Memory* memory, program_layout* layout) {
+    struct timeval now;
+    if (!tv) return 0;
+    if (!valid_buffer(tv, 16, true, layout)) return -EFAULT;
+
+    gettimeofday(&now, NULL);
+    int64_t guest_time[2] = {now.tv_sec, now.tv_usec};
+    flush_guest_memory(tv, 16);
+    memcpy(memory->data + tv, guest_time, 16);
+    guest_memory_written(tv, 16);
+    return 0;
+}
+
+int handle_syscall(uint64_t* registers, Memory* memory, program_layout* layout) {
+    uint64_t* a = registers + 10; // Arguments are in a0-a5, the result goes in a0
+    int64_t result;
+
+    switch (registers[17]) {
+        case SYS_exit: // Only the calling hart stops, the program ends once every hart has
+            return 2;
+
+        case SYS_exit_group:
+            end_program((int32_t) a[0]);
+            return 1;
+
+        case SYS_write:
+            result = sys_write(a[0], a[1], a[2], memory, layout);
+            break;
+
+        case SYS_read:
+            result = sys_read(a[0], a[1], a[2], memory, layout);
+            break;
+
+        case SYS_openat:
+            result = sys_openat(a[0], a[1], a[2], a[3], memory);
+            break;
+
+        case SYS_close:
+            result = sys_close(a[0]);
+            break;
+
+        case SYS_lseek:
+            result = sys_lseek(a[0], a[1], a[2]);
+            break;
+
+        case SYS_brk:
+            result = sys_brk(a[0], memory);
+            break;
+
+        case SYS_clock_gettime:
+            result = sys_clock_gettime(a[0], a[1], memory, layout);
+            break;
+
+        case SYS_gettimeofday:
+            result = sys_gettimeofday(a[0], memory, layout);
+            break;
+
+        default:
+            result = -ENOSYS;
+    }
+
+    a[0] = result;
+    return 0;
+}
@@ -0,0 +1,61 @@
+#ifndef SYSCALL_H
+#define SYSCALL_H
+#include <stdint.h>
+#include <stdbool.h>
+#include "memory.h"
+#include "backend.h"
+
+#define OUTPUT_FLUSH_SIZE 0x1000    // Output is written to the host in chunks of this size
+#define OUTPUT_LIMIT 0x10000        // Most output kept for the output pane, older output is dropped
+#define STACK_RESERVE 0x10000       // Space below the top of memory that brk will not hand out
+#define MAX_FILES 16                // Most files a program can have open, including stdin, stdout and stderr
+
+// Linux syscall numbers (RISC-V uses the generic table)
+enum Syscall {
+    SYS_openat = 56,
+    SYS_close = 57,
+    SYS_lseek = 62,
+    SYS_read = 63,
+    SYS_write = 64,
+    SYS_exit = 93,
+    SYS_exit_group = 94,
+    SYS_clock_gettime = 113,
+    SYS_gettimeofday = 169,
+    SYS_brk = 214,
+};
+
+// Everything the program wrote to stdout and stderr that has not been flushed to the host
+typedef struct guest_output {
+    char* data;
+    size_t len;
+    size_t capacity;
+} guest_output;
+
+// Files, output, program break and exit status of one simulator. Selected along with its backend_state
+typedef struct syscall_state syscall_state;
+
+syscall_state* new_syscall_state();
+void free_syscall_state(syscall_state* state);
+void select_syscalls(syscall_state* state); // NULL selects the default instance
+
+// Closes files opened by the program, clears output and resets the program break. Called on every reset
+void reset_syscalls(uint64_t heap_start);
+
+// Performs the syscall requested by a7, with arguments in a0-a5. The result is written to a0.
+// Returns 0 to continue, 1 if the program exited, 2 if only the calling hart exited and 3 on a fatal error (message already shown)
+int handle_syscall(uint64_t* registers, Memory* memory, program_layout* layout);
+
+// Returns true once the program has called exit, and sets code (if not NULL) to its exit code
+bool program_exited(int64_t* code);
+
+// Ends the program with an exit code, used once the last hart has exited
+void end_program(int64_t code);
+
+// When enabled, output is written to the host's stdout in chunks instead of being kept for the output pane
+void set_output_to_host(bool enabled);
+void flush_output();
+
+guest_output* get_output_pointer();
+void free_syscalls();
+
+#endif
@@ -0,0 +1,132 @@
+#include <string.h>
+#include "watchpoint.h"
+#include "memory.h"
+
+// Multiplicative hash of a page number into the filter
+static inline uint64_t page_hash(uint64_t page) {
+    return (page * 0x9E3779B97F4A7C15) >> (64 - 12) & (WATCH_FILTER_BITS - 1);
+}
+
+static inline bool filter_test(watch_list* list, uint64_t page) {
+    uint64_t bit = page_hash(page);
+    return list->page_filter[bit/64] & ((uint64_t) 1 << (bit%64));
+}
+
+static void filter_set(watch_list* list, uint64_t page) {
+    uint64_t bit = page_hash(page);
+    list->page_filter[bit/64] |= ((uint64_t) 1 << (bit%64));
+}
+
+// Recomputes the page filter and register masks from scratch, and hooks/unhooks the list from memory
+static void rebuild_filter(watch_list* list) {
+    memset(list->page_filter, 0, sizeof(list->page_filter));
+    list->register_read_mask = 0;
+    list->register_write_mask = 0;
+
+    for (int i=0; i<list->len; i++) {
+        watchpoint* wp = &list->entries[i];
+
+        if (wp->is_register) {
+            if (wp->flags & WATCH_READ) list->register_read_mask |= 1u << wp->start;
+            if (wp->flags & WATCH_WRITE) list->register_write_mask |= 1u << wp->start;
+            continue;
+        }
+
+        for (uint64_t page = wp->start >> WATCH_PAGE_SHIFT; page <= (wp->end-1) >> WATCH_PAGE_SHIFT; page++) {
+            filter_set(list, page);
+        }
+    }
+
+    list->memory->watches = list->len?list:NULL;
+}
+
+watch_list* new_watch_list(Memory* memory) {
+    watch_list* list = malloc(sizeof(watch_list));
+    if (!list) return NULL;
+
+    list->len = 0;
+    list->capacity = 4;
+    list->entries = malloc(4*sizeof(watchpoint));
+
+    if (!list->entries) {
+        free(list);
+        return NULL;
+    }
+
+    list->memory = memory;
+    list->triggered = false;
+    list->hit = -1;
+    rebuild_filter(list);
+
+    return list;
+}
+
+int toggle_watchpoint(watch_list* list, watchpoint wp) {
+
+    for (int i=0; i<list->len; i++) {
+        watchpoint* other = &list->entries[i];
+        if (other->is_register == wp.is_register && other->start == wp.start && other->end == wp.end && other->flags == wp.flags) {
+            memmove(list->entries+i, list->entries+i+1, (list->len-i-1)*sizeof(watchpoint));
+            list->len--;
+            rebuild_filter(list);
+            return 0;
+        }
+    }
+
+    // If out of space, double capacity
+    if (list->len == list->capacity) {
+        watchpoint* entries_new = realloc(list->entries, 2*list->capacity*sizeof(watchpoint));
+        if (!entries_new) return -1;
+        list->entries = entries_new;
+        list->capacity *= 2;
+    }
+
+    list->entries[list->len++] = wp;
+    rebuild_filter(list);
+    return 1;
+}
+
+void clear_watchpoints(watch_list* list) {
+    list->len = 0;
+    list->triggered = false;
+    rebuild_filter(list);
+}
+
+// Called from the memory read/write paths only while at least one watchpoint is set
+void watch_memory_access(watch_list* list, uint64_t addr, uint64_t size, uint8_t kind) {
+    if (!filter_test(list, addr >> WATCH_PAGE_SHIFT) && !filter_test(list, (addr+size-1) >> WATCH_PAGE_SHIFT)) return;
+
+    for (int i=0; i<list->len; i++) {
+        watchpoint* wp = &list->entries[i];
+        if (wp->is_register || !(wp->flags & kind)) continue;
+        if (addr >= wp->end || addr+size <= wp->start) continue;
+
+        list->triggered = true;
+        list->hit = i;
+        list->hit_addr = addr;
+        list->hit_kind = kind;
+        return;
+    }
+}
+
+void watch_register_access(watch_list* list, uint64_t reg, uint8_t kind) {
+    uint32_t mask = kind == WATCH_READ?list->register_read_mask:list->register_write_mask;
+    if (!(mask & (1u << reg))) return;
+
+    for (int i=0; i<list->len; i++) {
+        watchpoint* wp = &list->entries[i];
+        if (!wp->is_register || wp->start != reg || !(wp->flags & kind)) continue;
+
+        list->triggered = true;
+        list->hit = i;
+        list->hit_addr = reg;
+        list->hit_kind = kind;
+        return;
+    }
+}
+
+void free_watch_list(watch_list* list) {
+    if (list->memory && list->memory->watches == list) list->memory->watches = NULL;
+    free(list->entries);
+    free(list);
+}
@@ -0,0 +1,53 @@
+#ifndef WATCHPOINT_H
+#define WATCHPOINT_H
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#define WATCH_READ  (uint8_t) 0b01
+#define WATCH_WRITE (uint8_t) 0b10
+
+#define WATCH_PAGE_SHIFT 8      // Granularity of the page filter (256 byte pages)
+#define WATCH_FILTER_BITS 4096  // Size of the hashed page filter, must be a power of 2
+
+typedef struct Memory Memory;
+
+typedef struct watchpoint {
+    uint64_t start;     // First watched address, or register number
+    uint64_t end;       // One past the last watched address
+    uint8_t flags;      // WATCH_READ and/or WATCH_WRITE
+    bool is_register;
+} watchpoint;
+
+// A list of watchpoints along with a hashed filter of the pages they cover.
+// While the list is empty it is unhooked from the Memory it watches, so the
+// read/write paths only ever pay for a single NULL check.
+typedef struct watch_list {
+    size_t len;
+    size_t capacity;
+    watchpoint* entries;
+    Memory* memory;                                 // Memory whose accesses are being watched
+    uint64_t page_filter[WATCH_FILTER_BITS/64];     // Bit set for every (hashed) page covered by a watchpoint
+    uint32_t register_read_mask;
+    uint32_t register_write_mask;
+    bool triggered;                                 // Set when an access hits a watchpoint, cleared by the backend
+    int hit;                                        // Index of the watchpoint that was hit
+    uint64_t hit_addr;
+    uint8_t hit_kind;
+} watch_list;
+
+watch_list* new_watch_list(Memory* memory);
+
+// Adds a watchpoint, or removes it if an identical one already exists.
+// Returns 1 if it was added and 0 if it was removed
+int toggle_watchpoint(watch_list* list, watchpoint wp);
+
+void clear_watchpoints(watch_list* list);
+
+void watch_memory_access(watch_list* list, uint64_t addr, uint64_t size, uint8_t kind);
+
+void watch_register_access(watch_list* list, uint64_t reg, uint8_t kind);
+
+void free_watch_list(watch_list* list);
+
+#endif
@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <time.h>
+#include "batch.h"
+#include "sim.h"
+#include "assembler/objcache.h"
+
+typedef struct batch_pool batch_pool;
+
+// A worker thread with its own simulator. It runs the programs of its range from the front, and once that is empty
+// steals the back half of the longest range left, so a few long running programs do not hold up the others
+typedef struct batch_worker {
+	pthread_t thread;
+	pthread_mutex_t lock;	// Guards next and end, which thieves change too
+	int next, end;			// Programs queued for this worker
+	bool started;			// Whether its thread is running, the first worker runs on the calling thread
+	batch_pool* pool;
+} batch_worker;
+
+struct batch_pool {
+	char** paths;
+	batch_result* results;	// One for every path, each written by the worker that ran it
+	batch_config* config;
+	batch_worker* workers;
+	int n_workers;
+};
+
+static int compare_names(const void* a, const void* b) {
+	return strcmp(*(char**) a, *(char**) b);
+}
+
+// Lists the .s files in dir, in order of name so reports can be compared between runs
+static char** list_sources(const char* dir, int* n) {
+	DIR* d = opendir(dir);
+	if (!d) return NULL;
+
+	int capacity = 64;
+	char** paths = malloc(sizeof(char*)*capacity);
+	struct dirent* entry;
+	*n = 0;
+
+	while (paths && (entry = readdir(d))) {
+		size_t len = strlen(entry->d_name);
+		if (len < 3 || strcmp(entry->d_name+len-2, ".s")) continue;
+
+		if (*n == capacity) {
+			capacity *= 2;
+			char** new_paths = realloc(paths, sizeof(char*)*capacity);
+			if (!new_paths) break;
+			paths = new_paths;
+		}
+
+		paths[*n] = malloc(strlen(dir) + len + 2);
+		if (!paths[*n]) break;
+		sprintf(paths[*n], "%s/%s", dir, entry->d_name);
+		(*n)++;
+	}
+
+	closedir(d);
+	if (paths) qsort(paths, *n, sizeof(char*), compare_names);
+	return paths;
+}
+
+static double now() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec/1e9;
+}
+
+// Assembles and runs one program on the worker's simulator, the same way the TUI loads and runs it
+static void run_program(sim_t* sim, const char* path, uint64_t max_steps, batch_result* result) {
+	double start = now();
+	sim_result run_result;
+
+	result->status = BATCH_ASSEMBLY_ERROR;
+
+	if (sim_load(sim, path)) {
+		// ebreak and watchpoints only matter to the TUI, execution carries on after them
+		do run_result = sim_run(sim, SIM_NO_ADDRESS, max_steps - result->instructions, &result->instructions);
+		while (run_result == SIM_BREAKPOINT || run_result == SIM_WATCHPOINT);
+
+		if (run_result == SIM_END) result->status = sim_exited(sim, &result->exit_code)?BATCH_EXITED:BATCH_ENDED;
+		else if (run_result == SIM_ERROR) result->status = BATCH_RUNTIME_ERROR;
+		else result->status = BATCH_TIMEOUT;
+
+		size_t len;
+		const char* output = sim_output(sim, &len);
+		result->output_hash = hash_source(output, len);
+		result->output_len = len;
+	}
+
+	snprintf(result->message, BATCH_MESSAGE_LEN, "%s", sim_error(sim));
+	result->seconds = now() - start;
+}
+
+// Moves the back half of the longest range of another worker to worker. Returns false once there is nothing left
+static bool steal(batch_worker* worker) {
+	batch_pool* pool = worker->pool;
+
+	while (1) {
+		batch_worker* victim = NULL;
+		int longest = 0;
+
+		// Only a hint, the range may change before the victim is locked
+		for (int i=0; i<pool->n_workers; i++) {
+			batch_worker* other = &pool->workers[i];
+			pthread_mutex_lock(&other->lock);
+			if (other != worker && other->end - other->next > longest) {
+				longest = other->end - other->next;
+				victim = other;
+			}
+			pthread_mutex_unlock(&other->lock);
+		}
+		if (!victim) return false;
+
+		pthread_mutex_lock(&victim->lock);
+		int taken = (victim->end - victim->next + 1) / 2;
+		int end = victim->end;
+		victim->end -= taken;
+		pthread_mutex_unlock(&victim->lock);
+
+		if (!taken) continue;
+
+		pthread_mutex_lock(&worker->lock);
+		worker->next = end - taken;
+		worker->end = end;
+		pthread_mutex_unlock(&worker->lock);
+		return true;
+	}
+}
+
+// Takes the next program of the worker's range, or one stolen from another worker. Returns -1 once all are taken
+static int next_program(batch_worker* worker) {
+	while (1) {
+		pthread_mutex_lock(&worker->lock);
+		int i = worker->next < worker->end?worker->next++:-1;
+		pthread_mutex_unlock(&worker->lock);
+
+		if (i != -1) return i;
+		if (!steal(worker)) return -1;
+	}
+}
+
+// Every worker loads its programs into one simulator. One that fails to make its simulator runs nothing,
+// and the others steal its range
+static void* run_worker(void* arg) {
+	batch_worker* worker = arg;
+	batch_config* config = worker->pool->config;
+	sim_t* sim = sim_new(config->n_harts, config->quantum, false);
+	int i;
+
+	if (!sim) return NULL;
+	sim_set_smc(sim, config->smc);
+	if (config->cache_config.has_cache) sim_set_cache(sim, config->cache_config);
+
+	while ((i = next_program(worker)) != -1) run_program(sim, worker->pool->paths[i], config->max_steps, &worker->pool->results[i]);
+	sim_free(sim);
+	return NULL;
+}
+
+static void print_result(const char* path, batch_result* result) {
+	char status[32];
+	bool show_message = false;
+
+	switch (result->status) {
+		case BATCH_EXITED: snprintf(status, sizeof(status), "exit %ld", result->exit_code); break;
+		case BATCH_ENDED: strcpy(status, "ended"); break;
+		case BATCH_TIMEOUT: strcpy(status, "timeout"); break;
+		case BATCH_PENDING: strcpy(status, "not run"); break;
+		case BATCH_ASSEMBLY_ERROR: strcpy(status, "asm error"); show_message = true; break;
+		case BATCH_RUNTIME_ERROR: strcpy(status, "error"); show_message = true; break;
+	}
+
+	// Messages are written for the TUI, some end in a newline
+	size_t len = strlen(result->message);
+	while (len && result->message[len-1] == '\n') result->message[--len] = '\0';
+
+	printf("%-40s %-10s %12lu instr %9.3fs  output %016lx (%lu bytes)%s%s\n", path, status, result->instructions, result->seconds,
+		result->output_hash, result->output_len, show_message?"  ":"", show_message?result->message:"");
+}
+
+int batch_main(const char* dir, int jobs, batch_config config) {
+	int n;
+	char** paths = list_sources(dir, &n);
+
+	if (!paths) {
+		fprintf(stderr, "Failed to read directory %s!\n", dir);
+		return 1;
+	}
+
+	if (jobs > n) jobs = n;
+	if (jobs < 1) jobs = 1;
+
+	batch_pool pool = {paths, calloc(n?n:1, sizeof(batch_result)), &config, calloc(jobs, sizeof(batch_worker)), jobs};
+	if (!pool.results || !pool.workers) {
+		fprintf(stderr, "Out Of Memory!\n");
+		return 1;
+	}
+
+	// Every program gets a fresh cache, traces of thousands of programs are not worth writing
+	strcpy(config.cache_config.trace_file_name, "/dev/null");
+	fflush(stdout);
+
+	// The programs start out split into one range per worker, in order of name
+	for (int i=0; i<jobs; i++) {
+		batch_worker* worker = &pool.workers[i];
+		pthread_mutex_init(&worker->lock, NULL);
+		worker->next = (long) n*i/jobs;
+		worker->end = (long) n*(i+1)/jobs;
+		worker->pool = &pool;
+	}
+
+	double start = now();
+
+	// The first worker is the calling thread, so there always is one even if no thread can be started
+	for (int i=1; i<jobs; i++) {
+		pool.workers[i].started = !pthread_create(&pool.workers[i].thread, NULL, run_worker, &pool.workers[i]);
+	}
+	run_worker(&pool.workers[0]);
+
+	int workers = 1;
+	for (int i=1; i<jobs; i++) {
+		if (!pool.workers[i].started) continue;
+		pthread_join(pool.workers[i].thread, NULL);
+		workers++;
+	}
+
+	double wall = now() - start;
+	int counts[BATCH_TIMEOUT+1] = {0};
+	int failed_exits = 0;
+	uint64_t instructions = 0;
+	double cpu = 0;
+
+	for (int i=0; i<n; i++) {
+		batch_result* result = &pool.results[i];
+		print_result(paths[i], result);
+
+		counts[result->status]++;
+		if (result->status == BATCH_EXITED && result->exit_code) failed_exits++;
+		instructions += result->instructions;
+		cpu += result->seconds;
+	}
+
+	printf("\n%d programs: %d exited with 0, %d exited with another code, %d ended, %d assembly errors, %d runtime errors, %d timed out, %d not run\n",
+		n, counts[BATCH_EXITED]-failed_exits, failed_exits, counts[BATCH_ENDED], counts[BATCH_ASSEMBLY_ERROR], counts[BATCH_RUNTIME_ERROR], counts[BATCH_TIMEOUT], counts[BATCH_PENDING]);
+	printf("%lu instructions, %.2fs of simulation in %.2fs on %d workers\n", instructions, cpu, wall, workers);
+
+	int failures = n - (counts[BATCH_EXITED]-failed_exits) - counts[BATCH_ENDED];
+
+	for (int i=0; i<jobs; i++) pthread_mutex_destroy(&pool.workers[i].lock);
+	for (int i=0; i<n; i++) free(paths[i]);
+	free(paths);
+	free(pool.results);
+	free(pool.workers);
+	return failures != 0;
+}
@@ -0,0 +1,42 @@
+#ifndef BATCH_H
+#define BATCH_H
+#include <stdint.h>
+#include <stdbool.h>
+#include "backend/memory.h"
+
+#define BATCH_MAX_STEPS 100000000 // Default number of instructions after which a program is stopped
+#define BATCH_MESSAGE_LEN 120
+
+typedef enum batch_status {
+	BATCH_PENDING,          // Not run, because no worker could create a simulator
+	BATCH_EXITED,           // Called exit, with exit_code
+	BATCH_ENDED,            // Ran off the end of the code
+	BATCH_ASSEMBLY_ERROR,
+	BATCH_RUNTIME_ERROR,
+	BATCH_TIMEOUT,          // Still running after max_steps instructions
+} batch_status;
+
+typedef struct batch_result {
+	batch_status status;
+	int64_t exit_code;
+	uint64_t instructions;
+	uint64_t output_hash;   // Hash of everything the program wrote to stdout and stderr
+	uint64_t output_len;
+	double seconds;
+	char message[BATCH_MESSAGE_LEN]; // Last error shown while assembling or running
+} batch_result;
+
+// How every program of a batch is run
+typedef struct batch_config {
+	int n_harts;
+	int quantum;
+	bool smc;
+	uint64_t max_steps;
+	CacheConfig cache_config;
+} batch_config;
+
+// Assembles and runs every .s file in dir without the TUI, spread over jobs worker threads with a simulator each, and
+// prints a report of all of them to stdout. Returns 0 if every program exited with 0 or ran to the end of its code
+int batch_main(const char* dir, int jobs, batch_config config);
+
+#endif
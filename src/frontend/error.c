@@ -0,0 +1,22 @@
+#include <stdio.h>
+#include "error.h"
+
+// Kept apart from the TUI, so the library and Python module can report errors without linking ncurses
+static __thread void (*error_screen)(char* format, va_list args) = NULL;
+static __thread char* error_buffer = NULL; // Where show_error writes while the TUI is not running, NULL to print
+static __thread size_t error_buffer_size = 0;
+
+void set_error_buffer(char* buffer, size_t size) {error_buffer = buffer; error_buffer_size = size;}
+char* get_error_buffer(size_t* size) {*size = error_buffer_size; return error_buffer;}
+void set_error_screen(void (*screen)(char* format, va_list args)) {error_screen = screen;}
+
+void show_error(char* format, ...) {
+    va_list args;
+    va_start(args, format);
+
+    if (error_screen) error_screen(format, args);
+    else if (error_buffer) vsnprintf(error_buffer, error_buffer_size, format, args);
+    else vprintf(format, args);
+
+    va_end(args);
+}
@@ -0,0 +1,18 @@
+#ifndef ERROR_H
+#define ERROR_H
+#include <stddef.h>
+#include <stdarg.h>
+
+// Shows an error or status message. Messages go to the TUI if the calling thread runs it, to the thread's error buffer
+// if it set one, and are printed otherwise
+void show_error(char* format, ...);
+
+// Makes show_error keep its message in buffer instead of printing it while the TUI is not running, NULL to print again.
+// The buffer belongs to the calling thread
+void set_error_buffer(char* buffer, size_t size);
+char* get_error_buffer(size_t* size);
+
+// Used by the TUI to take the messages of the thread it runs on, NULL gives them back
+void set_error_screen(void (*screen)(char* format, va_list args));
+
+#endif
@@ -1,13 +1,19 @@
+#define _GNU_SOURCE // memmem
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <ncurses.h>
 #include "../assembler/index.h"
 #include "../assembler/vec.h"
 #include "frontend.h"
-#include "../globals.h"
 #include "../backend/stacktrace.h"
 #include "../backend/memory.h"
+#include "../backend/watchpoint.h"
+#include "../backend/condition.h"
+#include "../backend/syscall.h"
+#include "../backend/backend.h"
+#include "../assembler/translator.h"
 
 // Related to terminal color configuration
 #define C_NORMAL 0
@@ -17,9 +23,18 @@
 #define C_TERMINAL 4
 #define C_NORMAL_HIGHLIGHT 5
 #define C_OFF_NORMAL_HIGHLIGHT 6
+#define C_HEAT 7                // Four pairs, from the coldest shade of the heatmap to the hottest
 
 #define COLOR_GRAY COLOR_CYAN
 
+#define SCRIPT_DEPTH 8          // How deep $source can nest
+#define SCRIPT_LINE_MAX 256     // Longest line of a script, with the $ and terminator. Paths have to fit in input_file
+#define HEAT_PAGE 4096          // Bytes per cell of "heatmap pages"
+#define MEM_ROW_MAX 32          // Most bytes in a row of the memory pane
+#define FIND_MAX 64             // Longest pattern find searches for
+
+typedef enum {HEAT_ACCESSES, HEAT_READS, HEAT_WRITES, HEAT_MISSES, HEAT_SETS} heat_mode;
+
 // All common state of the frontend is accessible to all functions.
 static int rows=0, columns=0;           // Window information
 static int cursor=0;
@@ -33,17 +48,22 @@ static size_t  last_command_len = 0;
 static char* input_buffer = NULL;       
 static size_t input_buffer_len;
 static size_t input_buffer_size;
+static char input_file[256] = "";       // File named by the last $load or $cache_sim command
 static bool initialized = false;        // State flags
 static bool showing_error = false;
 static bool showing_mem = false;
 static bool showing_cache = false;
+static bool showing_output = false;
+static bool showing_heatmap = false;
 static bool color_mode = false;
 static bool run_lock = false;
 static bool showing_run_lock = false;
 static bool code_loaded = false;
 static MEVENT mouse;                    // Stores last mouse event
-static uint64_t last_reg_write = -2;    // Last register written to
+static uint64_t* last_reg_write = NULL; // Last register written to by the viewed hart, kept by the backend
 static uint64_t memory_size = 0;        // Size of memory (for scrolling)
+static FILE* scripts[SCRIPT_DEPTH];     // Command files being replayed, the innermost last
+static int script_depth = 0;
 
 static uint64_t* regs = NULL;
 static uint64_t* pc = NULL;
@@ -51,35 +71,121 @@ static uint8_t* memory_data = NULL;
 static Memory* memory = NULL;
 static int* code_v_offsets = NULL;      // Stores a pre-calculated list of vertical offsets of each line of code.
 static char** code = NULL;
+static arena* program = NULL;           // Owns everything of the loaded program, including code and code_v_offsets
 static uint32_t* hexcode = NULL;
+static vec* addresses = NULL;           // Address of each line of code, followed by the end of the text segment
+static int* pc_lines = NULL;            // Line at every 2 byte aligned address from the start of the text segment, -1 if none
 static vec* breakpoints = NULL;
+static vec* breakpoint_conditions = NULL;
+static watch_list* watchpoints = NULL;
+static guest_output* output = NULL;
 static label_index* labels = NULL;
 static stacktrace* stack = NULL;
+static hart* harts = NULL;
+static int n_harts = 1;
+static int viewed_hart = 0;             // Hart whose registers, pc, stack trace and cache are shown
+static int mem_group = 1;               // Bytes of the memory pane shown together, as one little endian value
+static int mem_row = 16;                // Bytes per row of the memory pane, if they fit
+static int mem_rows = 0;                // Rows of the memory pane, for scrolling
+static uint8_t find_pattern[FIND_MAX];  // Last pattern of find, searched again by a find without one
+static size_t find_len = 0;
+static uint64_t match_addr = 0;         // Bytes found by find, highlighted in the memory pane
+static size_t match_len = 0;
 
 static const char policy_names[3][10] = {"FIFO", "LRU ", "RAND"};
+static const char heat_mode_names[5][10] = {"Accesses", "Reads", "Writes", "Misses", "Misses"};
+static const char heat_shades[] = ".-:+*#";  // Never touched, touched before, then rising numbers of recent accesses
+
+static heat_mode heatmap_mode = HEAT_ACCESSES;
+static int heatmap_cell = HEAT_REGION;      // Bytes of memory per cell
+static uint32_t* heat_seen = NULL;          // Counters as of the last frame
+static uint32_t* heat_recent = NULL;        // What the counters moved in recent frames, halved every frame
+static uint8_t* heat_shown = NULL;          // Shade drawn in every cell
+static size_t heat_counters = 0;
+static Memory* heat_memory = NULL;          // Memory the counters are read from
+static heat_mode heat_seen_mode;
+static int heat_rows = 0;                   // Rows of cells, for scrolling
 
 static int input_root_x, input_root_y, input_h, input_w;
 static int register_w, register_root_x, register_root_y, register_h;
 static int aux_root_x, aux_root_y, aux_w, aux_h;
+static int memory_w;                    // The memory pane takes the place of both the aux and registers panes
 static int cache_stats_root_x, cache_stats_root_y, cache_stats_w, cache_stats_h;
 static int cache_root_x, cache_root_y, cache_w, cache_h;
 static int code_root_x, code_root_y, code_w, code_h;
 
+// What decides the layout of the screen and which panes are shown. When any of it changes the whole screen is drawn again
+typedef struct {
+    int rows, columns;
+    bool showing_mem, showing_cache, showing_output, showing_heatmap;
+    heat_mode heatmap_mode;
+    int heatmap_cell;
+    int mem_group, mem_row;
+    int code_scroll, aux_scroll, cache_scroll;
+    char** code;
+    uint64_t* regs;
+    Memory* memory;
+    uint8_t* cache;
+    bool has_cache;
+    stacktrace* stack;
+} screen_view;
+
+// Everything else a frame shows is remembered as drawn, so the next frame only rewrites what changed since
+static screen_view shown_view;
+static bool redraw_all = true;
+static uint64_t shown_regs[32];
+static uint64_t shown_reg_write = -2;
+static int shown_pc_line = -1;
+static uint64_t shown_breakpoints = 0;      // Checksum of the breakpoint lines
+static uint64_t shown_stack = 0;            // Checksum of the visible stack frames
+static size_t shown_output_len = 0;
+static uint8_t* shown_memory = NULL;        // Visible rows of the memory pane, their bytes followed by which were written
+static uint8_t* shown_cache = NULL;         // Visible lines of the cache pane, with their flags and tag
+static size_t shown_cache_size = 0;
+
 // Utility functions to link frontend to backend
 void set_frontend_register_pointer(uint64_t* regs_pointer) {regs = regs_pointer;}
 void set_frontend_pc_pointer(uint64_t* pc_pointer) {pc = pc_pointer;}
 void set_frontend_memory_pointer(Memory* memory_pointer, uint64_t size_of_memory) {memory = memory_pointer; memory_data = &memory_pointer->data[0]; memory_size = size_of_memory;}
 void set_breakpoints_pointer(vec* breakpoints_pointer) {breakpoints = breakpoints_pointer;}
+void set_breakpoint_conditions_pointer(vec* conditions_pointer) {breakpoint_conditions = conditions_pointer;}
+void set_watchpoints_pointer(watch_list* watchpoints_pointer) {watchpoints = watchpoints_pointer;}
+void set_output_pointer(guest_output* output_pointer) {output = output_pointer;}
 void set_stack_pointer(stacktrace* stacktrace) {stack = stacktrace;}
 void set_hexcode_pointer(uint32_t* hexcode_pointer) {hexcode = hexcode_pointer;}
+void set_program_arena(arena* program_arena) {program = program_arena;}
+const char* get_input_file() {return input_file;}
+void set_addresses_pointer(vec* addresses_pointer) {addresses = addresses_pointer;}
+void set_pc_lines_pointer(int* pc_lines_pointer) {pc_lines = pc_lines_pointer;}
 void set_run_lock() {run_lock = true; showing_run_lock = true;} // Locks user out of certain actions
-void set_reg_write(uint64_t reg) {last_reg_write = reg;}
+void set_reg_write_pointer(uint64_t* reg_write_pointer) {last_reg_write = reg_write_pointer;}
+void set_harts_pointer(hart* harts_pointer, int count) {harts = harts_pointer; n_harts = count;}
+void set_viewed_hart(int id) {viewed_hart = id;}
+
+// Points the panes at the viewed hart. Done on every draw, since the backend replaces the stack traces of the other harts on reset
+static void view_hart() {
+    if (!harts || n_harts == 1) return;
+
+    regs = harts[viewed_hart].registers;
+    last_reg_write = &harts[viewed_hart].last_reg_write;
+    pc = &harts[viewed_hart].pc;
+    memory = harts[viewed_hart].memory;
+    if (harts[viewed_hart].stack) stack = harts[viewed_hart].stack;
+}
+
+// Returns the line that the PC is on, -1 if it is outside the code
+static int pc_line() {
+    uint64_t start = addresses->values[0];
+    return *pc >= start && *pc < addresses->values[addresses->len-1]?pc_lines[(*pc-start)/2]:-1;
+}
 
 void reset_frontend(bool hard) {
     if (hard) code_scroll = 0;
-    last_reg_write = -2;
+    if (hard) match_len = 0;
+    if (last_reg_write) *last_reg_write = -2;
     if (!showing_mem) aux_scroll = 0;
     cache_scroll = 0;
+    redraw_all = true;
 }
 
 void release_run_lock() {
@@ -101,8 +207,7 @@ void set_labels_pointer(label_index* index) {
     int offset = 0;
     int last = 0;
 
-    if (code_v_offsets) free(code_v_offsets);
-    code_v_offsets = malloc(sizeof(int)*lines_of_code);
+    code_v_offsets = arena_alloc(program, sizeof(int)*lines_of_code);
 
     for (int i=0; i<index->len; i++) {
 
@@ -123,10 +228,9 @@ void set_labels_pointer(label_index* index) {
 // changing \n to \0 thus making it a contiguous array of strings 
 // also creates a list of pointers to each string's start 
 // this helps to speed up rendering
+// Must be called after set_program_arena, the list is freed along with the program
 void update_code(char* code_pointer, uint64_t n) {
-    if (code) free(code);
-    
-    code = malloc(sizeof(char*)*(n+1));
+    code = arena_alloc(program, sizeof(char*)*(n+1));
     code[0] = code_pointer;
     code_loaded = true;
     int i=1;
@@ -171,86 +275,161 @@ int write_centered(int x, int y, int w, char* string) {
     return 0;
 }
 
-// Render the registers pane
-void write_regs(int x, int y, int h, int w) {
+// Blanks the inside of a pane, for content that does not overwrite what it replaces
+static void clear_pane(int x, int y, int h, int w) {
+    for (int i=1; i<h-1; i++) mvhline(y+i, x+1, ' ', w-2);
+}
+
+// Render the registers pane, only rewriting registers that changed or were just written to unless full
+void write_regs(int x, int y, int h, int w, bool full) {
     if(w<26) return;
 
     int padding = (w-26)/3;
     int name_x = x + 2 + padding;
-    int value_x = x + 2 + 3 + 1 + 2*padding;
-    bool color_toggle = false;
+    uint64_t written = last_reg_write?*last_reg_write:-2;
 
     for(int i=0; i<((h>36)?32:(h-4)); i++) {
+        bool highlight = i==written;
+        if (!full && regs[i] == shown_regs[i] && highlight == (i==shown_reg_write)) continue;
 
-        if (color_toggle) {
-            if (i-1==last_reg_write) attroff(COLOR_PAIR(C_NORMAL_HIGHLIGHT));
-            else attroff(COLOR_PAIR(C_NORMAL));
-
-            if (i==last_reg_write) attron(COLOR_PAIR(C_OFF_NORMAL_HIGHLIGHT));
-            else attron(COLOR_PAIR(C_OFF_NORMAL));
-        } else {
-            if (i-1==last_reg_write) attroff(COLOR_PAIR(C_OFF_NORMAL_HIGHLIGHT));
-            else attroff(COLOR_PAIR(C_OFF_NORMAL));
-
-            if (i==last_reg_write) attron(COLOR_PAIR(C_NORMAL_HIGHLIGHT));
-            else attron(COLOR_PAIR(C_NORMAL));
-        }
-
-        color_toggle = !color_toggle;
+        // Alternating colors
+        int pair = i%2?(highlight?C_OFF_NORMAL_HIGHLIGHT:C_OFF_NORMAL):(highlight?C_NORMAL_HIGHLIGHT:C_NORMAL);
 
+        attron(COLOR_PAIR(pair));
         mvprintw(y+2+i, name_x, "x%02d %*s 0x%016lX", i, padding, "", regs[i]);
+        attroff(COLOR_PAIR(pair));
+        shown_regs[i] = regs[i];
     }
 
-    attroff(COLOR_PAIR(C_OFF_NORMAL));
+    shown_reg_write = written;
 }
 
-// Render the code pane
-void write_code(int x, int y, int h, int w) {
-
-    if (!code) return;
-    
-    int inst_len = w-32;
-    if (inst_len<1) return;
+// Compressed instructions are shown as 4 hex digits, right aligned with the rest
+static void format_hexcode(char* hex, uint32_t instruction) {
+    if ((instruction & 0x3) != 0x3) snprintf(hex, 9, "    %04X", instruction & 0xFFFF);
+    else snprintf(hex, 9, "%08X", instruction);
+}
 
+// Number of rows of the code pane that have code on them
+static int code_rows(int h) {
     int num_lines = code_v_offsets[lines_of_code-1]-code_scroll+1;
-    num_lines = num_lines<h-4?num_lines:h-4;
+    return num_lines<h-4?num_lines:h-4;
+}
 
-    int print_y = 0;
-    int pos;
+static uint64_t breakpoint_checksum() {
+    uint64_t sum = breakpoints->len;
+    for (int i=0; i<breakpoints->len; i++) sum = sum*31 + breakpoints->values[i];
+    return sum;
+}
 
-    for (int i=0; i<lines_of_code; i++) {
-        print_y = code_v_offsets[i]-code_scroll;
-        if (print_y >= 0 && print_y < num_lines) {
-            mvprintw(y+2+print_y, x+5, "% 5d %04x: %.*s ", (i+1), (i)*4, inst_len, code[i]);
-            mvprintw(y+2+print_y, x+w-2-12, "%08X %s ", hexcode[i], "  ");
-        }
-    }
+// Render a line of code with its breakpoint marker, highlighted if the pc is on it
+static void write_code_line(int x, int y, int h, int w, int line, int pc_pos) {
+    int inst_len = w-32;
+    int print_y = code_v_offsets[line]-code_scroll;
+    char hex[9];
+
+    if (print_y < 0 || print_y >= code_rows(h)) return;
 
-    pos = *pc/4;
-    print_y = pos<lines_of_code?code_v_offsets[pos]-code_scroll:-1;
-    if (print_y>=0 && print_y<num_lines) {
+    mvhline(y+2+print_y, x+1, ' ', w-2); // The line may have been highlighted before
+    format_hexcode(hex, hexcode[line]);
+
+    if (line == pc_pos) {
         size_t size = sizeof(char) * (w+1);
-        char* line = malloc(size);
-        snprintf(line, w+1, "% 5d %04x: %.*s", pos+1, (pos)*4, inst_len, code[pos]);
-        int space_count = w-strlen(line)-19;
+        char* text = malloc(size);
+        snprintf(text, w+1, "% 5d %04lx: %.*s", line+1, addresses->values[line], inst_len, code[line]);
+        int space_count = w-strlen(text)-19;
 
         attron(COLOR_PAIR(C_RUNNING));
-        mvprintw(y+2+print_y, x+5, "%s%*s%08X %s ", line, space_count, "", hexcode[pos], "EX");
+        mvprintw(y+2+print_y, x+5, "%s%*s%s %s ", text, space_count, "", hex, "EX");
         attroff(COLOR_PAIR(C_RUNNING));
-        if (line) free(line);
+        if (text) free(text);
+    } else {
+        mvprintw(y+2+print_y, x+5, "% 5d %04lx: %.*s ", (line+1), addresses->values[line], inst_len, code[line]);
+        mvprintw(y+2+print_y, x+w-2-12, "%s %s ", hex, "  ");
     }
 
     for (int i=0; i<breakpoints->len; i++) {
-        pos = breakpoints->values[i];
-        print_y = code_v_offsets[pos]-code_scroll;
-        if (print_y>=0 && pos<num_lines) mvaddch(y+2+print_y, x+3, '>');
+        if (breakpoints->values[i] == line) mvaddch(y+2+print_y, x+3, '>');
+    }
+}
+
+// Render the code pane. Unless full, only the lines the pc moved between are rewritten, or everything if breakpoints changed
+void write_code(int x, int y, int h, int w, bool full) {
+
+    if (!code) return;
+    if (w-32<1) return;
+
+    int pos = pc_line();
+    uint64_t breakpoint_sum = breakpoint_checksum();
+
+    if (!full && breakpoint_sum != shown_breakpoints) {
+        clear_pane(x, y, h, w);
+        full = true;
     }
 
-    for (int i=0; i<labels->len; i++) {
-        pos = labels->positions[i];
-        print_y = code_v_offsets[pos]-code_scroll-1;
-        if (print_y>=0 && print_y<num_lines) mvprintw(y+2+print_y, x+7, "<%s>:", labels->labels[i]);
+    if (full) {
+        for (int i=0; i<lines_of_code; i++) write_code_line(x, y, h, w, i, pos);
+
+        int num_lines = code_rows(h);
+        for (int i=0; i<labels->len; i++) {
+            int print_y = code_v_offsets[labels->positions[i]]-code_scroll-1;
+            if (print_y>=0 && print_y<num_lines) mvprintw(y+2+print_y, x+7, "<%s>:", labels->labels[i]);
+        }
+    } else if (pos != shown_pc_line) {
+        if (shown_pc_line != -1) write_code_line(x, y, h, w, shown_pc_line, pos);
+        if (pos != -1) write_code_line(x, y, h, w, pos, pos);
     }
+
+    shown_pc_line = pos;
+    shown_breakpoints = breakpoint_sum;
+}
+
+// Calculates the position and size of everything based on window size. Only needed when the window is resized
+static void layout() {
+    getmaxyx(stdscr, rows, columns); // Get window size
+
+    input_root_x = 0;
+    input_root_y = rows-4;
+    input_h=4;
+    input_w=columns;
+    
+    register_w = 0.25*columns, // TODO: Make this responsive someday (update scroll part too) columns>108?27:0.25*columns;
+    register_root_x = columns-register_w;
+    register_root_y = 0;
+    register_h=input_root_y+1;
+    
+    aux_root_x = 0.5*columns;
+    aux_root_y = 0;
+    aux_w=register_root_x-aux_root_x+1;
+    aux_h=input_root_y+1;
+    memory_w=columns-aux_root_x;
+
+    cache_stats_root_x = 0.5*columns;
+    cache_stats_root_y = input_root_y>6?input_root_y - 6:1;
+    cache_stats_w = columns-cache_stats_root_x;
+    cache_stats_h = input_root_y-cache_stats_root_y+1;
+    
+    cache_root_x = 0.5*columns;
+    cache_root_y = 0;
+    cache_w = columns-cache_root_x;
+    cache_h = cache_stats_root_y+1;
+    
+    code_root_x = 0;
+    code_root_y = 0;
+    code_w=aux_root_x+1;
+    code_h=input_root_y+1;
+
+    free(shown_memory);
+    shown_memory = malloc((rows > 0?rows:1)*2*MEM_ROW_MAX);
+    redraw_all = true;
+}
+
+// Shows errors in the input line while the TUI runs
+static void show_tui_error(char* format, va_list args) {
+    showing_run_lock = false;
+    vsnprintf(input_buffer, input_buffer_size, format, args);
+    curs_set(0);
+    showing_error = true;
 }
 
 // Initializes frontend
@@ -277,13 +456,17 @@ int init_frontend() {
         init_pair(C_TERMINAL, COLOR_GREEN, COLOR_BLACK);
         init_pair(C_NORMAL_HIGHLIGHT, COLOR_WHITE, COLOR_YELLOW);
         init_pair(C_OFF_NORMAL_HIGHLIGHT, COLOR_WHITE, COLOR_YELLOW);
+        init_pair(C_HEAT, COLOR_WHITE, COLOR_BLUE);
+        init_pair(C_HEAT+1, COLOR_BLACK, COLOR_GREEN);
+        init_pair(C_HEAT+2, COLOR_BLACK, COLOR_YELLOW);
+        init_pair(C_HEAT+3, COLOR_WHITE, COLOR_RED);
     }
 
 
     // Allocate buffers
     input_buffer_size = (getmaxx(stdscr)-1);
     input_buffer = malloc(input_buffer_size*sizeof(char));
-    last_command = malloc(input_buffer_size*sizeof(char));
+    last_command = malloc((input_buffer_size > SCRIPT_LINE_MAX?input_buffer_size:SCRIPT_LINE_MAX)*sizeof(char));
 
     if(!input_buffer || !last_command) return 1;
 
@@ -291,46 +474,131 @@ int init_frontend() {
     input_buffer[1] = '\0';
     input_buffer_len = 1;
 
+    layout();
     initialized = true;
+    set_error_screen(show_tui_error); // Only this thread may draw, others keep their errors
     return 0;
 }
 
-// Render the memory pane
-void write_memory(int x, int y, int w, int h) {
-    int padding = w-6-3-11; // Calculate padding to center the text
+// Width of a row of the memory pane holding row bytes: its address, the groups and the bytes as text
+static int memory_row_width(int row) {
+    return 6 + row/mem_group*(2*mem_group+1) + 2 + row;
+}
+
+// Bytes per row of the memory pane. Rows are made narrower than asked for until they fit
+static int memory_row_bytes() {
+    int row = mem_row;
+    while (row > mem_group && memory_row_width(row) > memory_w-4) row /= 2;
+    return row;
+}
 
-    if (padding<2) return;
+// Whether any hart stored to addr since execution was last resumed
+static bool byte_written(uint64_t addr) {
+    if (!harts || n_harts == 1) return memory->written[addr/8] & (1 << (addr%8));
 
-    // Scroll related calculations
-    int last_line = aux_scroll+(h-5);
-    int offset=0;
-    bool color_toggle = false;
-    if (last_line > memory_size-1) last_line = memory_size-1;
+    for (int i=0; i<n_harts; i++) {
+        if (harts[i].memory->written[addr/8] & (1 << (addr%8))) return true;
+    }
+    return false;
+}
+
+// Bytes written from here on are highlighted in the memory pane
+static void clear_written_bytes() {
+    if (!harts || n_harts == 1) clear_written(memory);
+    else for (int i=0; i<n_harts; i++) clear_written(harts[i].memory);
+}
+
+// Render the memory pane as a hex dump, rows of bytes in groups shown as little endian values followed by the bytes as text.
+// Bytes written since execution was last resumed and the last match of find are highlighted. Unless full, only changed rows are rewritten
+void write_memory(int x, int y, int w, int h, bool full) {
+    int row_bytes = memory_row_bytes();
+    int width = memory_row_width(row_bytes);
+
+    mem_rows = (memory_size+row_bytes-1)/row_bytes;
+    if (width > w-4 || h < 6) return;
+    if (!shown_memory) full = true;
+
+    int h_offset = (w-width)/2;
+
+    if (full) {
+        mvprintw(y+2, x+h_offset, "%6s", "");
+        for (int i=0; i<row_bytes; i+=mem_group) printw(" %*x", 2*mem_group, i);
+    }
 
-    for (int i=aux_scroll; i<=last_line; i++) {
+    for (int line=0; line<h-5 && aux_scroll+line<mem_rows; line++) {
+        uint64_t addr = (uint64_t) (aux_scroll+line)*row_bytes;
+        int len = addr+row_bytes > memory_size?memory_size-addr:row_bytes;
+        uint8_t* shown = shown_memory?shown_memory+line*2*MEM_ROW_MAX:NULL;
+        uint8_t written[MEM_ROW_MAX];
+
+        for (int i=0; i<len; i++) written[i] = byte_written(addr+i);
+        if (!full && !memcmp(shown, memory_data+addr, len) && !memcmp(shown+MEM_ROW_MAX, written, len)) continue;
+        if (shown) {
+            memcpy(shown, memory_data+addr, len);
+            memcpy(shown+MEM_ROW_MAX, written, len);
+        }
 
         // Alternating colors
-        if (color_toggle) {
-            attron(COLOR_PAIR(C_OFF_NORMAL));
-        } else {
-            attroff(COLOR_PAIR(C_OFF_NORMAL));
+        int normal = line%2?C_OFF_NORMAL:C_NORMAL;
+        int highlight = line%2?C_OFF_NORMAL_HIGHLIGHT:C_NORMAL_HIGHLIGHT;
+
+        attron(COLOR_PAIR(normal));
+        mvprintw(y+3+line, x+h_offset, "%05lx ", addr);
+
+        for (int i=0; i<row_bytes; i+=mem_group) {
+            int pair = normal;
+            uint64_t value = 0;
+
+            for (int j=mem_group-1; j>=0; j--) {
+                if (i+j >= len) continue;
+                value = value << 8 | memory_data[addr+i+j];
+                if (written[i+j]) pair = highlight;
+                if (match_len && addr+i+j >= match_addr && addr+i+j < match_addr+match_len) pair = C_RUNNING;
+            }
+
+            addch(' ');
+            attron(COLOR_PAIR(pair));
+            if (i+mem_group <= len) printw("%0*lx", 2*mem_group, value);
+            else printw("%*s", 2*mem_group, "");
+            attroff(COLOR_PAIR(pair));
+            attron(COLOR_PAIR(normal));
         }
 
-        color_toggle = !color_toggle;
+        printw("  ");
+        for (int i=0; i<row_bytes; i++) {
+            char c = i<len?memory_data[addr+i]:' ';
+            int pair = i>=len?normal:match_len && addr+i >= match_addr && addr+i < match_addr+match_len?C_RUNNING:written[i]?highlight:normal;
 
-        // Write the actual content
-        mvprintw(y+2+offset, x+2+padding/4, "0x%08X %*s 0x%02x", i, padding/2, "", memory_data[i]);
-        offset++;
+            attron(COLOR_PAIR(pair));
+            addch((c<32 || c>126)?'.':c);
+            attroff(COLOR_PAIR(pair));
+            attron(COLOR_PAIR(normal));
+        }
+
+        attroff(COLOR_PAIR(normal));
     }
+}
+
+static uint64_t stack_checksum(int h) {
+    uint64_t sum = stack->len;
+    int last_line = aux_scroll+(h-5);
+    if (last_line > stack->len) last_line = stack->len;
 
-    attroff(COLOR_PAIR(C_OFF_NORMAL));
+    for (int i=aux_scroll; i<last_line; i++) sum = (sum*31 + st_frame_at(stack, i)->section)*31 + st_frame_at(stack, i)->line;
+    return sum;
 }
 
 // Render the stack pane
-void write_stack(int x, int y, int w, int h) {
+void write_stack(int x, int y, int w, int h, bool full) {
     
     if (!stack) return;
 
+    // Frames are centered, so a changed stack is drawn again from a blank pane
+    uint64_t sum = stack_checksum(h);
+    if (!full && sum == shown_stack) return;
+    if (!full) clear_pane(x, y, h, w);
+    shown_stack = sum;
+
     if (stack->len == 0) {
         write_centered(x, y+2, w, "Empty Call Stack: Execution complete");
         return;
@@ -343,9 +611,10 @@ void write_stack(int x, int y, int w, int h) {
     if (last_line > stack->len) last_line = stack->len;
 
     for (int i=aux_scroll; i<last_line; i++) {
-        if (stack->label_indices->values[i] < 0) continue;
-        if (stack->stack->values[i] == -1) continue;
-        snprintf(line, w-4, "(%s:%ld)", labels->labels[stack->label_indices->values[i]], stack->stack->values[i]);
+        st_frame* frame = st_frame_at(stack, i);
+        if (frame->section < 0) continue;
+        if (frame->line == -1) continue;
+        snprintf(line, w-4, "(%s:%d)", labels->labels[frame->section], frame->line);
         write_centered(x, y+2+offset, w, line);
         offset++;
     }
@@ -354,42 +623,198 @@ void write_stack(int x, int y, int w, int h) {
 
 }
 
-void write_cache(int x, int y, int w, int h) {
+// Render the output pane, showing the last lines the program wrote to stdout/stderr
+void write_output(int x, int y, int w, int h, bool full) {
+    if (!full && output->len == shown_output_len) return;
+    if (!full) clear_pane(x, y, h, w);
+    shown_output_len = output->len;
+
+    if (!output->len) {
+        write_centered(x, y+2, w, "No output yet");
+        return;
+    }
+
+    // Find where the last h-4 lines start, ignoring a trailing newline
+    size_t start = output->len;
+    if (output->data[start-1] == '\n') start--;
+    for (int lines=0; start > 0; start--) {
+        if (output->data[start-1] == '\n' && ++lines == h-4) break;
+    }
+
+    int row = 0, col = 0;
+    for (size_t i=start; i<output->len && row<h-4; i++) {
+        char c = output->data[i];
+
+        if (c == '\n') {
+            row++;
+            col = 0;
+            continue;
+        }
+
+        if (col < w-4) mvaddch(y+2+row, x+2+col, (c<32 || c>126)?' ':c); // Long lines are cut off
+        col++;
+    }
+}
+
+// Counter i of what the heatmap shows, per HEAT_REGION bytes of memory or per cache set
+static uint32_t heat_counter(size_t i) {
+    switch (heatmap_mode) {
+        case HEAT_READS: return memory->heat[i].reads;
+        case HEAT_WRITES: return memory->heat[i].writes;
+        case HEAT_MISSES: return memory->heat[i].misses;
+        case HEAT_SETS: return memory->set_misses[i];
+        default: return memory->heat[i].reads + memory->heat[i].writes;
+    }
+}
+
+// Folds what the counters moved since the last frame into the recent counts, which halve every frame.
+// Starts over when the counters are of another memory or mode. Returns false if out of memory
+static bool update_heat() {
+    size_t n = heatmap_mode == HEAT_SETS?memory->cache_config.n_lines:HEAT_REGIONS;
+
+    if (heat_memory != memory || heat_counters != n || heat_seen_mode != heatmap_mode) {
+        free(heat_seen);
+        free(heat_recent);
+        free(heat_shown);
+        heat_seen = malloc(n*sizeof(uint32_t));
+        heat_recent = calloc(n, sizeof(uint32_t));
+        heat_shown = malloc(n*sizeof(uint8_t));
+        heat_memory = NULL;
+
+        if (!heat_seen || !heat_recent || !heat_shown) return false;
+        for (size_t i=0; i<n; i++) heat_seen[i] = heat_counter(i);
+        memset(heat_shown, 0xFF, n*sizeof(uint8_t));
+        heat_memory = memory;
+        heat_counters = n;
+        heat_seen_mode = heatmap_mode;
+        return true;
+    }
+
+    for (size_t i=0; i<n; i++) {
+        uint32_t count = heat_counter(i);
+        heat_recent[i] = heat_recent[i]/2 + (count<heat_seen[i]?count:count-heat_seen[i]); // Counters restart on reset
+        heat_seen[i] = count;
+    }
+    return true;
+}
+
+// Sums the counters of cell k
+static uint64_t heat_cell(size_t k, size_t per_cell, bool* touched) {
+    uint64_t recent = 0;
+    *touched = false;
+
+    for (size_t i=k*per_cell; i<(k+1)*per_cell && i<heat_counters; i++) {
+        recent += heat_recent[i];
+        if (heat_seen[i]) *touched = true;
+    }
+    return recent;
+}
+
+// Render the heatmap pane, a cell per region of memory or per cache set shaded by how much it was accessed
+// recently compared to the hottest cell. Unless full, only cells whose shade changed are rewritten
+void write_heatmap(int x, int y, int w, int h, bool full) {
+    bool sets = heatmap_mode == HEAT_SETS;
+
+    if ((sets || heatmap_mode == HEAT_MISSES) && !memory->cache_config.has_cache) {
+        if (full) write_centered(x, y+(h/2), w, "Cache is disabled");
+        return;
+    }
+
+    int label_w = 6; // Address or set of the first cell of a row
+    if (w-4-label_w < 1 || h < 6) return;
+    if (!update_heat()) return;
+    if (full) memset(heat_shown, 0xFF, heat_counters*sizeof(uint8_t));
+
+    // Rows hold a power of 2 cells, so their addresses stay round
+    int per_row = 1;
+    while (per_row*2 <= w-4-label_w) per_row *= 2;
+
+    size_t per_cell = sets?1:heatmap_cell/HEAT_REGION;
+    size_t n_cells = (heat_counters+per_cell-1)/per_cell;
+    int h_offset = (w-2-label_w-per_row)/2;
+    uint64_t hottest = 0;
+    bool touched;
+
+    heat_rows = (n_cells+per_row-1)/per_row;
+    for (size_t k=0; k<n_cells; k++) {
+        uint64_t recent = heat_cell(k, per_cell, &touched);
+        if (recent > hottest) hottest = recent;
+    }
+
+    if (full) {
+        char legend[64];
+        if (sets) snprintf(legend, sizeof(legend), "Misses per set, %lu sets", n_cells);
+        else snprintf(legend, sizeof(legend), "%s per %d B", heat_mode_names[heatmap_mode], heatmap_cell);
+        write_centered(x, y+2, w, legend);
+    }
+
+    for (int row=0; row<h-5 && aux_scroll+row<heat_rows; row++) {
+        size_t first = (size_t) (aux_scroll+row)*per_row;
+        if (full) mvprintw(y+3+row, x+1+h_offset, "%05lx ", sets?first:first*heatmap_cell);
+
+        for (int col=0; col<per_row && first+col<n_cells; col++) {
+            uint64_t recent = heat_cell(first+col, per_cell, &touched);
+            uint8_t shade = !recent?touched:recent*2>hottest?5:recent*8>hottest?4:recent*32>hottest?3:2;
+
+            if (heat_shown[first+col] == shade) continue;
+            heat_shown[first+col] = shade;
+
+            if (shade >= 2) attron(COLOR_PAIR(C_HEAT+shade-2));
+            mvaddch(y+3+row, x+1+h_offset+label_w+col, heat_shades[shade]);
+            if (shade >= 2) attroff(COLOR_PAIR(C_HEAT+shade-2));
+        }
+    }
+}
+
+// Render the cache pane, only rewriting the lines whose flags, tag or data changed unless full
+void write_cache(int x, int y, int w, int h, bool full) {
     if (!memory->cache_config.has_cache) {
-        write_centered(x, y+(h/2), w, "Cache is disabled");
+        if (full) write_centered(x, y+(h/2), w, "Cache is disabled");
         return;
     }
 
+    int state_w = memory->bus?2:0; // Coherence state column, only shown when there are other caches to be coherent with
     if (h<7) return;
-    if (w<34) return;
+    if (w<34+state_w) return;
     // 0x00 0 0 0x0000000000000000 44 18 32 54 23 53 34 
 
     int last_line = cache_scroll+h-6;
-    int max_bytes = (w<32+3*memory->cache_config.block_size)?(w-32)/3:memory->cache_config.block_size;
+    int max_bytes = (w<32+state_w+3*memory->cache_config.block_size)?(w-32-state_w)/3:memory->cache_config.block_size;
     int v_offset = 0;
-    int h_offset = (w - 32 - 3*max_bytes)/2;
+    int h_offset = (w - 32 - state_w - 3*max_bytes)/2;
+    size_t line_size = memory->masks.block_offset;
+    size_t shown_size = memory->masks.data_offset+memory->cache_config.block_size; // Replacement timestamps are not shown
     if (last_line > memory->cache_config.n_blocks) last_line = memory->cache_config.n_blocks;
-    
-    // printf("%d %d %d\n", w, h_offset, x+2+h_offset);
-    // return;
 
-    mvprintw(y+2+v_offset, x+2+h_offset," Set  V D         Tag        Data");
+    if (last_line > cache_scroll && shown_cache_size < (last_line-cache_scroll)*shown_size) {
+        free(shown_cache);
+        shown_cache_size = (last_line-cache_scroll)*shown_size;
+        shown_cache = malloc(shown_cache_size);
+        if (!shown_cache) shown_cache_size = 0;
+        full = true;
+    }
+
+    if (full) {
+        if (memory->bus) mvprintw(y+2+v_offset, x+2+h_offset," Set  V D S         Tag        Data");
+        else mvprintw(y+2+v_offset, x+2+h_offset," Set  V D         Tag        Data");
+    }
+
+    for (int i=cache_scroll; i<last_line; i++, v_offset++) {
+        uint8_t* line = memory->cache+i*line_size;
+        uint8_t* shown = shown_cache?shown_cache+v_offset*shown_size:NULL;
+
+        if (!full && shown && !memcmp(line, shown, shown_size)) continue;
+        if (shown) memcpy(shown, line, shown_size);
 
-    for (int i=cache_scroll; i<last_line; i++) {
-        mvprintw(y+4+v_offset, x+2+h_offset," 0x%02lx %d %d 0x%016lx",
+        mvprintw(y+4+v_offset, x+2+h_offset," 0x%02lx %d %d",
             i/memory->cache_config.associativity,
-            memory->cache[i*memory->masks.block_offset]&VALID?1:0,
-            memory->cache[i*memory->masks.block_offset]&DIRTY?1:0,
-            (*(uint64_t*) (memory->cache+(i*memory->masks.block_offset)+1))/memory->cache_config.block_size/memory->cache_config.n_lines);
-        // mvprintw(y+4+v_offset, x+2+h_offset," 0x%02lx %d %d 0x%016lx", 1, 1, 0, 128);
+            line[0]&VALID?1:0,
+            line[0]&DIRTY?1:0);
+        if (memory->bus) printw(" %c", coherence_state(line[0]));
+        printw(" 0x%016lx", (*(uint64_t*) (line+1))/memory->cache_config.block_size/memory->cache_config.n_lines);
 
-        // for (int j=0; j<memory->cache_config.associativity; j++) {
-        for (int j=0; j<max_bytes; j++) {
-            mvprintw(y+4+v_offset, x+30+h_offset+3*j, " %02x", memory->cache[i*memory->masks.block_offset+memory->masks.data_offset+j]);
-            // mvprintw(y+4+v_offset, x+29+h_offset+3*j, " %02x", 64);
-        }
-        
-        v_offset++;
+        move(y+4+v_offset, x+30+state_w+h_offset);
+        for (int j=0; j<max_bytes; j++) printw(" %02x", line[memory->masks.data_offset+j]);
     }
 }
 
@@ -403,79 +828,88 @@ void write_cache_stats(int x, int y, int w, int h) {
     mvprintw(y+2, x+1+offset, " Size     :%7luB   Block_Size  :%7luB   Associativity : %7lu ", memory->cache_config.block_size*memory->cache_config.n_lines*memory->cache_config.associativity, memory->cache_config.block_size, memory->cache_config.associativity);
     mvprintw(y+3, x+1+offset, " Accesses :%7lu    Write_Backs :%7lu    Policy        : %s %s ", memory->cache_stats.access_count, memory->cache_stats.writebacks ,policy_names[memory->cache_config.replacement_policy], memory->cache_config.write_policy==WriteBack?"WB":"WT");
     mvprintw(y+4, x+1+offset, " Hits     :%7lu    Missess     :%7lu    Hit_Rate      : %.5lf ", memory->cache_stats.hit_count, memory->cache_stats.miss_count, memory->cache_stats.hit_rate);
+    if (memory->bus) mvprintw(y+5, x+1+offset, " Bus_Txns :%7lu    Invalidates :%7lu    Coh_Miss/False: %7lu/%lu ", memory->bus->stats.transactions, memory->bus->stats.invalidations, memory->bus->stats.coherence_misses, memory->bus->stats.false_sharing);
 }
 
-// Draws a frame and renders it
+// Draws a frame and renders it. Only what changed since the last frame is written again,
+// unless something that moves or replaces whole panes changed too
 void draw() {
-    getmaxyx(stdscr, rows, columns); // Get window size
-
-    // Calculate the position and size of everything based on window size
-    input_root_x = 0;
-    input_root_y = rows-4;
-    input_h=4;
-    input_w=columns;
-    
-    register_w = 0.25*columns, // TODO: Make this responsive someday (update scroll part too) columns>108?27:0.25*columns;
-    register_root_x = columns-register_w;
-    register_root_y = 0;
-    register_h=input_root_y+1;
-    
-    aux_root_x = 0.5*columns;
-    aux_root_y = 0;
-    aux_w=register_root_x-aux_root_x+1;
-    aux_h=input_root_y+1;
+    view_hart();
+
+    screen_view view;
+    memset(&view, 0, sizeof(view)); // Padding is compared too
+    view.rows = rows;
+    view.columns = columns;
+    view.showing_mem = showing_mem;
+    view.showing_cache = showing_cache;
+    view.showing_output = showing_output;
+    view.showing_heatmap = showing_heatmap;
+    view.heatmap_mode = heatmap_mode;
+    view.heatmap_cell = heatmap_cell;
+    view.mem_group = mem_group;
+    view.mem_row = mem_row;
+    view.code_scroll = code_scroll;
+    view.aux_scroll = aux_scroll;
+    view.cache_scroll = cache_scroll;
+    view.code = code;
+    view.regs = regs;
+    view.memory = memory;
+    view.cache = memory?memory->cache:NULL;
+    view.has_cache = memory && memory->cache_config.has_cache;
+    view.stack = stack;
+
+    bool full = redraw_all || memcmp(&view, &shown_view, sizeof(view));
+    shown_view = view;
+    redraw_all = false;
 
-    cache_stats_root_x = 0.5*columns;
-    cache_stats_root_y = input_root_y>6?input_root_y - 6:1;
-    cache_stats_w = columns-cache_stats_root_x;
-    cache_stats_h = input_root_y-cache_stats_root_y+1;
-    
-    cache_root_x = 0.5*columns;
-    cache_root_y = 0;
-    cache_w = columns-cache_root_x;
-    cache_h = cache_stats_root_y+1;
-    
-    code_root_x = 0;
-    code_root_y = 0;
-    code_w=aux_root_x+1;
-    code_h=input_root_y+1;
-    
     // Drawing the outline and title of the panes
-    erase();
-    draw_outline_rect(0,0,rows,columns);
-    draw_outline_rect(input_root_x, input_root_y, input_h, input_w);
-    if (showing_cache) {
-        draw_outline_rect(cache_root_x, cache_root_y, cache_h, cache_w);
-        draw_outline_rect(cache_stats_root_x, cache_stats_root_y, cache_stats_h, cache_stats_w);
-    } else {
-        draw_outline_rect(register_root_x, register_root_y, register_h, register_w);
-        draw_outline_rect(aux_root_x, aux_root_y, aux_h, aux_w);
-    }
-    draw_outline_rect(code_root_x, code_root_y, code_h, code_w);
+    if (full) {
+        erase();
+        draw_outline_rect(0,0,rows,columns);
+        draw_outline_rect(input_root_x, input_root_y, input_h, input_w);
+        if (showing_cache) {
+            draw_outline_rect(cache_root_x, cache_root_y, cache_h, cache_w);
+            draw_outline_rect(cache_stats_root_x, cache_stats_root_y, cache_stats_h, cache_stats_w);
+        } else if (showing_mem) {
+            draw_outline_rect(aux_root_x, aux_root_y, aux_h, memory_w);
+        } else {
+            draw_outline_rect(register_root_x, register_root_y, register_h, register_w);
+            draw_outline_rect(aux_root_x, aux_root_y, aux_h, aux_w);
+        }
+        draw_outline_rect(code_root_x, code_root_y, code_h, code_w);
 
-    if (showing_cache) {
-        write_centered(cache_root_x, cache_root_y, cache_w, "CACHE");
-        write_centered(cache_stats_root_x, cache_stats_root_y, cache_stats_w, "STATS");
-    } else {
-        write_centered(register_root_x, register_root_y, register_w, "REGISTERS");
-        write_centered(aux_root_x, aux_root_y, aux_w, showing_mem?"MEMORY":"STACK");
+        if (showing_cache) {
+            write_centered(cache_root_x, cache_root_y, cache_w, "CACHE");
+            write_centered(cache_stats_root_x, cache_stats_root_y, cache_stats_w, "STATS");
+        } else if (showing_mem) {
+            write_centered(aux_root_x, aux_root_y, memory_w, "MEMORY");
+        } else {
+            write_centered(register_root_x, register_root_y, register_w, "REGISTERS");
+            write_centered(aux_root_x, aux_root_y, aux_w, showing_output?"OUTPUT":showing_heatmap?"HEATMAP":"STACK");
+        }
+        write_centered(code_root_x, code_root_y, code_w, "CODE");
     }
-    write_centered(code_root_x, code_root_y, code_w, "CODE");
 
     // Render the actual content
-    mvprintw(0,0,"PC: %08lX", *pc);
+    if (n_harts > 1) mvprintw(0,0,"PC: %08lX  HART: %d/%d", *pc, viewed_hart, n_harts);
+    else mvprintw(0,0,"PC: %08lX", *pc);
     if (showing_cache) {
-        write_cache(cache_root_x, cache_root_y, cache_w, cache_h);
+        write_cache(cache_root_x, cache_root_y, cache_w, cache_h, full);
         write_cache_stats(cache_stats_root_x, cache_stats_root_y, cache_stats_w, cache_stats_h);
+    } else if (showing_mem) {
+        write_memory(aux_root_x, aux_root_y, memory_w, aux_h, full);
     } else {
-        write_regs(register_root_x, register_root_y, register_h, register_w);
-        if (showing_mem) write_memory(aux_root_x, aux_root_y, aux_w, aux_h);
-        else write_stack(aux_root_x, aux_root_y, aux_w, aux_h);
+        write_regs(register_root_x, register_root_y, register_h, register_w, full);
+        if (showing_output) write_output(aux_root_x, aux_root_y, aux_w, aux_h, full);
+        else if (showing_heatmap) write_heatmap(aux_root_x, aux_root_y, aux_w, aux_h, full);
+        else write_stack(aux_root_x, aux_root_y, aux_w, aux_h, full);
 
     }
-    write_code(code_root_x, code_root_y, code_h, code_w);
+    write_code(code_root_x, code_root_y, code_h, code_w, full);
 
     // Render input line at the bottom
+    if (!full) mvhline(input_root_y+1, input_root_x+1, ' ', input_w-2);
+
     if (showing_error) attron(COLOR_PAIR(C_ERROR));
     else attron(COLOR_PAIR(C_TERMINAL));
 
@@ -489,100 +923,649 @@ void draw() {
 
 void destroy_frontend() {
     initialized = false;
+    set_error_screen(NULL);
     endwin();
-    if (code) free(code);
-    if (code_v_offsets) free(code_v_offsets);
+    code = NULL;
+    code_v_offsets = NULL;
+
+    free(shown_memory);
+    free(shown_cache);
+    shown_memory = NULL;
+    shown_cache = NULL;
+    shown_cache_size = 0;
+    redraw_all = true;
+
+    free(heat_seen);
+    free(heat_recent);
+    free(heat_shown);
+    heat_seen = heat_recent = NULL;
+    heat_shown = NULL;
+    heat_memory = NULL;
 }
 
-// Utility function to show errors
-void show_error(char* format, ...) {
-    va_list args;
-    va_start(args, format);
-    showing_run_lock = false;
+// Skips spaces and the word at *arg if it is there, as a whole word
+static bool take_word(char** arg, const char* word) {
+    size_t len = strlen(word);
 
-    if (initialized) {
-        vsprintf(input_buffer, format, args);
-        curs_set(0);
-        showing_error = true;
-    }
-    else vprintf(format, args);
+    while (**arg == ' ') (*arg)++;
+    if (strncmp(*arg, word, len) || ((*arg)[len] != ' ' && (*arg)[len] != '\0')) return false;
 
-    va_end(args);
+    *arg += len;
+    return true;
 }
 
-// Top level function called by the main loop that handles input and calls other functions as necessary.
-// Calling this function regularly is sufficient and necessary to keep the UI responsive.
-Command frontend_update() {	
-    draw();
-    input = getch();
-    
-    if (input_buffer_size < (getmaxx(stdscr)-1)) {
-        input_buffer_size = (getmaxx(stdscr)-1);
-        input_buffer = realloc(input_buffer, input_buffer_size*sizeof(char));
-        last_command = realloc(last_command, input_buffer_size*sizeof(char));
-    }
+// Reads the pattern of find into find_pattern, either text in double quotes or bytes as pairs of hex digits,
+// optionally split by spaces and prefixed with 0x. Returns false if it is neither
+static bool parse_pattern(char* arg) {
+    uint8_t pattern[FIND_MAX];
+    size_t len = 0;
 
-    // Here follow a long series of input matching if statements and corresponding safety checks
+    if (*arg == '"') {
+        char* end = strrchr(arg+1, '"');
+        if (!end || end[1] != '\0' || end == arg+1 || end-arg-1 > FIND_MAX) return false;
 
-    if (input == ERR) {
-        return NONE;
+        find_len = end-arg-1;
+        memcpy(find_pattern, arg+1, find_len);
+        return true;
     }
 
-    // Scrolling
-    if (input == KEY_MOUSE) {
-        getmouse(&mouse);
-
-        if (mouse.bstate == BUTTON4_PRESSED) {
-            if (mouse.x<columns/2) code_scroll = code_scroll==0?code_scroll:code_scroll-1;
-            else if (showing_cache) {if (mouse.y<cache_stats_root_y) cache_scroll = cache_scroll==0?cache_scroll:cache_scroll-1;}
-            else if (mouse.x<3*columns/4) {
-                if (showing_mem) aux_scroll = aux_scroll==0?aux_scroll:aux_scroll-1;
-                else aux_scroll = aux_scroll==0?aux_scroll:aux_scroll-1;
-            }
+    while (*arg) {
+        if (*arg == ' ') {
+            arg++;
+            continue;
         }
+        if (arg[0] == '0' && (arg[1] == 'x' || arg[1] == 'X')) arg += 2;
 
-        if (mouse.bstate == BUTTON5_PRESSED) {
-            if (mouse.x<columns/2) code_scroll = code_scroll<=code_v_offsets[lines_of_code-1]-5?code_scroll+1:code_scroll;
-            else if (showing_cache) {if (mouse.y<cache_stats_root_y) cache_scroll = (cache_scroll<=(memory->cache_config.n_blocks)-5)?cache_scroll+1:cache_scroll;}
-            else if (mouse.x<3*columns/4) {
-                if (showing_mem) aux_scroll = aux_scroll<=(memory_size-5)?aux_scroll+1:aux_scroll;
-                else aux_scroll = aux_scroll<=(stack->len-5)?aux_scroll+1:aux_scroll;
-            }
+        for (; isxdigit(arg[0]); arg += 2) {
+            char hex[3] = {arg[0], arg[1], '\0'};
+            if (!isxdigit(arg[1]) || len == FIND_MAX) return false;
+            pattern[len++] = strtoul(hex, NULL, 16);
         }
-
-        return NONE;
+        if (*arg && *arg != ' ') return false;
     }
 
+    if (!len) return false;
+    memcpy(find_pattern, pattern, len);
+    find_len = len;
+    return true;
+}
 
-    if (input == KEY_UP) {
-        // if (mouse.y>input_root_y) {
-        //     printf("chk\n");
-        //     if (!show_error && !strcmp(input_buffer, "$") && last_command_len != 0) {
-        //         printf("trig\n");
-        //         strcpy(input_buffer, last_command);
-        //         input_buffer_len = last_command_len;
-        //     }
-        // } else 
-        if (mouse.x<columns/2) code_scroll = code_scroll==0?code_scroll:code_scroll-1;
-        else if (showing_cache) {if (mouse.y<cache_stats_root_y) cache_scroll = cache_scroll==0?cache_scroll:cache_scroll-1;}
-        else if (mouse.x<3*columns/4) {
-            if (showing_mem) aux_scroll = aux_scroll==0?aux_scroll:aux_scroll-1;
-            else aux_scroll = aux_scroll==0?aux_scroll:aux_scroll-1;
+// Carries out the command in last_command, typed or read from a script
+static Command run_command() {
+    if (!strncmp("$load ", last_command, 6)) {
+        if (run_lock) {
+            show_error("Command invalid while running!");
+            return NONE;
         }
+        snprintf(input_file, sizeof(input_file), "%s", last_command+6);
+        return LOAD;
 
-        return NONE;
-    }
-
-    if (input == KEY_DOWN) {
-        if (mouse.x<columns/2) code_scroll = code_scroll<=code_v_offsets[lines_of_code-1]-5?code_scroll+1:code_scroll;
-        else if (showing_cache) {if (mouse.y<cache_stats_root_y) cache_scroll = (cache_scroll<=(memory->cache_config.n_blocks)-5)?cache_scroll+1:cache_scroll;}
-        else if (mouse.x<3*columns/4) {
-            if (showing_mem) aux_scroll = aux_scroll<=(memory_size-5)?aux_scroll+1:aux_scroll;
-            else aux_scroll = aux_scroll<=(stack->len-5)?aux_scroll+1:aux_scroll;
+    } else if ((last_command_len == 7 && !strcmp("$reload", last_command)) || (last_command_len == 12 && !strcmp("$reload auto", last_command))) {
+        if (!code_loaded) {
+            show_error("No code loaded! use load <filename> to load code");
+            return NONE;
+        }
+        if (run_lock) {
+            show_error("Command invalid while running!");
+            return NONE;
         }
+        return last_command_len == 7?RELOAD:RELOAD_AUTO;
 
-        return NONE;
-    }
+    } else if (!strncmp("$cache_sim enable ", last_command, 18)) {
+        if (run_lock) {
+            show_error("Command invalid while running!");
+            return NONE;
+        }
+        snprintf(input_file, sizeof(input_file), "%s", last_command+18);
+        return CACHE_ENABLE;
+
+    } else if (!strncmp("$cache_sim dump ", last_command, 16)) {
+        if (!memory->cache_config.has_cache) {
+            show_error("Cache is disabled!");
+            return NONE;
+        }
+
+        snprintf(input_file, sizeof(input_file), "%s", last_command+16);
+        return CACHE_DUMP;
+
+    } else if (!strncmp("$cache_sim disable", last_command, 17)) {
+        if (run_lock) {
+            show_error("Command invalid while running!");
+            return NONE;
+        }
+
+        return CACHE_DISABLE;
+
+    } else if (!strncmp("$break ", last_command, 7)) {
+
+        if (run_lock) {
+            show_error("Command invalid while running!");
+            return NONE;
+        }
+
+        if (!code_loaded) {
+            show_error("No code loaded! use load <filename> to load code");
+            return NONE;
+        }
+
+        // Syntax is "$break <line> [hits <n>] [if <condition>]"
+        char* end_ptr = NULL;
+        unsigned long break_line = strtol(last_command+7, &end_ptr, 10);
+        unsigned long hit_target = 0;
+        char* condition = NULL;
+
+        if (end_ptr == last_command+7 || (*end_ptr != ' ' && *end_ptr != '\0')) {
+            show_error("Failed to parse line number");
+            return NONE;
+        }
+
+        while (*end_ptr == ' ') end_ptr++;
+
+        if (!strncmp("hits ", end_ptr, 5)) {
+            char* hits_ptr = end_ptr+5;
+            hit_target = strtoul(hits_ptr, &end_ptr, 10);
+
+            if (end_ptr == hits_ptr || hit_target == 0 || (*end_ptr != ' ' && *end_ptr != '\0')) {
+                show_error("Failed to parse hit count");
+                return NONE;
+            }
+
+            while (*end_ptr == ' ') end_ptr++;
+        }
+
+        if (!strncmp("if ", end_ptr, 3)) {
+            condition = end_ptr+3;
+        } else if (*end_ptr != '\0') {
+            show_error("Expected \"hits <n>\" or \"if <condition>\" after line number");
+            return NONE;
+        }
+
+        break_line -= 1;
+        if (break_line < 0 | break_line > lines_of_code-1) {
+            show_error("Invalid Line number");
+            return NONE;
+        }
+
+        bool exists = false;
+        for (int i=0; i<breakpoints->len; i++) {
+            if (break_line==breakpoints->values[i]) {
+                exists = true;
+
+                // A plain break on an existing breakpoint removes it
+                if (!condition && !hit_target) {
+                    remove_condition(breakpoint_conditions, break_line);
+                    vec_remove(breakpoints, i);
+                    return NONE;
+                }
+                break;
+            }
+        }
+
+        // Otherwise the breakpoint is added, or its condition is replaced
+        if (condition || hit_target) {
+            bp_condition* cond = compile_condition(condition, break_line, hit_target);
+            if (!cond) return NONE;
+
+            remove_condition(breakpoint_conditions, break_line);
+            append(breakpoint_conditions, (uint64_t) cond);
+        }
+
+        if (!exists) append(breakpoints, break_line);
+
+    } else if (!strncmp("$watch ", last_command, 7)) {
+
+        if (run_lock) {
+            show_error("Command invalid while running!");
+            return NONE;
+        }
+
+        if (!strcmp("$watch clear", last_command)) {
+            clear_watchpoints(watchpoints);
+            show_error("Cleared all watchpoints");
+            return NONE;
+        }
+
+        // Syntax is either "$watch <register> [r|w|rw]" or "$watch <address> [length] [r|w|rw]"
+        char target[32], arg1[32], arg2[32];
+        int n_args = sscanf(last_command+7, "%31s %31s %31s", target, arg1, arg2);
+        char* mode = NULL;
+        char* end_ptr = NULL;
+        int reg = parse_alias(target);
+        watchpoint wp;
+
+        wp.is_register = false;
+
+        if (reg != -1) {
+            wp.is_register = true;
+            wp.start = reg;
+            wp.end = reg+1;
+            if (n_args > 2) {
+                show_error("Too many arguments for a register watchpoint");
+                return NONE;
+            }
+            if (n_args == 2) mode = arg1;
+
+        } else {
+            wp.start = strtoul(target, &end_ptr, 0);
+            if (*end_ptr != '\0') {
+                show_error("Invalid register or memory address!");
+                return NONE;
+            }
+
+            wp.end = wp.start+1;
+            if (n_args >= 2 && isdigit(arg1[0])) {
+                wp.end = wp.start + strtoul(arg1, &end_ptr, 0);
+                if (*end_ptr != '\0' || wp.end <= wp.start) {
+                    show_error("Invalid watchpoint length!");
+                    return NONE;
+                }
+                if (n_args == 3) mode = arg2;
+            } else if (n_args == 3) {
+                show_error("Invalid watchpoint length!");
+                return NONE;
+            } else if (n_args == 2) mode = arg1;
+
+            if (wp.end > memory_size) {
+                show_error("Memory Address out of bounds!");
+                return NONE;
+            }
+        }
+
+        if (!mode || !strcmp(mode, "w")) wp.flags = WATCH_WRITE;
+        else if (!strcmp(mode, "r")) wp.flags = WATCH_READ;
+        else if (!strcmp(mode, "rw")) wp.flags = WATCH_READ | WATCH_WRITE;
+        else {
+            show_error("Invalid watchpoint mode, expected r, w or rw");
+            return NONE;
+        }
+
+        switch (toggle_watchpoint(watchpoints, wp)) {
+            case 1:
+                show_error("Watchpoint set (%lu active)", watchpoints->len);
+                break;
+            case 0:
+                show_error("Watchpoint removed (%lu active)", watchpoints->len);
+                break;
+            default:
+                show_error("Out Of Memory!");
+        }
+
+    } else if (!strncmp("$mem", last_command, 4) && (last_command[4] == ' ' || last_command[4] == '\0')) {
+        // Syntax is "$mem [<address>] [group <1|2|4|8>] [row <16|32>]"
+        char* arg = last_command+4;
+        char* end_ptr = NULL;
+        uint64_t new_addr = 0;
+        int group = mem_group, row = mem_row;
+
+        while (*arg == ' ') arg++;
+        bool has_addr = *arg && strncmp(arg, "group", 5) && strncmp(arg, "row", 3);
+
+        if (has_addr) {
+            if (arg[0] == '0' && arg[1] == 'b') new_addr = strtoul(arg+2, &end_ptr, 2);
+            else new_addr = strtoul(arg, &end_ptr, 0);
+
+            if (end_ptr == arg || (*end_ptr != ' ' && *end_ptr != '\0')) {
+                show_error("Invalid Memory Address!");
+                return NONE;
+            }
+
+            if (new_addr >= memory_size) {
+                show_error("Memory Address out of bounds!");
+                return NONE;
+            }
+            arg = end_ptr;
+        } else if (showing_mem) {
+            new_addr = (uint64_t) aux_scroll*memory_row_bytes(); // Options alone keep the pane where it is
+        }
+
+        while (*arg) {
+            if (take_word(&arg, "group")) group = strtol(arg, &arg, 10);
+            else if (take_word(&arg, "row")) row = strtol(arg, &arg, 10);
+            else if (*arg == ' ') arg++;
+            else break;
+        }
+
+        if (*arg || (group != 1 && group != 2 && group != 4 && group != 8) || (row != 16 && row != MEM_ROW_MAX)) {
+            show_error("Syntax is mem [<address>] [group <1|2|4|8>] [row <16|32>]");
+            return NONE;
+        }
+
+        mem_group = group;
+        mem_row = row;
+        aux_scroll = new_addr/memory_row_bytes();
+        showing_mem = true;
+        showing_cache = false;
+        showing_output = false;
+        showing_heatmap = false;
+
+    } else if (!strncmp("$find", last_command, 5) && (last_command[5] == ' ' || last_command[5] == '\0')) {
+        // Syntax is "$find \"<text>\"" or "$find <hex bytes>", which searches from the start of memory,
+        // or just "$find" for the next match of the last pattern
+        char* arg = last_command+5;
+        uint64_t from = 0;
+
+        while (*arg == ' ') arg++;
+        if (!*arg) {
+            if (!find_len) {
+                show_error("Nothing to find again! use find \"<text>\" or find <hex bytes>");
+                return NONE;
+            }
+            from = match_len?match_addr+1:0;
+        } else if (!parse_pattern(arg)) {
+            show_error("Syntax is find \"<text>\" or find <hex bytes>, at most %d bytes", FIND_MAX);
+            return NONE;
+        }
+
+        // Searching goes on from the start once it reaches the end of memory
+        uint8_t* found = from < memory_size?memmem(memory_data+from, memory_size-from, find_pattern, find_len):NULL;
+        if (!found && from) found = memmem(memory_data, memory_size, find_pattern, find_len);
+
+        redraw_all = true;
+        if (!found) {
+            match_len = 0;
+            show_error("Not found in memory");
+            return NONE;
+        }
+
+        match_addr = found-memory_data;
+        match_len = find_len;
+        aux_scroll = match_addr/memory_row_bytes();
+        showing_mem = true;
+        showing_cache = false;
+        showing_output = false;
+        showing_heatmap = false;
+        show_error("Found at 0x%05lx, find again for the next match", match_addr);
+
+    } else if (last_command_len == 4 && !strcmp("$run", last_command)) {
+
+        if (!code_loaded) {
+            show_error("No code loaded! use load <filename> to load code");
+            return NONE;
+        }
+
+        if (run_lock) {
+            show_error("Already running, Press F6 or type \"stop\" to stop!");
+            return NONE;
+        }
+
+        if (pc_line() == -1) {
+            show_error("Nothing to run! use reset command to reset");
+            return NONE;
+        }
+
+        set_run_lock();
+        show_error("Running! Press F6 or type \"stop\" to stop execution");
+        clear_written_bytes();
+        return RUN;
+
+    } else if (last_command_len == 5 && !strcmp("$step", last_command)) {
+        if (!code_loaded) {
+            show_error("No code loaded! use load <filename> to load code");
+            return NONE;
+        }
+        if (run_lock) {
+            show_error("Command invalid while running!");
+            return NONE;
+        }
+        clear_written_bytes();
+        return STEP;
+
+    } else if ((last_command_len == 16 && !strcmp("$cache_sim stats", last_command)) || (last_command_len == 17 && !strcmp("$cache_sim status", last_command))) {
+        if (showing_cache) {
+            show_error("Cache Info already visible!");
+        } else {
+            showing_cache = true;
+            cache_scroll = 0;
+        }
+        
+        return NONE;
+
+    } else if (last_command_len == 21 && !strcmp("$cache_sim invalidate", last_command)) {
+        if (!memory->cache_config.has_cache) {
+            show_error("Cache is disabled!");
+            return NONE;
+        } 
+        
+        return CACHE_INVALIDATE;
+
+    } else if (last_command_len == 6 && !strcmp("$reset", last_command)) {
+        if (!code_loaded) {
+            show_error("No code loaded! use load <filename> to load code");
+            return NONE;
+        }
+        if (run_lock) {
+            show_error("Command invalid while running!");
+            return NONE;
+        }
+        return RESET;
+
+    } else if (!strncmp("$hart ", last_command, 6)) {
+        char* end_ptr = NULL;
+        long id = strtol(last_command+6, &end_ptr, 10);
+
+        if (end_ptr == last_command+6 || *end_ptr != '\0' || id < 0 || id >= n_harts) {
+            show_error("Invalid hart, expected a number within 0...%d", n_harts-1);
+            return NONE;
+        }
+
+        viewed_hart = id;
+
+    } else if (last_command_len == 11 && !strcmp("$show-stack", last_command)) {
+        if (!showing_mem && !showing_output && !showing_heatmap) show_error("Stack Trace is already shown on the right!");
+        else aux_scroll = 0;
+        showing_mem = false;
+        showing_cache = false;
+        showing_output = false;
+        showing_heatmap = false;
+
+    } else if (last_command_len == 7 && !strcmp("$output", last_command)) {
+        if (showing_output && !showing_cache) show_error("Output is already shown on the right!");
+        showing_output = true;
+        showing_cache = false;
+        showing_heatmap = false;
+        showing_mem = false;
+
+    } else if (!strncmp("$heatmap", last_command, 8) && (last_command[8] == ' ' || last_command[8] == '\0')) {
+        // Syntax is "$heatmap [reads|writes|misses|sets] [pages]"
+        char* arg = last_command+8;
+        heat_mode mode = HEAT_ACCESSES;
+
+        if (take_word(&arg, "reads")) mode = HEAT_READS;
+        else if (take_word(&arg, "writes")) mode = HEAT_WRITES;
+        else if (take_word(&arg, "misses")) mode = HEAT_MISSES;
+        else if (take_word(&arg, "sets")) mode = HEAT_SETS;
+        int cell = mode != HEAT_SETS && take_word(&arg, "pages")?HEAT_PAGE:HEAT_REGION;
+
+        while (*arg == ' ') arg++;
+        if (*arg) {
+            show_error("Syntax is heatmap [reads|writes|misses|sets] [pages]");
+            return NONE;
+        }
+
+        if (mode != heatmap_mode || cell != heatmap_cell) aux_scroll = 0;
+        heatmap_mode = mode;
+        heatmap_cell = cell;
+        showing_heatmap = true;
+        showing_mem = false;
+        showing_cache = false;
+        showing_output = false;
+
+    } else if (last_command_len == 5 && !strcmp("$regs", last_command)) {
+        if (!showing_cache && !showing_mem) {
+            show_error("Registers are already shown on the right pane!");
+        } else {
+            showing_cache = false;
+            showing_mem = false;
+        }
+
+    } else if (last_command_len == 5 && !strcmp("$exit", last_command)) {
+        if (run_lock) {
+            show_error("Stopping execution, use exit again to exit");
+            return STOP;
+        }
+        return EXIT;
+
+    } else if (last_command_len == 5 && !strcmp("$stop", last_command)) {
+        if (!code_loaded) {
+            show_error("No code loaded! use load <filename> to load code");
+            return NONE;
+        }
+        if (run_lock) {
+            showing_error = false;
+            return STOP;
+        }
+        show_error("Nothing is running!");
+        return NONE;
+
+    } else if (!strncmp("$source ", last_command, 8)) {
+        if (run_lock) {
+            show_error("Command invalid while running!");
+            return NONE;
+        }
+        source_script(last_command+8);
+
+    } else {
+        show_error("Invalid command");
+    }
+
+    return NONE;
+}
+
+
+// Feeds the next line of the innermost script to run_command. Lines may leave out the $, and blank lines and lines
+// starting with # are skipped
+static Command next_script_command() {
+    char line[SCRIPT_LINE_MAX+1];
+
+    while (script_depth) {
+        FILE* script = scripts[script_depth-1];
+
+        if (!fgets(line+1, SCRIPT_LINE_MAX, script)) {
+            fclose(script);
+            script_depth--;
+            continue;
+        }
+
+        size_t len = strlen(line+1);
+        if (len && line[len] != '\n' && !feof(script)) {
+            show_error("Script line longer than %d characters, stopped the script", SCRIPT_LINE_MAX-2);
+            while (script_depth) fclose(scripts[--script_depth]);
+            return NONE;
+        }
+        while (len && isspace((unsigned char) line[len])) line[len--] = '\0';
+
+        char* command = line+1;
+        while (*command == ' ' || *command == '\t') command++;
+        if (*command == '\0' || *command == '#') continue;
+        if (*command != '$') *(--command) = '$';
+
+        strcpy(last_command, command);
+        last_command_len = strlen(last_command);
+        return run_command();
+    }
+
+    return NONE;
+}
+
+bool source_script(char* path) {
+    if (script_depth == SCRIPT_DEPTH) {
+        show_error("Scripts are nested more than %d deep!", SCRIPT_DEPTH);
+        return false;
+    }
+
+    FILE* script = fopen(path, "r");
+    if (!script) {
+        show_error("Failed to open %s!", path);
+        return false;
+    }
+
+    scripts[script_depth++] = script;
+    return true;
+}
+
+// Top level function called by the main loop that handles input and calls other functions as necessary.
+// Calling this function regularly is sufficient and necessary to keep the UI responsive.
+Command frontend_update() {	
+    // Scripts skip drawing and waiting for keys, they only wait for programs they run to stop
+    if (script_depth && !run_lock) return next_script_command();
+
+    draw();
+    input = getch();
+    
+    if (input_buffer_size < (getmaxx(stdscr)-1)) {
+        input_buffer_size = (getmaxx(stdscr)-1);
+        input_buffer = realloc(input_buffer, input_buffer_size*sizeof(char));
+        last_command = realloc(last_command, (input_buffer_size > SCRIPT_LINE_MAX?input_buffer_size:SCRIPT_LINE_MAX)*sizeof(char));
+    }
+
+    // Here follow a long series of input matching if statements and corresponding safety checks
+
+    if (input == ERR) {
+        return NONE;
+    }
+
+    if (input == KEY_RESIZE) {
+        layout();
+        return NONE;
+    }
+
+    // Scrolling
+    if (input == KEY_MOUSE) {
+        getmouse(&mouse);
+
+        if (mouse.bstate == BUTTON4_PRESSED) {
+            if (mouse.x<columns/2) code_scroll = code_scroll==0?code_scroll:code_scroll-1;
+            else if (showing_cache) {if (mouse.y<cache_stats_root_y) cache_scroll = cache_scroll==0?cache_scroll:cache_scroll-1;}
+            else if (showing_mem || mouse.x<3*columns/4) {
+                if (showing_mem) aux_scroll = aux_scroll==0?aux_scroll:aux_scroll-1;
+                else aux_scroll = aux_scroll==0?aux_scroll:aux_scroll-1;
+            }
+        }
+
+        if (mouse.bstate == BUTTON5_PRESSED) {
+            if (mouse.x<columns/2) code_scroll = code_scroll<=code_v_offsets[lines_of_code-1]-5?code_scroll+1:code_scroll;
+            else if (showing_cache) {if (mouse.y<cache_stats_root_y) cache_scroll = (cache_scroll<=(memory->cache_config.n_blocks)-5)?cache_scroll+1:cache_scroll;}
+            else if (showing_mem || mouse.x<3*columns/4) {
+                if (showing_mem) aux_scroll = aux_scroll+1<mem_rows?aux_scroll+1:aux_scroll;
+                else if (showing_heatmap) aux_scroll = aux_scroll+1<heat_rows?aux_scroll+1:aux_scroll;
+                else aux_scroll = aux_scroll<=(stack->len-5)?aux_scroll+1:aux_scroll;
+            }
+        }
+
+        return NONE;
+    }
+
+
+    if (input == KEY_UP) {
+        // if (mouse.y>input_root_y) {
+        //     printf("chk\n");
+        //     if (!show_error && !strcmp(input_buffer, "$") && last_command_len != 0) {
+        //         printf("trig\n");
+        //         strcpy(input_buffer, last_command);
+        //         input_buffer_len = last_command_len;
+        //     }
+        // } else 
+        if (mouse.x<columns/2) code_scroll = code_scroll==0?code_scroll:code_scroll-1;
+        else if (showing_cache) {if (mouse.y<cache_stats_root_y) cache_scroll = cache_scroll==0?cache_scroll:cache_scroll-1;}
+        else if (showing_mem || mouse.x<3*columns/4) {
+            if (showing_mem) aux_scroll = aux_scroll==0?aux_scroll:aux_scroll-1;
+            else aux_scroll = aux_scroll==0?aux_scroll:aux_scroll-1;
+        }
+
+        return NONE;
+    }
+
+    if (input == KEY_DOWN) {
+        if (mouse.x<columns/2) code_scroll = code_scroll<=code_v_offsets[lines_of_code-1]-5?code_scroll+1:code_scroll;
+        else if (showing_cache) {if (mouse.y<cache_stats_root_y) cache_scroll = (cache_scroll<=(memory->cache_config.n_blocks)-5)?cache_scroll+1:cache_scroll;}
+        else if (showing_mem || mouse.x<3*columns/4) {
+            if (showing_mem) aux_scroll = aux_scroll+1<mem_rows?aux_scroll+1:aux_scroll;
+            else if (showing_heatmap) aux_scroll = aux_scroll+1<heat_rows?aux_scroll+1:aux_scroll;
+            else aux_scroll = aux_scroll<=(stack->len-5)?aux_scroll+1:aux_scroll;
+        }
+
+        return NONE;
+    }
 
     // Keyboard input. Clear error if being shown
     if (showing_error) {
@@ -632,6 +1615,7 @@ Command frontend_update() {
             show_error("Command invalid while running!");
             return NONE;
         }
+        clear_written_bytes();
         return STEP;
     }
 
@@ -646,13 +1630,14 @@ Command frontend_update() {
             return NONE;
         }
 
-        if (*pc/4 >= lines_of_code) {
+        if (pc_line() == -1) {
             show_error("Nothing to run! use reset command to reset");
             return NONE;
         }
 
         set_run_lock();
         show_error("Running! Press F6 or type \"stop\" to stop execution");
+        clear_written_bytes();
         return RUN;
     }
 
@@ -669,204 +1654,7 @@ Command frontend_update() {
         last_command_len = input_buffer_len;
         input_buffer_len = 1;
 
-        if (!strncmp("$load ", last_command, 6)) {
-            if (run_lock) {
-                show_error("Command invalid while running!");
-                return NONE;
-            }
-            strcpy(input_file, last_command+6);
-            return LOAD;
-
-        } else if (!strncmp("$cache_sim enable ", last_command, 18)) {
-            if (run_lock) {
-                show_error("Command invalid while running!");
-                return NONE;
-            }
-            strcpy(input_file, last_command+18);
-            return CACHE_ENABLE;
-
-        } else if (!strncmp("$cache_sim dump ", last_command, 16)) {
-            if (!memory->cache_config.has_cache) {
-                show_error("Cache is disabled!");
-                return NONE;
-            }
-
-            strcpy(input_file, last_command+16);
-            return CACHE_DUMP;
-
-        } else if (!strncmp("$cache_sim disable", last_command, 17)) {
-            if (run_lock) {
-                show_error("Command invalid while running!");
-                return NONE;
-            }
-
-            return CACHE_DISABLE;
-
-        } else if (!strncmp("$break ", last_command, 7)) {
-
-            if (run_lock) {
-                show_error("Command invalid while running!");
-                return NONE;
-            }
-
-            if (!code_loaded) {
-                show_error("No code loaded! use load <filename> to load code");
-                return NONE;
-            }
-
-            char* end_ptr = NULL;
-            unsigned long break_line = strtol(last_command+7, &end_ptr, 10);
-
-            if (end_ptr-last_command != strlen(last_command)) {
-                show_error("Failed to parse line number");
-                return NONE;
-            }
-
-            break_line -= 1;
-            if (break_line < 0 | break_line > lines_of_code-1) {
-                show_error("Invalid Line number");
-                return NONE;
-            }
-
-            for (int i=0; i<breakpoints->len; i++) {
-                if (break_line==breakpoints->values[i]) {
-                    vec_remove(breakpoints, i);
-                    return NONE;
-                }
-            }
-
-            append(breakpoints, break_line);
-
-        } else if (!strncmp("$mem", last_command, 4)) {
-
-            if (strlen(last_command) == 4) {
-                showing_mem = true;
-                showing_cache = false;
-                aux_scroll = 0;
-                return NONE;
-            }
-
-            char* end_ptr = NULL;
-            uint64_t new_addr, count;
-
-            if (last_command[5] == '0' && last_command[6] == 'b') {
-                new_addr = strtoul(last_command+7, &end_ptr, 2);
-            }
-            else {
-                new_addr = strtoul(last_command+5, &end_ptr, 0);
-            }
-
-            if (*end_ptr != ' ' && *end_ptr != '\0') {
-                show_error("Invalid Memory Address!");
-                return NONE;
-            }
-
-            if (new_addr >= memory_size) {
-                show_error("Memory Address out of bounds!");
-                return NONE;
-            }
-            
-            aux_scroll = new_addr;
-            showing_mem = true;
-            showing_cache = false;
-
-
-        } else if (last_command_len == 4 && !strcmp("$run", last_command)) {
-
-            if (!code_loaded) {
-                show_error("No code loaded! use load <filename> to load code");
-                return NONE;
-            }
-
-            if (run_lock) {
-                show_error("Already running, Press F6 or type \"stop\" to stop!");
-                return NONE;
-            }
-
-            if (*pc/4 >= lines_of_code) {
-                show_error("Nothing to run! use reset command to reset");
-                return NONE;
-            }
-
-            set_run_lock();
-            show_error("Running! Press F6 or type \"stop\" to stop execution");
-            return RUN;
-
-        } else if (last_command_len == 5 && !strcmp("$step", last_command)) {
-            if (!code_loaded) {
-                show_error("No code loaded! use load <filename> to load code");
-                return NONE;
-            }
-            if (run_lock) {
-                show_error("Command invalid while running!");
-                return NONE;
-            }
-            return STEP;
-
-        } else if ((last_command_len == 16 && !strcmp("$cache_sim stats", last_command)) || (last_command_len == 17 && !strcmp("$cache_sim status", last_command))) {
-            if (showing_cache) {
-                show_error("Cache Info already visible!");
-            } else {
-                showing_cache = true;
-                cache_scroll = 0;
-            }
-            
-            return NONE;
-
-        } else if (last_command_len == 21 && !strcmp("$cache_sim invalidate", last_command)) {
-            if (!memory->cache_config.has_cache) {
-                show_error("Cache is disabled!");
-                return NONE;
-            } 
-            
-            return CACHE_INVALIDATE;
-
-        } else if (last_command_len == 6 && !strcmp("$reset", last_command)) {
-            if (!code_loaded) {
-                show_error("No code loaded! use load <filename> to load code");
-                return NONE;
-            }
-            if (run_lock) {
-                show_error("Command invalid while running!");
-                return NONE;
-            }
-            return RESET;
-
-        } else if (last_command_len == 11 && !strcmp("$show-stack", last_command)) {
-            if (!showing_mem) show_error("Stack Trace is already shown on the right!");
-            else aux_scroll = 0;
-            showing_mem = false;
-            showing_cache = false;
-
-        } else if (last_command_len == 5 && !strcmp("$regs", last_command)) {
-            if (!showing_cache) {
-                show_error("Registers are already shown on the right pane!");
-            } else {
-                showing_cache = false;
-            }
-
-        } else if (last_command_len == 5 && !strcmp("$exit", last_command)) {
-            if (run_lock) {
-                show_error("Stopping execution, use exit again to exit");
-                return STOP;
-            }
-            return EXIT;
-
-        } else if (last_command_len == 5 && !strcmp("$stop", last_command)) {
-            if (!code_loaded) {
-                show_error("No code loaded! use load <filename> to load code");
-                return NONE;
-            }
-            if (run_lock) {
-                showing_error = false;
-                return STOP;
-            }
-            show_error("Nothing is running!");
-            return NONE;
-
-        } else {
-            show_error("Invalid command");
-        }
+        return run_command();
 
     } else if (input>31 && input<127 && input_buffer_len<columns-16) {
 
@@ -6,6 +6,10 @@
 #include <stdbool.h>
 #include "../backend/stacktrace.h"
 #include "../backend/memory.h"
+#include "../backend/watchpoint.h"
+#include "../backend/syscall.h"
+#include "../backend/backend.h"
+#include "error.h"
 
 // Messages exchanged between frontend and other sections of the application
 typedef enum {
@@ -21,6 +25,8 @@ typedef enum {
     CACHE_ENABLE,
     CACHE_INVALIDATE,
     CACHE_DUMP,
+    RELOAD,
+    RELOAD_AUTO,
     NONE
 } Command;
 
@@ -31,16 +37,28 @@ void set_frontend_register_pointer(uint64_t* regs_pointer);
 void set_frontend_pc_pointer(uint64_t* pc_pointer);
 void set_frontend_memory_pointer(Memory* memory_pointer, uint64_t size_of_memory);
 void set_breakpoints_pointer(vec* breakpoints_pointer);
+void set_breakpoint_conditions_pointer(vec* conditions_pointer);
+void set_watchpoints_pointer(watch_list* watchpoints_pointer);
+void set_output_pointer(guest_output* output_pointer);
 void set_stack_pointer(stacktrace* stacktrace);
-void set_reg_write(uint64_t reg);
+void set_reg_write_pointer(uint64_t* reg_write_pointer);
 void set_run_lock();
 void set_hexcode_pointer(uint32_t* hexcode_pointer);
+void set_addresses_pointer(vec* addresses_pointer);
+void set_pc_lines_pointer(int* pc_lines_pointer);
+void set_harts_pointer(hart* harts_pointer, int count);
+void set_viewed_hart(int id);
 
+void set_program_arena(arena* program);
 void set_labels_pointer(label_index* index);
 void update_code(char* code_pointer, uint64_t n);
-void show_error(char* format, ...);
+const char* get_input_file(); // File named by the last LOAD, CACHE_ENABLE or CACHE_DUMP command
 void release_run_lock();
 void reset_frontend(bool hard);
 Command frontend_update();
 
+// Queues the commands in a file to be carried out by frontend_update, one per line, before any more keys are read.
+// Used by --script and $source, which can also be used within scripts
+bool source_script(char* path);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,459 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "gdbstub.h"
+
+#define GDB_PACKET_SIZE 4096	// Largest packet either side sends, as told to GDB in qSupported
+#define GDB_RUN_SLICE 65536		// Instructions run between checks for an interrupt from GDB
+#define GDB_PC 32				// Number of the pc in g packets, after x0...x31
+
+// Signals reported to GDB
+#define GDB_SIGINT 2
+#define GDB_SIGTRAP 5
+#define GDB_SIGSEGV 11
+
+typedef struct gdb_stub {
+	sim_t* sim;
+	int fd;
+	bool no_ack;				// GDB asked to leave out the + and - that acknowledge packets
+	int hart;					// Hart whose registers g, G, p and P access, set by Hg
+	int step_hart;				// Hart that s steps, set by Hc. -1 steps the one of Hg
+	int signal;					// Why the program last stopped
+	bool exited;
+	uint8_t exit_code;
+	char in[GDB_PACKET_SIZE];	// Bytes received but not read yet
+	int in_len, in_pos;
+} gdb_stub;
+
+static const char* register_names[32] = {
+	"zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2", "fp", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+	"a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7", "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6",
+};
+
+// Tells GDB the registers are those of RV64 without floating point, so gdb-multiarch needs no "set architecture"
+static char target_xml[4096];
+static size_t target_xml_len;
+
+static void describe_target() {
+	int len = sprintf(target_xml, "<?xml version=\"1.0\"?><!DOCTYPE target SYSTEM \"gdb-target.dtd\"><target version=\"1.0\">"
+		"<architecture>riscv:rv64</architecture><feature name=\"org.gnu.gdb.riscv.cpu\">");
+
+	for (int i=0; i<32; i++) {
+		const char* type = i == 1?"code_ptr":i == 2?"data_ptr":"int";
+		len += sprintf(target_xml+len, "<reg name=\"%s\" bitsize=\"64\" type=\"%s\"/>", register_names[i], type);
+	}
+
+	len += sprintf(target_xml+len, "<reg name=\"pc\" bitsize=\"64\" type=\"code_ptr\"/></feature></target>");
+	target_xml_len = len;
+}
+
+// Returns the next byte from GDB, -1 once it disconnected
+static int read_byte(gdb_stub* stub) {
+	if (stub->in_pos == stub->in_len) {
+		stub->in_len = read(stub->fd, stub->in, sizeof(stub->in));
+		stub->in_pos = 0;
+		if (stub->in_len <= 0) {
+			stub->in_len = 0;
+			return -1;
+		}
+	}
+
+	return (unsigned char) stub->in[stub->in_pos++];
+}
+
+static bool write_all(gdb_stub* stub, const char* data, size_t len) {
+	while (len) {
+		ssize_t written = write(stub->fd, data, len);
+		if (written <= 0) return false;
+		data += written;
+		len -= written;
+	}
+	return true;
+}
+
+static void send_packet(gdb_stub* stub, const char* data) {
+	static char packet[GDB_PACKET_SIZE+8];
+	size_t len = strlen(data);
+	uint8_t checksum = 0;
+
+	for (size_t i=0; i<len; i++) checksum += data[i];
+	len = snprintf(packet, sizeof(packet), "$%s#%02x", data, checksum);
+
+	// Without no ack mode, GDB asks for the packet again with - if it arrived damaged
+	int ack;
+	do {
+		if (!write_all(stub, packet, len)) return;
+		if (stub->no_ack) return;
+		while ((ack = read_byte(stub)) != '+' && ack != '-' && ack != -1);
+	} while (ack == '-');
+}
+
+// Reads the next packet into packet, without the $ and checksum. Returns false once GDB disconnected
+static bool receive_packet(gdb_stub* stub, char* packet) {
+	int c;
+
+	while (1) {
+		while ((c = read_byte(stub)) != '$') if (c == -1) return false; // Ctrl+C while stopped is ignored
+
+		uint8_t checksum = 0;
+		int len = 0;
+
+		while ((c = read_byte(stub)) != '#' && c != -1) {
+			checksum += c;
+			if (c == '}') { // Escaped byte
+				c = read_byte(stub);
+				checksum += c;
+				c ^= 0x20;
+			}
+			if (len < GDB_PACKET_SIZE-1) packet[len++] = c;
+		}
+		packet[len] = '\0';
+
+		int high = read_byte(stub), low = read_byte(stub);
+		if (c == -1 || low == -1) return false;
+
+		char sent[3] = {high, low, '\0'};
+		if (stub->no_ack) return true;
+		if (strtoul(sent, NULL, 16) == checksum) {
+			write_all(stub, "+", 1);
+			return true;
+		}
+		write_all(stub, "-", 1);
+	}
+}
+
+// Registers go over the wire in target byte order, which is little endian
+static char* write_hex(char* out, const void* data, size_t len) {
+	for (size_t i=0; i<len; i++) out += sprintf(out, "%02x", ((uint8_t*) data)[i]);
+	return out;
+}
+
+static bool read_hex(const char* in, void* data, size_t len) {
+	for (size_t i=0; i<len; i++) {
+		unsigned int byte;
+		if (sscanf(in+2*i, "%2x", &byte) != 1) return false;
+		((uint8_t*) data)[i] = byte;
+	}
+	return true;
+}
+
+static uint64_t get_register(gdb_stub* stub, int reg) {
+	return reg == GDB_PC?sim_get_pc(stub->sim, stub->hart):sim_get_register(stub->sim, stub->hart, reg);
+}
+
+static void set_register(gdb_stub* stub, int reg, uint64_t value) {
+	if (reg == GDB_PC) sim_set_pc(stub->sim, stub->hart, value);
+	else sim_set_register(stub->sim, stub->hart, reg, value);
+}
+
+static bool valid_hart(gdb_stub* stub, long thread) {
+	return thread > 0 && sim_registers(stub->sim, thread-1);
+}
+
+// Whether GDB sent Ctrl+C (or disconnected) while the program runs
+static bool interrupted(gdb_stub* stub) {
+	struct pollfd fd = {stub->fd, POLLIN, 0};
+
+	while (stub->in_pos < stub->in_len || poll(&fd, 1, 0) > 0) {
+		int c = read_byte(stub);
+		if (c == 0x03 || c == -1) return true;
+	}
+	return false;
+}
+
+// Sends a line of text to the GDB console
+static void send_console(gdb_stub* stub, const char* text) {
+	char packet[GDB_PACKET_SIZE];
+	size_t len = strlen(text);
+
+	if (len > GDB_PACKET_SIZE/2-4) len = GDB_PACKET_SIZE/2-4;
+	packet[0] = 'O';
+	strcpy(write_hex(packet+1, text, len), "0a");
+	send_packet(stub, packet);
+}
+
+// Runs one instruction of the hart GDB chose or every hart until the program stops, then tells GDB why it stopped
+static void resume(gdb_stub* stub, bool single_step, char* reply) {
+	sim_result result;
+	int64_t code = 0;
+	int signal = GDB_SIGTRAP;
+
+	if (stub->exited) {
+		sprintf(reply, "W%02x", stub->exit_code);
+		return;
+	}
+
+	if (single_step) result = sim_step_hart(stub->sim, stub->step_hart == -1?stub->hart:stub->step_hart);
+	else do result = sim_run(stub->sim, SIM_NO_ADDRESS, GDB_RUN_SLICE, NULL);
+	while (result == SIM_LIMIT && !interrupted(stub));
+
+	switch (result) {
+		case SIM_END:
+			if (!sim_exited(stub->sim, &code)) send_console(stub, "Reached End of Program");
+			stub->exited = true;
+			stub->exit_code = code;
+			sprintf(reply, "W%02x", stub->exit_code);
+			return;
+		case SIM_ERROR:
+			send_console(stub, sim_error(stub->sim));
+			signal = GDB_SIGSEGV;
+			break;
+		case SIM_LIMIT:
+			signal = GDB_SIGINT;
+			break;
+		default:
+			break;
+	}
+
+	stub->signal = signal;
+	stub->hart = sim_current_hart(stub->sim);
+	sprintf(reply, "T%02xthread:%x;", signal, stub->hart+1);
+}
+
+// Handles the q packets GDB asks about the target with
+static void query(gdb_stub* stub, char* packet, char* reply) {
+	unsigned long offset, len;
+
+	if (!strncmp(packet, "qSupported", 10)) {
+		sprintf(reply, "PacketSize=%x;qXfer:features:read+;QStartNoAckMode+", GDB_PACKET_SIZE);
+	} else if (!strcmp(packet, "qAttached")) {
+		strcpy(reply, "1");
+	} else if (!strcmp(packet, "qC")) {
+		sprintf(reply, "QC%x", stub->hart+1);
+	} else if (!strcmp(packet, "qfThreadInfo")) {
+		reply += sprintf(reply, "m1");
+		for (int i=1; sim_registers(stub->sim, i); i++) reply += sprintf(reply, ",%x", i+1);
+	} else if (!strcmp(packet, "qsThreadInfo")) {
+		strcpy(reply, "l");
+	} else if (sscanf(packet, "qXfer:features:read:target.xml:%lx,%lx", &offset, &len) == 2) {
+		if (offset > target_xml_len) offset = target_xml_len;
+		if (len > target_xml_len - offset) len = target_xml_len - offset;
+		if (len > GDB_PACKET_SIZE-2) len = GDB_PACKET_SIZE-2;
+
+		reply[0] = offset+len == target_xml_len?'l':'m';
+		memcpy(reply+1, target_xml+offset, len);
+		reply[len+1] = '\0';
+	}
+}
+
+// Answers one packet in reply, an empty reply tells GDB the packet is not supported. Returns false once GDB is done
+static bool handle_packet(gdb_stub* stub, char* packet, char* reply) {
+	unsigned long addr, len, reg;
+	uint64_t value;
+	uint8_t data[GDB_PACKET_SIZE/2-8];
+	char* end;
+	long thread;
+
+	reply[0] = '\0';
+
+	switch (packet[0]) {
+		case '?':
+			if (stub->exited) sprintf(reply, "W%02x", stub->exit_code);
+			else sprintf(reply, "T%02xthread:%x;", stub->signal, stub->hart+1);
+			break;
+
+		case 'g':
+			end = reply;
+			for (int i=0; i<=GDB_PC; i++) {
+				value = get_register(stub, i);
+				end = write_hex(end, &value, sizeof(value));
+			}
+			break;
+
+		case 'G':
+			if (strlen(packet+1) < (GDB_PC+1)*16) {
+				strcpy(reply, "E01");
+				break;
+			}
+			for (int i=0; i<=GDB_PC; i++) {
+				read_hex(packet+1+16*i, &value, sizeof(value));
+				set_register(stub, i, value);
+			}
+			strcpy(reply, "OK");
+			break;
+
+		case 'p':
+			reg = strtoul(packet+1, NULL, 16);
+			if (reg > GDB_PC) {
+				strcpy(reply, "E01");
+				break;
+			}
+			value = get_register(stub, reg);
+			write_hex(reply, &value, sizeof(value));
+			break;
+
+		case 'P':
+			reg = strtoul(packet+1, &end, 16);
+			if (reg > GDB_PC || *end != '=' || !read_hex(end+1, &value, sizeof(value))) {
+				strcpy(reply, "E01");
+				break;
+			}
+			set_register(stub, reg, value);
+			strcpy(reply, "OK");
+			break;
+
+		case 'm':
+			// Longer reads are cut short, GDB asks for the rest
+			if (sscanf(packet+1, "%lx,%lx", &addr, &len) == 2 && len > sizeof(data)) len = sizeof(data);
+			if (sscanf(packet+1, "%lx,%lx", &addr, &len) != 2 || !sim_read_memory(stub->sim, addr, data, len)) {
+				strcpy(reply, "E01");
+				break;
+			}
+			*write_hex(reply, data, len) = '\0';
+			break;
+
+		case 'M':
+			end = strchr(packet, ':');
+			if (sscanf(packet+1, "%lx,%lx", &addr, &len) != 2 || !end || len > sizeof(data) || strlen(end+1) < 2*len ||
+				!read_hex(end+1, data, len) || !sim_write_memory(stub->sim, addr, data, len)) {
+				strcpy(reply, "E01");
+				break;
+			}
+			strcpy(reply, "OK");
+			break;
+
+		case 'c':
+		case 's':
+			if (packet[1]) sim_set_pc(stub->sim, packet[0] == 's' && stub->step_hart != -1?stub->step_hart:stub->hart, strtoull(packet+1, NULL, 16));
+			resume(stub, packet[0] == 's', reply);
+			break;
+
+		case 'Z':
+		case 'z':
+			// Software and hardware breakpoints both go into the breakpoints of the backend. Watchpoints are left to GDB
+			if ((packet[1] != '0' && packet[1] != '1') || sscanf(packet+2, ",%lx", &addr) != 1) break;
+			strcpy(reply, sim_set_breakpoint(stub->sim, addr, packet[0] == 'Z')?"OK":"E01");
+			break;
+
+		case 'H':
+			thread = strtol(packet+2, NULL, 16);
+			if (packet[1] == 'g' && valid_hart(stub, thread)) stub->hart = thread-1;
+			if (packet[1] == 'c' && (thread <= 0 || valid_hart(stub, thread))) stub->step_hart = thread > 0?thread-1:-1;
+			strcpy(reply, thread <= 0 || valid_hart(stub, thread)?"OK":"E01");
+			break;
+
+		case 'T':
+			strcpy(reply, valid_hart(stub, strtol(packet+1, NULL, 16))?"OK":"E01");
+			break;
+
+		case 'q':
+			query(stub, packet, reply);
+			break;
+
+		case 'Q':
+			if (!strcmp(packet, "QStartNoAckMode")) {
+				send_packet(stub, "OK");
+				stub->no_ack = true;
+				return true;
+			}
+			break;
+
+		case 'v':
+			if (!strcmp(packet, "vKill;1") || !strcmp(packet, "vKill")) {
+				send_packet(stub, "OK");
+				return false;
+			}
+			break;
+
+		case 'D':
+			send_packet(stub, "OK");
+			return false;
+
+		case 'k':
+			return false;
+	}
+
+	send_packet(stub, reply);
+	return true;
+}
+
+// Listens on address and returns the connection of the first client, -1 if that failed
+static int accept_client(const char* address) {
+	int server, client;
+
+	if (strchr(address, '/')) {
+		struct sockaddr_un local = {.sun_family = AF_UNIX};
+		struct stat info;
+
+		if (strlen(address) >= sizeof(local.sun_path)) {
+			fprintf(stderr, "Socket path %s is too long!\n", address);
+			return -1;
+		}
+		strcpy(local.sun_path, address);
+
+		// A socket left behind by an earlier run is replaced, anything else is not
+		if (!stat(address, &info) && S_ISSOCK(info.st_mode)) unlink(address);
+
+		server = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (server == -1 || bind(server, (struct sockaddr*) &local, sizeof(local)) || listen(server, 1)) {
+			perror("Failed to listen for GDB");
+			if (server != -1) close(server);
+			return -1;
+		}
+	} else {
+		const char* port = strrchr(address, ':');
+		struct sockaddr_in local = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+		int yes = 1;
+
+		local.sin_port = htons(atoi(port?port+1:address));
+		server = socket(AF_INET, SOCK_STREAM, 0);
+
+		if (server == -1 || setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) ||
+			bind(server, (struct sockaddr*) &local, sizeof(local)) || listen(server, 1)) {
+			perror("Failed to listen for GDB");
+			if (server != -1) close(server);
+			return -1;
+		}
+	}
+
+	printf("Waiting for GDB on %s\n", address);
+	fflush(stdout);
+
+	client = accept(server, NULL, NULL);
+	close(server);
+	if (client == -1) perror("Failed to accept GDB");
+
+	// Packets are small and answered one at a time, so they should not wait to fill a segment
+	int yes = 1;
+	if (client != -1 && !strchr(address, '/')) setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+	return client;
+}
+
+int gdb_main(sim_t* sim, const char* address, const char* path) {
+	static char packet[GDB_PACKET_SIZE], reply[GDB_PACKET_SIZE*2+1];
+
+	if (!sim_load(sim, path)) {
+		fprintf(stderr, "%s\n", sim_error(sim));
+		return 1;
+	}
+
+	describe_target();
+	gdb_stub* stub = calloc(1, sizeof(gdb_stub));
+	if (!stub) {
+		fprintf(stderr, "Out Of Memory!\n");
+		return 1;
+	}
+
+	stub->sim = sim;
+	stub->signal = GDB_SIGTRAP;
+	stub->step_hart = -1;
+	stub->fd = accept_client(address);
+	if (stub->fd == -1) {
+		free(stub);
+		return 1;
+	}
+
+	while (receive_packet(stub, packet) && handle_packet(stub, packet, reply));
+
+	close(stub->fd);
+	free(stub);
+	return 0;
+}
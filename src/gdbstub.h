@@ -0,0 +1,10 @@
+#ifndef GDBSTUB_H
+#define GDBSTUB_H
+#include "sim.h"
+
+// Loads path into sim and serves one GDB client on address, a TCP port on localhost ("1234" or "localhost:1234") or
+// the path of a Unix socket, using the GDB remote serial protocol. Harts are shown to GDB as threads 1...n. The program
+// runs without the TUI, at the speed of --batch, until it stops or GDB interrupts it. Returns once GDB kills or detaches
+int gdb_main(sim_t* sim, const char* address, const char* path);
+
+#endif
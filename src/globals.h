@@ -3,8 +3,5 @@
 #include <stdbool.h>
 
 extern bool segfault_flag; // For Crash handler
-extern bool text_write_enabled;    // Allow writing to text segment 
-extern char input_file[256];
-extern char active_file[256];
 
 #endif
\ No newline at end of file
@@ -7,40 +7,71 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
-#include "globals.h"
+#include <unistd.h>
 #include "backend/backend.h"
 #include "frontend/frontend.h"
 #include "assembler/vec.h"
 #include "assembler/assembler.h"
+#include "assembler/loader.h"
+#include "assembler/objcache.h"
+#include "assembler/filewatch.h"
+#include "batch.h"
+#include "gdbstub.h"
+#include "sim.h"
 #include "backend/stacktrace.h"
+#include "backend/syscall.h"
 #include "time.h"
 
-static stacktrace* stack = NULL;
-static label_index* index_of_labels = NULL;
-static uint32_t* hexcode = NULL;
-static uint8_t *memory_template = NULL;
-static char* cleaned_code = NULL;
-static CacheConfig cache_config;
+static sim_t* sim = NULL;				// The TUI is a client of one simulator, selected for the main thread
+static sim_program* program = NULL;		// Program loaded into it
+static char active_file[256] = "cache";	// Loaded file without .s, which its cache trace is named after
 
 
 // Ensures memory is freed and ncurses mode is exited properly, regardless of exit cause`
 void exit_handler() {
 
-	if (hexcode) free(hexcode);
-	if (stack) st_free(stack);
-	if (index_of_labels) free_label_index(index_of_labels);
-	if (cleaned_code) free(cleaned_code);
-	if (memory_template) free(memory_template);
 	destroy_frontend();
-	destroy_backend();
+	if (sim) sim_free(sim);
+	unwatch_file();
+}
+
+// Gives the frontend new pointers to data in the backend, which change on every load and reset. The code only changes
+// on loads and reloads, and must not be handed over again otherwise since the frontend splits it into lines in place
+static void show_program(bool new_code) {
+	set_stack_pointer(program->stack);
+	set_breakpoints_pointer(get_breakpoints_pointer());
+	set_breakpoint_conditions_pointer(get_breakpoint_conditions_pointer());
+	set_watchpoints_pointer(get_watchpoints_pointer());
+	set_frontend_memory_pointer(get_memory_pointer(), MEMORY_SIZE);
+	if (!program->loaded) return;
+
+	if (new_code) {
+		set_program_arena(program->arena);
+		update_code(program->cleaned, program->hexcode[0]);
+		set_labels_pointer(program->labels);
+		set_addresses_pointer(program->addresses);
+		set_pc_lines_pointer(get_pc_lines_pointer());
+	}
+	set_hexcode_pointer((uint32_t*) &program->hexcode[1]);
 }
 
 int main(int* argc, char** argv) {
 	
 	Command command = NONE;
 	bool file_loaded = false;
-
-	cache_config.has_cache = 0;
+	int64_t exit_code;
+	int n_harts = 1, quantum = 1;
+	bool fast = false, smc = false;
+	bool object_cache_chosen = false;
+	FILE* fp = NULL;
+	char* batch_dir = NULL;
+	char* script = NULL;
+	char* gdb_address = NULL;
+	char* gdb_program = NULL;
+	int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	uint64_t max_steps = BATCH_MAX_STEPS;
+
+	CacheConfig cache_config = {0};
 	
 	atexit(*(exit_handler));
 	// input_file = malloc(sizeof(char) * 256); // Allocate memory for the input file_name // TODO: make this be fixed size and put it in d-segment
@@ -49,130 +80,172 @@ int main(int* argc, char** argv) {
     while(*(++argv) != NULL) {
             
 		if (strcmp(*argv,"--smc")==0 || strcmp(*argv,"--self-modifying-code")==0) {
-			text_write_enabled = true;
+			smc = true;
+		} else if (strcmp(*argv,"--harts")==0) {
+			if (!argv[1] || (n_harts = atoi(*(++argv))) < 1 || n_harts > MAX_HARTS) {
+				show_error("--harts expects a number of harts within 1...%d\n", MAX_HARTS);
+				return 1;
+			}
+		} else if (strcmp(*argv,"--quantum")==0) {
+			if (!argv[1] || (quantum = atoi(*(++argv))) < 1) {
+				show_error("--quantum expects a positive number of instructions\n");
+				return 1;
+			}
+		} else if (strcmp(*argv,"--fast")==0) {
+			fast = true;
+		} else if (strcmp(*argv,"--object-cache")==0) {
+			if (!argv[1]) {
+				show_error("--object-cache expects a directory\n");
+				return 1;
+			}
+			set_object_cache_dir(*(++argv));
+			object_cache_chosen = true;
+		} else if (strcmp(*argv,"--no-object-cache")==0) {
+			set_object_cache_dir(NULL);
+			object_cache_chosen = true;
+		} else if (strcmp(*argv,"--cache")==0) {
+			if (!argv[1] || !(fp = fopen(*(++argv), "r"))) {
+				show_error("--cache expects a cache config file\n");
+				return 1;
+			}
+			cache_config = read_cache_config(fp);
+			fclose(fp);
+			if (!cache_config.has_cache) return 1;
+		} else if (strcmp(*argv,"--script")==0) {
+			if (!argv[1]) {
+				show_error("--script expects a command file\n");
+				return 1;
+			}
+			script = *(++argv);
+		} else if (strcmp(*argv,"--gdb")==0) {
+			if (!argv[1] || !argv[2]) {
+				show_error("--gdb expects a port or socket path and a program\n");
+				return 1;
+			}
+			gdb_address = *(++argv);
+			gdb_program = *(++argv);
+		} else if (strcmp(*argv,"--batch")==0) {
+			if (!argv[1]) {
+				show_error("--batch expects a directory\n");
+				return 1;
+			}
+			batch_dir = *(++argv);
+		} else if (strcmp(*argv,"-j")==0) {
+			if (!argv[1] || (jobs = atoi(*(++argv))) < 1) {
+				show_error("-j expects a positive number of jobs\n");
+				return 1;
+			}
+		} else if (strcmp(*argv,"--max-steps")==0) {
+			if (!argv[1] || !(max_steps = strtoull(*(++argv), NULL, 10))) {
+				show_error("--max-steps expects a positive number of instructions\n");
+				return 1;
+			}
 		}
     }
 
+	// Like other users of the library, batches only cache objects when given a directory. The TUI uses the default one
+	if (batch_dir) return batch_main(batch_dir, jobs, (batch_config) {n_harts, quantum, smc, max_steps, cache_config});
+	if (!object_cache_chosen) set_default_object_cache_dir();
+
 	srand(time(NULL));
 
 	// Initialization
-	reset_backend(true, cache_config);
+	sim = sim_new(n_harts, quantum, fast);
+	if (!sim) {
+		show_error("Out Of Memory!\n");
+		return 1;
+	}
+	sim_select(sim);
+	sim_set_smc(sim, smc);
+	program = sim_get_program(sim);
+	if (cache_config.has_cache) sim_set_cache(sim, cache_config);
+	if (gdb_address) return gdb_main(sim, gdb_address, gdb_program);
 
 	init_frontend();
 	set_frontend_register_pointer(get_register_pointer());
 	set_frontend_pc_pointer(get_pc_pointer());
+	set_reg_write_pointer(get_reg_write_pointer());
 	set_frontend_memory_pointer(get_memory_pointer(), MEMORY_SIZE);
 	set_breakpoints_pointer(get_breakpoints_pointer());
-
-	memory_template = malloc(sizeof(uint8_t)* MEMORY_SIZE);
-
-	FILE* fp = NULL;
+	set_breakpoint_conditions_pointer(get_breakpoint_conditions_pointer());
+	set_watchpoints_pointer(get_watchpoints_pointer());
+	set_output_pointer(get_output_pointer());
+	set_harts_pointer(get_harts_pointer(), get_hart_count());
+	if (script) source_script(script);
 
 	// Main loop
 	// Polls for updates from the frontend, and processes them
 	while (1) {
-		switch (frontend_update()) {
-			case LOAD:
-				
-				fp = fopen(input_file, "r");
-
-				if (!fp) {
-					show_error("Failed to read %s!", input_file);
+		command = frontend_update();
+
+		// With auto reload on, saves of the source are picked up whenever nothing else is happening
+		if (command == NONE && file_loaded && file_changed()) command = RELOAD;
+
+		switch (command) {
+			case RELOAD:
+				if (!program->elf) {
+					reload_stats stats;
+					uint64_t patched;
+
+					if (sim_reload(sim, &stats, &patched)) {
+						reset_frontend(false);
+						show_program(true);
+						show_error("Reloaded: %d kept, %d patched, %d assembled, %lu bytes written", stats.reused, stats.patched, stats.encoded, patched);
+					}
 					break;
 				}
+				// fall through - ELF files are simply loaded again
 
-				fseek(fp, 0L, SEEK_END);
-				long len = ftell(fp);
-				fseek(fp, 0L, SEEK_SET);
-
-				char* new_cleaned_code = malloc(sizeof(char) * len+1);
-				if (!new_cleaned_code) {
-					show_error("Out Of Memory!");
-					break;
-				}
-				
-				label_index* new_index_of_labels = new_label_index();
-
-				uint8_t* new_memory_template = malloc(sizeof(uint8_t)* MEMORY_SIZE);
-				memset(new_memory_template, 0, sizeof(uint8_t)*MEMORY_SIZE);
-
-				hexcode = assembler_main(fp, new_cleaned_code, new_index_of_labels, new_memory_template);
-				fclose(fp);
-
-				// If assembler failed, free temporary memory and abort
-				if (!hexcode) {
-					free(new_cleaned_code);
-					free(new_index_of_labels);
-					free(new_memory_template);
+			case LOAD:
+				const char* path = command == LOAD?get_input_file():program->source_file;
+				char old_trace_file_name[sizeof(sim_cache_config(sim)->trace_file_name)];
+				char new_active_file[256];
+
+				// The cache trace of every program goes next to it
+				snprintf(new_active_file, sizeof(new_active_file), "%s", path);
+				if (strlen(new_active_file) > 2 && !strcmp(new_active_file+strlen(new_active_file)-2, ".s")) new_active_file[strlen(new_active_file)-2] = '\0';
+				strcpy(old_trace_file_name, sim_cache_config(sim)->trace_file_name);
+				snprintf(sim_cache_config(sim)->trace_file_name, sizeof(sim_cache_config(sim)->trace_file_name), "%s.output", new_active_file);
+
+				if (!sim_load(sim, path)) {
+					strcpy(sim_cache_config(sim)->trace_file_name, old_trace_file_name);
 					break;
 				}
-				
-				// Else, update state
-				strcpy(active_file, input_file);
-				active_file[strlen(active_file)-2] = '\0';
-				snprintf(cache_config.trace_file_name, 300, "%s.output", active_file);
-
-				if (index_of_labels) free_label_index(index_of_labels);
-				index_of_labels = new_index_of_labels;
-
-				if (cleaned_code) free(cleaned_code);
-				cleaned_code = new_cleaned_code;
 
-				if (memory_template) free(memory_template);
-				memory_template = new_memory_template;
-
-				if (get_section_label(index_of_labels, 0) == -1) prepend_label(index_of_labels, "main", 0); // Adding main to stack if there is no label at the start
-				index_dedup(index_of_labels);
-				if (stack) st_free(stack);
-				stack = new_stacktrace(index_of_labels);
-				st_push(stack, 0);
-
-				reset_backend(true, cache_config);
+				strcpy(active_file, new_active_file);
+				if (watching_file()) watch_file(program->source_file);
 				reset_frontend(true);
+				show_program(true);
 
-				// Write data segment and instructions into memory
-				memcpy(get_memory_pointer()->data, &hexcode[1], hexcode[0]*4); // hexcode[0] is implicitly the length in words. actual hexcode starts from hexcode[1]
-				memcpy(get_memory_pointer()->data+DATA_BASE, memory_template+DATA_BASE, MEMORY_SIZE-DATA_BASE);
-
-				// Give frontend new pointers to data in backend
-				update_code(cleaned_code, hexcode[0]);
-				set_stack_pointer(stack);
-				set_stacktrace_pointer(stack);
-				set_breakpoints_pointer(get_breakpoints_pointer());
-				set_frontend_memory_pointer(get_memory_pointer(), MEMORY_SIZE);
-				set_labels_pointer(index_of_labels);
-				set_hexcode_pointer((uint32_t*) &hexcode[1]);
-				
 				file_loaded = true;
 				break;
 
+			case RELOAD_AUTO:
+				if (watching_file()) {
+					unwatch_file();
+					show_error("Auto reload disabled");
+				} else if (watch_file(program->source_file)) {
+					show_error("Auto reload enabled, %s is reloaded whenever it is saved", program->source_file);
+				} else {
+					show_error("Failed to watch %s!", program->source_file);
+				}
+				break;
+
 			case RUN:
 				int result = run(&frontend_update);
 				release_run_lock();
+				if (result >= 2) set_viewed_hart(get_current_hart()); // Show the hart that stopped
 				if (result == 2) show_error("Execution stopped at breakpoint!");
 				else if (result == 1) {
-					show_error("Reached End of Program");
+					if (program_exited(&exit_code)) show_error("Program exited with code %ld", exit_code);
+					else show_error("Reached End of Program");
 				}
 				break;
 
 			case RESET:
-				// Reset stack
-				if (stack) st_free(stack);
-				stack = new_stacktrace(index_of_labels);
-				st_push(stack, 0);
-
-				reset_backend(false, cache_config);
+				sim_reset(sim);
 				reset_frontend(false);
-
-				// Give frontend new pointers to data in backend
-				set_stack_pointer(stack);
-				set_stacktrace_pointer(stack);
-				set_breakpoints_pointer(get_breakpoints_pointer());
-				
-				// Reset data segment and instructions in memory
-				memcpy(get_memory_pointer()->data, &hexcode[1], hexcode[0]*4);
-				memcpy(get_memory_pointer()->data+DATA_BASE, memory_template+DATA_BASE, MEMORY_SIZE-DATA_BASE);
-				set_hexcode_pointer((uint32_t*) &hexcode[1]);
+				show_program(false);
 				break;
 
 			case EXIT:
@@ -182,89 +255,57 @@ int main(int* argc, char** argv) {
 				break;
 
 			case STEP:
-				if (step() == 1) show_error("Nothing to step");
+				int step_result = step();
+				if (step_result >= 2) set_viewed_hart(get_current_hart());
+				if (step_result == 1) {
+					if (program_exited(&exit_code)) show_error("Program exited with code %ld", exit_code);
+					else show_error("Nothing to step");
+				}
 				break;
 
 			case CACHE_DISABLE:
-				if (!cache_config.has_cache) {
+				if (!sim_cache_config(sim)->has_cache) {
 					show_error("Cache is already disabled!");
 					break;
 				}
 
-				cache_config.has_cache = false;
+				CacheConfig no_cache = *sim_cache_config(sim);
+				no_cache.has_cache = false;
 
-				reset_backend(true, cache_config);
+				sim_set_cache(sim, no_cache);
 				reset_frontend(false);
-
-				// Give frontend new pointers to data in backend
-				set_breakpoints_pointer(get_breakpoints_pointer());
-				set_frontend_memory_pointer(get_memory_pointer(), MEMORY_SIZE);
-				
-				if (file_loaded) {
-					// Reset stack
-					if (stack) st_free(stack);
-					stack = new_stacktrace(index_of_labels);
-					st_push(stack, 0);
-					
-					set_stack_pointer(stack);
-					set_stacktrace_pointer(stack);
-
-					// Reset data segment and instructions in memory
-					memcpy(get_memory_pointer()->data, &hexcode[1], hexcode[0]*4);
-					memcpy(get_memory_pointer()->data+DATA_BASE, memory_template+DATA_BASE, MEMORY_SIZE-DATA_BASE);
-					set_hexcode_pointer((uint32_t*) &hexcode[1]);
-				}	
-
+				show_program(false);
 				break;
 
 			case CACHE_ENABLE:
-				fp = fopen(input_file, "r");
+				fp = fopen(get_input_file(), "r");
 
 				if (!fp) {
-					show_error("Failed to open %s!", input_file);
+					show_error("Failed to open %s!", get_input_file());
 					break;
 				}
 
 				CacheConfig new_config = read_cache_config(fp);
+				fclose(fp);
 
 				if (!new_config.has_cache) break;
-				cache_config = new_config;				
+				snprintf(new_config.trace_file_name, sizeof(new_config.trace_file_name), "%s.output", active_file);
 
-				reset_backend(true, cache_config);
+				sim_set_cache(sim, new_config);
 				reset_frontend(false);
-
-				// Give frontend new pointers to data in backend
-				set_breakpoints_pointer(get_breakpoints_pointer());
-				set_frontend_memory_pointer(get_memory_pointer(), MEMORY_SIZE);
-				
-				if (file_loaded) {
-					// Reset stack
-					if (stack) st_free(stack);
-					stack = new_stacktrace(index_of_labels);
-					st_push(stack, 0);
-
-					set_stack_pointer(stack);
-					set_stacktrace_pointer(stack);
-
-					// Reset data segment and instructions in memory
-					memcpy(get_memory_pointer()->data, &hexcode[1], hexcode[0]*4);
-					memcpy(get_memory_pointer()->data+DATA_BASE, memory_template+DATA_BASE, MEMORY_SIZE-DATA_BASE);
-					set_hexcode_pointer((uint32_t*) &hexcode[1]);
-				}
-
-				fclose(fp);
+				show_program(false);
 				break;
 
 			case CACHE_DUMP:
-				if (!cache_config.has_cache) {
+				if (!sim_cache_config(sim)->has_cache) {
 					show_error("Cache is disabled!");
 					break;
 				}
 
-				fp = fopen(input_file, "w");
+				fp = fopen(get_input_file(), "w");
 
 				if (!fp) {
-					show_error("Failed to open %s!", input_file);
+					show_error("Failed to open %s!", get_input_file());
 					break;
 				}
 
@@ -275,12 +316,12 @@ int main(int* argc, char** argv) {
 				break;
 
 			case CACHE_INVALIDATE:
-				if (!cache_config.has_cache) {
+				if (!sim_cache_config(sim)->has_cache) {
 					show_error("Cache is disabled!");
 					break;
 				}
 
-				invalidate_cache(get_memory_pointer());
+				for (int i=0; i<get_hart_count(); i++) invalidate_cache(get_harts_pointer()[i].memory);
 				break;
 		}
 	}
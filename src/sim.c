@@ -0,0 +1,444 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+#include "assembler/loader.h"
+#include "assembler/objcache.h"
+#include "backend/syscall.h"
+#include "backend/condition.h"
+#include "frontend/error.h"
+
+struct sim_t {
+	backend_state* backend;
+	sim_program program;
+	CacheConfig cache_config;
+	char error[SIM_ERROR_LEN];
+};
+
+// What the calling thread had selected before a call, so that it gets it back afterwards
+typedef struct sim_caller {
+	backend_state* backend;
+	char* error_buffer;
+	size_t error_buffer_size;
+} sim_caller;
+
+// Every call works on the simulator it was given, whatever the thread used last, and keeps its errors in it
+static sim_caller enter(sim_t* sim) {
+	sim_caller caller = {selected_backend()};
+	caller.error_buffer = get_error_buffer(&caller.error_buffer_size);
+
+	select_backend(sim->backend);
+	set_error_buffer(sim->error, SIM_ERROR_LEN);
+	return caller;
+}
+
+static void leave(sim_caller caller) {
+	select_backend(caller.backend);
+	set_error_buffer(caller.error_buffer, caller.error_buffer_size);
+}
+
+sim_t* sim_new(int n_harts, int quantum, bool fast) {
+	sim_t* sim = calloc(1, sizeof(sim_t));
+	if (!sim) return NULL;
+
+	sim->backend = new_backend_state();
+	if (!sim->backend) {
+		free(sim);
+		return NULL;
+	}
+
+	sim_caller caller = enter(sim);
+	set_hart_config(n_harts, quantum, fast);
+	reset_backend(true, sim->cache_config);
+	leave(caller);
+	return sim;
+}
+
+static void free_program(sim_program* program) {
+	if (program->stack) st_free(program->stack);
+	if (program->labels) free_label_index(program->labels);
+	if (program->addresses) free_managed_array(program->addresses);
+	if (program->arena) free_arena(program->arena);
+}
+
+void sim_free(sim_t* sim) {
+	free_program(&sim->program);
+	free_backend_state(sim->backend);
+	free(sim);
+}
+
+void sim_select(sim_t* sim) {select_backend(sim->backend);}
+
+sim_program* sim_get_program(sim_t* sim) {return &sim->program;}
+CacheConfig* sim_cache_config(sim_t* sim) {return &sim->cache_config;}
+const char* sim_error(sim_t* sim) {return sim->error;}
+
+static void restart_program(sim_t* sim) {
+	restart_stacktraces();
+	memcpy(get_memory_pointer()->data, sim->program.memory_template, MEMORY_SIZE);
+}
+
+// Everything of the new program comes from its own arena, so replacing the old program is a single free
+static bool new_program(sim_program* program) {
+	*program = (sim_program) {0};
+
+	program->arena = new_arena(ARENA_BLOCK_SIZE);
+	if (program->arena) program->labels = new_label_index(program->arena);
+	if (program->labels) program->addresses = new_managed_array();
+	if (program->addresses) program->memory_template = arena_alloc(program->arena, sizeof(uint8_t)*MEMORY_SIZE);
+
+	if (!program->memory_template) {
+		show_error("Out Of Memory!");
+		free_program(program);
+		return false;
+	}
+
+	memset(program->memory_template, 0, sizeof(uint8_t)*MEMORY_SIZE);
+	return true;
+}
+
+// Assembles fp, which has to be a regular file since the assembler maps it
+static int* assemble_file(FILE* fp, sim_program* program, program_layout* layout, assembled_program* old, reload_stats* stats) {
+	fseek(fp, 0L, SEEK_END);
+	long len = ftell(fp);
+	fseek(fp, 0L, SEEK_SET);
+
+	program->cleaned = arena_alloc(program->arena, sizeof(char) * len+1);
+	if (!program->cleaned) {
+		show_error("Out Of Memory!");
+		return NULL;
+	}
+
+	if (old) return reassembler_main(fp, program->cleaned, program->labels, program->memory_template, program->addresses, layout, program->arena, old, stats);
+	return assembler_main(fp, program->cleaned, program->labels, program->memory_template, program->addresses, layout, program->arena);
+}
+
+// Replaces the loaded program with one that was just built, and gives the harts stack traces over its labels.
+// If they cannot be made, the new program is freed and the old one stays loaded
+static bool replace_program(sim_t* sim, sim_program* program) {
+	if (get_section_label(program->labels, 0) == -1) prepend_label(program->labels, "main", 0); // Adding main to stack if there is no label at the start
+	index_dedup(program->labels);
+
+	program->stack = new_stacktrace(program->labels, program->addresses->len-1);
+	if (!program->stack || !set_stacktrace_pointer(program->stack)) {
+		show_error("Out Of Memory!");
+		free_program(program);
+		return false;
+	}
+
+	free_program(&sim->program);
+	sim->program = *program;
+	sim->program.loaded = true;
+	return true;
+}
+
+// Loads from path, or from fp if it is not NULL
+static bool load(sim_t* sim, const char* path, FILE* fp) {
+	sim_program program;
+	program_layout layout;
+
+	if (!new_program(&program)) return false;
+
+	program.elf = !fp && is_elf_file(path);
+	snprintf(program.source_file, sizeof(program.source_file), "%s", path);
+
+	if (program.elf) {
+		program.hexcode = elf_main(path, &program.cleaned, program.labels, program.memory_template, program.addresses, &layout, program.arena);
+	} else if (fp) {
+		program.hexcode = assemble_file(fp, &program, &layout, NULL, NULL);
+	} else if ((fp = fopen(path, "r"))) {
+		program.hexcode = assemble_file(fp, &program, &layout, NULL, NULL);
+		fclose(fp);
+	} else {
+		show_error("Failed to read %s!", path);
+	}
+
+	// If loading failed, the old program stays loaded
+	if (!program.hexcode) {
+		free_program(&program);
+		return false;
+	}
+
+	if (!replace_program(sim, &program)) return false;
+	reset_backend(true, sim->cache_config);
+	set_program_layout(&layout);
+	set_line_mapping(sim->program.addresses);
+
+	// Both the assembler and ELF loader place instructions in the template at their addresses
+	restart_program(sim);
+	return true;
+}
+
+bool sim_load(sim_t* sim, const char* path) {
+	sim_caller caller = enter(sim);
+	sim->error[0] = '\0';
+	bool loaded = load(sim, path, NULL);
+	leave(caller);
+	return loaded;
+}
+
+bool sim_load_source(sim_t* sim, const char* source, size_t len) {
+	sim_caller caller = enter(sim);
+	sim->error[0] = '\0';
+	bool loaded = false;
+
+	FILE* fp = tmpfile();
+	if (!fp) show_error("Failed to create a temporary file!");
+	else if (fwrite(source, 1, len, fp) != len) show_error("Failed to write a temporary file!");
+	else loaded = load(sim, "", fp);
+
+	if (fp) fclose(fp);
+	leave(caller);
+	return loaded;
+}
+
+bool sim_reload(sim_t* sim, reload_stats* stats, uint64_t* patched) {
+	if (sim->program.elf) return sim_load(sim, sim->program.source_file);
+
+	sim_caller caller = enter(sim);
+	sim->error[0] = '\0';
+
+	FILE* fp = fopen(sim->program.source_file, "r");
+	if (!fp) {
+		show_error("Failed to read %s!", sim->program.source_file);
+		leave(caller);
+		return false;
+	}
+
+	sim_program program;
+	program_layout layout;
+	reload_stats new_stats;
+	assembled_program old = {sim->program.hexcode, sim->program.cleaned, sim->program.labels, sim->program.addresses};
+
+	if (!new_program(&program)) {
+		fclose(fp);
+		leave(caller);
+		return false;
+	}
+
+	strcpy(program.source_file, sim->program.source_file);
+	program.hexcode = assemble_file(fp, &program, &layout, &old, &new_stats);
+	fclose(fp);
+
+	// The old program stays loaded if the new one does not assemble
+	if (!program.hexcode) {
+		free_program(&program);
+		leave(caller);
+		return false;
+	}
+
+	if (!replace_program(sim, &program)) {
+		leave(caller);
+		return false;
+	}
+
+	uint64_t written = reload_backend(&layout, sim->program.memory_template, sim->program.addresses);
+	remap_breakpoints(new_stats.changed_start, new_stats.old_end, new_stats.new_end);
+
+	if (stats) *stats = new_stats;
+	if (patched) *patched = written;
+	leave(caller);
+	return true;
+}
+
+void sim_reset(sim_t* sim) {
+	sim_caller caller = enter(sim);
+	reset_backend(false, sim->cache_config);
+	if (sim->program.loaded) restart_program(sim);
+	leave(caller);
+}
+
+void sim_set_cache(sim_t* sim, CacheConfig cache_config) {
+	sim_caller caller = enter(sim);
+	sim->cache_config = cache_config;
+	reset_backend(true, sim->cache_config);
+	if (sim->program.loaded) restart_program(sim);
+	leave(caller);
+}
+
+void sim_set_object_cache(const char* dir) {set_object_cache_dir(dir);}
+
+void sim_set_smc(sim_t* sim, bool enabled) {
+	sim_caller caller = enter(sim);
+	set_text_write(enabled);
+	leave(caller);
+}
+
+// Runs the current simulator. Instructions that stop execution at a breakpoint or watchpoint still ran, and so did an
+// exit, but running into the zeros after the code or an error did not run anything
+static sim_result run_steps(uint64_t until, uint64_t max_steps, uint64_t* executed) {
+	hart* harts = get_harts_pointer();
+	bool exited = program_exited(NULL);
+	int result;
+
+	for (uint64_t i=0; i<max_steps; i++) {
+		result = step();
+		if (result == SIM_END && !exited && program_exited(NULL) && executed) (*executed)++;
+		if (result == SIM_END || result == SIM_ERROR) return result;
+
+		if (executed) (*executed)++;
+		if (result) return result;
+		if (until != SIM_NO_ADDRESS && harts[get_current_hart()].pc == until) return SIM_UNTIL;
+	}
+
+	return SIM_LIMIT;
+}
+
+sim_result sim_step(sim_t* sim, uint64_t n, uint64_t* executed) {
+	sim_caller caller = enter(sim);
+	sim->error[0] = '\0';
+	sim_result result = run_steps(SIM_NO_ADDRESS, n, executed);
+	leave(caller);
+	return result == SIM_LIMIT?SIM_OK:result;
+}
+
+sim_result sim_step_hart(sim_t* sim, int hart) {
+	sim_caller caller = enter(sim);
+	sim->error[0] = '\0';
+	sim_result result = SIM_ERROR;
+
+	if (hart < 0 || hart >= get_hart_count()) show_error("There is no hart %d!", hart);
+	else result = step_hart_id(hart);
+
+	leave(caller);
+	return result;
+}
+
+sim_result sim_run(sim_t* sim, uint64_t until, uint64_t max_steps, uint64_t* executed) {
+	sim_caller caller = enter(sim);
+	sim->error[0] = '\0';
+	sim_result result = run_steps(until, max_steps, executed);
+	leave(caller);
+	return result;
+}
+
+uint64_t sim_get_register(sim_t* sim, int hart, int reg) {
+	sim_caller caller = enter(sim);
+	uint64_t value = 0;
+
+	if (hart >= 0 && hart < get_hart_count() && reg >= 0 && reg < 32) value = get_harts_pointer()[hart].registers[reg];
+	leave(caller);
+	return value;
+}
+
+void sim_set_register(sim_t* sim, int hart, int reg, uint64_t value) {
+	sim_caller caller = enter(sim);
+	if (hart >= 0 && hart < get_hart_count() && reg > 0 && reg < 32) get_harts_pointer()[hart].registers[reg] = value;
+	leave(caller);
+}
+
+uint64_t sim_get_pc(sim_t* sim, int hart) {
+	sim_caller caller = enter(sim);
+	uint64_t pc = 0;
+
+	if (hart >= 0 && hart < get_hart_count()) pc = get_harts_pointer()[hart].pc;
+	leave(caller);
+	return pc;
+}
+
+void sim_set_pc(sim_t* sim, int hart, uint64_t pc) {
+	sim_caller caller = enter(sim);
+	if (hart >= 0 && hart < get_hart_count()) get_harts_pointer()[hart].pc = pc;
+	leave(caller);
+}
+
+bool sim_read_memory(sim_t* sim, uint64_t addr, void* buf, size_t len) {
+	sim_caller caller = enter(sim);
+	bool read = read_guest_memory(addr, buf, len);
+	leave(caller);
+	return read;
+}
+
+bool sim_write_memory(sim_t* sim, uint64_t addr, const void* buf, size_t len) {
+	sim_caller caller = enter(sim);
+	bool written = write_guest_memory(addr, buf, len);
+	leave(caller);
+	return written;
+}
+
+int sim_current_hart(sim_t* sim) {
+	sim_caller caller = enter(sim);
+	int hart = get_current_hart();
+	leave(caller);
+	return hart;
+}
+
+// Adds or removes the breakpoint of line, unless it already is or is not set
+static void set_breakpoint(int line, bool enabled) {
+	vec* breakpoints = get_breakpoints_pointer();
+
+	for (size_t i=0; i<breakpoints->len; i++) {
+		if (breakpoints->values[i] != line) continue;
+		if (enabled) return;
+
+		remove_condition(get_breakpoint_conditions_pointer(), line);
+		breakpoints->values[i] = breakpoints->values[--breakpoints->len]; // The order does not matter
+		return;
+	}
+
+	if (enabled) append(breakpoints, line);
+}
+
+bool sim_set_breakpoint(sim_t* sim, uint64_t addr, bool enabled) {
+	sim_caller caller = enter(sim);
+	int line = get_address_line(addr);
+
+	if (line != -1) set_breakpoint(line, enabled);
+	leave(caller);
+	return line != -1;
+}
+
+uint8_t* sim_memory(sim_t* sim) {
+	sim_caller caller = enter(sim);
+	uint8_t* data = get_memory_pointer()->data;
+	leave(caller);
+	return data;
+}
+
+bool sim_flush_memory(sim_t* sim, uint64_t addr, size_t len) {
+	sim_caller caller = enter(sim);
+	bool flushed = flush_guest_memory(addr, len);
+	leave(caller);
+	return flushed;
+}
+
+bool sim_memory_written(sim_t* sim, uint64_t addr, size_t len) {
+	sim_caller caller = enter(sim);
+	bool synced = guest_memory_written(addr, len);
+	leave(caller);
+	return synced;
+}
+
+uint64_t* sim_registers(sim_t* sim, int hart) {
+	sim_caller caller = enter(sim);
+	uint64_t* registers = NULL;
+
+	if (hart >= 0 && hart < get_hart_count()) registers = get_harts_pointer()[hart].registers;
+	leave(caller);
+	return registers;
+}
+
+bool sim_cache_stats(sim_t* sim, int hart, CacheStats* stats) {
+	sim_caller caller = enter(sim);
+	bool has_stats = sim->cache_config.has_cache && hart >= 0 && hart < get_hart_count();
+
+	if (has_stats) *stats = get_harts_pointer()[hart].memory->cache_stats;
+	leave(caller);
+	return has_stats;
+}
+
+const char* sim_output(sim_t* sim, size_t* len) {
+	sim_caller caller = enter(sim);
+	guest_output* output = get_output_pointer();
+
+	if (len) *len = output->len;
+	leave(caller);
+	return output->data?output->data:"";
+}
+
+bool sim_exited(sim_t* sim, int64_t* code) {
+	sim_caller caller = enter(sim);
+	bool exited = program_exited(code);
+	leave(caller);
+	return exited;
+}
@@ -0,0 +1,121 @@
+#ifndef SIM_H
+#define SIM_H
+#include <stdint.h>
+#include <stdbool.h>
+#include "assembler/arena.h"
+#include "assembler/index.h"
+#include "assembler/vec.h"
+#include "assembler/assembler.h"
+#include "backend/backend.h"
+#include "backend/stacktrace.h"
+
+#define SIM_ERROR_LEN 256
+#define SIM_NO_ADDRESS UINT64_MAX // Makes sim_run run without stopping at an address
+
+// Why sim_step or sim_run returned. The first five are the same as the return codes of step
+typedef enum sim_result {
+	SIM_OK,
+	SIM_END,			// The program exited or ran off the end of its code
+	SIM_BREAKPOINT,
+	SIM_ERROR,			// The message is in sim_error
+	SIM_WATCHPOINT,
+	SIM_UNTIL,			// sim_run reached its address
+	SIM_LIMIT,			// sim_run ran max_steps instructions
+} sim_result;
+
+// The program a simulator has loaded. Everything but the label index, addresses and stack trace lives in the arena
+typedef struct sim_program {
+	arena* arena;
+	label_index* labels;
+	int* hexcode;				// Count first
+	uint8_t* memory_template;	// Memory as the program starts
+	vec* addresses;				// Address of every instruction, followed by the end of the text segment
+	char* cleaned;
+	stacktrace* stack;			// Stack trace of hart 0
+	char source_file[256];		// Path the program was loaded from, for reloads
+	bool elf;
+	bool loaded;
+} sim_program;
+
+// One simulator: a backend with its harts, caches and memory, and the program loaded into it. Simulators share nothing,
+// so any number of them can be used at once, from any threads, as long as each is only used by one thread at a time
+typedef struct sim_t sim_t;
+
+// Creates a simulator without a cache and with nothing loaded. fast only affects run, which sim_run does not use
+sim_t* sim_new(int n_harts, int quantum, bool fast);
+void sim_free(sim_t* sim);
+
+// Makes the backend calls of the calling thread (step, run, get_memory_pointer...) work on sim, for clients like the TUI
+// that use the backend directly. Every function below selects its simulator by itself, and gives the calling thread
+// back whatever it had selected (and where its errors went) before returning
+void sim_select(sim_t* sim);
+
+// Loads an assembly source or ELF executable, replacing the loaded program (which is kept if loading fails)
+bool sim_load(sim_t* sim, const char* path);
+
+// Loads assembly source from memory
+bool sim_load_source(sim_t* sim, const char* source, size_t len);
+
+// Reassembles the loaded source after it was edited, like reassembler_main, keeping the caches and the breakpoints of
+// unchanged lines. ELF files are loaded again. Fills in stats and the bytes of memory written (if not NULL) for sources
+bool sim_reload(sim_t* sim, reload_stats* stats, uint64_t* patched);
+
+// Restarts the loaded program, keeping breakpoints
+void sim_reset(sim_t* sim);
+
+// Sets the cache used from the next load or reset on. Changing it with sim_set_cache restarts the program right away
+CacheConfig* sim_cache_config(sim_t* sim);
+void sim_set_cache(sim_t* sim, CacheConfig cache_config);
+void sim_set_smc(sim_t* sim, bool enabled);
+
+// Runs up to n instructions, stopping early at the end of the program, a breakpoint, watchpoint or error.
+// executed (if not NULL) is increased by the number of instructions run
+sim_result sim_step(sim_t* sim, uint64_t n, uint64_t* executed);
+
+// Runs one instruction of a hart, whoever's turn it is, and gives it the turn. A hart that has halted does not run
+sim_result sim_step_hart(sim_t* sim, int hart);
+
+// Runs until the hart that ran last reaches until (SIM_NO_ADDRESS for none), anything sim_step stops at, or max_steps instructions
+sim_result sim_run(sim_t* sim, uint64_t until, uint64_t max_steps, uint64_t* executed);
+
+// Registers of a hart, x0 to x31. Writes to x0 are ignored. Out of range harts and registers read as 0
+uint64_t sim_get_register(sim_t* sim, int hart, int reg);
+void sim_set_register(sim_t* sim, int hart, int reg, uint64_t value);
+uint64_t sim_get_pc(sim_t* sim, int hart);
+void sim_set_pc(sim_t* sim, int hart, uint64_t pc);
+
+// Guest memory as the harts see it, through the caches. Return false if the range does not fit in memory
+bool sim_read_memory(sim_t* sim, uint64_t addr, void* buf, size_t len);
+bool sim_write_memory(sim_t* sim, uint64_t addr, const void* buf, size_t len);
+
+// Guest memory itself, MEMORY_SIZE bytes, for hosts that would rather not copy it. It stays in place until the next
+// load or cache change. With a cache, sim_flush_memory has to come before reading it and sim_memory_written after writing it
+uint8_t* sim_memory(sim_t* sim);
+bool sim_flush_memory(sim_t* sim, uint64_t addr, size_t len);
+bool sim_memory_written(sim_t* sim, uint64_t addr, size_t len);
+
+// The 32 registers of a hart, which stay in place as long as the simulator. NULL for harts out of range
+uint64_t* sim_registers(sim_t* sim, int hart);
+
+int sim_current_hart(sim_t* sim);	// Hart that ran last, or stopped execution
+
+// Sets or clears a breakpoint on the instruction at addr, like $break without a condition. Returns false if no
+// instruction starts there
+bool sim_set_breakpoint(sim_t* sim, uint64_t addr, bool enabled);
+
+// Copies the stats of a hart's L1. Returns false without a cache
+bool sim_cache_stats(sim_t* sim, int hart, CacheStats* stats);
+
+// Everything the program wrote to stdout and stderr (the last OUTPUT_LIMIT bytes of it)
+const char* sim_output(sim_t* sim, size_t* len);
+bool sim_exited(sim_t* sim, int64_t* code);
+
+// Makes loads keep assembled programs in dir and load them from there when their source is loaded again, NULL turns
+// that off again. Off by default. The directory is shared by every simulator, and kept to OBJECT_CACHE_LIMIT bytes
+void sim_set_object_cache(const char* dir);
+
+// Last error of a load, reload or run
+const char* sim_error(sim_t* sim);
+sim_program* sim_get_program(sim_t* sim);
+
+#endif